@@ -0,0 +1,468 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <SOIL2/SOIL2.h>
+
+#include "LockFreeQueue.h"
+#include "MeshUpload.h"
+#include "Profiler.h"
+#include "TextureUpload.h"
+#include "ThreadPool.h"
+
+// Asynchronous asset loading. Worker threads read and decode files (images, KTX2 textures, mesh files with
+// their index conversion, LODs and quantization) and hand the results to the GL thread through a lock-free queue.
+// The GL thread creates the objects and streams the data in through a ring of staging buffers,
+// at most a fixed number of bytes per frame, so loading never stalls a frame for long.
+// Everything with GL runs in pumpAssetLoader, called once per frame on the GL thread.
+
+const int kUploadRingSize = 3; // staging buffers, one filled per frame while the GPU reads the others
+const int kDefaultUploadBudgetMB = 4;
+const size_t kDecodedQueueCapacity = 64;
+const GLuint64 kUploadFenceTimeout = 1000000000; // 1 s in ns, only reached on a hung GPU
+
+enum AssetType
+{
+	kAssetTexture,
+	kAssetMesh
+};
+
+enum AssetState
+{
+	kAssetLoading, // queued or decoding on a worker
+	kAssetUploading, // decoded, GL objects exist and are being filled
+	kAssetResident, // ready to draw
+	kAssetFailed // `error` says why
+};
+
+// Source range copied into a texture level or a buffer, in units that are never split
+struct AssetRegion
+{
+	const uint8_t* data = nullptr;
+	size_t bytes = 0;
+	size_t unitBytes = 1; // a texel row, a row of blocks, or one byte for buffers
+	GLuint buffer = 0; // destination buffer, 0 for a texture level
+	int level = 0;
+	GLsizei width = 0, height = 0;
+	int unitRows = 1; // texel rows per unit, 4 for block compressed levels
+};
+
+struct Asset
+{
+	AssetType type = kAssetTexture;
+	AssetState state = kAssetLoading;
+	std::string path, error;
+	std::chrono::steady_clock::time_point requested;
+	double decodeMs = 0.0; // time on the worker
+	double residentMs = 0.0; // from the request until drawable
+
+	// Textures: a baked file (BC1 decoded here when the driver lacks S3TC) or an image that still needs mips
+	TextureFile textureFile;
+	std::vector<std::vector<uint8_t>> decodedLevels;
+	unsigned char* image = nullptr;
+	int imageWidth = 0, imageHeight = 0;
+	GLuint texture = 0;
+	uint64_t gpuBytes = 0;
+
+	// Meshes: the mapped file and its converted data, then one MeshLods per submesh once resident
+	MeshFile meshFile;
+	MeshUploadOptions meshOptions;
+	PreparedMesh prepared;
+	uint16_t firstMeshId = 0;
+	GLuint vao = 0, vbo = 0, ebo = 0;
+	std::vector<MeshLods> meshes;
+
+	// Upload progress
+	std::vector<AssetRegion> regions;
+	size_t region = 0, regionOffset = 0;
+};
+
+// Staging buffers written through a mapping and fenced after the copies that read them
+struct StagingRing
+{
+	GLuint buffers[kUploadRingSize] = {};
+	GLsync fences[kUploadRingSize] = {};
+	size_t capacity = 0;
+	int next = 0;
+};
+
+struct AssetLoader
+{
+	ThreadPool pool;
+	LockFreeQueue<Asset*> decoded;
+	std::vector<Asset*> assets; // every request, owned here
+	std::vector<Asset*> uploading; // in request order, the first one gets the budget first
+	StagingRing ring;
+	size_t budgetBytes = 0;
+	int pending = 0; // requested but not resident or failed yet
+
+	// Stats
+	uint64_t uploadedBytes = 0;
+	size_t maxFrameBytes = 0;
+	int uploadFrames = 0, fenceWaits = 0;
+};
+
+inline void initAssetLoader(AssetLoader& loader, int budgetMB = kDefaultUploadBudgetMB, int workers = defaultWorkerCount())
+{
+	initLockFreeQueue(loader.decoded, kDecodedQueueCapacity);
+	startThreadPool(loader.pool, workers);
+	loader.budgetBytes = (size_t)budgetMB << 20;
+	loader.ring.capacity = loader.budgetBytes;
+	glGenBuffers(kUploadRingSize, loader.ring.buffers);
+	for (int i = 0; i < kUploadRingSize; i++)
+	{
+		stateBindBuffer(GL_COPY_READ_BUFFER, loader.ring.buffers[i]);
+		glBufferData(GL_COPY_READ_BUFFER, (GLsizeiptr)loader.ring.capacity, nullptr, GL_STREAM_DRAW);
+	}
+	stateBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+inline void freeAssetData(Asset& asset)
+{
+	if (asset.image)
+		SOIL_free_image_data(asset.image);
+	asset.image = nullptr;
+	asset.textureFile = TextureFile();
+	asset.decodedLevels.clear();
+	closeMeshFile(asset.meshFile);
+	asset.prepared.indices.clear();
+	asset.regions.clear();
+}
+
+// GL objects of resident assets belong to whoever took them, the rest are deleted here
+inline void releaseAssetLoader(AssetLoader& loader)
+{
+	stopThreadPool(loader.pool);
+	for (Asset* asset : loader.assets)
+	{
+		if (asset->state == kAssetUploading)
+		{
+			glDeleteTextures(1, &asset->texture);
+			glDeleteVertexArrays(1, &asset->vao);
+			glDeleteBuffers(1, &asset->vbo);
+			glDeleteBuffers(1, &asset->ebo);
+		}
+		freeAssetData(*asset);
+		delete asset;
+	}
+	loader.assets.clear();
+	loader.uploading.clear();
+	for (int i = 0; i < kUploadRingSize; i++)
+		if (loader.ring.fences[i])
+			glDeleteSync(loader.ring.fences[i]);
+	glDeleteBuffers(kUploadRingSize, loader.ring.buffers);
+	loader.ring = StagingRing();
+	loader.pending = 0;
+	invalidateGLBindings();
+}
+
+// Worker side: load and decode, then hand over to the GL thread
+inline void decodeAsset(AssetLoader& loader, Asset* asset)
+{
+	PROFILE_ZONE("decode asset");
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if (asset->type == kAssetTexture)
+	{
+		bool baked = asset->path.size() > 5 && asset->path.compare(asset->path.size() - 5, 5, ".ktx2") == 0;
+		if (baked)
+		{
+			uint32_t vkFormat = 0;
+			if (!openTextureFile(asset->path.c_str(), asset->textureFile))
+				asset->error = asset->textureFile.error;
+			else if (!textureGLFormat(vkFormat = asset->textureFile.header.vkFormat) && vkFormat == kVkFormatBc7Unorm)
+				asset->error = "BC7 textures need ARB_texture_compression_bptc";
+			else if (!textureGLFormat(vkFormat) && vkFormat == kVkFormatBc1RgbUnorm)
+			{
+				const Ktx2Header& header = asset->textureFile.header;
+				asset->decodedLevels.resize(asset->textureFile.levels.size());
+				for (uint32_t level = 0; level < asset->decodedLevels.size(); level++)
+					decodeBc1Image(textureLevelData(asset->textureFile, level), std::max(header.pixelWidth >> level, 1u),
+						std::max(header.pixelHeight >> level, 1u), asset->decodedLevels[level]);
+			}
+		}
+		else
+		{
+			asset->image = SOIL_load_image(asset->path.c_str(), &asset->imageWidth, &asset->imageHeight, 0, SOIL_LOAD_RGB);
+			if (!asset->image)
+				asset->error = "could not load image";
+		}
+	}
+	else
+	{
+		if (!openMeshFile(asset->path.c_str(), asset->meshFile))
+			asset->error = asset->meshFile.error;
+		else
+			prepareMeshUpload(asset->meshFile, asset->meshOptions, asset->prepared, asset->error);
+	}
+	asset->decodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	// The GL thread drains the queue every frame, a full queue only means it is behind
+	while (!tryPush(loader.decoded, asset))
+		std::this_thread::yield();
+}
+
+inline Asset* requestAsset(AssetLoader& loader, Asset* asset)
+{
+	asset->requested = std::chrono::steady_clock::now();
+	loader.assets.push_back(asset);
+	loader.pending++;
+	submitTask(loader.pool, [&loader, asset] { decodeAsset(loader, asset); });
+	return asset;
+}
+
+// Images go through SOIL2 and get their mips on the GPU, .ktx2 files are uploaded as baked
+inline Asset* requestTexture(AssetLoader& loader, const std::string& path)
+{
+	Asset* asset = new Asset();
+	asset->type = kAssetTexture;
+	asset->path = path;
+	return requestAsset(loader, asset);
+}
+
+// Mesh ids of the submeshes are taken from firstMeshId on
+inline Asset* requestMesh(AssetLoader& loader, const std::string& path, const MeshUploadOptions& options, uint16_t firstMeshId)
+{
+	Asset* asset = new Asset();
+	asset->type = kAssetMesh;
+	asset->path = path;
+	asset->meshOptions = options;
+	asset->firstMeshId = firstMeshId;
+	return requestAsset(loader, asset);
+}
+
+// Create the GL objects with uninitialized storage and list what has to be copied into them
+inline void beginAssetUpload(Asset& asset)
+{
+	asset.regions.clear();
+	asset.region = asset.regionOffset = 0;
+	if (asset.type == kAssetTexture)
+	{
+		glGenTextures(1, &asset.texture);
+		stateBindTexture(0, GL_TEXTURE_2D, asset.texture);
+		asset.gpuBytes = 0;
+		if (asset.image)
+		{
+			AssetRegion region;
+			region.data = asset.image;
+			region.width = asset.imageWidth;
+			region.height = asset.imageHeight;
+			region.unitBytes = (size_t)asset.imageWidth * 3;
+			region.bytes = region.unitBytes * asset.imageHeight;
+			asset.regions.push_back(region);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, asset.imageWidth, asset.imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+			asset.gpuBytes = (uint64_t)asset.imageWidth * asset.imageHeight * 4 * 4 / 3; // drivers pad RGB to RGBA
+			return;
+		}
+
+		const TextureFile& file = asset.textureFile;
+		GLenum compressed = textureGLFormat(file.header.vkFormat);
+		uint32_t blockSize;
+		uint32_t blockBytes = textureBlockBytes(file.header.vkFormat, blockSize);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)file.levels.size() - 1);
+		for (uint32_t level = 0; level < file.levels.size(); level++)
+		{
+			AssetRegion region;
+			region.level = (int)level;
+			region.width = (GLsizei)std::max(file.header.pixelWidth >> level, 1u);
+			region.height = (GLsizei)std::max(file.header.pixelHeight >> level, 1u);
+			if (compressed)
+			{
+				region.data = textureLevelData(file, level);
+				region.bytes = (size_t)file.levels[level].byteLength;
+				region.unitRows = (int)blockSize;
+				region.unitBytes = (size_t)(region.width + blockSize - 1) / blockSize * blockBytes;
+				glCompressedTexImage2D(GL_TEXTURE_2D, level, compressed, region.width, region.height, 0, (GLsizei)region.bytes, nullptr);
+			}
+			else
+			{
+				// RGBA8 levels, or BC1 decoded on the worker
+				region.data = asset.decodedLevels.empty() ? textureLevelData(file, level) : asset.decodedLevels[level].data();
+				region.unitBytes = (size_t)region.width * 4;
+				region.bytes = region.unitBytes * region.height;
+				glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, region.width, region.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			}
+			asset.gpuBytes += region.bytes;
+			asset.regions.push_back(region);
+		}
+		return;
+	}
+
+	glGenVertexArrays(1, &asset.vao);
+	glGenBuffers(1, &asset.vbo);
+	glGenBuffers(1, &asset.ebo);
+	AssetRegion indices, vertices;
+	indices.data = (const uint8_t*)preparedIndexData(asset.prepared, indices.bytes);
+	indices.buffer = asset.ebo;
+	vertices.data = (const uint8_t*)preparedVertexData(asset.prepared, vertices.bytes);
+	vertices.buffer = asset.vbo;
+	for (const AssetRegion& region : { indices, vertices })
+	{
+		stateBindBuffer(GL_COPY_WRITE_BUFFER, region.buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)region.bytes, nullptr, GL_STATIC_DRAW);
+		// An empty mesh has nothing to copy, a region without units would never complete
+		if (region.bytes > 0)
+			asset.regions.push_back(region);
+	}
+}
+
+// Everything is in GL, build what the data alone could not give
+inline void finishAssetUpload(Asset& asset, const RenderQueue& queue)
+{
+	if (asset.type == kAssetTexture)
+	{
+		if (asset.image)
+		{
+			stateBindTexture(0, GL_TEXTURE_2D, asset.texture);
+			glGenerateMipmap(GL_TEXTURE_2D);
+		}
+	}
+	else
+	{
+		stateBindVertexArray(asset.vao);
+		glBindBuffer(GL_ARRAY_BUFFER, asset.vbo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, asset.ebo);
+		setPreparedAttributes(asset.prepared, queue);
+		glBindVertexArray(0);
+		makePreparedMeshLods(asset.prepared, asset.vao, asset.firstMeshId, asset.meshes);
+	}
+	freeAssetData(asset);
+	asset.state = kAssetResident;
+	asset.residentMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - asset.requested).count();
+}
+
+// One copy out of the staging buffer
+struct StagedCopy
+{
+	const Asset* asset;
+	const AssetRegion* region;
+	size_t destinationOffset, stagingOffset, bytes;
+};
+
+// GL thread, once per frame: take decoded assets, stage up to the budget and finish what is complete.
+// Assets that became resident or failed this call are appended to `finished`
+inline void pumpAssetLoader(AssetLoader& loader, const RenderQueue& queue, std::vector<Asset*>& finished)
+{
+	size_t firstNew = loader.uploading.size();
+	Asset* asset;
+	while (tryPop(loader.decoded, asset))
+	{
+		if (!asset->error.empty())
+		{
+			asset->state = kAssetFailed;
+			freeAssetData(*asset);
+			loader.pending--;
+			finished.push_back(asset);
+			continue;
+		}
+		asset->state = kAssetUploading;
+		loader.uploading.push_back(asset);
+	}
+	if (loader.uploading.empty())
+		return;
+
+	// Bindings go through the cache here, but it cannot know what the frame code bound directly
+	invalidateGLBindings();
+	for (size_t i = firstNew; i < loader.uploading.size(); i++)
+		beginAssetUpload(*loader.uploading[i]);
+
+	// The slot was last read three frames ago, this wait rarely blocks
+	StagingRing& ring = loader.ring;
+	int slot = ring.next;
+	ring.next = (ring.next + 1) % kUploadRingSize;
+	if (ring.fences[slot])
+	{
+		if (glClientWaitSync(ring.fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, kUploadFenceTimeout) != GL_ALREADY_SIGNALED)
+			loader.fenceWaits++;
+		glDeleteSync(ring.fences[slot]);
+		ring.fences[slot] = 0;
+	}
+
+	stateBindBuffer(GL_COPY_READ_BUFFER, ring.buffers[slot]);
+	uint8_t* staging = (uint8_t*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, (GLsizeiptr)ring.capacity,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (!staging)
+	{
+		invalidateGLBindings();
+		return;
+	}
+
+	// Whole units only, oldest request first. A frame always makes some progress, the budget is at least one unit
+	std::vector<StagedCopy> copies;
+	size_t used = 0;
+	for (Asset* uploading : loader.uploading)
+	{
+		while (uploading->region < uploading->regions.size())
+		{
+			const AssetRegion& region = uploading->regions[uploading->region];
+			size_t units = std::min((ring.capacity - used) / region.unitBytes, (region.bytes - uploading->regionOffset + region.unitBytes - 1) / region.unitBytes);
+			if (units == 0)
+				break;
+			size_t bytes = std::min(units * region.unitBytes, region.bytes - uploading->regionOffset);
+			memcpy(staging + used, region.data + uploading->regionOffset, bytes);
+			copies.push_back({ uploading, &region, uploading->regionOffset, used, bytes });
+			used += bytes;
+			uploading->regionOffset += bytes;
+			if (uploading->regionOffset == region.bytes)
+			{
+				uploading->region++;
+				uploading->regionOffset = 0;
+			}
+		}
+		if (uploading->region < uploading->regions.size())
+			break;
+	}
+	glUnmapBuffer(GL_COPY_READ_BUFFER);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	stateBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring.buffers[slot]);
+	for (const StagedCopy& copy : copies)
+	{
+		const AssetRegion& region = *copy.region;
+		if (region.buffer)
+		{
+			stateBindBuffer(GL_COPY_WRITE_BUFFER, region.buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr)copy.stagingOffset,
+				(GLintptr)copy.destinationOffset, (GLsizeiptr)copy.bytes);
+			continue;
+		}
+
+		// Texture levels are staged in whole rows or rows of blocks
+		const Asset& owner = *copy.asset;
+		GLsizei y = (GLsizei)(copy.destinationOffset / region.unitBytes) * region.unitRows;
+		GLsizei rows = std::min((GLsizei)((copy.bytes + region.unitBytes - 1) / region.unitBytes) * region.unitRows, region.height - y);
+		const GLvoid* offset = (const GLvoid*)copy.stagingOffset;
+		GLenum compressed = owner.image ? 0 : textureGLFormat(owner.textureFile.header.vkFormat);
+		stateBindTexture(0, GL_TEXTURE_2D, owner.texture);
+		if (compressed)
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, region.level, 0, y, region.width, rows, compressed, (GLsizei)copy.bytes, offset);
+		else
+			glTexSubImage2D(GL_TEXTURE_2D, region.level, 0, y, region.width, rows, owner.image ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, offset);
+	}
+	stateBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	ring.fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	loader.uploadedBytes += used;
+	loader.maxFrameBytes = std::max(loader.maxFrameBytes, used);
+	loader.uploadFrames++;
+
+	// Complete assets leave the upload list in order
+	size_t kept = 0;
+	for (Asset* uploading : loader.uploading)
+	{
+		if (uploading->region < uploading->regions.size())
+		{
+			loader.uploading[kept++] = uploading;
+			continue;
+		}
+		finishAssetUpload(*uploading, queue);
+		loader.pending--;
+		finished.push_back(uploading);
+	}
+	loader.uploading.resize(kept);
+	invalidateGLBindings();
+}
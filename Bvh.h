@@ -0,0 +1,345 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86)
+#include <xmmintrin.h>
+#define BVH_SSE 1
+#endif
+
+#include "TransformStore.h"
+
+// Bounding volume hierarchy over scene instances for view frustum culling.
+// Nodes have four children with their boxes stored side by side, so one SIMD pass tests all four against a plane.
+// The tree is built once over the instances' world boxes and refit when their transforms change.
+
+const int kBvhWidth = 4;
+
+struct Aabb
+{
+	glm::vec3 min, max;
+};
+
+// Children of one node, a child is another node (>= 0) or an item (~item)
+struct alignas(16) BvhNode
+{
+	float minX[kBvhWidth], minY[kBvhWidth], minZ[kBvhWidth];
+	float maxX[kBvhWidth], maxY[kBvhWidth], maxZ[kBvhWidth];
+	int32_t child[kBvhWidth];
+	int32_t parent;
+	uint8_t parentSlot, count;
+};
+
+struct SceneBvh
+{
+	std::vector<BvhNode> nodes; // parents before children, the root is 0
+	std::vector<uint8_t> dirtyNodes;
+
+	// Per item: object space box, the transform it follows and where its box sits in the tree
+	std::vector<Aabb> localBounds;
+	std::vector<TransformId> itemTransform;
+	std::vector<uint32_t> itemNode;
+	std::vector<uint8_t> itemSlot;
+
+	// Items of each transform, for refitting what moved
+	std::vector<uint32_t> transformItemOffset, transformItems;
+
+	std::vector<uint32_t> buildOrder; // scratch
+	std::vector<Aabb> buildBounds; // scratch, world boxes during the build
+	std::vector<std::pair<int32_t, bool>> stack; // scratch, node and whether it is known to be inside
+
+	// Stats of the last refit and cull
+	int refitItems = 0, testedNodes = 0;
+};
+
+// Box of `count` points `floatStride` floats apart
+inline Aabb pointBounds(const float* points, size_t count, size_t floatStride)
+{
+	Aabb box = { glm::vec3(INFINITY), glm::vec3(-INFINITY) };
+	for (size_t i = 0; i < count; i++)
+	{
+		glm::vec3 p(points[i * floatStride], points[i * floatStride + 1], points[i * floatStride + 2]);
+		box.min = glm::min(box.min, p);
+		box.max = glm::max(box.max, p);
+	}
+	return box;
+}
+
+// Box around the transformed box, from the center and the absolute matrix applied to the extent
+inline Aabb transformAabb(const Aabb& box, const glm::mat4& m)
+{
+	glm::vec3 center = (box.min + box.max) * 0.5f, extent = (box.max - box.min) * 0.5f;
+	glm::vec3 worldCenter = glm::vec3(m * glm::vec4(center, 1.0f));
+	glm::vec3 worldExtent = glm::abs(glm::vec3(m[0])) * extent.x + glm::abs(glm::vec3(m[1])) * extent.y + glm::abs(glm::vec3(m[2])) * extent.z;
+	Aabb result = { worldCenter - worldExtent, worldCenter + worldExtent };
+	return result;
+}
+
+inline void setBvhSlot(BvhNode& node, int slot, const Aabb& box)
+{
+	node.minX[slot] = box.min.x; node.minY[slot] = box.min.y; node.minZ[slot] = box.min.z;
+	node.maxX[slot] = box.max.x; node.maxY[slot] = box.max.y; node.maxZ[slot] = box.max.z;
+}
+
+inline Aabb bvhNodeBounds(const BvhNode& node)
+{
+	Aabb box = { glm::vec3(INFINITY), glm::vec3(-INFINITY) };
+	for (int slot = 0; slot < node.count; slot++)
+	{
+		box.min = glm::min(box.min, glm::vec3(node.minX[slot], node.minY[slot], node.minZ[slot]));
+		box.max = glm::max(box.max, glm::vec3(node.maxX[slot], node.maxY[slot], node.maxZ[slot]));
+	}
+	return box;
+}
+
+inline void clearBvh(SceneBvh& bvh)
+{
+	bvh.nodes.clear();
+	bvh.dirtyNodes.clear();
+	bvh.localBounds.clear();
+	bvh.itemTransform.clear();
+	bvh.itemNode.clear();
+	bvh.itemSlot.clear();
+}
+
+// Register an instance, items are numbered in the order they are added
+inline uint32_t addBvhItem(SceneBvh& bvh, TransformId transform, const Aabb& localBounds)
+{
+	bvh.localBounds.push_back(localBounds);
+	bvh.itemTransform.push_back(transform);
+	return (uint32_t)bvh.localBounds.size() - 1;
+}
+
+// Split buildOrder[first, last) into up to four groups by median on the widest centroid axis, twice
+inline void splitBvhRange(SceneBvh& bvh, uint32_t first, uint32_t last, uint32_t bounds[kBvhWidth + 1], int& groups)
+{
+	uint32_t halves[3] = { first, first + (last - first) / 2, last };
+	bounds[0] = first;
+	groups = 0;
+	for (int half = -1; half < 2; half++)
+	{
+		uint32_t begin = half < 0 ? first : halves[half], end = half < 0 ? last : halves[half + 1];
+		glm::vec3 centroidMin(INFINITY), centroidMax(-INFINITY);
+		for (uint32_t i = begin; i < end; i++)
+		{
+			const Aabb& box = bvh.buildBounds[bvh.buildOrder[i]];
+			centroidMin = glm::min(centroidMin, box.min + box.max);
+			centroidMax = glm::max(centroidMax, box.min + box.max);
+		}
+		glm::vec3 extent = centroidMax - centroidMin;
+		int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+		uint32_t middle = begin + (end - begin) / 2;
+		std::nth_element(bvh.buildOrder.begin() + begin, bvh.buildOrder.begin() + middle, bvh.buildOrder.begin() + end,
+			[&](uint32_t a, uint32_t b) { return bvh.buildBounds[a].min[axis] + bvh.buildBounds[a].max[axis] < bvh.buildBounds[b].min[axis] + bvh.buildBounds[b].max[axis]; });
+		if (half < 0)
+			continue;
+		if (middle > begin)
+			bounds[++groups] = middle;
+		if (end > middle)
+			bounds[++groups] = end;
+	}
+}
+
+inline int32_t buildBvhNode(SceneBvh& bvh, uint32_t first, uint32_t last, int32_t parent, uint8_t parentSlot)
+{
+	int32_t index = (int32_t)bvh.nodes.size();
+	bvh.nodes.push_back(BvhNode());
+	bvh.nodes[index].parent = parent;
+	bvh.nodes[index].parentSlot = parentSlot;
+
+	uint32_t bounds[kBvhWidth + 1];
+	int groups;
+	if (last - first <= (uint32_t)kBvhWidth)
+	{
+		groups = (int)(last - first);
+		for (int i = 0; i <= groups; i++)
+			bounds[i] = first + i;
+	}
+	else
+		splitBvhRange(bvh, first, last, bounds, groups);
+
+	bvh.nodes[index].count = (uint8_t)groups;
+	for (int slot = 0; slot < groups; slot++)
+	{
+		int32_t child;
+		if (bounds[slot + 1] - bounds[slot] == 1)
+		{
+			uint32_t item = bvh.buildOrder[bounds[slot]];
+			bvh.itemNode[item] = (uint32_t)index;
+			bvh.itemSlot[item] = (uint8_t)slot;
+			setBvhSlot(bvh.nodes[index], slot, bvh.buildBounds[item]);
+			child = ~(int32_t)item;
+		}
+		else
+		{
+			child = buildBvhNode(bvh, bounds[slot], bounds[slot + 1], index, (uint8_t)slot);
+			setBvhSlot(bvh.nodes[index], slot, bvhNodeBounds(bvh.nodes[child]));
+		}
+		bvh.nodes[index].child[slot] = child;
+	}
+	return index;
+}
+
+// Build the tree over every added item at its current world transform
+inline void buildBvh(SceneBvh& bvh, const TransformStore& transforms)
+{
+	size_t itemCount = bvh.localBounds.size();
+	bvh.nodes.clear();
+	bvh.itemNode.assign(itemCount, 0);
+	bvh.itemSlot.assign(itemCount, 0);
+	bvh.buildOrder.resize(itemCount);
+	bvh.buildBounds.resize(itemCount);
+	for (uint32_t item = 0; item < itemCount; item++)
+	{
+		bvh.buildOrder[item] = item;
+		bvh.buildBounds[item] = transformAabb(bvh.localBounds[item], transforms.world[bvh.itemTransform[item]]);
+	}
+	if (itemCount)
+		buildBvhNode(bvh, 0, (uint32_t)itemCount, -1, 0);
+	bvh.dirtyNodes.assign(bvh.nodes.size(), 0);
+
+	// Transform to items lookup
+	bvh.transformItemOffset.assign(transforms.parent.size() + 1, 0);
+	for (TransformId transform : bvh.itemTransform)
+		bvh.transformItemOffset[transform + 1]++;
+	for (size_t t = 0; t < transforms.parent.size(); t++)
+		bvh.transformItemOffset[t + 1] += bvh.transformItemOffset[t];
+	bvh.transformItems.resize(itemCount);
+	std::vector<uint32_t> fill(bvh.transformItemOffset.begin(), bvh.transformItemOffset.end() - 1);
+	for (uint32_t item = 0; item < itemCount; item++)
+		bvh.transformItems[fill[bvh.itemTransform[item]]++] = item;
+}
+
+// Update the boxes of items whose transforms changed in the last updateTransforms, then their ancestors bottom up.
+// The topology stays as built, which is fine while objects move less than the scene is large
+inline void refitBvh(SceneBvh& bvh, const TransformStore& transforms)
+{
+	bvh.refitItems = 0;
+	if (bvh.nodes.empty() || transforms.updatedNodes == 0)
+		return;
+
+	for (const std::vector<TransformId>& batch : transforms.levelBatches)
+	{
+		for (TransformId transform : batch)
+		{
+			if (transform + 1 >= bvh.transformItemOffset.size())
+				continue;
+			for (uint32_t i = bvh.transformItemOffset[transform]; i < bvh.transformItemOffset[transform + 1]; i++)
+			{
+				uint32_t item = bvh.transformItems[i];
+				setBvhSlot(bvh.nodes[bvh.itemNode[item]], bvh.itemSlot[item], transformAabb(bvh.localBounds[item], transforms.world[transform]));
+				bvh.dirtyNodes[bvh.itemNode[item]] = 1;
+				bvh.refitItems++;
+			}
+		}
+	}
+
+	for (size_t n = bvh.nodes.size() - 1; n > 0; n--)
+	{
+		if (!bvh.dirtyNodes[n])
+			continue;
+		const BvhNode& node = bvh.nodes[n];
+		setBvhSlot(bvh.nodes[node.parent], node.parentSlot, bvhNodeBounds(node));
+		bvh.dirtyNodes[node.parent] = 1;
+		bvh.dirtyNodes[n] = 0;
+	}
+	bvh.dirtyNodes[0] = 0;
+}
+
+// The six clip planes of a view projection matrix, normals pointing inside
+inline void extractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6])
+{
+	glm::vec4 row[4];
+	for (int i = 0; i < 4; i++)
+		row[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+	for (int i = 0; i < 3; i++)
+	{
+		planes[i * 2] = row[3] + row[i];
+		planes[i * 2 + 1] = row[3] - row[i];
+	}
+	for (int i = 0; i < 6; i++)
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+// Test a node's children against the planes, bit i of `outside` / `inside` is set when child i is
+// completely outside one plane / inside all of them
+inline void testBvhNode(const BvhNode& node, const glm::vec4 planes[6], int& outside, int& inside)
+{
+#ifdef BVH_SSE
+	__m128 minX = _mm_load_ps(node.minX), minY = _mm_load_ps(node.minY), minZ = _mm_load_ps(node.minZ);
+	__m128 maxX = _mm_load_ps(node.maxX), maxY = _mm_load_ps(node.maxY), maxZ = _mm_load_ps(node.maxZ);
+	__m128 out = _mm_setzero_ps(), in = _mm_cmpeq_ps(out, out), zero = _mm_setzero_ps();
+	for (int p = 0; p < 6; p++)
+	{
+		__m128 nx = _mm_set1_ps(planes[p].x), ny = _mm_set1_ps(planes[p].y), nz = _mm_set1_ps(planes[p].z);
+		__m128 x0 = _mm_mul_ps(nx, minX), x1 = _mm_mul_ps(nx, maxX);
+		__m128 y0 = _mm_mul_ps(ny, minY), y1 = _mm_mul_ps(ny, maxY);
+		__m128 z0 = _mm_mul_ps(nz, minZ), z1 = _mm_mul_ps(nz, maxZ);
+
+		// Signed distance of the corner furthest along the normal and of the one furthest against it
+		__m128 w = _mm_set1_ps(planes[p].w);
+		__m128 farthest = _mm_add_ps(_mm_add_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)), _mm_add_ps(_mm_max_ps(z0, z1), w));
+		__m128 nearest = _mm_add_ps(_mm_add_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)), _mm_add_ps(_mm_min_ps(z0, z1), w));
+		out = _mm_or_ps(out, _mm_cmplt_ps(farthest, zero));
+		in = _mm_and_ps(in, _mm_cmpge_ps(nearest, zero));
+	}
+	int used = (1 << node.count) - 1;
+	outside = _mm_movemask_ps(out) & used;
+	inside = _mm_movemask_ps(in) & used;
+#else
+	outside = inside = 0;
+	for (int slot = 0; slot < node.count; slot++)
+	{
+		bool out = false, in = true;
+		for (int p = 0; p < 6; p++)
+		{
+			float x0 = planes[p].x * node.minX[slot], x1 = planes[p].x * node.maxX[slot];
+			float y0 = planes[p].y * node.minY[slot], y1 = planes[p].y * node.maxY[slot];
+			float z0 = planes[p].z * node.minZ[slot], z1 = planes[p].z * node.maxZ[slot];
+			out = out || std::max(x0, x1) + std::max(y0, y1) + std::max(z0, z1) + planes[p].w < 0.0f;
+			in = in && std::min(x0, x1) + std::min(y0, y1) + std::min(z0, z1) + planes[p].w >= 0.0f;
+		}
+		outside |= out << slot;
+		inside |= in << slot;
+	}
+#endif
+}
+
+// Items whose box touches the frustum, subtrees found completely inside are taken without further tests
+inline void cullBvh(SceneBvh& bvh, const glm::vec4 planes[6], std::vector<uint32_t>& visible)
+{
+	visible.clear();
+	bvh.testedNodes = 0;
+	if (bvh.nodes.empty())
+		return;
+
+	bvh.stack.clear();
+	bvh.stack.push_back(std::make_pair(0, false));
+	while (!bvh.stack.empty())
+	{
+		std::pair<int32_t, bool> entry = bvh.stack.back();
+		bvh.stack.pop_back();
+		const BvhNode& node = bvh.nodes[entry.first];
+		int outside = 0, inside = (1 << node.count) - 1;
+		if (!entry.second)
+		{
+			testBvhNode(node, planes, outside, inside);
+			bvh.testedNodes++;
+		}
+		for (int slot = 0; slot < node.count; slot++)
+		{
+			if (outside & (1 << slot))
+				continue;
+			int32_t child = node.child[slot];
+			if (child < 0)
+				visible.push_back((uint32_t)~child);
+			else
+				bvh.stack.push_back(std::make_pair(child, (inside & (1 << slot)) != 0));
+		}
+	}
+}
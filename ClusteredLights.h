@@ -0,0 +1,289 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86)
+#include <xmmintrin.h>
+#define CLUSTER_SSE 1
+#endif
+
+#include "GLStateCache.h"
+
+// Clustered forward lighting: the view frustum is split into tiles x depth slices,
+// each cluster gets the list of lights touching it and the fragment shader only loops over that list
+
+const int kClusterTilesX = 16, kClusterTilesY = 9, kClusterSlices = 24;
+const int kClustersPerSlice = kClusterTilesX * kClusterTilesY;
+const int kClusterCount = kClustersPerSlice * kClusterSlices;
+static_assert(kClustersPerSlice % 4 == 0, "light assignment tests four clusters at a time");
+
+// Texture units of the light buffers (unit 0 is the material texture)
+const GLuint kLightDataUnit = 1, kClusterGridUnit = 2, kLightIndexUnit = 3;
+
+struct PointLight
+{
+	glm::vec3 position; // world space
+	float radius; // no contribution beyond this distance
+	glm::vec3 color;
+};
+
+struct LightClusters
+{
+	std::vector<PointLight> lights;
+
+	// View space cluster bounds, structure of arrays for the SIMD test
+	std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+	glm::mat4 boundsProjection;
+	int boundsWidth = 0, boundsHeight = 0;
+	float nearPlane = 0.1f, farPlane = 100.0f;
+
+	// Per cluster (offset, count) into lightIndices
+	std::vector<uint32_t> grid;
+	std::vector<uint32_t> lightIndices;
+	std::vector<uint32_t> clusterCounts;
+	std::vector<uint32_t> pairs; // (cluster << 16 | light) scratch from the assignment pass
+	std::vector<glm::vec4> lightTexels;
+
+	GLuint lightBuffer = 0, gridBuffer = 0, indexBuffer = 0;
+	GLuint lightTexture = 0, gridTexture = 0, indexTexture = 0;
+	GLint maxTexels = 65536;
+
+	// Stats of the last update
+	int lightClusterPairs = 0, maxLightsPerCluster = 0, droppedPairs = 0;
+};
+
+inline void initLightClusters(LightClusters& clusters)
+{
+	GLuint buffers[3], textures[3];
+	glGenBuffers(3, buffers);
+	glGenTextures(3, textures);
+	clusters.lightBuffer = buffers[0]; clusters.gridBuffer = buffers[1]; clusters.indexBuffer = buffers[2];
+	clusters.lightTexture = textures[0]; clusters.gridTexture = textures[1]; clusters.indexTexture = textures[2];
+
+	// Buffer objects only exist once bound, glTexBuffer rejects bare names
+	for (int i = 0; i < 3; i++)
+		glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	// Light texels: (position, radius) then (color, 0)
+	glBindTexture(GL_TEXTURE_BUFFER, clusters.lightTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, clusters.lightBuffer);
+	glBindTexture(GL_TEXTURE_BUFFER, clusters.gridTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, clusters.gridBuffer);
+	glBindTexture(GL_TEXTURE_BUFFER, clusters.indexTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, clusters.indexBuffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &clusters.maxTexels);
+	clusters.grid.resize(kClusterCount * 2);
+	clusters.clusterCounts.resize(kClusterCount);
+}
+
+inline void releaseLightClusters(LightClusters& clusters)
+{
+	GLuint buffers[3] = { clusters.lightBuffer, clusters.gridBuffer, clusters.indexBuffer };
+	GLuint textures[3] = { clusters.lightTexture, clusters.gridTexture, clusters.indexTexture };
+	glDeleteBuffers(3, buffers);
+	glDeleteTextures(3, textures);
+	clusters.lightBuffer = clusters.gridBuffer = clusters.indexBuffer = 0;
+	clusters.lightTexture = clusters.gridTexture = clusters.indexTexture = 0;
+}
+
+// Exponential slices keep clusters roughly cubic in view space
+inline float clusterSliceDepth(const LightClusters& clusters, int slice)
+{
+	return clusters.nearPlane * powf(clusters.farPlane / clusters.nearPlane, (float)slice / kClusterSlices);
+}
+
+inline int clusterSliceOf(const LightClusters& clusters, float viewDepth)
+{
+	if (viewDepth <= clusters.nearPlane)
+		return 0;
+	int slice = (int)floorf(logf(viewDepth / clusters.nearPlane) / logf(clusters.farPlane / clusters.nearPlane) * kClusterSlices);
+	return slice < 0 ? 0 : (slice >= kClusterSlices ? kClusterSlices - 1 : slice);
+}
+
+// Point on the ray through an NDC position at a view space depth (works for perspective and ortho)
+inline glm::vec3 pointAtViewDepth(const glm::mat4& inverseProjection, float ndcX, float ndcY, float viewDepth)
+{
+	glm::vec4 nearPoint = inverseProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+	glm::vec4 farPoint = inverseProjection * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+	glm::vec3 a = glm::vec3(nearPoint) / nearPoint.w;
+	glm::vec3 b = glm::vec3(farPoint) / farPoint.w;
+	float t = (-viewDepth - a.z) / (b.z - a.z);
+	return a + (b - a) * t;
+}
+
+// Rebuild the view space bounds of every cluster, only needed when the projection changes
+inline void buildClusterBounds(LightClusters& clusters, const glm::mat4& projection, int width, int height, float nearPlane, float farPlane)
+{
+	clusters.boundsProjection = projection;
+	clusters.boundsWidth = width;
+	clusters.boundsHeight = height;
+	clusters.nearPlane = nearPlane;
+	clusters.farPlane = farPlane;
+
+	clusters.minX.resize(kClusterCount); clusters.minY.resize(kClusterCount); clusters.minZ.resize(kClusterCount);
+	clusters.maxX.resize(kClusterCount); clusters.maxY.resize(kClusterCount); clusters.maxZ.resize(kClusterCount);
+
+	glm::mat4 inverseProjection = glm::inverse(projection);
+	float tileWidth = ceilf((float)width / kClusterTilesX), tileHeight = ceilf((float)height / kClusterTilesY);
+	for (int slice = 0; slice < kClusterSlices; slice++)
+	{
+		float sliceNear = clusterSliceDepth(clusters, slice), sliceFar = clusterSliceDepth(clusters, slice + 1);
+		for (int y = 0; y < kClusterTilesY; y++)
+		{
+			for (int x = 0; x < kClusterTilesX; x++)
+			{
+				float ndcX0 = -1.0f + 2.0f * x * tileWidth / width, ndcX1 = -1.0f + 2.0f * (x + 1) * tileWidth / width;
+				float ndcY0 = -1.0f + 2.0f * y * tileHeight / height, ndcY1 = -1.0f + 2.0f * (y + 1) * tileHeight / height;
+
+				glm::vec3 lo(1e30f), hi(-1e30f);
+				for (int corner = 0; corner < 8; corner++)
+				{
+					glm::vec3 p = pointAtViewDepth(inverseProjection, corner & 1 ? ndcX1 : ndcX0, corner & 2 ? ndcY1 : ndcY0,
+						corner & 4 ? sliceFar : sliceNear);
+					lo = glm::min(lo, p);
+					hi = glm::max(hi, p);
+				}
+
+				int cluster = (slice * kClusterTilesY + y) * kClusterTilesX + x;
+				clusters.minX[cluster] = lo.x; clusters.minY[cluster] = lo.y; clusters.minZ[cluster] = lo.z;
+				clusters.maxX[cluster] = hi.x; clusters.maxY[cluster] = hi.y; clusters.maxZ[cluster] = hi.z;
+			}
+		}
+	}
+}
+
+// Record every cluster of one slice that the view space sphere touches
+inline void assignLightToSlice(LightClusters& clusters, int slice, const glm::vec3& center, float radius, uint32_t light)
+{
+	int first = slice * kClustersPerSlice, last = first + kClustersPerSlice;
+#ifdef CLUSTER_SSE
+	__m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+	__m128 radius2 = _mm_set1_ps(radius * radius), zero = _mm_setzero_ps();
+	for (int c = first; c < last; c += 4)
+	{
+		// Distance from the sphere center to each box, per axis
+		__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&clusters.minX[c]), cx), _mm_sub_ps(cx, _mm_loadu_ps(&clusters.maxX[c]))), zero);
+		__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&clusters.minY[c]), cy), _mm_sub_ps(cy, _mm_loadu_ps(&clusters.maxY[c]))), zero);
+		__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&clusters.minZ[c]), cz), _mm_sub_ps(cz, _mm_loadu_ps(&clusters.maxZ[c]))), zero);
+		__m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		int hits = _mm_movemask_ps(_mm_cmple_ps(distance2, radius2));
+		while (hits)
+		{
+			int lane = 0;
+			while (!(hits & (1 << lane)))
+				lane++;
+			hits &= ~(1 << lane);
+			clusters.pairs.push_back((uint32_t)(c + lane) << 16 | light);
+			clusters.clusterCounts[c + lane]++;
+		}
+	}
+#else
+	for (int c = first; c < last; c++)
+	{
+		float dx = std::max(std::max(clusters.minX[c] - center.x, center.x - clusters.maxX[c]), 0.0f);
+		float dy = std::max(std::max(clusters.minY[c] - center.y, center.y - clusters.maxY[c]), 0.0f);
+		float dz = std::max(std::max(clusters.minZ[c] - center.z, center.z - clusters.maxZ[c]), 0.0f);
+		if (dx * dx + dy * dy + dz * dz <= radius * radius)
+		{
+			clusters.pairs.push_back((uint32_t)c << 16 | light);
+			clusters.clusterCounts[c]++;
+		}
+	}
+#endif
+}
+
+// Assign lights to clusters on the CPU and upload the light, grid and index buffers
+inline void updateLightClusters(LightClusters& clusters, const glm::mat4& viewMatrix, const glm::mat4& projection,
+	int width, int height, float nearPlane, float farPlane)
+{
+	if (!(projection == clusters.boundsProjection) || width != clusters.boundsWidth || height != clusters.boundsHeight ||
+		clusters.minX.empty())
+		buildClusterBounds(clusters, projection, width, height, nearPlane, farPlane);
+
+	clusters.pairs.clear();
+	std::fill(clusters.clusterCounts.begin(), clusters.clusterCounts.end(), 0u);
+
+	// Light indices share 16 bits with the cluster index in the scratch pairs
+	uint32_t lightCount = (uint32_t)std::min<size_t>(clusters.lights.size(), 0xFFFF);
+	for (uint32_t light = 0; light < lightCount; light++)
+	{
+		const PointLight& pointLight = clusters.lights[light];
+		glm::vec3 center = glm::vec3(viewMatrix * glm::vec4(pointLight.position, 1.0f));
+		float depth = -center.z;
+		if (depth + pointLight.radius < clusters.nearPlane || depth - pointLight.radius > clusters.farPlane)
+			continue;
+
+		// Only the slices the sphere spans in depth are tested
+		int firstSlice = clusterSliceOf(clusters, depth - pointLight.radius);
+		int lastSlice = clusterSliceOf(clusters, depth + pointLight.radius);
+		for (int slice = firstSlice; slice <= lastSlice; slice++)
+			assignLightToSlice(clusters, slice, center, pointLight.radius, light);
+	}
+
+	// Prefix sum into (offset, count) and scatter the light indices
+	uint32_t maxPairs = (uint32_t)std::max(clusters.maxTexels, 1);
+	uint32_t offset = 0;
+	clusters.maxLightsPerCluster = 0;
+	for (int c = 0; c < kClusterCount; c++)
+	{
+		uint32_t count = std::min(clusters.clusterCounts[c], maxPairs - std::min(offset, maxPairs));
+		clusters.grid[c * 2] = offset;
+		clusters.grid[c * 2 + 1] = 0;
+		clusters.clusterCounts[c] = count;
+		offset += count;
+		clusters.maxLightsPerCluster = std::max(clusters.maxLightsPerCluster, (int)count);
+	}
+	clusters.lightIndices.resize(std::max<uint32_t>(offset, 1));
+	clusters.droppedPairs = 0;
+	for (uint32_t pair : clusters.pairs)
+	{
+		uint32_t cluster = pair >> 16;
+		uint32_t& filled = clusters.grid[cluster * 2 + 1];
+		if (filled >= clusters.clusterCounts[cluster])
+		{
+			clusters.droppedPairs++;
+			continue;
+		}
+		clusters.lightIndices[clusters.grid[cluster * 2] + filled++] = pair & 0xFFFF;
+	}
+	clusters.lightClusterPairs = (int)offset;
+
+	// Lights as two RGBA32F texels each
+	std::vector<glm::vec4>& lightTexels = clusters.lightTexels;
+	lightTexels.resize(std::max<size_t>(lightCount, 1) * 2);
+	for (uint32_t light = 0; light < lightCount; light++)
+	{
+		lightTexels[light * 2] = glm::vec4(clusters.lights[light].position, clusters.lights[light].radius);
+		lightTexels[light * 2 + 1] = glm::vec4(clusters.lights[light].color, 0.0f);
+	}
+
+	stateBindBuffer(GL_TEXTURE_BUFFER, clusters.lightBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, lightTexels.size() * sizeof(glm::vec4), lightTexels.data(), GL_STREAM_DRAW);
+	stateBindBuffer(GL_TEXTURE_BUFFER, clusters.gridBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, clusters.grid.size() * sizeof(uint32_t), clusters.grid.data(), GL_STREAM_DRAW);
+	stateBindBuffer(GL_TEXTURE_BUFFER, clusters.indexBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, clusters.lightIndices.size() * sizeof(uint32_t), clusters.lightIndices.data(), GL_STREAM_DRAW);
+}
+
+// Bind the three light buffers to their texture units
+inline void bindLightClusters(const LightClusters& clusters)
+{
+	stateBindTexture(kLightDataUnit, GL_TEXTURE_BUFFER, clusters.lightTexture);
+	stateBindTexture(kClusterGridUnit, GL_TEXTURE_BUFFER, clusters.gridTexture);
+	stateBindTexture(kLightIndexUnit, GL_TEXTURE_BUFFER, clusters.indexTexture);
+}
+
+// Shader constants for finding a fragment's cluster: tile size in pixels and the slice log scale/bias
+inline glm::vec4 clusterScaleBias(const LightClusters& clusters, int width, int height)
+{
+	float scale = kClusterSlices / logf(clusters.farPlane / clusters.nearPlane);
+	return glm::vec4(ceilf((float)width / kClusterTilesX), ceilf((float)height / kClusterTilesY), scale, -logf(clusters.nearPlane) * scale);
+}
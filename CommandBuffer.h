@@ -0,0 +1,299 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "Profiler.h"
+#include "RenderQueue.h"
+#include "ThreadPool.h"
+
+// Draw lists recorded on worker threads into CPU command buffers and replayed on the GL thread.
+//
+// Recording: the visible objects are cut into partitions, and each partition job builds its objects' instance
+// transforms and sort keys into its own arrays and sorts them. Arrays belong to partitions, not threads, so
+// the result does not depend on which thread ran which job.
+// Encoding: the GL thread merges the sorted runs, cuts the merged list at batch boundaries into one piece
+// per thread and the pieces are encoded in parallel. Each piece gathers its instances into the upload array
+// (mapped GPU memory when the queue has a ring) and writes bind and draw commands into a linear arena, with
+// redundant binds already dropped.
+// Replay: the GL thread makes the instances visible once and walks the arenas in order. Only the GL calls stay serial.
+
+const uint32_t kDrawPartitionSize = 128; // objects recorded per job
+
+enum DrawCommandType : uint8_t
+{
+	kCommandUseProgram, // GLuint
+	kCommandBindVertexArray, // GLuint
+	kCommandBindTexture, // GLuint, unit 0
+	kCommandDraw // DrawCommand
+};
+
+// One instanced draw of a batch, its instances start at instanceOffset in the instance buffer
+struct DrawCommand
+{
+	GLenum mode, indexType;
+	GLsizei indexCount, instanceCount;
+	GLsizeiptr indexOffset, instanceOffset;
+	const char* zone; // GPU profiler zone, a string literal
+};
+
+// Commands as a type byte followed by the payload, copied in and out so nothing needs alignment.
+// The storage is kept between frames and only grows
+struct CommandArena
+{
+	std::vector<uint8_t> bytes;
+	size_t used = 0;
+	int commands = 0;
+};
+
+// Draws of one partition, sorted by key. The items' instance field indexes `instances`
+struct DrawPartition
+{
+	std::vector<DrawItem> items;
+	std::vector<InstanceData> instances;
+};
+
+// Draw item with the partition that holds its transforms
+struct RecordedDraw
+{
+	DrawItem item;
+	uint32_t partition;
+};
+
+struct DrawLists
+{
+	std::vector<DrawPartition> partitions;
+	std::vector<RecordedDraw> merged, mergeScratch;
+	std::vector<uint32_t> runStarts; // merged index where each sorted run starts, then the total
+	std::vector<uint32_t> pieceStarts; // merged index where each encoded piece starts, then the total
+	std::vector<CommandArena> arenas; // one per piece, replayed in order
+
+	// Stats of the last flush
+	int partitionCount = 0, pieces = 0, commands = 0;
+	size_t commandBytes = 0;
+};
+
+inline void resetCommandArena(CommandArena& arena)
+{
+	arena.used = 0;
+	arena.commands = 0;
+}
+
+template <typename T>
+inline void writeCommand(CommandArena& arena, DrawCommandType type, const T& payload)
+{
+	size_t size = 1 + sizeof(T);
+	if (arena.used + size > arena.bytes.size())
+		arena.bytes.resize(std::max(arena.bytes.size() * 2, arena.used + size + 4096));
+	arena.bytes[arena.used] = (uint8_t)type;
+	memcpy(&arena.bytes[arena.used + 1], &payload, sizeof(T));
+	arena.used += size;
+	arena.commands++;
+}
+
+template <typename T>
+inline T readCommand(const uint8_t*& at)
+{
+	T payload;
+	memcpy(&payload, at, sizeof(T));
+	at += sizeof(T);
+	return payload;
+}
+
+// Object transforms and sort key into a partition, on the thread recording it
+inline void recordDraw(const RenderQueue& queue, DrawPartition& partition, GLuint program, const DrawMesh& mesh, GLuint texture,
+	const glm::mat4& world, const glm::mat3& normal)
+{
+	InstanceData instance;
+	DrawItem item = prepareDrawItem(queue.viewMatrix, queue.nearPlane, queue.farPlane, program, mesh, texture, world, normal, instance);
+	item.instance = (uint32_t)partition.instances.size();
+	partition.items.push_back(item);
+	partition.instances.push_back(instance);
+}
+
+// Record `count` objects in partitions of kDrawPartitionSize on the pool. record(begin, end, partition)
+// calls recordDraw for the objects in [begin, end). Call after beginRenderQueue, the camera comes from the queue
+inline void recordDrawLists(DrawLists& lists, WorkStealingPool& pool, uint32_t count,
+	const std::function<void(uint32_t, uint32_t, DrawPartition&)>& record)
+{
+	uint32_t partitions = (count + kDrawPartitionSize - 1) / kDrawPartitionSize;
+	if (lists.partitions.size() < partitions)
+		lists.partitions.resize(partitions);
+	lists.partitionCount = (int)partitions;
+	parallelFor(pool, partitions, [&lists, &record, count](uint32_t index, int)
+	{
+		PROFILE_ZONE("record draws");
+		DrawPartition& partition = lists.partitions[index];
+		partition.items.clear();
+		partition.instances.clear();
+		uint32_t begin = index * kDrawPartitionSize;
+		record(begin, std::min(begin + kDrawPartitionSize, count), partition);
+		std::sort(partition.items.begin(), partition.items.end(),
+			[](const DrawItem& a, const DrawItem& b) { return a.key != b.key ? a.key < b.key : a.instance < b.instance; });
+	});
+}
+
+// Key order, ties broken by partition and position so the merge is deterministic
+inline bool recordedDrawBefore(const RecordedDraw& a, const RecordedDraw& b)
+{
+	if (a.item.key != b.item.key)
+		return a.item.key < b.item.key;
+	if (a.partition != b.partition)
+		return a.partition < b.partition;
+	return a.item.instance < b.item.instance;
+}
+
+// Concatenate the sorted partitions and merge neighbouring runs pairwise until one is left
+inline void mergeDrawPartitions(DrawLists& lists)
+{
+	lists.merged.clear();
+	lists.runStarts.clear();
+	for (int p = 0; p < lists.partitionCount; p++)
+	{
+		lists.runStarts.push_back((uint32_t)lists.merged.size());
+		for (const DrawItem& item : lists.partitions[p].items)
+			lists.merged.push_back({ item, (uint32_t)p });
+	}
+	lists.runStarts.push_back((uint32_t)lists.merged.size());
+
+	lists.mergeScratch.resize(lists.merged.size());
+	while (lists.runStarts.size() > 2)
+	{
+		std::vector<uint32_t> starts;
+		for (size_t run = 0; run + 1 < lists.runStarts.size(); run += 2)
+		{
+			uint32_t begin = lists.runStarts[run], middle = lists.runStarts[run + 1];
+			uint32_t end = run + 2 < lists.runStarts.size() ? lists.runStarts[run + 2] : middle;
+			std::merge(lists.merged.begin() + begin, lists.merged.begin() + middle, lists.merged.begin() + middle, lists.merged.begin() + end,
+				lists.mergeScratch.begin() + begin, recordedDrawBefore);
+			starts.push_back(begin);
+		}
+		starts.push_back((uint32_t)lists.merged.size());
+		lists.merged.swap(lists.mergeScratch);
+		lists.runStarts.swap(starts);
+	}
+}
+
+// Gather one piece's instances in draw order and write its commands, on a worker
+inline void encodeDrawPiece(DrawLists& lists, InstanceData* instances, uint32_t piece)
+{
+	PROFILE_ZONE("encode draws");
+	CommandArena& arena = lists.arenas[piece];
+	resetCommandArena(arena);
+	GLuint program = 0, vao = 0, texture = 0;
+	uint32_t end = lists.pieceStarts[piece + 1];
+	uint32_t first = lists.pieceStarts[piece];
+	while (first < end)
+	{
+		uint32_t last = first + 1;
+		while (last < end && sameBatch(lists.merged[first].item, lists.merged[last].item))
+			last++;
+		for (uint32_t i = first; i < last; i++)
+		{
+			const RecordedDraw& draw = lists.merged[i];
+			instances[i] = lists.partitions[draw.partition].instances[draw.item.instance];
+		}
+
+		// The first batch of a piece binds everything, the state cache drops what is already bound
+		const DrawItem& item = lists.merged[first].item;
+		const DrawMesh& mesh = *item.mesh;
+		bool pieceStart = first == lists.pieceStarts[piece];
+		if (pieceStart || item.program != program)
+			writeCommand(arena, kCommandUseProgram, program = item.program);
+		if (pieceStart || mesh.vao != vao)
+			writeCommand(arena, kCommandBindVertexArray, vao = mesh.vao);
+		if (item.texture && (pieceStart || item.texture != texture))
+			writeCommand(arena, kCommandBindTexture, texture = item.texture);
+
+		// Knives are the textured objects, lamps the untextured ones
+		DrawCommand command = { mesh.mode, mesh.indexType, mesh.indexCount, (GLsizei)(last - first), mesh.indexOffset,
+			(GLsizeiptr)(first * sizeof(InstanceData)), item.texture ? "textured batch" : "untextured batch" };
+		writeCommand(arena, kCommandDraw, command);
+		first = last;
+	}
+}
+
+// Issue one arena's commands, returns the draw calls made
+inline int replayCommands(const CommandArena& arena, GLuint instanceBuffer, GLintptr instanceBase)
+{
+	int draws = 0;
+	const uint8_t* at = arena.bytes.data();
+	const uint8_t* end = at + arena.used;
+	while (at < end)
+	{
+		DrawCommandType type = (DrawCommandType)*at++;
+		switch (type)
+		{
+		case kCommandUseProgram:
+			stateUseProgram(readCommand<GLuint>(at));
+			break;
+		case kCommandBindVertexArray:
+			stateBindVertexArray(readCommand<GLuint>(at));
+			break;
+		case kCommandBindTexture:
+			stateBindTexture(0, GL_TEXTURE_2D, readCommand<GLuint>(at));
+			break;
+		case kCommandDraw:
+		{
+			DrawCommand draw = readCommand<DrawCommand>(at);
+			PROFILE_GPU_ZONE(draw.zone);
+			bindInstanceAttributes(instanceBuffer, instanceBase + draw.instanceOffset);
+			glDrawElementsInstanced(draw.mode, draw.indexCount, draw.indexType, (GLvoid*)draw.indexOffset, draw.instanceCount);
+			draws++;
+			break;
+		}
+		}
+	}
+	return draws;
+}
+
+// Merge the recorded partitions, encode them on the pool, then upload the instances and replay on the GL thread.
+// Draw calls and submitted objects are reported in the queue's stats like flushRenderQueue does
+inline void flushDrawLists(DrawLists& lists, RenderQueue& queue, WorkStealingPool& pool)
+{
+	queue.drawCalls = 0;
+	{
+		PROFILE_ZONE("merge draws");
+		mergeDrawPartitions(lists);
+	}
+	uint32_t count = (uint32_t)lists.merged.size();
+	queue.submittedItems = (int)count;
+	lists.pieces = 0;
+	lists.commands = 0;
+	lists.commandBytes = 0;
+	if (count == 0)
+		return;
+
+	// Even cuts, each moved forward to the next batch boundary so no batch is split
+	uint32_t threads = (uint32_t)std::max(workStealingThreads(pool), 1);
+	lists.pieceStarts.assign(1, 0);
+	for (uint32_t piece = 1; piece < threads; piece++)
+	{
+		uint32_t cut = std::max((uint32_t)((uint64_t)count * piece / threads), lists.pieceStarts.back());
+		while (cut > lists.pieceStarts.back() && cut < count && sameBatch(lists.merged[cut - 1].item, lists.merged[cut].item))
+			cut++;
+		if (cut > lists.pieceStarts.back() && cut < count)
+			lists.pieceStarts.push_back(cut);
+	}
+	lists.pieceStarts.push_back(count);
+	lists.pieces = (int)lists.pieceStarts.size() - 1;
+	if (lists.arenas.size() < (size_t)lists.pieces)
+		lists.arenas.resize(lists.pieces);
+
+	InstanceData* instances = beginInstanceUpload(queue, count);
+	parallelFor(pool, (uint32_t)lists.pieces, [&lists, instances](uint32_t piece, int) { encodeDrawPiece(lists, instances, piece); });
+
+	{
+		PROFILE_ZONE("upload instances");
+		finishInstanceUpload(queue);
+	}
+	for (int piece = 0; piece < lists.pieces; piece++)
+	{
+		queue.drawCalls += replayCommands(lists.arenas[piece], queue.instanceBuffer, queue.instanceBase);
+		lists.commands += lists.arenas[piece].commands;
+		lists.commandBytes += lists.arenas[piece].used;
+	}
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Per-frame CPU and GPU timings for scripted benchmark runs
+const int kBenchmarkQueryRing = 4; // GPU queries are read back this many frames late
+
+struct FrameBenchmark
+{
+	std::vector<double> cpuMs, gpuMs, frameMs;
+
+	// Off for renderers without a GL context, gpu_ms stays empty
+	bool gpuTimers = true;
+	GLuint queries[kBenchmarkQueryRing] = {};
+	bool queryPending[kBenchmarkQueryRing] = {};
+	bool queryRecorded[kBenchmarkQueryRing] = {};
+	int frameIndex = 0;
+
+	std::chrono::steady_clock::time_point frameStart, lastFrameEnd;
+	bool hasLastFrame = false;
+
+	// Named per-run values reported next to the timings (draw calls, culled objects, ...)
+	std::vector<std::pair<std::string, double>> counters;
+
+	// Reported in place of the GL renderer and version when set
+	std::string renderer;
+};
+
+struct BenchmarkStats
+{
+	double mean = 0.0, p50 = 0.0, p95 = 0.0, p99 = 0.0, min = 0.0, max = 0.0;
+};
+
+// Camera angles (degrees) along a fixed orbit, one full turn per `turns` over the run
+inline void scriptedOrbitAngles(int frame, int frameCount, float turns, float& yaw, float& pitch)
+{
+	float t = frameCount > 0 ? (float)frame / (float)frameCount : 0.0f;
+	yaw = 360.0f * turns * t;
+	pitch = 25.0f * sinf(2.0f * 3.14159265f * t);
+}
+
+inline void setBenchmarkCounter(FrameBenchmark& bench, const std::string& name, double value)
+{
+	for (std::pair<std::string, double>& counter : bench.counters)
+	{
+		if (counter.first == name)
+		{
+			counter.second = value;
+			return;
+		}
+	}
+	bench.counters.push_back(std::make_pair(name, value));
+}
+
+inline void initBenchmark(FrameBenchmark& bench, int expectedFrames)
+{
+	if (bench.gpuTimers)
+		glGenQueries(kBenchmarkQueryRing, bench.queries);
+	bench.cpuMs.reserve(expectedFrames);
+	bench.gpuMs.reserve(expectedFrames);
+	bench.frameMs.reserve(expectedFrames);
+}
+
+// Collect the GPU time of an earlier frame, waits if it is still in flight
+inline void resolveBenchmarkQuery(FrameBenchmark& bench, int slot)
+{
+	if (!bench.queryPending[slot])
+		return;
+
+	GLuint64 elapsed = 0;
+	glGetQueryObjectui64v(bench.queries[slot], GL_QUERY_RESULT, &elapsed);
+	if (bench.queryRecorded[slot])
+		bench.gpuMs.push_back(elapsed / 1.0e6);
+	bench.queryPending[slot] = false;
+}
+
+inline void beginBenchmarkFrame(FrameBenchmark& bench)
+{
+	int slot = bench.frameIndex % kBenchmarkQueryRing;
+	resolveBenchmarkQuery(bench, slot);
+
+	bench.frameStart = std::chrono::steady_clock::now();
+	if (bench.gpuTimers)
+		glBeginQuery(GL_TIME_ELAPSED, bench.queries[slot]);
+}
+
+// Close the frame, warmup frames are timed but not recorded
+inline void endBenchmarkFrame(FrameBenchmark& bench, bool record)
+{
+	int slot = bench.frameIndex % kBenchmarkQueryRing;
+	if (bench.gpuTimers)
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		bench.queryPending[slot] = true;
+		bench.queryRecorded[slot] = record;
+	}
+
+	std::chrono::steady_clock::time_point frameEnd = std::chrono::steady_clock::now();
+	if (bench.gpuTimers)
+		glFlush();
+
+	if (record)
+	{
+		bench.cpuMs.push_back(std::chrono::duration<double, std::milli>(frameEnd - bench.frameStart).count());
+		if (bench.hasLastFrame)
+			bench.frameMs.push_back(std::chrono::duration<double, std::milli>(frameEnd - bench.lastFrameEnd).count());
+	}
+	bench.lastFrameEnd = frameEnd;
+	bench.hasLastFrame = true;
+	bench.frameIndex++;
+}
+
+// Drain the outstanding queries and release them
+inline void finishBenchmark(FrameBenchmark& bench)
+{
+	if (!bench.gpuTimers)
+		return;
+	glFinish();
+	for (int i = 0; i < kBenchmarkQueryRing; i++)
+		resolveBenchmarkQuery(bench, (bench.frameIndex + i) % kBenchmarkQueryRing);
+	glDeleteQueries(kBenchmarkQueryRing, bench.queries);
+}
+
+// Nearest-rank percentile over sorted samples
+inline double percentile(const std::vector<double>& sorted, double p)
+{
+	if (sorted.empty())
+		return 0.0;
+	size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+	return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+inline BenchmarkStats summarizeSamples(std::vector<double> samples)
+{
+	BenchmarkStats stats;
+	if (samples.empty())
+		return stats;
+
+	std::sort(samples.begin(), samples.end());
+	double total = 0.0;
+	for (double sample : samples)
+		total += sample;
+
+	stats.mean = total / samples.size();
+	stats.p50 = percentile(samples, 50.0);
+	stats.p95 = percentile(samples, 95.0);
+	stats.p99 = percentile(samples, 99.0);
+	stats.min = samples.front();
+	stats.max = samples.back();
+	return stats;
+}
+
+inline std::string jsonEscape(const char* text)
+{
+	std::string escaped;
+	for (const char* c = text ? text : ""; *c; c++)
+	{
+		if (*c == '"' || *c == '\\')
+			escaped += '\\';
+		if ((unsigned char)*c >= 0x20)
+			escaped += *c;
+	}
+	return escaped;
+}
+
+inline void writeStatsJson(FILE* out, const char* name, const BenchmarkStats& stats, bool last)
+{
+	fprintf(out, "  \"%s\": { \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"min\": %.4f, \"max\": %.4f }%s\n",
+		name, stats.mean, stats.p50, stats.p95, stats.p99, stats.min, stats.max, last ? "" : ",");
+}
+
+// Write the run summary as JSON, to stdout when no path is given
+inline bool writeBenchmarkJson(const FrameBenchmark& bench, const std::string& path, int width, int height, int warmupFrames)
+{
+	FILE* out = path.empty() ? stdout : fopen(path.c_str(), "w");
+	if (!out)
+		return false;
+
+	BenchmarkStats frameStats = summarizeSamples(bench.frameMs);
+
+	fprintf(out, "{\n");
+	bool glRenderer = bench.renderer.empty();
+	fprintf(out, "  \"renderer\": \"%s\",\n", jsonEscape(glRenderer ? (const char*)glGetString(GL_RENDERER) : bench.renderer.c_str()).c_str());
+	fprintf(out, "  \"version\": \"%s\",\n", jsonEscape(glRenderer ? (const char*)glGetString(GL_VERSION) : "").c_str());
+	fprintf(out, "  \"width\": %d,\n  \"height\": %d,\n", width, height);
+	fprintf(out, "  \"frames\": %d,\n  \"warmup\": %d,\n", (int)bench.cpuMs.size(), warmupFrames);
+	fprintf(out, "  \"fps\": %.2f,\n", frameStats.mean > 0.0 ? 1000.0 / frameStats.mean : 0.0);
+	writeStatsJson(out, "cpu_ms", summarizeSamples(bench.cpuMs), false);
+	writeStatsJson(out, "gpu_ms", summarizeSamples(bench.gpuMs), false);
+	writeStatsJson(out, "frame_ms", frameStats, bench.counters.empty());
+	if (!bench.counters.empty())
+	{
+		fprintf(out, "  \"counters\": {");
+		for (size_t i = 0; i < bench.counters.size(); i++)
+			fprintf(out, "%s \"%s\": %.6g", i ? "," : "", jsonEscape(bench.counters[i].first.c_str()).c_str(), bench.counters[i].second);
+		fprintf(out, " }\n");
+	}
+	fprintf(out, "}\n");
+
+	if (out != stdout)
+		fclose(out);
+	return true;
+}
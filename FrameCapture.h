@@ -0,0 +1,350 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "GLStateCache.h"
+#include "ThreadPool.h"
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+// Frames read back from the GPU without stalling it and encoded on worker threads.
+//
+// Each captured frame is copied into a pixel pack buffer by glReadPixels, which only queues the copy, and fenced.
+// A buffer is mapped when the ring comes round to it, `slots` frames later, or sooner once its fence has
+// signalled. By then the copy is done and the mapping does not wait. The GL thread only copies the mapping into
+// a frame buffer from a free list and queues it. Workers turn the RGBA rows into top down RGB and write a PNG or
+// raw file, or raw RGB into one stream (a pipe into an encoder such as ffmpeg) in frame order.
+// At most `maxQueued` frames wait for or are in encoding. When that many are, the GL thread waits for one to
+// finish rather than letting memory grow, and the waits are counted.
+
+const int kMaxCaptureSlots = 8;
+const int kDefaultCaptureSlots = 3;
+const int kDefaultCaptureQueue = 8;
+const GLuint64 kCaptureFenceTimeout = 1000000000; // 1 s in ns, only reached on a hung GPU
+
+enum CaptureOutput
+{
+	kCapturePng, // one file per frame
+	kCaptureRaw, // one file per frame, RGB rows top down
+	kCaptureStream // RGB rows top down, every frame into one pipe
+};
+
+// Pack buffer of the ring and the frame being copied into it
+struct CaptureSlot
+{
+	GLuint pbo = 0;
+	GLsync fence = 0;
+	size_t capacity = 0;
+	int width = 0, height = 0;
+	std::string path;
+	uint64_t frame = 0;
+	std::chrono::steady_clock::time_point issued;
+	bool pending = false;
+};
+
+// Frame on its way through the encoders, RGBA rows bottom up as GL reads them
+struct CapturedFrame
+{
+	std::vector<uint8_t> pixels;
+	int width = 0, height = 0;
+	std::string path;
+	uint64_t frame = 0;
+};
+
+struct FrameCapture
+{
+	CaptureSlot slots[kMaxCaptureSlots];
+	int slotCount = kDefaultCaptureSlots, next = 0;
+	uint64_t frames = 0; // issued
+	CaptureOutput output = kCapturePng;
+	FILE* stream = nullptr;
+
+	ThreadPool encoders;
+	int encoderCount = 0, maxQueued = kDefaultCaptureQueue;
+
+	// Shared with the encoders
+	std::mutex mutex;
+	std::condition_variable finished;
+	int queued = 0;
+	std::vector<std::vector<uint8_t>> freeBuffers;
+	uint64_t nextStreamFrame = 0; // frames go into the stream in order
+
+	// Stats: readback latency from the copy being queued to the pixels in memory, GL thread waits on a copy
+	// or on the encoders, and the encoders' work
+	std::vector<double> readbackMs;
+	int readbackStalls = 0, backpressureWaits = 0;
+	double backpressureMs = 0.0;
+	int encoded = 0, failures = 0;
+	uint64_t encodedBytes = 0;
+	double encodeMs = 0.0; // summed over the encoders
+	std::chrono::steady_clock::time_point start, end;
+};
+
+// Output type from a file pattern: PNG for .png, raw RGB otherwise
+inline CaptureOutput captureOutputForPath(const std::string& pattern)
+{
+	return pattern.size() > 4 && pattern.compare(pattern.size() - 4, 4, ".png") == 0 ? kCapturePng : kCaptureRaw;
+}
+
+// File of one frame: the run of # in the pattern replaced by the zero padded frame number,
+// or five digits before the extension when there is none
+inline std::string captureFramePath(const std::string& pattern, uint64_t frame)
+{
+	size_t first = pattern.find('#');
+	size_t count = 5;
+	std::string path = pattern;
+	if (first == std::string::npos)
+	{
+		size_t slash = pattern.find_last_of("/\\");
+		size_t dot = pattern.find_last_of('.');
+		first = dot != std::string::npos && (slash == std::string::npos || dot > slash) ? dot : pattern.size();
+		path.insert(first, count, '#');
+	}
+	else
+		count = pattern.find_first_not_of('#', first) == std::string::npos ? pattern.size() - first : pattern.find_first_not_of('#', first) - first;
+	std::string digits = std::to_string(frame);
+	if (digits.size() < count)
+		digits.insert(0, count - digits.size(), '0');
+	return path.replace(first, count, digits);
+}
+
+// Start the encoders. A non-empty `streamCommand` is run with its standard input receiving every frame
+inline bool initFrameCapture(FrameCapture& capture, CaptureOutput output, int slots = kDefaultCaptureSlots,
+	int encoders = defaultWorkerCount(), int maxQueued = kDefaultCaptureQueue, const std::string& streamCommand = std::string())
+{
+	capture.slotCount = std::max(1, std::min(slots, kMaxCaptureSlots));
+	capture.output = output;
+	capture.encoderCount = std::max(encoders, 1);
+	capture.maxQueued = std::max(maxQueued, 1);
+	if (output == kCaptureStream)
+	{
+		capture.stream = popen(streamCommand.c_str(), "w");
+		if (!capture.stream)
+			return false;
+#ifndef _WIN32
+		// A command that exits early fails the writes instead of ending the process
+		signal(SIGPIPE, SIG_IGN);
+#endif
+	}
+	startThreadPool(capture.encoders, capture.encoderCount);
+	capture.start = std::chrono::steady_clock::now();
+	return true;
+}
+
+// Worker: RGBA bottom up into RGB top down, in place, then out to the file or stream
+inline void encodeCapturedFrame(FrameCapture& capture, CapturedFrame& frame)
+{
+	std::chrono::steady_clock::time_point encodeStart = std::chrono::steady_clock::now();
+	std::vector<uint8_t>& pixels = frame.pixels;
+	size_t rowBytes = (size_t)frame.width * 4;
+	size_t bytes = (size_t)frame.width * frame.height * 3;
+	bool mapped = !pixels.empty(); // a failed mapping leaves nothing to write
+	if (mapped)
+	{
+		std::vector<uint8_t> row(rowBytes);
+		for (int y = 0; y < frame.height / 2; y++)
+		{
+			uint8_t* top = &pixels[y * rowBytes];
+			uint8_t* bottom = &pixels[(frame.height - 1 - y) * rowBytes];
+			memcpy(row.data(), top, rowBytes);
+			memcpy(top, bottom, rowBytes);
+			memcpy(bottom, row.data(), rowBytes);
+		}
+		for (size_t i = 0; i < bytes / 3; i++)
+		{
+			pixels[i * 3] = pixels[i * 4];
+			pixels[i * 3 + 1] = pixels[i * 4 + 1];
+			pixels[i * 3 + 2] = pixels[i * 4 + 2];
+		}
+	}
+
+	bool written = false;
+	if (capture.output == kCapturePng)
+		written = mapped && SOIL_save_image(frame.path.c_str(), SOIL_SAVE_TYPE_PNG, frame.width, frame.height, 3, pixels.data()) != 0;
+	else if (capture.output == kCaptureRaw && mapped)
+	{
+		FILE* file = fopen(frame.path.c_str(), "wb");
+		written = file && fwrite(pixels.data(), 1, bytes, file) == bytes;
+		written = file && fclose(file) == 0 && written;
+	}
+	else if (capture.output == kCaptureStream)
+	{
+		// Earlier frames were handed out first, whoever holds them is about to write them.
+		// Only the frame whose turn it is writes, the lock is not held while the pipe blocks
+		{
+			std::unique_lock<std::mutex> lock(capture.mutex);
+			capture.finished.wait(lock, [&capture, &frame] { return capture.nextStreamFrame == frame.frame; });
+		}
+		written = mapped && fwrite(pixels.data(), 1, bytes, capture.stream) == bytes;
+		{
+			std::lock_guard<std::mutex> lock(capture.mutex);
+			capture.nextStreamFrame++;
+		}
+		capture.finished.notify_all();
+	}
+	double encodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - encodeStart).count();
+
+	{
+		std::lock_guard<std::mutex> lock(capture.mutex);
+		capture.encodeMs += encodeMs;
+		capture.encoded += written;
+		capture.failures += !written;
+		capture.encodedBytes += written ? bytes : 0;
+		capture.freeBuffers.push_back(std::move(pixels));
+		capture.queued--;
+	}
+	capture.finished.notify_all();
+}
+
+// GL thread: wait for a slot's copy, take its pixels out of the mapping and queue them
+inline void retireCaptureSlot(FrameCapture& capture, CaptureSlot& slot)
+{
+	if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+	{
+		glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, kCaptureFenceTimeout);
+		capture.readbackStalls++;
+	}
+	glDeleteSync(slot.fence);
+	slot.fence = 0;
+	slot.pending = false;
+
+	// Encoders full: wait for one rather than hold more than maxQueued frames in memory
+	CapturedFrame frame;
+	{
+		std::unique_lock<std::mutex> lock(capture.mutex);
+		if (capture.queued >= capture.maxQueued)
+		{
+			std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+			capture.finished.wait(lock, [&capture] { return capture.queued < capture.maxQueued; });
+			capture.backpressureWaits++;
+			capture.backpressureMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
+		}
+		capture.queued++;
+		if (!capture.freeBuffers.empty())
+		{
+			frame.pixels = std::move(capture.freeBuffers.back());
+			capture.freeBuffers.pop_back();
+		}
+	}
+
+	size_t bytes = (size_t)slot.width * slot.height * 4;
+	frame.pixels.resize(bytes);
+	stateBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)bytes, GL_MAP_READ_BIT);
+	if (mapped)
+	{
+		memcpy(frame.pixels.data(), mapped, bytes);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	else
+		frame.pixels.clear();
+	stateBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	capture.readbackMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - slot.issued).count());
+
+	frame.width = slot.width;
+	frame.height = slot.height;
+	frame.path = slot.path;
+	frame.frame = slot.frame;
+	CapturedFrame* queuedFrame = new CapturedFrame(std::move(frame));
+	submitTask(capture.encoders, [&capture, queuedFrame]
+	{
+		encodeCapturedFrame(capture, *queuedFrame);
+		delete queuedFrame;
+	});
+}
+
+// Take the frames whose copies are already done, oldest first, without waiting
+inline void pollFrameCapture(FrameCapture& capture)
+{
+	for (int i = 0; i < capture.slotCount; i++)
+	{
+		CaptureSlot& slot = capture.slots[(capture.next + i) % capture.slotCount];
+		if (!slot.pending)
+			continue;
+		if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+			break;
+		retireCaptureSlot(capture, slot);
+	}
+}
+
+// GL thread, after a frame's draws: queue a copy of the bound read framebuffer. `path` names the frame's file
+inline void captureFrame(FrameCapture& capture, int width, int height, const std::string& path)
+{
+	pollFrameCapture(capture);
+	CaptureSlot& slot = capture.slots[capture.next];
+	if (slot.pending)
+		retireCaptureSlot(capture, slot);
+
+	size_t bytes = (size_t)width * height * 4;
+	if (!slot.pbo)
+		glGenBuffers(1, &slot.pbo);
+	stateBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	if (slot.capacity < bytes)
+	{
+		glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)bytes, nullptr, GL_STREAM_READ);
+		slot.capacity = bytes;
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)0);
+	stateBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.width = width;
+	slot.height = height;
+	slot.path = path;
+	slot.frame = capture.frames++;
+	slot.issued = std::chrono::steady_clock::now();
+	slot.pending = true;
+	capture.next = (capture.next + 1) % capture.slotCount;
+}
+
+// GL thread: read back every frame still in the ring, wait for the encoders and release everything
+inline void finishFrameCapture(FrameCapture& capture)
+{
+	for (int i = 0; i < capture.slotCount; i++)
+	{
+		CaptureSlot& slot = capture.slots[(capture.next + i) % capture.slotCount];
+		if (slot.pending)
+			retireCaptureSlot(capture, slot);
+	}
+	{
+		std::unique_lock<std::mutex> lock(capture.mutex);
+		capture.finished.wait(lock, [&capture] { return capture.queued == 0; });
+	}
+	capture.end = std::chrono::steady_clock::now();
+	stopThreadPool(capture.encoders);
+	if (capture.stream)
+		pclose(capture.stream);
+	capture.stream = nullptr;
+	for (CaptureSlot& slot : capture.slots)
+	{
+		if (slot.pbo)
+		{
+			// The name can come back from glGenBuffers, the state cache must not think it is still bound
+			for (GLuint& bound : glState().buffers)
+				if (bound == slot.pbo)
+					bound = kUnknownBinding;
+			glDeleteBuffers(1, &slot.pbo);
+		}
+		slot = CaptureSlot();
+	}
+	capture.freeBuffers.clear();
+}
+
+// Frames encoded per second of capture, from the first frame to the last one written
+inline double captureEncodeFps(const FrameCapture& capture)
+{
+	double seconds = std::chrono::duration<double>(capture.end - capture.start).count();
+	return seconds > 0.0 ? capture.encoded / seconds : 0.0;
+}
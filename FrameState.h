@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+// What the simulation hands the renderer each step: a complete copy, never changed once published.
+// The simulation thread and the render thread exchange them through a triple buffer. The writer always
+// has a slot of its own to fill and the reader always keeps the one it is drawing, so neither waits for
+// the other; a reader that falls behind only skips to the newest state.
+
+const double kSimulationHz = 120.0; // fixed simulation steps per second
+
+struct FrameState
+{
+	uint64_t step = 0; // simulation steps taken
+	double time = 0.0; // simulated seconds
+	glm::vec3 cameraPosition, target, worldUp;
+	float fov = 45.0f;
+	bool ortho = false;
+	int width = 0, height = 0; // framebuffer size
+	glm::vec3 lightPosition1, lightPosition2;
+	int64_t inputNs = 0; // newest input event this state reflects, inputClockNs time, 0 before any input
+};
+
+// Time stamps of input events, compared against the swap that first shows their effect
+inline int64_t inputClockNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Take the camera of a newer state into the one a frame is being drawn with. The window size and lights
+// stay, the frame's viewport and culled objects already depend on them
+inline void latchFrameCamera(FrameState& state, const FrameState& newest)
+{
+	state.step = newest.step;
+	state.time = newest.time;
+	state.cameraPosition = newest.cameraPosition;
+	state.target = newest.target;
+	state.worldUp = newest.worldUp;
+	state.fov = newest.fov;
+	state.ortho = newest.ortho;
+	state.inputNs = newest.inputNs;
+}
+
+const uint32_t kTripleBufferFresh = 4; // set on the shared slot index while it holds an unread state
+
+// Three slots: one the writer fills, one the reader holds, and the shared one between them.
+// Publishing and acquiring are each a single atomic exchange of the shared slot's index
+template <typename T>
+struct TripleBuffer
+{
+	T slots[3];
+	int back = 0; // writer only
+	int front = 1; // reader only
+	alignas(64) std::atomic<uint32_t> middle;
+
+	TripleBuffer() : middle(2) {}
+};
+
+// Writer: the slot to fill, then publish it
+template <typename T>
+inline T& tripleBufferBack(TripleBuffer<T>& buffer)
+{
+	return buffer.slots[buffer.back];
+}
+
+// Writer: hand the filled slot to the reader, replacing a state it has not taken yet
+template <typename T>
+inline void publishTripleBuffer(TripleBuffer<T>& buffer)
+{
+	uint32_t previous = buffer.middle.exchange((uint32_t)buffer.back | kTripleBufferFresh, std::memory_order_acq_rel);
+	buffer.back = (int)(previous & 3);
+}
+
+// Reader: take the newest published state, false when nothing new arrived and the front slot is unchanged
+template <typename T>
+inline bool acquireTripleBuffer(TripleBuffer<T>& buffer)
+{
+	if (!(buffer.middle.load(std::memory_order_relaxed) & kTripleBufferFresh))
+		return false;
+	uint32_t previous = buffer.middle.exchange((uint32_t)buffer.front, std::memory_order_acq_rel);
+	buffer.front = (int)(previous & 3);
+	return true;
+}
+
+// Reader: the state it holds
+template <typename T>
+inline const T& tripleBufferFront(const TripleBuffer<T>& buffer)
+{
+	return buffer.slots[buffer.front];
+}
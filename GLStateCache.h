@@ -0,0 +1,227 @@
+#pragma once
+
+// Shadow copy of the GL binding state; render code binds through it so redundant calls never reach the driver
+
+const GLuint kUnknownBinding = 0xFFFFFFFFu;
+const int kCachedTextureUnits = 8;
+
+// Buffer targets tracked by the cache
+enum CachedBufferTarget
+{
+	kArrayBufferSlot,
+	kElementBufferSlot,
+	kUniformBufferSlot,
+	kPixelPackBufferSlot,
+	kPixelUnpackBufferSlot,
+	kCopyReadBufferSlot,
+	kCopyWriteBufferSlot,
+	kTextureBufferSlot,
+	kCachedBufferTargets
+};
+
+// Capabilities tracked by stateEnable
+const GLenum kCachedCapabilities[] = { GL_DEPTH_TEST, GL_STENCIL_TEST, GL_BLEND, GL_CULL_FACE, GL_SCISSOR_TEST };
+const int kCachedCapabilityCount = sizeof(kCachedCapabilities) / sizeof(kCachedCapabilities[0]);
+
+struct GLStateCache
+{
+	GLuint program;
+	GLuint vao;
+	GLuint activeUnit;
+	GLuint textures2D[kCachedTextureUnits];
+	GLuint texturesBuffer[kCachedTextureUnits];
+	GLuint buffers[kCachedBufferTargets];
+	int capabilities[kCachedCapabilityCount]; // -1 unknown, 0 off, 1 on
+	GLint viewport[4];
+
+	// Stencil contents only change while the stencil test is on, a clean stencil needs no clear
+	bool stencilDirty;
+
+	// Calls that reached GL vs. calls dropped as redundant, this frame and in total
+	int frameIssued, frameElided;
+	long long totalIssued, totalElided;
+};
+
+// One cache per thread, a GL context is only ever current on one thread
+inline GLStateCache& glState()
+{
+	static thread_local GLStateCache cache;
+	return cache;
+}
+
+// Forget the bindings only, after code outside the cache (setup, uploads) bound things directly
+inline void invalidateGLBindings()
+{
+	GLStateCache& state = glState();
+	state.program = kUnknownBinding;
+	state.vao = kUnknownBinding;
+	state.activeUnit = kUnknownBinding;
+	for (int i = 0; i < kCachedTextureUnits; i++)
+		state.textures2D[i] = state.texturesBuffer[i] = kUnknownBinding;
+	for (int i = 0; i < kCachedBufferTargets; i++)
+		state.buffers[i] = kUnknownBinding;
+}
+
+// Forget everything, the next call of each kind is always issued
+inline void resetGLStateCache()
+{
+	GLStateCache& state = glState();
+	invalidateGLBindings();
+	for (int i = 0; i < kCachedCapabilityCount; i++)
+		state.capabilities[i] = -1;
+	state.viewport[0] = state.viewport[1] = -1;
+	state.viewport[2] = state.viewport[3] = -1;
+	state.stencilDirty = true;
+	state.frameIssued = state.frameElided = 0;
+	state.totalIssued = state.totalElided = 0;
+}
+
+inline void beginGLStateFrame()
+{
+	glState().frameIssued = 0;
+	glState().frameElided = 0;
+}
+
+// Count a call and report whether it has to be issued
+inline bool stateChanged(bool changed)
+{
+	GLStateCache& state = glState();
+	if (changed)
+	{
+		state.frameIssued++;
+		state.totalIssued++;
+	}
+	else
+	{
+		state.frameElided++;
+		state.totalElided++;
+	}
+	return changed;
+}
+
+inline int bufferSlot(GLenum target)
+{
+	switch (target)
+	{
+	case GL_ARRAY_BUFFER: return kArrayBufferSlot;
+	case GL_ELEMENT_ARRAY_BUFFER: return kElementBufferSlot;
+	case GL_UNIFORM_BUFFER: return kUniformBufferSlot;
+	case GL_PIXEL_PACK_BUFFER: return kPixelPackBufferSlot;
+	case GL_PIXEL_UNPACK_BUFFER: return kPixelUnpackBufferSlot;
+	case GL_COPY_READ_BUFFER: return kCopyReadBufferSlot;
+	case GL_COPY_WRITE_BUFFER: return kCopyWriteBufferSlot;
+	case GL_TEXTURE_BUFFER: return kTextureBufferSlot;
+	default: return -1;
+	}
+}
+
+inline void stateUseProgram(GLuint program)
+{
+	if (stateChanged(glState().program != program))
+		glUseProgram(glState().program = program);
+}
+
+inline void stateBindVertexArray(GLuint vao)
+{
+	GLStateCache& state = glState();
+	if (stateChanged(state.vao != vao))
+	{
+		glBindVertexArray(state.vao = vao);
+
+		// The element buffer binding belongs to the VAO
+		state.buffers[kElementBufferSlot] = kUnknownBinding;
+	}
+}
+
+inline void stateBindBuffer(GLenum target, GLuint buffer)
+{
+	int slot = bufferSlot(target);
+	if (slot < 0)
+	{
+		stateChanged(true);
+		glBindBuffer(target, buffer);
+		return;
+	}
+	if (stateChanged(glState().buffers[slot] != buffer))
+		glBindBuffer(target, glState().buffers[slot] = buffer);
+}
+
+inline void stateActiveTexture(GLuint unit)
+{
+	if (stateChanged(glState().activeUnit != unit))
+		glActiveTexture(GL_TEXTURE0 + (glState().activeUnit = unit));
+}
+
+inline void stateBindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+	GLStateCache& state = glState();
+	GLuint* bound = unit < (GLuint)kCachedTextureUnits ?
+		(target == GL_TEXTURE_BUFFER ? &state.texturesBuffer[unit] : target == GL_TEXTURE_2D ? &state.textures2D[unit] : nullptr) : nullptr;
+	if (bound && !stateChanged(*bound != texture))
+		return;
+	if (!bound)
+		stateChanged(true);
+
+	stateActiveTexture(unit);
+	glBindTexture(target, texture);
+	if (bound)
+		*bound = texture;
+}
+
+inline int capabilitySlot(GLenum capability)
+{
+	for (int i = 0; i < kCachedCapabilityCount; i++)
+		if (kCachedCapabilities[i] == capability)
+			return i;
+	return -1;
+}
+
+inline void stateEnable(GLenum capability, bool enabled)
+{
+	GLStateCache& state = glState();
+	int slot = capabilitySlot(capability);
+	if (slot >= 0 && !stateChanged(state.capabilities[slot] != (enabled ? 1 : 0)))
+		return;
+	if (slot < 0)
+		stateChanged(true);
+	else
+		state.capabilities[slot] = enabled ? 1 : 0;
+
+	if (enabled)
+		glEnable(capability);
+	else
+		glDisable(capability);
+	if (capability == GL_STENCIL_TEST && enabled)
+		state.stencilDirty = true;
+}
+
+inline void stateViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	GLint* viewport = glState().viewport;
+	if (stateChanged(viewport[0] != x || viewport[1] != y || viewport[2] != width || viewport[3] != height))
+	{
+		viewport[0] = x; viewport[1] = y; viewport[2] = width; viewport[3] = height;
+		glViewport(x, y, width, height);
+	}
+}
+
+// Clear, dropping the stencil bit while the stencil buffer is known to be clean
+inline void stateClear(GLbitfield mask)
+{
+	GLStateCache& state = glState();
+	bool stencilTest = state.capabilities[capabilitySlot(GL_STENCIL_TEST)] != 0;
+	if ((mask & GL_STENCIL_BUFFER_BIT) && !state.stencilDirty && !stencilTest)
+	{
+		mask &= ~GL_STENCIL_BUFFER_BIT;
+		if (mask == 0)
+		{
+			stateChanged(false);
+			return;
+		}
+	}
+
+	stateChanged(true);
+	glClear(mask);
+	if (mask & GL_STENCIL_BUFFER_BIT)
+		state.stencilDirty = stencilTest;
+}
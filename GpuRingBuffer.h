@@ -0,0 +1,211 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "GLStateCache.h"
+
+// Per-frame dynamic GPU data (frame uniforms, instance transforms) sub-allocated from one buffer that stays
+// mapped for the whole run (glBufferStorage, persistent and coherent). The buffer is split into one region per
+// frame in flight. A frame allocates linearly from its region and the region is fenced after the frame's draws;
+// the next frame to use it waits on that fence first, which is also what keeps the CPU at most `regions` frames ahead.
+// Writing a frame's data is a memcpy, with no driver call per object.
+//
+// A frame that outgrows its region moves to a buffer twice the size. The old buffer stays alive until the GPU has
+// finished the frames that used it. Without GL 4.4 buffer storage the regions are written in system memory and
+// copied in with one glBufferSubData before the draws.
+
+const int kMaxGpuRingRegions = 3; // frames in flight at most
+const int kDefaultGpuRingRegions = 2;
+const size_t kDefaultGpuRingRegionBytes = 1 << 20;
+const GLuint64 kGpuRingFenceTimeout = 1000000000; // 1 s in ns, only reached on a hung GPU
+
+// Buffer replaced by a larger one, deleted once `frame` is known to be finished
+struct RetiredGpuBuffer
+{
+	GLuint buffer;
+	uint64_t frame;
+};
+
+struct GpuRingBuffer
+{
+	GLuint buffer = 0;
+	uint8_t* mapped = nullptr; // persistent mapping, null when the fallback below is used
+	std::vector<uint8_t> shadow; // fallback: system memory copy of the buffer
+	bool persistent = false;
+	size_t regionBytes = 0;
+	size_t uniformAlignment = 256; // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, queried once: a glGet can stall a threaded driver
+	int regions = 1, region = 0;
+	size_t used = 0, flushed = 0; // bytes allocated and bytes copied in, this frame's region
+	size_t frameBytes = 0; // allocated this frame, across a move to a larger buffer
+	GLsync fences[kMaxGpuRingRegions] = {};
+	uint64_t frame = 0;
+	std::vector<RetiredGpuBuffer> retired;
+
+	// Stats over the run: bytes written, the largest frame, waits on the GPU and region growth
+	uint64_t totalBytes = 0;
+	size_t maxFrameBytes = 0;
+	int frames = 0, fenceWaits = 0, grows = 0;
+	double fenceWaitMs = 0.0;
+};
+
+inline void createGpuRingStorage(GpuRingBuffer& ring)
+{
+	size_t size = ring.regionBytes * ring.regions;
+	glGenBuffers(1, &ring.buffer);
+	stateBindBuffer(GL_COPY_WRITE_BUFFER, ring.buffer);
+	if (ring.persistent)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, (GLsizeiptr)size, nullptr, flags);
+		ring.mapped = (uint8_t*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, (GLsizeiptr)size, flags);
+	}
+	else
+	{
+		glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)size, nullptr, GL_DYNAMIC_DRAW);
+		ring.shadow.assign(size, 0);
+		ring.mapped = nullptr;
+	}
+}
+
+inline void initGpuRingBuffer(GpuRingBuffer& ring, int regions, size_t regionBytes = kDefaultGpuRingRegionBytes)
+{
+	ring = GpuRingBuffer();
+	ring.regions = std::max(1, std::min(regions, kMaxGpuRingRegions));
+	ring.regionBytes = regionBytes;
+	ring.persistent = GLEW_ARB_buffer_storage != 0;
+	GLint alignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	if (alignment > 0)
+		ring.uniformAlignment = (size_t)alignment;
+	createGpuRingStorage(ring);
+}
+
+inline uint8_t* gpuRingMemory(GpuRingBuffer& ring)
+{
+	return ring.persistent ? ring.mapped : ring.shadow.data();
+}
+
+// Start of a frame: wait until the GPU is done with the frame that last used this region
+inline void beginGpuRingFrame(GpuRingBuffer& ring)
+{
+	GLsync& fence = ring.fences[ring.region];
+	if (fence)
+	{
+		if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+		{
+			std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+			glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, kGpuRingFenceTimeout);
+			ring.fenceWaits++;
+			ring.fenceWaitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
+		}
+		glDeleteSync(fence);
+		fence = 0;
+	}
+
+	// Frames up to frame - regions are finished now
+	for (size_t i = 0; i < ring.retired.size();)
+	{
+		if (ring.retired[i].frame + ring.regions <= ring.frame)
+		{
+			// The name can come back from glGenBuffers, the state cache must not think it is still bound
+			for (GLuint& bound : glState().buffers)
+				if (bound == ring.retired[i].buffer)
+					bound = kUnknownBinding;
+			glDeleteBuffers(1, &ring.retired[i].buffer);
+			ring.retired[i] = ring.retired.back();
+			ring.retired.pop_back();
+		}
+		else
+			i++;
+	}
+	ring.used = 0;
+	ring.flushed = 0;
+	ring.frameBytes = 0;
+}
+
+// Before the draws that read this frame's data: nothing to do with a coherent mapping,
+// the written range is copied in otherwise
+inline void flushGpuRing(GpuRingBuffer& ring)
+{
+	if (ring.persistent || ring.used == ring.flushed)
+		return;
+	size_t base = ring.regionBytes * ring.region;
+	stateBindBuffer(GL_COPY_WRITE_BUFFER, ring.buffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)(base + ring.flushed), (GLsizeiptr)(ring.used - ring.flushed), ring.shadow.data() + base + ring.flushed);
+	ring.flushed = ring.used;
+}
+
+// Move to a buffer with regions of at least `bytes`, the current one is retired with this frame
+inline void growGpuRingBuffer(GpuRingBuffer& ring, size_t bytes)
+{
+	flushGpuRing(ring);
+	if (ring.persistent)
+	{
+		stateBindBuffer(GL_COPY_WRITE_BUFFER, ring.buffer);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+	}
+	ring.retired.push_back({ ring.buffer, ring.frame });
+	while (ring.regionBytes < bytes)
+		ring.regionBytes *= 2;
+	createGpuRingStorage(ring);
+	ring.used = 0;
+	ring.flushed = 0;
+	ring.grows++;
+}
+
+// Aligned space in this frame's region, the buffer and offset to bind and the memory to write.
+// Everything allocated earlier in a frame stays where it is, a frame that runs out moves only what follows
+struct GpuAllocation
+{
+	GLuint buffer;
+	GLintptr offset;
+	uint8_t* data;
+};
+
+inline GpuAllocation allocateGpuRing(GpuRingBuffer& ring, size_t bytes, size_t alignment)
+{
+	size_t start = (ring.used + alignment - 1) / alignment * alignment;
+	if (start + bytes > ring.regionBytes)
+	{
+		growGpuRingBuffer(ring, bytes + alignment);
+		start = 0;
+	}
+	ring.used = start + bytes;
+	ring.frameBytes += bytes;
+	GLintptr offset = (GLintptr)(ring.regionBytes * ring.region + start);
+	return { ring.buffer, offset, gpuRingMemory(ring) + offset };
+}
+
+// End of a frame, after its last draw: fence the region and move to the next one
+inline void endGpuRingFrame(GpuRingBuffer& ring)
+{
+	ring.fences[ring.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	ring.region = (ring.region + 1) % ring.regions;
+	ring.totalBytes += ring.frameBytes;
+	ring.maxFrameBytes = std::max(ring.maxFrameBytes, ring.frameBytes);
+	ring.frames++;
+	ring.frame++;
+}
+
+inline void releaseGpuRingBuffer(GpuRingBuffer& ring)
+{
+	for (GLsync& fence : ring.fences)
+	{
+		if (fence)
+			glDeleteSync(fence);
+		fence = 0;
+	}
+	for (RetiredGpuBuffer& retired : ring.retired)
+		glDeleteBuffers(1, &retired.buffer);
+	if (ring.persistent && ring.buffer)
+	{
+		stateBindBuffer(GL_COPY_WRITE_BUFFER, ring.buffer);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+	}
+	glDeleteBuffers(1, &ring.buffer);
+	ring = GpuRingBuffer();
+}
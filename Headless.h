@@ -0,0 +1,113 @@
+#pragma once
+
+// Offscreen rendering for hosts without a display (EGL surfaceless on Mesa)
+#ifndef _WIN32
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+struct HeadlessContext
+{
+#ifndef _WIN32
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+#endif
+	GLuint fbo = 0, colorRbo = 0, depthRbo = 0;
+	int width = 0, height = 0;
+};
+
+#ifndef _WIN32
+// Create a GL context with no window surface and make it current
+inline bool createHeadlessContext(HeadlessContext& headless, EGLContext shareContext = EGL_NO_CONTEXT)
+{
+	// Prefer Mesa's surfaceless platform, fall back to the default display
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay)
+		headless.display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	if (headless.display == EGL_NO_DISPLAY)
+		headless.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (headless.display == EGL_NO_DISPLAY || !eglInitialize(headless.display, nullptr, nullptr))
+		return false;
+
+	if (!eglBindAPI(EGL_OPENGL_API))
+		return false;
+
+	// Any GL capable config will do, the framebuffer is our own FBO
+	EGLint configAttribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	EGLConfig config = EGL_NO_CONFIG_KHR;
+	EGLint configCount = 0;
+	if (!eglChooseConfig(headless.display, configAttribs, &config, 1, &configCount) || configCount == 0)
+		config = EGL_NO_CONFIG_KHR;
+
+	// Compatibility profile so GL_QUADS keeps working
+	EGLint contextAttribs[] =
+	{
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+		EGL_NONE
+	};
+	headless.context = eglCreateContext(headless.display, config, shareContext, contextAttribs);
+	if (headless.context == EGL_NO_CONTEXT)
+		return false;
+
+	return eglMakeCurrent(headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, headless.context) == EGL_TRUE;
+}
+#else
+inline bool createHeadlessContext(HeadlessContext& headless)
+{
+	// EGL is not available here, headless mode needs a Linux/Mesa host
+	return false;
+}
+#endif
+
+// Create and bind a color + depth/stencil framebuffer to render into
+inline bool createOffscreenTarget(HeadlessContext& headless, int width, int height)
+{
+	headless.width = width;
+	headless.height = height;
+
+	glGenRenderbuffers(1, &headless.colorRbo);
+	glBindRenderbuffer(GL_RENDERBUFFER, headless.colorRbo);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+	glGenRenderbuffers(1, &headless.depthRbo);
+	glBindRenderbuffer(GL_RENDERBUFFER, headless.depthRbo);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &headless.fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, headless.fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, headless.colorRbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, headless.depthRbo);
+
+	return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+// Delete the framebuffer, e.g. before creating one of another size
+inline void destroyOffscreenTarget(HeadlessContext& headless)
+{
+	if (headless.fbo)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &headless.fbo);
+		glDeleteRenderbuffers(1, &headless.colorRbo);
+		glDeleteRenderbuffers(1, &headless.depthRbo);
+		headless.fbo = headless.colorRbo = headless.depthRbo = 0;
+	}
+	headless.width = headless.height = 0;
+}
+
+inline void destroyHeadlessContext(HeadlessContext& headless)
+{
+	destroyOffscreenTarget(headless);
+#ifndef _WIN32
+	if (headless.context != EGL_NO_CONTEXT)
+	{
+		eglMakeCurrent(headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext(headless.display, headless.context);
+		headless.context = EGL_NO_CONTEXT;
+	}
+#endif
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Bounded multi-producer multi-consumer queue without locks (Vyukov's sequence numbered ring).
+// Every cell carries a sequence number that tells producers and consumers whose turn it is, so a
+// push or pop is one compare-and-swap on the shared position plus plain stores to the cell.
+
+template <typename T>
+struct LockFreeQueue
+{
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	std::vector<Cell> cells;
+	size_t mask = 0;
+	alignas(64) std::atomic<size_t> enqueuePosition;
+	alignas(64) std::atomic<size_t> dequeuePosition;
+};
+
+// Capacity is rounded up to a power of two, the queue must be empty and unused by other threads
+template <typename T>
+inline void initLockFreeQueue(LockFreeQueue<T>& queue, size_t capacity)
+{
+	size_t size = 2;
+	while (size < capacity)
+		size *= 2;
+	queue.cells = std::vector<typename LockFreeQueue<T>::Cell>(size);
+	for (size_t i = 0; i < size; i++)
+		queue.cells[i].sequence.store(i, std::memory_order_relaxed);
+	queue.mask = size - 1;
+	queue.enqueuePosition.store(0, std::memory_order_relaxed);
+	queue.dequeuePosition.store(0, std::memory_order_relaxed);
+}
+
+// False when the queue is full
+template <typename T>
+inline bool tryPush(LockFreeQueue<T>& queue, const T& value)
+{
+	size_t position = queue.enqueuePosition.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		typename LockFreeQueue<T>::Cell& cell = queue.cells[position & queue.mask];
+		size_t sequence = cell.sequence.load(std::memory_order_acquire);
+		ptrdiff_t difference = (ptrdiff_t)sequence - (ptrdiff_t)position;
+		if (difference == 0)
+		{
+			if (queue.enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				cell.value = value;
+				cell.sequence.store(position + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if (difference < 0)
+			return false;
+		else
+			position = queue.enqueuePosition.load(std::memory_order_relaxed);
+	}
+}
+
+// False when the queue is empty
+template <typename T>
+inline bool tryPop(LockFreeQueue<T>& queue, T& value)
+{
+	size_t position = queue.dequeuePosition.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		typename LockFreeQueue<T>::Cell& cell = queue.cells[position & queue.mask];
+		size_t sequence = cell.sequence.load(std::memory_order_acquire);
+		ptrdiff_t difference = (ptrdiff_t)sequence - (ptrdiff_t)(position + 1);
+		if (difference == 0)
+		{
+			if (queue.dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				value = cell.value;
+				cell.sequence.store(position + queue.mask + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if (difference < 0)
+			return false;
+		else
+			position = queue.dequeuePosition.load(std::memory_order_relaxed);
+	}
+}
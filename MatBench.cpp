@@ -0,0 +1,185 @@
+// Microbenchmark of the batched matrix kernels in SimdMat4.h against glm, one object at a time
+//
+//     MatBench [--instances N] [--runs R]
+//
+// Builds N random transforms (100000 by default) with rotations and uneven scales, then times each kernel on
+// every path the CPU can run and the glm code the viewer used before: translate/rotate/scale, the matrix product,
+// transpose(inverse(mat3)) and transformAabb per object. Prints the best of R runs and the largest difference
+// from glm's results.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "SimdMat4.h"
+
+using namespace std;
+
+const int kDefaultInstances = 100000;
+const int kDefaultRuns = 20;
+
+// Random instances, as TRS arrays for the kernels and axis/angle for glm
+struct BenchInstances
+{
+	vector<float> components[10]; // translation xyz, rotation xyzw, scale xyz
+	vector<glm::vec3> axes;
+	vector<float> angles;
+	vector<Aabb> local;
+	TrsArrays trs;
+};
+
+static void makeInstances(BenchInstances& bench, int count)
+{
+	mt19937 random(1234);
+	uniform_real_distribution<float> position(-100.0f, 100.0f), unit(-1.0f, 1.0f), angle(0.0f, 6.2831853f), scale(0.5f, 2.0f);
+	for (vector<float>& component : bench.components)
+		component.resize(count);
+	bench.axes.resize(count);
+	bench.angles.resize(count);
+	bench.local.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		glm::vec3 axis;
+		do
+			axis = glm::vec3(unit(random), unit(random), unit(random));
+		while (glm::length(axis) < 0.1f);
+		axis = glm::normalize(axis);
+		bench.axes[i] = axis;
+		bench.angles[i] = angle(random);
+		float s = sin(bench.angles[i] * 0.5f);
+		float values[10] = { position(random), position(random), position(random), axis.x * s, axis.y * s, axis.z * s,
+			cos(bench.angles[i] * 0.5f), scale(random), scale(random), scale(random) };
+		for (int c = 0; c < 10; c++)
+			bench.components[c][i] = values[c];
+		glm::vec3 corner(unit(random), unit(random), unit(random));
+		bench.local[i] = { -glm::abs(corner), glm::abs(corner) + glm::vec3(0.1f) };
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		bench.trs.translation[c] = bench.components[c].data();
+		bench.trs.scale[c] = bench.components[7 + c].data();
+	}
+	for (int c = 0; c < 4; c++)
+		bench.trs.rotation[c] = bench.components[3 + c].data();
+}
+
+// Best time of the runs in milliseconds
+static double timeRuns(int runs, const function<void()>& body)
+{
+	double best = INFINITY;
+	for (int run = 0; run < runs; run++)
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		body();
+		best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+	}
+	return best;
+}
+
+static float maxDifference(const float* a, const float* b, size_t count)
+{
+	float worst = 0.0f;
+	for (size_t i = 0; i < count; i++)
+		worst = max(worst, fabs(a[i] - b[i]));
+	return worst;
+}
+
+static void printRow(const char* kernel, const char* path, double ms, double glmMs, int count, float error)
+{
+	printf("%-10s %-7s %9.3f ms %8.2f ns %7.2fx  max diff %g\n", kernel, path, ms, ms * 1e6 / count, glmMs / ms, error);
+}
+
+int main(int argc, char* argv[])
+{
+	int count = kDefaultInstances, runs = kDefaultRuns;
+	bool valid = true;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--instances" && i + 1 < argc)
+			count = atoi(argv[++i]);
+		else if (arg == "--runs" && i + 1 < argc)
+			runs = atoi(argv[++i]);
+		else
+			valid = false;
+	}
+	if (!valid || count <= 0 || runs <= 0)
+	{
+		cout << "Usage: MatBench [--instances N] [--runs R]" << endl;
+		return -1;
+	}
+
+	BenchInstances bench;
+	makeInstances(bench, count);
+	glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 1000.0f)
+		* glm::lookAt(glm::vec3(0.0f, 50.0f, 150.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	vector<glm::mat4> glmWorld(count), glmClip(count), world(count), clip(count);
+	vector<glm::mat3> glmNormal(count), normal(count);
+	vector<Aabb> glmBounds(count), bounds(count);
+	MatrixPath widest = detectMatrixPath();
+	cout << count << " instances, best of " << runs << " runs, widest path " << matrixPathName(widest) << endl;
+
+	//glm one object at a time, the reference for the differences
+	double composeGlm = timeRuns(runs, [&]() {
+		for (int i = 0; i < count; i++)
+		{
+			glm::mat4 m = glm::translate(glm::mat4(), glm::vec3(bench.components[0][i], bench.components[1][i], bench.components[2][i]));
+			m = glm::rotate(m, bench.angles[i], bench.axes[i]);
+			glmWorld[i] = glm::scale(m, glm::vec3(bench.components[7][i], bench.components[8][i], bench.components[9][i]));
+		}
+	});
+	double multiplyGlm = timeRuns(runs, [&]() {
+		for (int i = 0; i < count; i++)
+			glmClip[i] = viewProjection * glmWorld[i];
+	});
+	double normalGlm = timeRuns(runs, [&]() {
+		for (int i = 0; i < count; i++)
+			glmNormal[i] = glm::transpose(glm::inverse(glm::mat3(glmWorld[i])));
+	});
+	double boundsGlm = timeRuns(runs, [&]() {
+		for (int i = 0; i < count; i++)
+			glmBounds[i] = transformAabb(bench.local[i], glmWorld[i]);
+	});
+
+	printf("%-10s %-7s %9.3f ms %8.2f ns\n", "compose", "glm", composeGlm, composeGlm * 1e6 / count);
+	for (int path = kMatrixScalar; path <= widest; path++)
+	{
+		setMatrixPath((MatrixPath)path);
+		double ms = timeRuns(runs, [&]() { composeTransforms(bench.trs, count, world.data()); });
+		printRow("compose", matrixPathName((MatrixPath)path), ms, composeGlm, count, maxDifference(&world[0][0][0], &glmWorld[0][0][0], count * 16));
+	}
+
+	//The rest start from glm's world matrices so only their own differences show
+	printf("%-10s %-7s %9.3f ms %8.2f ns\n", "multiply", "glm", multiplyGlm, multiplyGlm * 1e6 / count);
+	for (int path = kMatrixScalar; path <= widest; path++)
+	{
+		setMatrixPath((MatrixPath)path);
+		double ms = timeRuns(runs, [&]() { multiplyTransforms(viewProjection, glmWorld.data(), count, clip.data()); });
+		printRow("multiply", matrixPathName((MatrixPath)path), ms, multiplyGlm, count, maxDifference(&clip[0][0][0], &glmClip[0][0][0], count * 16));
+	}
+	printf("%-10s %-7s %9.3f ms %8.2f ns\n", "normal", "glm", normalGlm, normalGlm * 1e6 / count);
+	for (int path = kMatrixScalar; path <= widest; path++)
+	{
+		setMatrixPath((MatrixPath)path);
+		double ms = timeRuns(runs, [&]() { normalMatrices(glmWorld.data(), count, normal.data()); });
+		printRow("normal", matrixPathName((MatrixPath)path), ms, normalGlm, count, maxDifference(&normal[0][0][0], &glmNormal[0][0][0], count * 9));
+	}
+	printf("%-10s %-7s %9.3f ms %8.2f ns\n", "bounds", "glm", boundsGlm, boundsGlm * 1e6 / count);
+	for (int path = kMatrixScalar; path <= widest; path++)
+	{
+		setMatrixPath((MatrixPath)path);
+		double ms = timeRuns(runs, [&]() { transformAabbs(bench.local.data(), glmWorld.data(), count, bounds.data()); });
+		printRow("bounds", matrixPathName((MatrixPath)path), ms, boundsGlm, count, maxDifference(&bounds[0].min.x, &glmBounds[0].min.x, count * 6));
+	}
+	return 0;
+}
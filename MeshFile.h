@@ -0,0 +1,329 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Binary mesh container, memory mapped so the vertex and index blocks go to GL without parsing or copies.
+// Layout: header, attribute table, submesh table, vertex block, index block. Blocks start 16-byte aligned, values are little endian.
+
+const uint32_t kMeshFileMagic = 0x4D535352u; // "RSSM"
+const uint32_t kMeshFileVersion = 1;
+const uint32_t kMeshMaxAttributes = 8;
+const uint32_t kMeshBlockAlignment = 16;
+const uint32_t kMeshMaxLocation = 4; // attribute locations from here up hold the per-instance model matrix
+
+// Attribute component encodings
+enum MeshComponentType : uint32_t
+{
+	kMeshFloat32 = 0
+};
+
+enum MeshPrimitive : uint32_t
+{
+	kMeshTriangles = 0,
+	kMeshQuads = 1
+};
+
+struct MeshAttribute
+{
+	uint32_t location; // shader attribute location
+	uint32_t components;
+	uint32_t type; // MeshComponentType
+	uint32_t offset; // bytes into the vertex
+};
+
+// Index range drawn as one unit, with its object space bounds
+struct MeshSubmesh
+{
+	uint32_t firstIndex, indexCount;
+	float boundsMin[3], boundsMax[3];
+};
+
+struct MeshFileHeader
+{
+	uint32_t magic, version;
+	uint32_t primitive; // MeshPrimitive
+	uint32_t vertexCount, vertexStride;
+	uint32_t indexCount, indexSize; // 1, 2 or 4 bytes per index
+	uint32_t attributeCount, submeshCount;
+	float boundsMin[3], boundsMax[3];
+	uint32_t flags; // reserved, 0
+	uint64_t attributeOffset, submeshOffset, vertexOffset, indexOffset; // bytes from the start of the file
+};
+static_assert(sizeof(MeshFileHeader) == 96, "MeshFileHeader is written to disk as is");
+
+// Position/color/uv/normal, 11 floats per vertex as in the built-in knife
+const MeshAttribute kMeshStandardAttributes[] =
+{
+	{ 0, 3, kMeshFloat32, 0 },
+	{ 1, 3, kMeshFloat32, 3 * sizeof(float) },
+	{ 2, 2, kMeshFloat32, 6 * sizeof(float) },
+	{ 3, 3, kMeshFloat32, 8 * sizeof(float) }
+};
+const uint32_t kMeshStandardStride = 11 * sizeof(float);
+
+// Mesh being built in memory, e.g. by the converter
+struct MeshData
+{
+	uint32_t primitive = kMeshTriangles;
+	uint32_t vertexStride = kMeshStandardStride;
+	std::vector<MeshAttribute> attributes;
+	std::vector<uint8_t> vertices;
+	uint32_t indexSize = 4;
+	std::vector<uint8_t> indices;
+	std::vector<MeshSubmesh> submeshes;
+};
+
+// Read-only view of a mapped mesh file, the pointers are valid until closeMeshFile
+struct MeshFile
+{
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE, mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+
+	const MeshFileHeader* header = nullptr;
+	const MeshAttribute* attributes = nullptr;
+	const MeshSubmesh* submeshes = nullptr;
+	const void* vertices = nullptr;
+	const void* indices = nullptr;
+
+	std::string error;
+};
+
+inline uint64_t alignMeshOffset(uint64_t offset)
+{
+	return (offset + kMeshBlockAlignment - 1) & ~(uint64_t)(kMeshBlockAlignment - 1);
+}
+
+inline void closeMeshFile(MeshFile& mesh)
+{
+#ifdef _WIN32
+	if (mesh.data)
+		UnmapViewOfFile(mesh.data);
+	if (mesh.mapping)
+		CloseHandle(mesh.mapping);
+	if (mesh.file != INVALID_HANDLE_VALUE)
+		CloseHandle(mesh.file);
+	mesh.file = INVALID_HANDLE_VALUE;
+	mesh.mapping = nullptr;
+#else
+	if (mesh.data)
+		munmap((void*)mesh.data, mesh.size);
+	if (mesh.fd >= 0)
+		close(mesh.fd);
+	mesh.fd = -1;
+#endif
+	mesh.data = nullptr;
+	mesh.size = 0;
+	mesh.header = nullptr;
+	mesh.attributes = nullptr;
+	mesh.submeshes = nullptr;
+	mesh.vertices = mesh.indices = nullptr;
+}
+
+inline bool mapMeshFile(const char* path, MeshFile& mesh)
+{
+#ifdef _WIN32
+	mesh.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (mesh.file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(mesh.file, &fileSize) || fileSize.QuadPart == 0)
+		return false;
+	mesh.size = (size_t)fileSize.QuadPart;
+	mesh.mapping = CreateFileMappingA(mesh.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mesh.mapping)
+		return false;
+	mesh.data = (const uint8_t*)MapViewOfFile(mesh.mapping, FILE_MAP_READ, 0, 0, 0);
+	return mesh.data != nullptr;
+#else
+	mesh.fd = open(path, O_RDONLY);
+	if (mesh.fd < 0)
+		return false;
+	struct stat info;
+	if (fstat(mesh.fd, &info) != 0 || info.st_size == 0)
+		return false;
+	mesh.size = (size_t)info.st_size;
+	void* data = mmap(nullptr, mesh.size, PROT_READ, MAP_PRIVATE, mesh.fd, 0);
+	if (data == MAP_FAILED)
+		return false;
+	// The whole file goes to the GPU right away, read it ahead
+	madvise(data, mesh.size, MADV_SEQUENTIAL | MADV_WILLNEED);
+	mesh.data = (const uint8_t*)data;
+	return true;
+#endif
+}
+
+// Block of `bytes` at `offset` inside a file of `size` bytes, without overflowing on crafted offsets
+inline bool meshBlockInFile(uint64_t offset, uint64_t bytes, uint64_t size)
+{
+	return offset <= size && bytes <= size - offset;
+}
+
+template <typename Index>
+inline bool meshIndicesInRange(const Index* indices, uint32_t indexCount, uint32_t vertexCount)
+{
+	Index largest = 0;
+	for (uint32_t i = 0; i < indexCount; i++)
+		largest = indices[i] > largest ? indices[i] : largest;
+	return indexCount == 0 || largest < vertexCount;
+}
+
+// Every index names a vertex of the vertex block, so nothing reading the mesh can go past it
+inline bool meshIndicesInRange(const void* indices, uint32_t indexSize, uint32_t indexCount, uint32_t vertexCount)
+{
+	if (indexSize == 1)
+		return meshIndicesInRange((const uint8_t*)indices, indexCount, vertexCount);
+	if (indexSize == 2)
+		return meshIndicesInRange((const uint16_t*)indices, indexCount, vertexCount);
+	return meshIndicesInRange((const uint32_t*)indices, indexCount, vertexCount);
+}
+
+// Every attribute is one to four floats inside the vertex, at a location below the instance attributes
+inline bool meshAttributesValid(const MeshFileHeader& header, const MeshAttribute* attributes)
+{
+	if (header.vertexStride == 0 || header.vertexStride % 4 != 0)
+		return false;
+	for (uint32_t i = 0; i < header.attributeCount; i++)
+	{
+		const MeshAttribute& attribute = attributes[i];
+		if (attribute.type != kMeshFloat32 || attribute.components < 1 || attribute.components > 4 || attribute.offset % 4 != 0 ||
+			(uint64_t)attribute.offset + attribute.components * sizeof(float) > header.vertexStride || attribute.location >= kMeshMaxLocation)
+			return false;
+	}
+	return true;
+}
+
+// Map a mesh file and check that every table and block lies inside it, every attribute inside the vertex and
+// every index inside the vertex block
+inline bool openMeshFile(const char* path, MeshFile& mesh)
+{
+	if (!mapMeshFile(path, mesh))
+	{
+		closeMeshFile(mesh);
+		mesh.error = std::string("cannot map ") + path;
+		return false;
+	}
+
+	const MeshFileHeader* header = (const MeshFileHeader*)mesh.data;
+	uint64_t vertexBytes = mesh.size >= sizeof(MeshFileHeader) ? (uint64_t)header->vertexCount * header->vertexStride : 0;
+	uint64_t indexBytes = mesh.size >= sizeof(MeshFileHeader) ? (uint64_t)header->indexCount * header->indexSize : 0;
+	if (mesh.size < sizeof(MeshFileHeader) || header->magic != kMeshFileMagic)
+		mesh.error = "not a mesh file";
+	else if (header->version != kMeshFileVersion)
+		mesh.error = "unsupported mesh file version";
+	else if (header->indexSize != 1 && header->indexSize != 2 && header->indexSize != 4)
+		mesh.error = "bad index size";
+	else if (header->primitive != kMeshTriangles && header->primitive != kMeshQuads)
+		mesh.error = "bad primitive";
+	else if (header->attributeCount == 0 || header->attributeCount > kMeshMaxAttributes)
+		mesh.error = "bad attribute count";
+	else if (!meshBlockInFile(header->attributeOffset, header->attributeCount * sizeof(MeshAttribute), mesh.size) ||
+		!meshBlockInFile(header->submeshOffset, (uint64_t)header->submeshCount * sizeof(MeshSubmesh), mesh.size) ||
+		!meshBlockInFile(header->vertexOffset, vertexBytes, mesh.size) || !meshBlockInFile(header->indexOffset, indexBytes, mesh.size) ||
+		(header->attributeOffset | header->submeshOffset | header->vertexOffset | header->indexOffset) % 4 != 0)
+		mesh.error = "truncated mesh file";
+	if (!mesh.error.empty())
+	{
+		closeMeshFile(mesh);
+		return false;
+	}
+
+	mesh.header = header;
+	mesh.attributes = (const MeshAttribute*)(mesh.data + header->attributeOffset);
+	mesh.submeshes = (const MeshSubmesh*)(mesh.data + header->submeshOffset);
+	mesh.vertices = mesh.data + header->vertexOffset;
+	mesh.indices = mesh.data + header->indexOffset;
+	if (!meshAttributesValid(*header, mesh.attributes))
+	{
+		closeMeshFile(mesh);
+		mesh.error = "bad attribute layout";
+		return false;
+	}
+
+	for (uint32_t i = 0; i < header->submeshCount; i++)
+	{
+		if ((uint64_t)mesh.submeshes[i].firstIndex + mesh.submeshes[i].indexCount > header->indexCount)
+		{
+			closeMeshFile(mesh);
+			mesh.error = "submesh outside the index block";
+			return false;
+		}
+	}
+	if (!meshIndicesInRange(mesh.indices, header->indexSize, header->indexCount, header->vertexCount))
+	{
+		closeMeshFile(mesh);
+		mesh.error = "index outside the vertex block";
+		return false;
+	}
+	return true;
+}
+
+// Write an in-memory mesh, the header bounds are the union of the submesh bounds
+inline bool writeMeshFile(const char* path, const MeshData& mesh)
+{
+	MeshFileHeader header = {};
+	header.magic = kMeshFileMagic;
+	header.version = kMeshFileVersion;
+	header.primitive = mesh.primitive;
+	header.vertexStride = mesh.vertexStride;
+	header.vertexCount = mesh.vertexStride ? (uint32_t)(mesh.vertices.size() / mesh.vertexStride) : 0;
+	header.indexSize = mesh.indexSize;
+	header.indexCount = (uint32_t)(mesh.indices.size() / mesh.indexSize);
+	header.attributeCount = (uint32_t)mesh.attributes.size();
+	header.submeshCount = (uint32_t)mesh.submeshes.size();
+	for (int axis = 0; axis < 3; axis++)
+	{
+		header.boundsMin[axis] = mesh.submeshes.empty() ? 0.0f : mesh.submeshes[0].boundsMin[axis];
+		header.boundsMax[axis] = mesh.submeshes.empty() ? 0.0f : mesh.submeshes[0].boundsMax[axis];
+		for (const MeshSubmesh& submesh : mesh.submeshes)
+		{
+			header.boundsMin[axis] = submesh.boundsMin[axis] < header.boundsMin[axis] ? submesh.boundsMin[axis] : header.boundsMin[axis];
+			header.boundsMax[axis] = submesh.boundsMax[axis] > header.boundsMax[axis] ? submesh.boundsMax[axis] : header.boundsMax[axis];
+		}
+	}
+	header.attributeOffset = alignMeshOffset(sizeof(MeshFileHeader));
+	header.submeshOffset = alignMeshOffset(header.attributeOffset + mesh.attributes.size() * sizeof(MeshAttribute));
+	header.vertexOffset = alignMeshOffset(header.submeshOffset + mesh.submeshes.size() * sizeof(MeshSubmesh));
+	header.indexOffset = alignMeshOffset(header.vertexOffset + mesh.vertices.size());
+
+	FILE* out = fopen(path, "wb");
+	if (!out)
+		return false;
+
+	// Blocks in file order, zero padding up to each offset
+	struct Block { uint64_t offset; const void* data; size_t bytes; };
+	Block blocks[] =
+	{
+		{ 0, &header, sizeof(header) },
+		{ header.attributeOffset, mesh.attributes.data(), mesh.attributes.size() * sizeof(MeshAttribute) },
+		{ header.submeshOffset, mesh.submeshes.data(), mesh.submeshes.size() * sizeof(MeshSubmesh) },
+		{ header.vertexOffset, mesh.vertices.data(), mesh.vertices.size() },
+		{ header.indexOffset, mesh.indices.data(), mesh.indices.size() }
+	};
+	const uint8_t padding[kMeshBlockAlignment] = {};
+	uint64_t written = 0;
+	bool ok = true;
+	for (const Block& block : blocks)
+	{
+		ok = ok && fwrite(padding, 1, (size_t)(block.offset - written), out) == block.offset - written;
+		ok = ok && (block.bytes == 0 || fwrite(block.data, 1, block.bytes, out) == block.bytes);
+		written = block.offset + block.bytes;
+	}
+	return fclose(out) == 0 && ok;
+}
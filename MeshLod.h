@@ -0,0 +1,329 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "MeshOptimize.h"
+#include "RenderQueue.h"
+
+// Level of detail chains built at load time by quadric error edge collapse.
+// Every level indexes the same vertex buffer: a collapse moves a vertex onto one of its neighbours, never creates one.
+// Vertices on UV/normal seams (same position, different attributes) and on open borders are never moved, so seams stay intact.
+
+const int kMaxLodLevels = 6;
+const float kLodReduction = 0.5f; // each level aims for this fraction of the previous level's triangles
+const float kLodErrorPixels = 1.0f; // default screen space error that picks a coarser level
+const float kLodHysteresis = 0.25f; // a coarser level must be this much under the threshold before switching to it
+const float kLodMaxRelativeError = 0.05f; // collapses stop at this fraction of the mesh's bounding box diagonal
+
+// Index range of one level inside the chain's index buffer, with its object space error
+struct LodLevel
+{
+	uint32_t firstIndex, indexCount;
+	float error;
+};
+
+// Draw ranges of one mesh from finest to coarsest
+struct MeshLods
+{
+	std::vector<DrawMesh> levels;
+	std::vector<float> errors; // object space, levels[0] is exact
+};
+
+// Symmetric 4x4 plane quadric, upper triangle
+struct Quadric
+{
+	double a[10];
+};
+
+inline void addPlaneQuadric(Quadric& q, double nx, double ny, double nz, double d)
+{
+	double p[4] = { nx, ny, nz, d };
+	int k = 0;
+	for (int i = 0; i < 4; i++)
+		for (int j = i; j < 4; j++)
+			q.a[k++] += p[i] * p[j];
+}
+
+inline void addQuadric(Quadric& q, const Quadric& other)
+{
+	for (int i = 0; i < 10; i++)
+		q.a[i] += other.a[i];
+}
+
+// Sum of squared distances of the point to the quadric's planes
+inline double evaluateQuadric(const Quadric& q, const float* p)
+{
+	double x = p[0], y = p[1], z = p[2];
+	const double* a = q.a;
+	return a[0] * x * x + 2.0 * a[1] * x * y + 2.0 * a[2] * x * z + 2.0 * a[3] * x +
+		a[4] * y * y + 2.0 * a[5] * y * z + 2.0 * a[6] * y +
+		a[7] * z * z + 2.0 * a[8] * z + a[9];
+}
+
+inline glm::vec3 triangleNormal(const float* a, const float* b, const float* c)
+{
+	glm::vec3 e1(b[0] - a[0], b[1] - a[1], b[2] - a[2]);
+	glm::vec3 e2(c[0] - a[0], c[1] - a[1], c[2] - a[2]);
+	return glm::cross(e1, e2);
+}
+
+// Collapse edges until the triangle count reaches targetIndexCount / 3 or the next collapse would exceed maxError.
+// Returns the simplified indices, `error` receives the largest collapse error in object space units
+inline std::vector<uint32_t> simplifyMesh(const std::vector<uint32_t>& indices, const float* vertices, size_t vertexCount,
+	size_t floatStride, size_t targetIndexCount, float maxError, float& error)
+{
+	error = 0.0f;
+	std::vector<uint32_t> result(indices);
+	if (indices.size() <= targetIndexCount)
+		return result;
+
+	// Vertices that share a position form one group, groups of more than one vertex are seams
+	struct PositionKey
+	{
+		float p[3];
+		bool operator==(const PositionKey& other) const { return memcmp(p, other.p, sizeof(p)) == 0; }
+	};
+	struct PositionHash
+	{
+		size_t operator()(const PositionKey& key) const
+		{
+			uint32_t bits[3];
+			memcpy(bits, key.p, sizeof(bits));
+			return bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u;
+		}
+	};
+	std::unordered_map<PositionKey, uint32_t, PositionHash> positions;
+	std::vector<uint32_t> group(vertexCount);
+	std::vector<uint8_t> locked(vertexCount, 0);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		PositionKey key;
+		memcpy(key.p, vertices + v * floatStride, sizeof(key.p));
+		std::pair<std::unordered_map<PositionKey, uint32_t, PositionHash>::iterator, bool> inserted = positions.insert(std::make_pair(key, (uint32_t)v));
+		group[v] = inserted.first->second;
+		if (!inserted.second)
+			locked[v] = locked[group[v]] = 1;
+	}
+
+	// Edges used by a single triangle are open borders
+	std::unordered_map<uint64_t, int> edgeUse;
+	for (size_t i = 0; i < result.size(); i += 3)
+	{
+		for (int e = 0; e < 3; e++)
+		{
+			uint32_t a = group[result[i + e]], b = group[result[i + (e + 1) % 3]];
+			edgeUse[((uint64_t)std::min(a, b) << 32) | std::max(a, b)]++;
+		}
+	}
+	for (const std::pair<const uint64_t, int>& edge : edgeUse)
+	{
+		if (edge.second == 1)
+			locked[(uint32_t)(edge.first >> 32)] = locked[(uint32_t)edge.first] = 1;
+	}
+	for (size_t v = 0; v < vertexCount; v++)
+		locked[v] = locked[group[v]];
+
+	// Plane quadric of every incident triangle
+	std::vector<Quadric> quadrics(vertexCount);
+	memset(quadrics.data(), 0, quadrics.size() * sizeof(Quadric));
+	for (size_t i = 0; i < result.size(); i += 3)
+	{
+		const float* a = vertices + result[i] * floatStride;
+		glm::vec3 n = triangleNormal(a, vertices + result[i + 1] * floatStride, vertices + result[i + 2] * floatStride);
+		float length = glm::length(n);
+		if (length <= 0.0f)
+			continue;
+		n /= length;
+		double d = -(n.x * a[0] + n.y * a[1] + n.z * a[2]);
+		for (int corner = 0; corner < 3; corner++)
+			addPlaneQuadric(quadrics[group[result[i + corner]]], n.x, n.y, n.z, d);
+	}
+
+	struct Collapse
+	{
+		uint32_t from, to;
+		double cost;
+	};
+	std::vector<Collapse> candidates;
+	std::vector<uint32_t> adjacencyOffset(vertexCount + 1), adjacency, fill;
+	std::vector<uint8_t> touched(vertexCount);
+	std::vector<uint32_t> collapseTo(vertexCount);
+	double maxCost = (double)maxError * maxError;
+	double worstCost = 0.0;
+
+	while (result.size() > targetIndexCount)
+	{
+		// Triangles of each vertex
+		std::fill(adjacencyOffset.begin(), adjacencyOffset.end(), 0);
+		for (uint32_t index : result)
+			adjacencyOffset[index + 1]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			adjacencyOffset[v + 1] += adjacencyOffset[v];
+		adjacency.resize(result.size());
+		fill.assign(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+		for (size_t i = 0; i < result.size(); i++)
+			adjacency[fill[result[i]]++] = (uint32_t)(i / 3);
+
+		// Every edge in both directions, cost is the merged quadric at the surviving vertex
+		candidates.clear();
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			for (int e = 0; e < 3; e++)
+			{
+				uint32_t a = result[i + e], b = result[i + (e + 1) % 3];
+				for (int direction = 0; direction < 2; direction++)
+				{
+					uint32_t from = direction ? b : a, to = direction ? a : b;
+					if (locked[from])
+						continue;
+					Quadric merged = quadrics[group[from]];
+					addQuadric(merged, quadrics[group[to]]);
+					double cost = std::max(0.0, evaluateQuadric(merged, vertices + to * floatStride));
+					if (cost <= maxCost)
+						candidates.push_back({ from, to, cost });
+				}
+			}
+		}
+		std::sort(candidates.begin(), candidates.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+		// Independent collapses, cheapest first, until enough triangles are gone
+		std::fill(touched.begin(), touched.end(), 0);
+		for (size_t v = 0; v < vertexCount; v++)
+			collapseTo[v] = (uint32_t)v;
+		size_t removedIndices = 0, neededIndices = result.size() - targetIndexCount;
+		int collapses = 0;
+		for (const Collapse& collapse : candidates)
+		{
+			if (removedIndices >= neededIndices)
+				break;
+			if (touched[collapse.from] || touched[collapse.to])
+				continue;
+
+			// Reject collapses that flip or flatten a surviving triangle
+			bool valid = true;
+			int removedTriangles = 0;
+			for (uint32_t j = adjacencyOffset[collapse.from]; j < adjacencyOffset[collapse.from + 1] && valid; j++)
+			{
+				const uint32_t* triangle = &result[adjacency[j] * 3];
+				if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+				{
+					removedTriangles++;
+					continue;
+				}
+				const float* corners[3], * moved[3];
+				for (int corner = 0; corner < 3; corner++)
+				{
+					corners[corner] = vertices + triangle[corner] * floatStride;
+					moved[corner] = triangle[corner] == collapse.from ? vertices + collapse.to * floatStride : corners[corner];
+				}
+				glm::vec3 before = triangleNormal(corners[0], corners[1], corners[2]);
+				glm::vec3 after = triangleNormal(moved[0], moved[1], moved[2]);
+				valid = glm::dot(before, after) > 0.25f * glm::length(before) * glm::length(after);
+			}
+			if (!valid || removedTriangles == 0)
+				continue;
+
+			collapseTo[collapse.from] = collapse.to;
+			addQuadric(quadrics[group[collapse.to]], quadrics[group[collapse.from]]);
+			worstCost = std::max(worstCost, collapse.cost);
+			removedIndices += removedTriangles * 3;
+			collapses++;
+
+			// Neighbours keep their triangles stable for the rest of this pass
+			for (uint32_t j = adjacencyOffset[collapse.from]; j < adjacencyOffset[collapse.from + 1]; j++)
+				for (int corner = 0; corner < 3; corner++)
+					touched[result[adjacency[j] * 3 + corner]] = 1;
+		}
+		if (collapses == 0)
+			break;
+
+		// Apply the collapses and drop triangles that became degenerate
+		size_t write = 0;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			uint32_t a = collapseTo[result[i]], b = collapseTo[result[i + 1]], c = collapseTo[result[i + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = c;
+		}
+		result.resize(write);
+	}
+
+	error = (float)sqrt(worstCost);
+	return result;
+}
+
+// Replace `chain` with lod0 followed by coarser versions of it until a level stops shrinking.
+// Each level is simplified from the previous one and reordered for the vertex cache
+inline void buildLodChain(const std::vector<uint32_t>& lod0, const float* vertices, size_t vertexCount, size_t floatStride,
+	int maxLevels, std::vector<uint32_t>& chain, std::vector<LodLevel>& levels)
+{
+	chain.assign(lod0.begin(), lod0.end());
+	levels.assign(1, { 0, (uint32_t)lod0.size(), 0.0f });
+
+	glm::vec3 boundsMin(INFINITY), boundsMax(-INFINITY);
+	for (uint32_t index : lod0)
+	{
+		glm::vec3 p(vertices[index * floatStride], vertices[index * floatStride + 1], vertices[index * floatStride + 2]);
+		boundsMin = glm::min(boundsMin, p);
+		boundsMax = glm::max(boundsMax, p);
+	}
+	float maxError = lod0.empty() ? 0.0f : glm::length(boundsMax - boundsMin) * kLodMaxRelativeError;
+
+	std::vector<uint32_t> previous(lod0);
+	float error = 0.0f;
+	while ((int)levels.size() < maxLevels)
+	{
+		size_t target = (size_t)(previous.size() / 3 * kLodReduction) * 3;
+		float levelError;
+		std::vector<uint32_t> level = simplifyMesh(previous, vertices, vertexCount, floatStride, target, maxError, levelError);
+		if (level.size() < 3 || level.size() > previous.size() * 9 / 10)
+			break;
+
+		// Errors add up because each level starts from the one before
+		error += levelError;
+		optimizeVertexCache(level.data(), level.size(), vertexCount);
+		levels.push_back({ (uint32_t)chain.size(), (uint32_t)level.size(), error });
+		chain.insert(chain.end(), level.begin(), level.end());
+		previous.swap(level);
+	}
+}
+
+// Screen pixels per object space unit at distance 1 (perspective) or anywhere (orthographic)
+inline float lodPixelScale(const glm::mat4& projection, int viewportHeight)
+{
+	return projection[1][1] * viewportHeight * 0.5f;
+}
+
+// Pick the coarsest level whose projected error stays under thresholdPixels.
+// Going coarser needs the error to be well under the threshold, so objects near a boundary do not flicker
+inline int selectLod(const MeshLods& lods, int current, const glm::mat4& world, const glm::vec3& cameraPosition,
+	const glm::mat4& projection, float pixelScale, float thresholdPixels)
+{
+	int count = (int)lods.levels.size();
+	if (count <= 1)
+		return 0;
+
+	// The largest axis scale turns object space error into world space
+	float scale = glm::max(glm::length(glm::vec3(world[0])), glm::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+	float pixelsPerUnit = pixelScale * scale;
+	bool perspective = projection[3][3] == 0.0f;
+	if (perspective)
+		pixelsPerUnit /= glm::max(glm::length(glm::vec3(world[3]) - cameraPosition), 1e-3f);
+
+	int lod = glm::clamp(current, 0, count - 1);
+	while (lod > 0 && lods.errors[lod] * pixelsPerUnit > thresholdPixels)
+		lod--;
+	while (lod + 1 < count && lods.errors[lod + 1] * pixelsPerUnit <= thresholdPixels * (1.0f - kLodHysteresis))
+		lod++;
+	return lod;
+}
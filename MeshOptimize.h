@@ -0,0 +1,353 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Index buffer processing for loaded meshes: triangulation, index width promotion,
+// triangle order for the post-transform vertex cache (Forsyth) and for overdraw (Sander et al. clusters),
+// and vertex order for fetch locality. Vertices are the 11-float layout, positions first.
+
+const int kVertexCacheSize = 16; // FIFO size used to measure ACMR/ATVR
+const int kForsythCacheSize = 32; // LRU size the optimizer scores against
+
+// Average cache miss ratio (misses per triangle, 0.5 ideal, 3 worst) and
+// average transform to vertex ratio (misses per vertex, 1 ideal)
+struct VertexCacheStats
+{
+	float acmr = 0.0f, atvr = 0.0f;
+};
+
+inline VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, int cacheSize = kVertexCacheSize)
+{
+	VertexCacheStats stats;
+	if (indexCount < 3 || vertexCount == 0)
+		return stats;
+
+	// A vertex is cached while fewer than cacheSize misses happened since it was loaded
+	std::vector<uint32_t> loadedAt(vertexCount, 0);
+	uint32_t misses = 0;
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		uint32_t vertex = indices[i];
+		if (loadedAt[vertex] == 0 || misses - loadedAt[vertex] >= (uint32_t)cacheSize)
+			loadedAt[vertex] = ++misses;
+	}
+
+	std::vector<uint8_t> used(vertexCount, 0);
+	size_t usedCount = 0;
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		if (!used[indices[i]])
+			usedCount++;
+		used[indices[i]] = 1;
+	}
+
+	stats.acmr = (float)misses / (float)(indexCount / 3);
+	stats.atvr = (float)misses / (float)usedCount;
+	return stats;
+}
+
+// Split polygons of faceSizes[i] corners into triangles. Quads use the 0-1-3 / 1-2-3 split
+// GL_QUADS gets on common drivers, so existing meshes keep their look; larger faces become fans
+inline void triangulateFaces(const uint32_t* indices, const uint32_t* faceSizes, size_t faceCount, std::vector<uint32_t>& triangles)
+{
+	triangles.clear();
+	for (size_t face = 0; face < faceCount; face++)
+	{
+		const uint32_t* corner = indices;
+		uint32_t size = faceSizes[face];
+		indices += size;
+		if (size == 4)
+		{
+			uint32_t quad[6] = { corner[0], corner[1], corner[3], corner[1], corner[2], corner[3] };
+			triangles.insert(triangles.end(), quad, quad + 6);
+			continue;
+		}
+		for (uint32_t i = 2; i < size; i++)
+		{
+			triangles.push_back(corner[0]);
+			triangles.push_back(corner[i - 1]);
+			triangles.push_back(corner[i]);
+		}
+	}
+}
+
+// 16-bit indices unless the mesh needs 32, never 8-bit
+inline uint32_t promotedIndexSize(size_t vertexCount)
+{
+	return vertexCount <= 0xFFFF ? 2 : 4;
+}
+
+inline void packIndices(const std::vector<uint32_t>& indices, uint32_t indexSize, std::vector<uint8_t>& packed)
+{
+	packed.resize(indices.size() * indexSize);
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		if (indexSize == 2)
+		{
+			uint16_t index = (uint16_t)indices[i];
+			memcpy(&packed[i * 2], &index, 2);
+		}
+		else
+			memcpy(&packed[i * 4], &indices[i], 4);
+	}
+}
+
+inline float forsythVertexScore(int cachePosition, uint32_t remainingTriangles)
+{
+	if (remainingTriangles == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		// The last triangle's vertices get a fixed score so its neighbours are not preferred over fresh strips
+		if (cachePosition < 3)
+			score = 0.75f;
+		else
+			score = powf(1.0f - (float)(cachePosition - 3) / (float)(kForsythCacheSize - 3), 1.5f);
+	}
+
+	// Boost vertices with few triangles left so they get finished off
+	return score + 2.0f * powf((float)remainingTriangles, -0.5f);
+}
+
+// Reorder triangles in place for post-transform cache hits (Forsyth's linear-speed optimizer)
+inline void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount < 2)
+		return;
+
+	// Triangles of each vertex
+	std::vector<uint32_t> adjacencyOffset(vertexCount + 1, 0), remaining(vertexCount, 0);
+	for (size_t i = 0; i < indexCount; i++)
+		remaining[indices[i]]++;
+	for (size_t v = 0; v < vertexCount; v++)
+		adjacencyOffset[v + 1] = adjacencyOffset[v] + remaining[v];
+	std::vector<uint32_t> adjacency(indexCount), fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+	for (size_t i = 0; i < indexCount; i++)
+		adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount), triangleScore(triangleCount, 0.0f);
+	for (size_t v = 0; v < vertexCount; v++)
+		vertexScore[v] = forsythVertexScore(-1, remaining[v]);
+	for (size_t t = 0; t < triangleCount; t++)
+		triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+	std::vector<uint8_t> emitted(triangleCount, 0);
+	std::vector<uint32_t> output;
+	output.reserve(indexCount);
+	uint32_t cache[kForsythCacheSize + 3], nextCache[kForsythCacheSize + 3];
+	int cacheCount = 0;
+	size_t inputCursor = 0;
+
+	long best = (long)(std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin());
+	while (output.size() < indexCount)
+	{
+		if (best < 0)
+		{
+			// Nothing adjacent to the cache is left, continue in input order
+			while (emitted[inputCursor])
+				inputCursor++;
+			best = (long)inputCursor;
+		}
+
+		const uint32_t* triangle = indices + best * 3;
+		output.insert(output.end(), triangle, triangle + 3);
+		emitted[best] = 1;
+
+		// Take the triangle out of its vertices' lists
+		for (int corner = 0; corner < 3; corner++)
+		{
+			uint32_t v = triangle[corner];
+			uint32_t* list = &adjacency[adjacencyOffset[v]];
+			for (uint32_t i = 0; i < remaining[v]; i++)
+			{
+				if (list[i] == (uint32_t)best)
+				{
+					list[i] = list[remaining[v] - 1];
+					break;
+				}
+			}
+			remaining[v]--;
+		}
+
+		// Triangle vertices move to the front of the cache
+		int nextCount = 0;
+		for (int corner = 0; corner < 3; corner++)
+			nextCache[nextCount++] = triangle[corner];
+		for (int i = 0; i < cacheCount; i++)
+		{
+			uint32_t v = cache[i];
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+				nextCache[nextCount++] = v;
+		}
+		for (int i = kForsythCacheSize; i < nextCount; i++)
+		{
+			cachePosition[nextCache[i]] = -1;
+			vertexScore[nextCache[i]] = forsythVertexScore(-1, remaining[nextCache[i]]);
+		}
+		cacheCount = std::min(nextCount, kForsythCacheSize);
+		memcpy(cache, nextCache, cacheCount * sizeof(uint32_t));
+		for (int i = 0; i < cacheCount; i++)
+		{
+			cachePosition[cache[i]] = i;
+			vertexScore[cache[i]] = forsythVertexScore(i, remaining[cache[i]]);
+		}
+
+		// Rescore the triangles touching the cache and pick the best of them
+		best = -1;
+		float bestScore = -1.0f;
+		for (int i = 0; i < cacheCount; i++)
+		{
+			uint32_t v = cache[i];
+			const uint32_t* list = &adjacency[adjacencyOffset[v]];
+			for (uint32_t j = 0; j < remaining[v]; j++)
+			{
+				uint32_t t = list[j];
+				float score = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+				triangleScore[t] = score;
+				if (score > bestScore)
+				{
+					bestScore = score;
+					best = (long)t;
+				}
+			}
+		}
+	}
+	memcpy(indices, output.data(), indexCount * sizeof(uint32_t));
+}
+
+// Reorder clusters of cache-optimized triangles so outward facing, occluding parts draw first.
+// Clusters end where the FIFO cache restarts, or where the cluster's ACMR is within `threshold` of the whole mesh
+inline void optimizeOverdraw(uint32_t* indices, size_t indexCount, const float* vertices, size_t floatStride, float threshold = 1.05f)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount < 2)
+		return;
+
+	uint32_t vertexCount = 0;
+	for (size_t i = 0; i < indexCount; i++)
+		vertexCount = std::max(vertexCount, indices[i] + 1);
+	float meshAcmr = analyzeVertexCache(indices, indexCount, vertexCount).acmr;
+
+	std::vector<size_t> clusterStart;
+	std::vector<uint32_t> loadedAt(vertexCount, 0);
+	uint32_t misses = 0, clusterMisses = 0;
+	size_t clusterFirst = 0;
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		int triangleMisses = 0;
+		for (int corner = 0; corner < 3; corner++)
+		{
+			uint32_t v = indices[t * 3 + corner];
+			if (loadedAt[v] == 0 || misses - loadedAt[v] >= (uint32_t)kVertexCacheSize)
+			{
+				loadedAt[v] = ++misses;
+				triangleMisses++;
+			}
+		}
+		if (t == 0 || triangleMisses == 3)
+		{
+			// Hard boundary, the cache starts over here anyway
+			clusterStart.push_back(t);
+			clusterFirst = t;
+			clusterMisses = 0;
+		}
+		clusterMisses += triangleMisses;
+
+		// Soft boundary once the cluster is cache efficient enough on its own
+		size_t clusterSize = t + 1 - clusterFirst;
+		if (clusterSize >= 8 && t + 1 < triangleCount && (float)clusterMisses / clusterSize <= meshAcmr * threshold)
+		{
+			clusterStart.push_back(t + 1);
+			clusterFirst = t + 1;
+			clusterMisses = 0;
+			std::fill(loadedAt.begin(), loadedAt.end(), 0);
+			misses = 0;
+		}
+	}
+	clusterStart.erase(std::unique(clusterStart.begin(), clusterStart.end()), clusterStart.end());
+	clusterStart.push_back(triangleCount);
+
+	// Mesh centroid, area weighted
+	size_t clusterCount = clusterStart.size() - 1;
+	std::vector<float> clusterCentroid(clusterCount * 3, 0.0f), clusterNormal(clusterCount * 3, 0.0f), clusterArea(clusterCount, 0.0f);
+	float meshCentroid[3] = { 0.0f, 0.0f, 0.0f }, meshArea = 0.0f;
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; t++)
+		{
+			const float* a = vertices + indices[t * 3] * floatStride;
+			const float* b = vertices + indices[t * 3 + 1] * floatStride;
+			const float* d = vertices + indices[t * 3 + 2] * floatStride;
+			float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float e2[3] = { d[0] - a[0], d[1] - a[1], d[2] - a[2] };
+			float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]) * 0.5f;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float centroid = (a[axis] + b[axis] + d[axis]) / 3.0f;
+				clusterCentroid[c * 3 + axis] += centroid * area;
+				clusterNormal[c * 3 + axis] += n[axis];
+				meshCentroid[axis] += centroid * area;
+			}
+			clusterArea[c] += area;
+			meshArea += area;
+		}
+	}
+	for (int axis = 0; axis < 3; axis++)
+		meshCentroid[axis] = meshArea > 0.0f ? meshCentroid[axis] / meshArea : 0.0f;
+
+	// Occlusion potential: how far the cluster sits out along its own normal
+	std::vector<float> potential(clusterCount);
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		float* n = &clusterNormal[c * 3];
+		float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		float dot = 0.0f;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float centroid = clusterArea[c] > 0.0f ? clusterCentroid[c * 3 + axis] / clusterArea[c] : 0.0f;
+			dot += (centroid - meshCentroid[axis]) * (length > 0.0f ? n[axis] / length : 0.0f);
+		}
+		potential[c] = dot;
+	}
+
+	std::vector<size_t> order(clusterCount);
+	for (size_t c = 0; c < clusterCount; c++)
+		order[c] = c;
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return potential[a] > potential[b]; });
+
+	std::vector<uint32_t> output;
+	output.reserve(indexCount);
+	for (size_t c : order)
+		output.insert(output.end(), indices + clusterStart[c] * 3, indices + clusterStart[c + 1] * 3);
+	memcpy(indices, output.data(), indexCount * sizeof(uint32_t));
+}
+
+// Renumber vertices in order of first use and drop unreferenced ones, returns the new vertex count
+inline size_t optimizeVertexFetch(std::vector<uint32_t>& indices, std::vector<float>& vertices, size_t floatStride)
+{
+	size_t vertexCount = vertices.size() / floatStride;
+	std::vector<uint32_t> remap(vertexCount, 0xFFFFFFFFu);
+	std::vector<float> fetched;
+	fetched.reserve(vertices.size());
+	uint32_t next = 0;
+	for (uint32_t& index : indices)
+	{
+		if (remap[index] == 0xFFFFFFFFu)
+		{
+			remap[index] = next++;
+			fetched.insert(fetched.end(), vertices.begin() + index * floatStride, vertices.begin() + (index + 1) * floatStride);
+		}
+		index = remap[index];
+	}
+	vertices.swap(fetched);
+	return next;
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "MeshFile.h"
+#include "MeshLod.h"
+#include "MeshOptimize.h"
+#include "RenderQueue.h"
+#include "VertexQuantize.h"
+
+// GL upload of mapped mesh files, the mapped blocks are the glBufferData sources unless they need converting
+
+static_assert(kMeshMaxLocation <= kInstanceModelLocation, "mesh attributes must stay below the instance matrix");
+
+inline GLenum meshComponentGLType(uint32_t type)
+{
+	switch (type)
+	{
+	case kMeshFloat32: return GL_FLOAT;
+	default: return 0;
+	}
+}
+
+inline uint32_t readMeshIndex(const void* indices, uint32_t indexSize, size_t i)
+{
+	if (indexSize == 1)
+		return ((const uint8_t*)indices)[i];
+	if (indexSize == 2)
+		return ((const uint16_t*)indices)[i];
+	return ((const uint32_t*)indices)[i];
+}
+
+inline GLenum meshIndexGLType(uint32_t indexSize)
+{
+	return indexSize == 1 ? GL_UNSIGNED_BYTE : indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+// True when the file uses the 11-float position/color/uv/normal vertex
+inline bool hasStandardLayout(const MeshFile& mesh)
+{
+	if (mesh.header->vertexStride != kMeshStandardStride || mesh.header->attributeCount != 4)
+		return false;
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		const MeshAttribute& attribute = mesh.attributes[i];
+		const MeshAttribute& standard = kMeshStandardAttributes[i];
+		if (attribute.location != standard.location || attribute.components != standard.components ||
+			attribute.type != standard.type || attribute.offset != standard.offset)
+			return false;
+	}
+	return true;
+}
+
+// Draw ranges for a LOD chain packed at `firstIndex` of the element buffer, mesh ids are taken from nextMeshId.
+// Every level keeps the full mesh's bounds, collapsed vertices never leave them
+inline MeshLods makeMeshLods(GLuint vao, uint32_t indexSize, uint32_t firstIndex, const std::vector<LodLevel>& levels,
+	const glm::vec3& boundsMin, const glm::vec3& boundsMax, const QuantizedVertices* quantized, uint16_t& nextMeshId)
+{
+	MeshLods lods;
+	for (const LodLevel& level : levels)
+	{
+		DrawMesh draw;
+		draw.vao = vao;
+		draw.mode = GL_TRIANGLES;
+		draw.indexCount = (GLsizei)level.indexCount;
+		draw.indexType = meshIndexGLType(indexSize);
+		draw.indexOffset = (GLsizeiptr)(firstIndex + level.firstIndex) * indexSize;
+		draw.id = nextMeshId++;
+		draw.boundsMin = boundsMin;
+		draw.boundsMax = boundsMax;
+		if (quantized)
+		{
+			draw.quantized = true;
+			draw.positionScale = quantized->positionScale;
+			draw.positionOffset = quantized->positionOffset;
+		}
+		lods.levels.push_back(draw);
+		lods.errors.push_back(level.error);
+	}
+	return lods;
+}
+
+struct MeshUploadOptions
+{
+	bool quantize = false; // compress the vertices on the way
+	int lodLevels = 1; // more than one builds a LOD chain per submesh
+};
+
+// CPU half of an upload: converted indices, LOD chains and compressed vertices, ready for the buffers.
+// Has no GL calls, so it can run on a worker thread. Points into the mesh file, which must stay open until uploaded
+struct PreparedMesh
+{
+	const MeshFile* file = nullptr;
+	std::vector<uint8_t> indices; // converted index block, empty when the mapped one is uploaded
+	uint32_t indexSize = 0;
+	bool quantize = false;
+	QuantizedVertices quantized;
+	std::vector<std::vector<LodLevel>> submeshLevels; // per submesh, only the finest level unless LODs are built
+	std::vector<uint32_t> submeshFirst; // first index of each submesh's chain
+};
+
+// Quantization and LOD chains need the standard vertex layout. Without them the mapped blocks are used as is,
+// quad meshes only get their index block converted
+inline bool prepareMeshUpload(const MeshFile& mesh, const MeshUploadOptions& options, PreparedMesh& prepared, std::string& error)
+{
+	const MeshFileHeader& header = *mesh.header;
+	for (uint32_t i = 0; i < header.attributeCount; i++)
+	{
+		if (meshComponentGLType(mesh.attributes[i].type) == 0)
+		{
+			error = "unsupported vertex format";
+			return false;
+		}
+	}
+	if ((options.quantize || options.lodLevels > 1) && !hasStandardLayout(mesh))
+	{
+		error = "quantization and LODs need the standard vertex layout";
+		return false;
+	}
+
+	prepared.file = &mesh;
+	prepared.submeshLevels.assign(header.submeshCount, std::vector<LodLevel>());
+	prepared.submeshFirst.resize(header.submeshCount);
+	for (uint32_t i = 0; i < header.submeshCount; i++)
+	{
+		prepared.submeshLevels[i].assign(1, { 0, mesh.submeshes[i].indexCount, 0.0f });
+		prepared.submeshFirst[i] = mesh.submeshes[i].firstIndex;
+	}
+
+	// Quad meshes are triangulated here, GL_QUADS is gone from core profiles
+	prepared.indices.clear();
+	prepared.indexSize = header.indexSize;
+	if (header.primitive == kMeshQuads || options.lodLevels > 1)
+	{
+		std::vector<uint32_t> allIndices, submeshIndices, triangles, chain;
+		for (uint32_t s = 0; s < header.submeshCount; s++)
+		{
+			const MeshSubmesh& submesh = mesh.submeshes[s];
+			submeshIndices.resize(submesh.indexCount);
+			for (uint32_t i = 0; i < submesh.indexCount; i++)
+				submeshIndices[i] = readMeshIndex(mesh.indices, header.indexSize, submesh.firstIndex + i);
+			if (header.primitive == kMeshQuads)
+			{
+				std::vector<uint32_t> faceSizes(submeshIndices.size() / 4, 4);
+				triangulateFaces(submeshIndices.data(), faceSizes.data(), faceSizes.size(), triangles);
+				submeshIndices.swap(triangles);
+			}
+			if (options.lodLevels > 1)
+				buildLodChain(submeshIndices, (const float*)mesh.vertices, header.vertexCount, 11, options.lodLevels, chain, prepared.submeshLevels[s]);
+			else
+			{
+				chain.swap(submeshIndices);
+				prepared.submeshLevels[s].assign(1, { 0, (uint32_t)chain.size(), 0.0f });
+			}
+			prepared.submeshFirst[s] = (uint32_t)allIndices.size();
+			allIndices.insert(allIndices.end(), chain.begin(), chain.end());
+		}
+		prepared.indexSize = promotedIndexSize(header.vertexCount);
+		packIndices(allIndices, prepared.indexSize, prepared.indices);
+	}
+
+	prepared.quantize = options.quantize;
+	if (options.quantize)
+		quantizeVertices((const float*)mesh.vertices, header.vertexCount, 11, prepared.quantized);
+	return true;
+}
+
+inline const void* preparedIndexData(const PreparedMesh& prepared, size_t& bytes)
+{
+	if (!prepared.indices.empty())
+	{
+		bytes = prepared.indices.size();
+		return prepared.indices.data();
+	}
+	bytes = (size_t)prepared.file->header->indexCount * prepared.file->header->indexSize;
+	return prepared.file->indices;
+}
+
+inline const void* preparedVertexData(const PreparedMesh& prepared, size_t& bytes)
+{
+	if (prepared.quantize)
+	{
+		bytes = prepared.quantized.data.size();
+		return prepared.quantized.data.data();
+	}
+	bytes = (size_t)prepared.file->header->vertexCount * prepared.file->header->vertexStride;
+	return prepared.file->vertices;
+}
+
+// Vertex layout of the bound VAO, reading the bound GL_ARRAY_BUFFER
+inline void setPreparedAttributes(const PreparedMesh& prepared, const RenderQueue& queue)
+{
+	const MeshFileHeader& header = *prepared.file->header;
+	if (prepared.quantize)
+		setQuantizedAttributes(prepared.quantized);
+	else
+	{
+		for (uint32_t i = 0; i < header.attributeCount; i++)
+		{
+			const MeshAttribute& attribute = prepared.file->attributes[i];
+			glVertexAttribPointer(attribute.location, attribute.components, meshComponentGLType(attribute.type), GL_FALSE,
+				header.vertexStride, (GLvoid*)(size_t)attribute.offset);
+			glEnableVertexAttribArray(attribute.location);
+		}
+	}
+	enableInstanceAttributes(queue);
+}
+
+// One MeshLods per submesh, drawn from `vao`
+inline void makePreparedMeshLods(const PreparedMesh& prepared, GLuint vao, uint16_t firstMeshId, std::vector<MeshLods>& meshes)
+{
+	uint16_t nextMeshId = firstMeshId;
+	for (uint32_t i = 0; i < prepared.file->header->submeshCount; i++)
+	{
+		const MeshSubmesh& submesh = prepared.file->submeshes[i];
+		glm::vec3 boundsMin(submesh.boundsMin[0], submesh.boundsMin[1], submesh.boundsMin[2]);
+		glm::vec3 boundsMax(submesh.boundsMax[0], submesh.boundsMax[1], submesh.boundsMax[2]);
+		meshes.push_back(makeMeshLods(vao, prepared.indexSize, prepared.submeshFirst[i], prepared.submeshLevels[i], boundsMin, boundsMax,
+			prepared.quantize ? &prepared.quantized : nullptr, nextMeshId));
+	}
+}
+
+// Fill the given VAO and buffers from an open mesh file and add one MeshLods per submesh.
+// `quantized` receives the compressed vertices and their error when options.quantize is set.
+// The file can be closed once this returns, GL has its own copy
+inline bool uploadMeshFile(const MeshFile& mesh, GLuint vao, GLuint vbo, GLuint ebo, const RenderQueue& queue,
+	uint16_t firstMeshId, std::vector<MeshLods>& meshes, const MeshUploadOptions& options, std::string& error,
+	QuantizedVertices* quantized = nullptr)
+{
+	PreparedMesh prepared;
+	if (!prepareMeshUpload(mesh, options, prepared, error))
+		return false;
+
+	size_t indexBytes, vertexBytes;
+	const void* indexData = preparedIndexData(prepared, indexBytes);
+	const void* vertexData = preparedVertexData(prepared, vertexBytes);
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)indexBytes, indexData, GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)vertexBytes, vertexData, GL_STATIC_DRAW);
+	setPreparedAttributes(prepared, queue);
+	glBindVertexArray(0);
+
+	makePreparedMeshLods(prepared, vao, firstMeshId, meshes);
+	if (quantized && prepared.quantize)
+		*quantized = std::move(prepared.quantized);
+	return true;
+}
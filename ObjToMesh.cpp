@@ -0,0 +1,314 @@
+// Offline converter from Wavefront OBJ to the binary mesh format read by RoughSketch --mesh
+//
+//     ObjToMesh input.obj output.rssm
+//
+// Faces are triangulated, v/vt/vn triplets are welded into shared vertices and
+// every o, g or usemtl statement starts a new submesh. Vertex colors ("v x y z r g b") are kept,
+// missing colors default to white and missing normals are rebuilt from the faces.
+// Triangles are then ordered for the vertex cache and overdraw, and vertices for fetch locality.
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "MeshFile.h"
+#include "MeshOptimize.h"
+
+using namespace std;
+
+// One corner of an OBJ face, indices into the position/uv/normal lists (-1 when absent)
+struct ObjCorner
+{
+	int position, uv, normal;
+	bool operator==(const ObjCorner& other) const
+	{
+		return position == other.position && uv == other.uv && normal == other.normal;
+	}
+};
+
+struct ObjCornerHash
+{
+	size_t operator()(const ObjCorner& corner) const
+	{
+		return ((size_t)corner.position * 73856093u) ^ ((size_t)corner.uv * 19349663u) ^ ((size_t)corner.normal * 83492791u);
+	}
+};
+
+static bool readFile(const char* path, string& text)
+{
+	FILE* in = fopen(path, "rb");
+	if (!in)
+		return false;
+	fseek(in, 0, SEEK_END);
+	long size = ftell(in);
+	fseek(in, 0, SEEK_SET);
+	text.resize(size > 0 ? (size_t)size : 0);
+	bool ok = size <= 0 || fread(&text[0], 1, (size_t)size, in) == (size_t)size;
+	fclose(in);
+	return ok;
+}
+
+// OBJ indices are 1-based, negative ones count back from the end of the list
+static int resolveObjIndex(long index, size_t count)
+{
+	if (index > 0)
+		return (int)index - 1;
+	if (index < 0)
+		return (int)count + (int)index;
+	return -1;
+}
+
+static ObjCorner parseCorner(const char*& cursor, size_t positions, size_t uvs, size_t normals)
+{
+	ObjCorner corner = { -1, -1, -1 };
+	char* end;
+	corner.position = resolveObjIndex(strtol(cursor, &end, 10), positions);
+	cursor = end;
+	if (*cursor == '/')
+	{
+		cursor++;
+		if (*cursor != '/')
+		{
+			corner.uv = resolveObjIndex(strtol(cursor, &end, 10), uvs);
+			cursor = end;
+		}
+		if (*cursor == '/')
+		{
+			cursor++;
+			corner.normal = resolveObjIndex(strtol(cursor, &end, 10), normals);
+			cursor = end;
+		}
+	}
+	return corner;
+}
+
+static void closeSubmesh(MeshData& mesh, vector<uint32_t>& indices, uint32_t& firstIndex)
+{
+	if (indices.size() == firstIndex)
+		return;
+	MeshSubmesh submesh = {};
+	submesh.firstIndex = firstIndex;
+	submesh.indexCount = (uint32_t)indices.size() - firstIndex;
+	mesh.submeshes.push_back(submesh);
+	firstIndex = (uint32_t)indices.size();
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 3)
+	{
+		cout << "Usage: ObjToMesh input.obj output.rssm" << endl;
+		return -1;
+	}
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	string text;
+	if (!readFile(argv[1], text))
+	{
+		cout << "Error! Could not read " << argv[1] << endl;
+		return -1;
+	}
+
+	vector<float> positions, colors, uvs, normals;
+	bool hasColors = false;
+	vector<float> vertices; // 11 floats per welded vertex
+	vector<uint32_t> indices;
+	unordered_map<ObjCorner, uint32_t, ObjCornerHash> welded;
+	vector<uint32_t> face, faceTriangles;
+	vector<bool> missingNormal; // per welded vertex
+	bool missingNormals = false;
+
+	MeshData mesh;
+	mesh.attributes.assign(kMeshStandardAttributes, kMeshStandardAttributes + 4);
+	uint32_t firstIndex = 0;
+
+	const char* cursor = text.c_str();
+	while (*cursor)
+	{
+		const char* line = cursor;
+		while (*cursor && *cursor != '\n')
+			cursor++;
+		if (*cursor)
+			cursor++;
+		while (*line == ' ' || *line == '\t')
+			line++;
+
+		char* end;
+		if (line[0] == 'v' && line[1] == ' ')
+		{
+			float values[6];
+			int count = 0;
+			const char* value = line + 2;
+			for (; count < 6; count++)
+			{
+				values[count] = strtof(value, &end);
+				if (end == value || end > cursor)
+					break;
+				value = end;
+			}
+			positions.insert(positions.end(), values, values + 3);
+			hasColors = hasColors || count == 6;
+			colors.push_back(count == 6 ? values[3] : 1.0f);
+			colors.push_back(count == 6 ? values[4] : 1.0f);
+			colors.push_back(count == 6 ? values[5] : 1.0f);
+		}
+		else if (line[0] == 'v' && line[1] == 't')
+		{
+			float u = strtof(line + 2, &end);
+			float v = strtof(end, &end);
+			uvs.push_back(u);
+			uvs.push_back(v);
+		}
+		else if (line[0] == 'v' && line[1] == 'n')
+		{
+			const char* value = line + 2;
+			for (int i = 0; i < 3; i++)
+			{
+				normals.push_back(strtof(value, &end));
+				value = end;
+			}
+		}
+		else if (line[0] == 'f' && line[1] == ' ')
+		{
+			face.clear();
+			const char* corner = line + 2;
+			while (corner < cursor)
+			{
+				while (*corner == ' ' || *corner == '\t')
+					corner++;
+				if (corner >= cursor || *corner == '\r' || *corner == '\n' || *corner == '\0')
+					break;
+
+				ObjCorner key = parseCorner(corner, positions.size() / 3, uvs.size() / 2, normals.size() / 3);
+				if (key.position < 0 || (size_t)key.position >= positions.size() / 3)
+				{
+					cout << "Error! Face references a missing vertex" << endl;
+					return -1;
+				}
+				if (key.uv >= (int)(uvs.size() / 2))
+					key.uv = -1;
+				if (key.normal >= (int)(normals.size() / 3))
+					key.normal = -1;
+
+				unordered_map<ObjCorner, uint32_t, ObjCornerHash>::iterator found = welded.find(key);
+				if (found == welded.end())
+				{
+					uint32_t index = (uint32_t)(vertices.size() / 11);
+					const float* p = &positions[key.position * 3];
+					const float* c = &colors[key.position * 3];
+					float vertex[11] = { p[0], p[1], p[2], c[0], c[1], c[2], 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+					if (key.uv >= 0)
+					{
+						vertex[6] = uvs[key.uv * 2];
+						vertex[7] = uvs[key.uv * 2 + 1];
+					}
+					if (key.normal >= 0)
+						memcpy(&vertex[8], &normals[key.normal * 3], 3 * sizeof(float));
+					missingNormal.push_back(key.normal < 0);
+					missingNormals = missingNormals || key.normal < 0;
+					vertices.insert(vertices.end(), vertex, vertex + 11);
+					found = welded.insert(make_pair(key, index)).first;
+				}
+				face.push_back(found->second);
+			}
+
+			uint32_t faceSize = (uint32_t)face.size();
+			triangulateFaces(face.data(), &faceSize, 1, faceTriangles);
+			indices.insert(indices.end(), faceTriangles.begin(), faceTriangles.end());
+		}
+		else if (((line[0] == 'o' || line[0] == 'g') && (line[1] == ' ' || line[1] == '\r' || line[1] == '\n')) ||
+			strncmp(line, "usemtl", 6) == 0)
+		{
+			closeSubmesh(mesh, indices, firstIndex);
+		}
+	}
+	closeSubmesh(mesh, indices, firstIndex);
+
+	if (indices.empty())
+	{
+		cout << "Error! " << argv[1] << " has no faces" << endl;
+		return -1;
+	}
+
+	// Area weighted smooth normals for corners that had none
+	if (missingNormals)
+	{
+		vector<float> accumulated(vertices.size() / 11 * 3, 0.0f);
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			const float* a = &vertices[indices[i] * 11];
+			const float* b = &vertices[indices[i + 1] * 11];
+			const float* c = &vertices[indices[i + 2] * 11];
+			float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			for (int corner = 0; corner < 3; corner++)
+				for (int axis = 0; axis < 3; axis++)
+					accumulated[indices[i + corner] * 3 + axis] += n[axis];
+		}
+		for (size_t v = 0; v < vertices.size() / 11; v++)
+		{
+			if (!missingNormal[v])
+				continue;
+			float* normal = &vertices[v * 11 + 8];
+			float* n = &accumulated[v * 3];
+			float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			for (int axis = 0; axis < 3; axis++)
+				normal[axis] = length > 0.0f ? n[axis] / length : (axis == 2 ? 1.0f : 0.0f);
+		}
+	}
+
+	// Per-submesh bounds
+	for (MeshSubmesh& submesh : mesh.submeshes)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			submesh.boundsMin[axis] = INFINITY;
+			submesh.boundsMax[axis] = -INFINITY;
+		}
+		for (uint32_t i = submesh.firstIndex; i < submesh.firstIndex + submesh.indexCount; i++)
+		{
+			const float* p = &vertices[indices[i] * 11];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				submesh.boundsMin[axis] = fminf(submesh.boundsMin[axis], p[axis]);
+				submesh.boundsMax[axis] = fmaxf(submesh.boundsMax[axis], p[axis]);
+			}
+		}
+	}
+
+	// Triangle order per submesh, then one vertex order for the whole mesh
+	size_t vertexCount = vertices.size() / 11;
+	VertexCacheStats before = analyzeVertexCache(indices.data(), indices.size(), vertexCount);
+	for (const MeshSubmesh& submesh : mesh.submeshes)
+	{
+		optimizeVertexCache(&indices[submesh.firstIndex], submesh.indexCount, vertexCount);
+		optimizeOverdraw(&indices[submesh.firstIndex], submesh.indexCount, vertices.data(), 11);
+	}
+	vertexCount = optimizeVertexFetch(indices, vertices, 11);
+	VertexCacheStats after = analyzeVertexCache(indices.data(), indices.size(), vertexCount);
+
+	mesh.indexSize = promotedIndexSize(vertexCount);
+	packIndices(indices, mesh.indexSize, mesh.indices);
+	mesh.vertices.resize(vertices.size() * sizeof(float));
+	memcpy(mesh.vertices.data(), vertices.data(), mesh.vertices.size());
+
+	if (!writeMeshFile(argv[2], mesh))
+	{
+		cout << "Error! Could not write " << argv[2] << endl;
+		return -1;
+	}
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cout << argv[2] << ": " << vertexCount << " vertices, " << indices.size() / 3 << " triangles, "
+		<< mesh.submeshes.size() << " submeshes, " << mesh.indexSize * 8 << "-bit indices"
+		<< (hasColors ? ", vertex colors" : "") << (missingNormals ? ", generated normals" : "")
+		<< " (" << seconds * 1000.0 << " ms)" << endl;
+	cout << "ACMR " << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr << endl;
+	return 0;
+}
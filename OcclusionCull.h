@@ -0,0 +1,397 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86)
+#include <xmmintrin.h>
+#define OCCLUSION_SSE 1
+#endif
+
+#include "Bvh.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+// Occlusion culling against a software depth buffer, after frustum culling and before draws are recorded.
+// The objects that cover the most of the screen are picked as occluders and their triangles rasterized into a
+// small CPU depth buffer, four pixels at a time, one band of rows per job on the pool. A pyramid of min and max
+// depth is built over it. Each candidate's world box is then projected to a screen rectangle and its nearest
+// depth, and the object is hidden when that depth is behind the farthest occluder depth everywhere under the
+// rectangle: the test reads 2x2 texels of the pyramid level the rectangle fits in, then finer levels while
+// that was not enough and the rectangle still covers few texels. Occluders only write the texels they cover
+// entirely, with their farthest depth over the texel, so a texel's depth is never nearer than what is drawn there.
+// Depth is z / w mapped to [0, 1], the buffer clears to 1. Occluders crossing the near plane are left out and
+// objects crossing it are always kept.
+
+const int kOcclusionWidth = 256, kOcclusionHeight = 128;
+const int kOcclusionBandRows = 16; // rows rasterized per job
+const int kDefaultOccluders = 24;
+const uint32_t kOcclusionTestBatch = 256; // objects tested per job
+const float kOccluderMinPixels = 4.0f; // projected radius, in depth buffer pixels, below which an object is not an occluder
+const float kOcclusionDepthBias = 1e-6f;
+const int kOcclusionMaxTexels = 256; // finest level a rectangle is tested at covers at most this many texels
+
+// Triangle mesh an occluder is drawn with, in object space
+struct OccluderMesh
+{
+	std::vector<glm::vec3> positions;
+	std::vector<uint32_t> indices;
+};
+
+// Candidate occluder: mesh, world matrix and how much of the screen it covers
+struct OccluderCandidate
+{
+	const OccluderMesh* mesh;
+	const glm::mat4* world;
+	float score;
+};
+
+// Occluder picked this frame, with its vertices in depth buffer pixels and depth
+struct Occluder
+{
+	const OccluderMesh* mesh = nullptr;
+	glm::mat4 world;
+	bool drawn = false; // false when it crosses the near plane
+	std::vector<glm::vec3> screen;
+};
+
+struct OcclusionCuller
+{
+	WorkStealingPool* pool = nullptr;
+	int maxOccluders = kDefaultOccluders;
+	glm::mat4 viewProjection;
+
+	std::vector<OccluderCandidate> candidates;
+	std::vector<Occluder> occluders; // slots reused between frames, occluderCount in use
+	int occluderCount = 0;
+
+	// Depth buffer and pyramid levels, level 0 is the buffer itself
+	std::vector<float> depth;
+	std::vector<std::vector<float>> minLevels, maxLevels;
+	std::vector<int> levelWidth, levelHeight;
+
+	std::vector<uint8_t> hidden; // scratch, per tested object
+
+	// Stats of the last frame, and over the run
+	int occluderTriangles = 0, tested = 0, culled = 0;
+	uint64_t totalTested = 0, totalCulled = 0;
+	double rasterMs = 0.0, testMs = 0.0;
+	int frames = 0;
+};
+
+inline void initOcclusionCuller(OcclusionCuller& culler, WorkStealingPool& pool, int maxOccluders)
+{
+	culler = OcclusionCuller();
+	culler.pool = &pool;
+	culler.maxOccluders = std::max(maxOccluders, 1);
+	culler.depth.assign((size_t)kOcclusionWidth * kOcclusionHeight, 1.0f);
+	int width = kOcclusionWidth, height = kOcclusionHeight;
+	while (true)
+	{
+		culler.levelWidth.push_back(width);
+		culler.levelHeight.push_back(height);
+		culler.minLevels.emplace_back((size_t)width * height, 1.0f);
+		culler.maxLevels.emplace_back((size_t)width * height, 1.0f);
+		if (width == 1 && height == 1)
+			break;
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+	}
+}
+
+// Start a frame for this camera, candidates are added after
+inline void beginOcclusionFrame(OcclusionCuller& culler, const glm::mat4& viewProjection)
+{
+	culler.viewProjection = viewProjection;
+	culler.candidates.clear();
+	culler.occluderCount = 0;
+	culler.tested = 0;
+	culler.culled = 0;
+	culler.frames++;
+}
+
+// A visible object that may hide others, with its world bounding sphere for scoring. Small ones are ignored
+inline void addOccluderCandidate(OcclusionCuller& culler, const OccluderMesh& mesh, const glm::mat4& world, const glm::vec3& center, float radius)
+{
+	if (mesh.indices.empty())
+		return;
+	glm::vec4 clip = culler.viewProjection * glm::vec4(center, 1.0f);
+	if (clip.w <= 0.0f)
+		return;
+
+	// The second row turns a world offset into clip y, its length is the projection's y scale
+	glm::vec3 rowY(culler.viewProjection[0][1], culler.viewProjection[1][1], culler.viewProjection[2][1]);
+	float pixels = radius * glm::length(rowY) / clip.w * kOcclusionHeight * 0.5f;
+	if (pixels >= kOccluderMinPixels)
+		culler.candidates.push_back({ &mesh, &world, pixels });
+}
+
+// Clip space to depth buffer pixels and [0, 1] depth
+inline glm::vec3 occlusionScreenPoint(const glm::vec4& clip)
+{
+	float inverseW = 1.0f / clip.w;
+	return glm::vec3((clip.x * inverseW * 0.5f + 0.5f) * kOcclusionWidth, (clip.y * inverseW * 0.5f + 0.5f) * kOcclusionHeight,
+		clip.z * inverseW * 0.5f + 0.5f);
+}
+
+// Keep the nearest depth of one triangle over rows [bandTop, bandBottom) of the buffer. Coverage is inner
+// conservative: a texel is written only when the whole square is inside the triangle, with the plane's depth at
+// its farthest corner
+inline void rasterizeOccluderTriangle(float* depth, glm::vec3 a, glm::vec3 b, glm::vec3 c, int bandTop, int bandBottom)
+{
+	// Counter-clockwise on screen, both sides of an occluder hide what is behind them
+	float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+	if (area == 0.0f || area != area)
+		return;
+	if (area < 0.0f)
+	{
+		std::swap(b, c);
+		area = -area;
+	}
+
+	// Pixel centers inside the box, x from a multiple of four
+	int minX = std::max((int)std::ceil(std::min(a.x, std::min(b.x, c.x)) - 0.5f), 0) & ~3;
+	int maxX = std::min((int)std::floor(std::max(a.x, std::max(b.x, c.x)) - 0.5f), kOcclusionWidth - 1);
+	int minY = std::max((int)std::ceil(std::min(a.y, std::min(b.y, c.y)) - 0.5f), bandTop);
+	int maxY = std::min((int)std::floor(std::max(a.y, std::max(b.y, c.y)) - 0.5f), bandBottom - 1);
+	if (minX > maxX || minY > maxY)
+		return;
+
+	// Edge functions and depth as planes over the screen: value at (0, 0) plus steps in x and y
+	float e0x = a.y - b.y, e0y = b.x - a.x, e0 = a.x * b.y - a.y * b.x;
+	float e1x = b.y - c.y, e1y = c.x - b.x, e1 = b.x * c.y - b.y * c.x;
+	float e2x = c.y - a.y, e2y = a.x - c.x, e2 = c.x * a.y - c.y * a.x;
+	float zx = ((b.z - a.z) * (c.y - a.y) - (c.z - a.z) * (b.y - a.y)) / area;
+	float zy = ((c.z - a.z) * (b.x - a.x) - (b.z - a.z) * (c.x - a.x)) / area;
+	float z0 = a.z - zx * a.x - zy * a.y;
+
+	// An edge function is smallest, and the depth largest, at one corner of the texel: half a texel off the center
+	// along each axis, towards the sign of that axis' step
+	e0 -= 0.5f * (std::abs(e0x) + std::abs(e0y));
+	e1 -= 0.5f * (std::abs(e1x) + std::abs(e1y));
+	e2 -= 0.5f * (std::abs(e2x) + std::abs(e2y));
+	z0 += 0.5f * (std::abs(zx) + std::abs(zy));
+
+	for (int y = minY; y <= maxY; y++)
+	{
+		float py = y + 0.5f;
+		float* row = depth + (size_t)y * kOcclusionWidth;
+#ifdef OCCLUSION_SSE
+		// Edge and depth values are evaluated at each group rather than stepped, so no error builds up along a row
+		__m128 e0Row = _mm_set1_ps(e0y * py + e0), e1Row = _mm_set1_ps(e1y * py + e1), e2Row = _mm_set1_ps(e2y * py + e2), zRow = _mm_set1_ps(zy * py + z0);
+		__m128 e0Step = _mm_set1_ps(e0x), e1Step = _mm_set1_ps(e1x), e2Step = _mm_set1_ps(e2x), zStep = _mm_set1_ps(zx);
+		__m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f), zero = _mm_setzero_ps();
+		for (int x = minX; x <= maxX; x += 4)
+		{
+			__m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+			__m128 w0 = _mm_add_ps(_mm_mul_ps(e0Step, px), e0Row);
+			__m128 w1 = _mm_add_ps(_mm_mul_ps(e1Step, px), e1Row);
+			__m128 w2 = _mm_add_ps(_mm_mul_ps(e2Step, px), e2Row);
+			__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(w0, zero), _mm_cmpge_ps(w1, zero)), _mm_cmpge_ps(w2, zero));
+			if (_mm_movemask_ps(inside))
+			{
+				__m128 z = _mm_add_ps(_mm_mul_ps(zStep, px), zRow);
+				__m128 old = _mm_loadu_ps(row + x);
+				__m128 nearer = _mm_min_ps(old, z);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+			}
+		}
+#else
+		for (int x = minX; x <= maxX; x++)
+		{
+			float px = x + 0.5f;
+			if (e0x * px + e0y * py + e0 >= 0.0f && e1x * px + e1y * py + e1 >= 0.0f && e2x * px + e2y * py + e2 >= 0.0f)
+				row[x] = std::min(row[x], zx * px + zy * py + z0);
+		}
+#endif
+	}
+}
+
+// Pick the largest candidates, transform them on the pool, then rasterize the bands and build the pyramid.
+// Objects with the same world matrix (instances drawn in one place) count once
+inline void renderOccluders(OcclusionCuller& culler)
+{
+	PROFILE_ZONE("occluders");
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::sort(culler.candidates.begin(), culler.candidates.end(),
+		[](const OccluderCandidate& a, const OccluderCandidate& b) { return a.score > b.score; });
+	if ((int)culler.occluders.size() < culler.maxOccluders)
+		culler.occluders.resize(culler.maxOccluders);
+	culler.occluderCount = 0;
+	for (size_t i = 0; i < culler.candidates.size() && culler.occluderCount < culler.maxOccluders; i++)
+	{
+		const OccluderCandidate& candidate = culler.candidates[i];
+		bool duplicate = false;
+		for (int j = culler.occluderCount - 1; j >= 0 && !duplicate; j--)
+			duplicate = culler.occluders[j].mesh == candidate.mesh && memcmp(&culler.occluders[j].world, candidate.world, sizeof(glm::mat4)) == 0;
+		if (duplicate)
+			continue;
+		Occluder& occluder = culler.occluders[culler.occluderCount++];
+		occluder.mesh = candidate.mesh;
+		occluder.world = *candidate.world;
+	}
+
+	parallelFor(*culler.pool, (uint32_t)culler.occluderCount, [&culler](uint32_t index, int)
+	{
+		Occluder& occluder = culler.occluders[index];
+		glm::mat4 transform = culler.viewProjection * occluder.world;
+		occluder.screen.resize(occluder.mesh->positions.size());
+		occluder.drawn = true;
+		for (size_t v = 0; v < occluder.mesh->positions.size() && occluder.drawn; v++)
+		{
+			glm::vec4 clip = transform * glm::vec4(occluder.mesh->positions[v], 1.0f);
+			occluder.drawn = clip.w > 1e-4f && clip.z >= -clip.w;
+			occluder.screen[v] = occluder.drawn ? occlusionScreenPoint(clip) : glm::vec3(0.0f);
+		}
+	});
+	culler.occluderTriangles = 0;
+	for (int i = 0; i < culler.occluderCount; i++)
+		culler.occluderTriangles += culler.occluders[i].drawn ? (int)culler.occluders[i].mesh->indices.size() / 3 : 0;
+
+	uint32_t bands = (kOcclusionHeight + kOcclusionBandRows - 1) / kOcclusionBandRows;
+	parallelFor(*culler.pool, bands, [&culler](uint32_t band, int)
+	{
+		int top = (int)band * kOcclusionBandRows, bottom = std::min(top + kOcclusionBandRows, kOcclusionHeight);
+		float* depth = culler.depth.data();
+		std::fill(depth + (size_t)top * kOcclusionWidth, depth + (size_t)bottom * kOcclusionWidth, 1.0f);
+		for (int i = 0; i < culler.occluderCount; i++)
+		{
+			const Occluder& occluder = culler.occluders[i];
+			if (!occluder.drawn)
+				continue;
+			const std::vector<uint32_t>& indices = occluder.mesh->indices;
+			for (size_t t = 0; t + 2 < indices.size(); t += 3)
+				rasterizeOccluderTriangle(depth, occluder.screen[indices[t]], occluder.screen[indices[t + 1]], occluder.screen[indices[t + 2]], top, bottom);
+		}
+		std::copy(depth + (size_t)top * kOcclusionWidth, depth + (size_t)bottom * kOcclusionWidth, culler.minLevels[0].begin() + (size_t)top * kOcclusionWidth);
+		std::copy(depth + (size_t)top * kOcclusionWidth, depth + (size_t)bottom * kOcclusionWidth, culler.maxLevels[0].begin() + (size_t)top * kOcclusionWidth);
+	});
+
+	// Each level's texel holds the min and max of the up to 2x2 texels under it
+	for (size_t level = 1; level < culler.levelWidth.size(); level++)
+	{
+		int width = culler.levelWidth[level], height = culler.levelHeight[level];
+		int fineWidth = culler.levelWidth[level - 1], fineHeight = culler.levelHeight[level - 1];
+		const std::vector<float>& fineMin = culler.minLevels[level - 1];
+		const std::vector<float>& fineMax = culler.maxLevels[level - 1];
+		for (int y = 0; y < height; y++)
+		{
+			int y0 = y * 2, y1 = std::min(y * 2 + 1, fineHeight - 1);
+			for (int x = 0; x < width; x++)
+			{
+				int x0 = x * 2, x1 = std::min(x * 2 + 1, fineWidth - 1);
+				size_t a = (size_t)y0 * fineWidth + x0, b = (size_t)y0 * fineWidth + x1, c = (size_t)y1 * fineWidth + x0, d = (size_t)y1 * fineWidth + x1;
+				culler.minLevels[level][(size_t)y * width + x] = std::min(std::min(fineMin[a], fineMin[b]), std::min(fineMin[c], fineMin[d]));
+				culler.maxLevels[level][(size_t)y * width + x] = std::max(std::max(fineMax[a], fineMax[b]), std::max(fineMax[c], fineMax[d]));
+			}
+		}
+	}
+	culler.rasterMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Min and max depth of a pyramid level over texels [x0, x1] x [y0, y1]
+inline void occlusionDepthRange(const OcclusionCuller& culler, size_t level, int x0, int y0, int x1, int y1, float& nearest, float& farthest)
+{
+	int width = culler.levelWidth[level];
+	nearest = 1.0f;
+	farthest = 0.0f;
+	for (int y = y0; y <= y1; y++)
+	{
+		for (int x = x0; x <= x1; x++)
+		{
+			nearest = std::min(nearest, culler.minLevels[level][(size_t)y * width + x]);
+			farthest = std::max(farthest, culler.maxLevels[level][(size_t)y * width + x]);
+		}
+	}
+}
+
+// Whether a world box is hidden behind the occluders
+inline bool isBoxOccluded(const OcclusionCuller& culler, const Aabb& box)
+{
+	float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY, boxNearest = INFINITY, boxFarthest = -INFINITY;
+	for (int corner = 0; corner < 8; corner++)
+	{
+		glm::vec3 p((corner & 1) ? box.max.x : box.min.x, (corner & 2) ? box.max.y : box.min.y, (corner & 4) ? box.max.z : box.min.z);
+		glm::vec4 clip = culler.viewProjection * glm::vec4(p, 1.0f);
+		if (clip.w <= 1e-4f || clip.z < -clip.w)
+			return false; // crosses the near plane
+		glm::vec3 screen = occlusionScreenPoint(clip);
+		minX = std::min(minX, screen.x);
+		maxX = std::max(maxX, screen.x);
+		minY = std::min(minY, screen.y);
+		maxY = std::max(maxY, screen.y);
+		boxNearest = std::min(boxNearest, screen.z);
+		boxFarthest = std::max(boxFarthest, screen.z);
+	}
+
+	// Pixels whose centers the rectangle may touch, the parts off screen are not drawn anyway
+	int x0 = std::max((int)std::floor(minX), 0), x1 = std::min((int)std::floor(maxX), kOcclusionWidth - 1);
+	int y0 = std::max((int)std::floor(minY), 0), y1 = std::min((int)std::floor(maxY), kOcclusionHeight - 1);
+	if (x0 > x1 || y0 > y1)
+		return false;
+
+	// Level where the rectangle covers at most 2x2 texels
+	size_t level = 0;
+	while (level + 1 < culler.levelWidth.size() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+		level++;
+	float nearest, farthest;
+	occlusionDepthRange(culler, level, x0 >> level, y0 >> level, x1 >> level, y1 >> level, nearest, farthest);
+	if (boxNearest > farthest + kOcclusionDepthBias)
+		return true;
+	if (boxFarthest < nearest)
+		return false; // in front of every occluder under it
+
+	// Finer levels fit the rectangle more closely, while it covers few enough texels
+	while (level > 0)
+	{
+		level--;
+		if (((x1 >> level) - (x0 >> level) + 1) * ((y1 >> level) - (y0 >> level) + 1) > kOcclusionMaxTexels)
+			return false;
+		occlusionDepthRange(culler, level, x0 >> level, y0 >> level, x1 >> level, y1 >> level, nearest, farthest);
+		if (boxNearest > farthest + kOcclusionDepthBias)
+			return true;
+	}
+	return false;
+}
+
+// Test `count` objects on the pool, hidden[i] is set for those behind the occluders. bounds(i) is the world box
+// of object i. Call renderOccluders first
+template <typename Bounds>
+inline void testOcclusion(OcclusionCuller& culler, uint32_t count, const Bounds& bounds)
+{
+	PROFILE_ZONE("occlusion test");
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	culler.hidden.assign(count, 0);
+	uint32_t batches = (count + kOcclusionTestBatch - 1) / kOcclusionTestBatch;
+	parallelFor(*culler.pool, batches, [&culler, &bounds, count](uint32_t batch, int)
+	{
+		uint32_t end = std::min((batch + 1) * kOcclusionTestBatch, count);
+		for (uint32_t i = batch * kOcclusionTestBatch; i < end; i++)
+			culler.hidden[i] = isBoxOccluded(culler, bounds(i));
+	});
+	uint32_t culled = 0;
+	for (uint8_t hidden : culler.hidden)
+		culled += hidden;
+	culler.tested += count;
+	culler.culled += culled;
+	culler.totalTested += count;
+	culler.totalCulled += culled;
+	culler.testMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Drop the hidden entries of a list tested with testOcclusion, keeping the order of the rest
+template <typename T>
+inline void removeOccluded(const OcclusionCuller& culler, std::vector<T>& items)
+{
+	size_t kept = 0;
+	for (size_t i = 0; i < items.size(); i++)
+		if (!culler.hidden[i])
+			items[kept++] = items[i];
+	items.resize(kept);
+}
@@ -0,0 +1,339 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Instrumentation zones for the CPU (any thread) and the GPU (GL thread), exported as a Chrome trace
+// (chrome://tracing or ui.perfetto.dev).
+//
+//     PROFILE_ZONE("cull");          CPU time of the enclosing scope
+//     PROFILE_GPU_ZONE("flush");     CPU and GPU time of the enclosing scope
+//
+// CPU zones write one event into a ring owned by their thread, nothing is allocated or locked after a
+// thread's first zone. GPU zones bracket their commands with timestamp queries from a per-frame pool,
+// read back kProfileGpuLatency frames later; results that are still not available are dropped rather than waited for.
+// Zones cost one branch while no capture runs. Build with RS_PROFILER=0 to compile every zone out.
+
+#ifndef RS_PROFILER
+#define RS_PROFILER 1
+#endif
+
+#if RS_PROFILER
+
+const size_t kProfileRingSize = 1 << 16; // events kept per thread, the oldest are overwritten
+const int kProfileGpuLatency = 4; // frames between issuing GPU queries and reading them
+const int kProfileGpuZonesPerFrame = 64;
+
+struct ProfileEvent
+{
+	const char* name; // string literal, never copied
+	int64_t start, end; // ns since the profiler started
+};
+
+// Event ring of one thread, written only by that thread
+struct ProfileThread
+{
+	std::vector<ProfileEvent> events;
+	std::atomic<uint64_t> written;
+	uint32_t id = 0;
+	std::string name;
+};
+
+// Timestamp query pairs of one frame's GPU zones
+struct GpuProfileFrame
+{
+	GLuint queries[kProfileGpuZonesPerFrame * 2] = {};
+	const char* names[kProfileGpuZonesPerFrame] = {};
+	int count = 0;
+	bool pending = false;
+};
+
+struct Profiler
+{
+	std::atomic<bool> capturing;
+	std::chrono::steady_clock::time_point epoch;
+
+	std::mutex threadsMutex;
+	std::vector<ProfileThread*> threads;
+
+	// GL thread only
+	GpuProfileFrame gpuFrames[kProfileGpuLatency];
+	int gpuFrame = 0;
+	bool gpuReady = false;
+	int64_t gpuOffset = 0; // GPU timestamp + offset = profiler time
+	ProfileThread gpuThread; // resolved GPU zones, shown as their own track
+	int gpuFramesDropped = 0;
+
+	Profiler() : capturing(false), epoch(std::chrono::steady_clock::now()) {}
+};
+
+inline Profiler& profiler()
+{
+	static Profiler instance;
+	return instance;
+}
+
+inline int64_t profileNow()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - profiler().epoch).count();
+}
+
+inline void initProfileThread(ProfileThread& thread, uint32_t id, const std::string& name)
+{
+	thread.events.resize(kProfileRingSize);
+	thread.written.store(0, std::memory_order_relaxed);
+	thread.id = id;
+	thread.name = name;
+}
+
+// Ring of the calling thread, registered on first use
+inline ProfileThread& profileThread()
+{
+	static thread_local ProfileThread* thread = nullptr;
+	if (!thread)
+	{
+		Profiler& state = profiler();
+		std::lock_guard<std::mutex> lock(state.threadsMutex);
+		thread = new ProfileThread();
+		uint32_t id = (uint32_t)state.threads.size() + 1;
+		initProfileThread(*thread, id, "Thread " + std::to_string(id));
+		state.threads.push_back(thread);
+	}
+	return *thread;
+}
+
+// Track name in the trace, threads are numbered in order of their first zone otherwise
+inline void nameProfileThread(const char* name)
+{
+	Profiler& state = profiler();
+	ProfileThread& thread = profileThread();
+	std::lock_guard<std::mutex> lock(state.threadsMutex);
+	thread.name = name;
+}
+
+inline void recordProfileEvent(ProfileThread& thread, const char* name, int64_t start, int64_t end)
+{
+	uint64_t index = thread.written.load(std::memory_order_relaxed);
+	thread.events[index & (kProfileRingSize - 1)] = { name, start, end };
+	thread.written.store(index + 1, std::memory_order_release);
+}
+
+inline bool profiling()
+{
+	return profiler().capturing.load(std::memory_order_relaxed);
+}
+
+struct ProfileZone
+{
+	const char* name;
+	int64_t start;
+
+	explicit ProfileZone(const char* zoneName) : name(profiling() ? zoneName : nullptr), start(name ? profileNow() : 0) {}
+	~ProfileZone()
+	{
+		if (name)
+			recordProfileEvent(profileThread(), name, start, profileNow());
+	}
+	ProfileZone(const ProfileZone&) = delete;
+	ProfileZone& operator=(const ProfileZone&) = delete;
+};
+
+// GL thread: timestamp queries around the zone, -1 when not capturing or the frame's pool is used up
+inline int beginGpuZone(const char* name)
+{
+	Profiler& state = profiler();
+	if (!state.gpuReady || !profiling())
+		return -1;
+	GpuProfileFrame& frame = state.gpuFrames[state.gpuFrame];
+	if (frame.count == kProfileGpuZonesPerFrame)
+		return -1;
+	int zone = frame.count++;
+	frame.names[zone] = name;
+	glQueryCounter(frame.queries[zone * 2], GL_TIMESTAMP);
+	return zone;
+}
+
+inline void endGpuZone(int zone)
+{
+	Profiler& state = profiler();
+	if (zone >= 0)
+		glQueryCounter(state.gpuFrames[state.gpuFrame].queries[zone * 2 + 1], GL_TIMESTAMP);
+}
+
+struct GpuProfileZone
+{
+	int zone;
+
+	explicit GpuProfileZone(const char* name) : zone(beginGpuZone(name)) {}
+	~GpuProfileZone() { endGpuZone(zone); }
+	GpuProfileZone(const GpuProfileZone&) = delete;
+	GpuProfileZone& operator=(const GpuProfileZone&) = delete;
+};
+
+// GL thread: queries and the GPU clock offset, call with a current context before the first GPU zone
+inline void initGpuProfiler()
+{
+	Profiler& state = profiler();
+	for (GpuProfileFrame& frame : state.gpuFrames)
+	{
+		glGenQueries(kProfileGpuZonesPerFrame * 2, frame.queries);
+		frame.count = 0;
+		frame.pending = false;
+	}
+	initProfileThread(state.gpuThread, 0, "GPU");
+	state.gpuFrame = 0;
+	state.gpuFramesDropped = 0;
+	state.gpuReady = true;
+
+	GLint64 gpuNow = 0;
+	glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+	state.gpuOffset = profileNow() - (int64_t)gpuNow;
+}
+
+inline void releaseGpuProfiler()
+{
+	Profiler& state = profiler();
+	if (!state.gpuReady)
+		return;
+	for (GpuProfileFrame& frame : state.gpuFrames)
+		glDeleteQueries(kProfileGpuZonesPerFrame * 2, frame.queries);
+	state.gpuReady = false;
+}
+
+// Read a frame's queries if the GPU is done with them, otherwise drop them
+inline void resolveGpuFrame(GpuProfileFrame& frame, bool wait)
+{
+	Profiler& state = profiler();
+	if (!frame.pending)
+		return;
+	frame.pending = false;
+	if (frame.count == 0)
+		return;
+
+	// Zones nest, so the last query issued is not necessarily the last one to finish
+	GLint available = GL_TRUE;
+	for (int zone = 0; zone < frame.count && available && !wait; zone++)
+		glGetQueryObjectiv(frame.queries[zone * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+	{
+		state.gpuFramesDropped++;
+		frame.count = 0;
+		return;
+	}
+	for (int zone = 0; zone < frame.count; zone++)
+	{
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v(frame.queries[zone * 2], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(frame.queries[zone * 2 + 1], GL_QUERY_RESULT, &end);
+		recordProfileEvent(state.gpuThread, frame.names[zone], (int64_t)begin + state.gpuOffset, (int64_t)end + state.gpuOffset);
+	}
+	frame.count = 0;
+}
+
+// GL thread, once per frame before its first GPU zone
+inline void profileFrame()
+{
+	Profiler& state = profiler();
+	if (!state.gpuReady)
+		return;
+	state.gpuFrames[state.gpuFrame].pending = true;
+	state.gpuFrame = (state.gpuFrame + 1) % kProfileGpuLatency;
+	resolveGpuFrame(state.gpuFrames[state.gpuFrame], false);
+}
+
+inline void startProfileCapture()
+{
+	profiler().capturing.store(true, std::memory_order_relaxed);
+}
+
+// GL thread: stop recording and wait for the GPU zones still in flight
+inline void stopProfileCapture()
+{
+	Profiler& state = profiler();
+	state.capturing.store(false, std::memory_order_relaxed);
+	if (!state.gpuReady)
+		return;
+	state.gpuFrames[state.gpuFrame].pending = true;
+	for (int i = 1; i <= kProfileGpuLatency; i++)
+		resolveGpuFrame(state.gpuFrames[(state.gpuFrame + i) % kProfileGpuLatency], true);
+}
+
+// Events still held by the rings, GPU track included
+inline size_t profileEventCount()
+{
+	Profiler& state = profiler();
+	std::lock_guard<std::mutex> lock(state.threadsMutex);
+	size_t count = (size_t)std::min<uint64_t>(state.gpuThread.written.load(std::memory_order_acquire), kProfileRingSize);
+	for (ProfileThread* thread : state.threads)
+		count += (size_t)std::min<uint64_t>(thread->written.load(std::memory_order_acquire), kProfileRingSize);
+	return count;
+}
+
+inline void writeProfileThread(FILE* file, const ProfileThread& thread, bool& first)
+{
+	fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+		first ? "" : ",", thread.id, thread.name.c_str());
+	first = false;
+	uint64_t written = thread.written.load(std::memory_order_acquire);
+	uint64_t begin = written > kProfileRingSize ? written - kProfileRingSize : 0;
+	for (uint64_t i = begin; i < written; i++)
+	{
+		const ProfileEvent& event = thread.events[i & (kProfileRingSize - 1)];
+		fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+			event.name, thread.id, event.start / 1000.0, (event.end - event.start) / 1000.0);
+	}
+}
+
+inline int profileGpuFramesDropped()
+{
+	return profiler().gpuFramesDropped;
+}
+
+// Chrome trace JSON of every thread's ring, taken after the capture stopped
+inline bool writeProfileTrace(const std::string& path)
+{
+	Profiler& state = profiler();
+	FILE* file = fopen(path.c_str(), "w");
+	if (!file)
+		return false;
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	bool first = true;
+	{
+		std::lock_guard<std::mutex> lock(state.threadsMutex);
+		for (const ProfileThread* thread : state.threads)
+			writeProfileThread(file, *thread, first);
+	}
+	if (state.gpuReady)
+		writeProfileThread(file, state.gpuThread, first);
+	fprintf(file, "\n]}\n");
+	return fclose(file) == 0;
+}
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_GPU_ZONE(name) PROFILE_ZONE(name); GpuProfileZone PROFILE_CONCAT(gpuProfileZone, __LINE__)(name)
+
+#else
+
+// Compiled out: the same calls, doing nothing
+inline void nameProfileThread(const char*) {}
+inline void initGpuProfiler() {}
+inline void releaseGpuProfiler() {}
+inline void profileFrame() {}
+inline void startProfileCapture() {}
+inline void stopProfileCapture() {}
+inline size_t profileEventCount() { return 0; }
+inline int profileGpuFramesDropped() { return 0; }
+inline bool writeProfileTrace(const std::string&) { return false; }
+
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_GPU_ZONE(name) ((void)0)
+
+#endif
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// Linked program binaries kept on disk between launches, one file per program.
+// Files are named by a hash of the shader sources (defines included, they are part of the source) and
+// of the driver that built them, so any change to either simply misses. A binary the driver still
+// rejects, after an update it does not report in its version string, is dropped and the program is compiled again.
+//
+// File layout: ProgramBinaryHeader, then the driver's blob as glGetProgramBinary returned it
+
+const uint32_t kProgramBinaryMagic = 0x42505352u; // "RSPB"
+const uint32_t kProgramBinaryVersion = 1;
+
+struct ProgramBinaryHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key; // checked again on load, the file name is only a lookup
+	uint32_t format; // driver binary format
+	uint32_t length;
+};
+
+struct ProgramCache
+{
+	std::string directory; // empty when disabled
+	std::string driver; // vendor, renderer and version strings
+
+	// Programs loaded from binaries, compiled because no binary existed, and binaries the driver refused
+	int hits = 0, misses = 0, rejected = 0;
+};
+
+// 64-bit FNV-1a, continued from `hash`
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	return hash;
+}
+
+inline std::string glString(GLenum name)
+{
+	const GLubyte* value = glGetString(name);
+	return value ? (const char*)value : "";
+}
+
+// Disabled when the directory is empty or the driver offers no binary format
+inline void initProgramCache(ProgramCache& cache, const std::string& directory)
+{
+	cache = ProgramCache();
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if (directory.empty() || formats <= 0)
+		return;
+
+#ifdef _WIN32
+	_mkdir(directory.c_str());
+#else
+	mkdir(directory.c_str(), 0755);
+#endif
+	cache.directory = directory;
+	cache.driver = glString(GL_VENDOR) + "\n" + glString(GL_RENDERER) + "\n" + glString(GL_VERSION) + "\n" +
+		glString(GL_SHADING_LANGUAGE_VERSION);
+}
+
+// Sources are hashed with a separator so moving text between the stages changes the key
+inline uint64_t programCacheKey(const ProgramCache& cache, const std::string& vertexSource, const std::string& fragmentSource)
+{
+	uint64_t key = hashBytes(&kProgramBinaryVersion, sizeof(kProgramBinaryVersion));
+	key = hashBytes(cache.driver.c_str(), cache.driver.size() + 1, key);
+	key = hashBytes(vertexSource.c_str(), vertexSource.size() + 1, key);
+	return hashBytes(fragmentSource.c_str(), fragmentSource.size() + 1, key);
+}
+
+inline std::string programCachePath(const ProgramCache& cache, uint64_t key)
+{
+	char name[24];
+	snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+	return cache.directory + "/" + name;
+}
+
+// New linked program from the stored binary, 0 when there is none or the driver rejects it
+inline GLuint loadCachedProgram(ProgramCache& cache, uint64_t key)
+{
+	if (cache.directory.empty())
+		return 0;
+
+	std::string path = programCachePath(cache, key);
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file)
+	{
+		cache.misses++;
+		return 0;
+	}
+	ProgramBinaryHeader header;
+	std::vector<uint8_t> blob;
+	bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == kProgramBinaryMagic &&
+		header.version == kProgramBinaryVersion && header.key == key && header.length > 0;
+	if (valid)
+	{
+		blob.resize(header.length);
+		valid = fread(blob.data(), 1, blob.size(), file) == blob.size();
+	}
+	fclose(file);
+
+	GLuint program = 0;
+	GLint linked = GL_FALSE;
+	if (valid)
+	{
+		program = glCreateProgram();
+		glProgramBinary(program, header.format, blob.data(), (GLsizei)blob.size());
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	}
+	if (!linked)
+	{
+		glDeleteProgram(program);
+		remove(path.c_str());
+		cache.rejected++;
+		return 0;
+	}
+	cache.hits++;
+	return program;
+}
+
+// Call before linking a program that is going to be stored
+inline void markProgramRetrievable(const ProgramCache& cache, GLuint program)
+{
+	if (!cache.directory.empty())
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+// Store a linked program, written to a temporary file first so a crash never leaves half a binary behind
+inline bool saveCachedProgram(const ProgramCache& cache, uint64_t key, GLuint program)
+{
+	if (cache.directory.empty())
+		return false;
+
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return false;
+	ProgramBinaryHeader header = { kProgramBinaryMagic, kProgramBinaryVersion, key, 0, 0 };
+	std::vector<uint8_t> blob((size_t)length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, blob.data());
+	header.format = format;
+	header.length = (uint32_t)length;
+
+	std::string path = programCachePath(cache, key);
+	std::string temporary = path + ".tmp";
+	FILE* file = fopen(temporary.c_str(), "wb");
+	if (!file)
+		return false;
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(blob.data(), 1, (size_t)length, file) == (size_t)length;
+	written = fclose(file) == 0 && written;
+	remove(path.c_str()); // rename does not replace on Windows
+	if (!written || rename(temporary.c_str(), path.c_str()) != 0)
+	{
+		remove(temporary.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Batch renders of camera poses from a job file (turntables, thumbnails), spread over several offscreen contexts.
+// The scene lives in globals next to its one GL context, so every context is a worker process, forked once the
+// job file is read and the mesh and texture are loaded. Workers read those through the parent's pages: the mesh
+// file stays mapped and the decoded texture is never written, so nothing is copied or loaded again.
+// Workers take the next job from a counter in shared memory, so slow and fast jobs even out, and write their
+// totals into their own slot of the same page. Without fork (Windows) the jobs run in this process.
+//
+// Job file, one job per line, # starts a comment. Angles in degrees as the orbit camera takes them:
+//     azimuth elevation radius width height perspective|ortho output.png
+
+const int kMaxFarmWorkers = 64;
+
+struct RenderJob
+{
+	float azimuth = 0.0f, elevation = 0.0f, radius = 3.0f;
+	int width = 0, height = 0;
+	bool ortho = false;
+	std::string outputPath;
+};
+
+// Totals of one worker, written by that worker only
+struct FarmWorkerStats
+{
+	bool started; // context created and scene set up
+	int images, failures;
+	double setupMs, renderMs, readbackMs, encodeMs;
+};
+
+struct FarmShared
+{
+	std::atomic<uint32_t> nextJob;
+	FarmWorkerStats workers[kMaxFarmWorkers];
+
+	FarmShared() : nextJob(0), workers() {}
+};
+
+// Jobs in file order, false with the line that could not be read
+inline bool loadRenderJobs(const std::string& path, std::vector<RenderJob>& jobs, std::string& error)
+{
+	jobs.clear();
+	std::ifstream in(path);
+	if (!in)
+	{
+		error = "cannot open the job file";
+		return false;
+	}
+	std::string line;
+	for (int lineNumber = 1; std::getline(in, line); lineNumber++)
+	{
+		size_t comment = line.find('#');
+		if (comment != std::string::npos)
+			line.erase(comment);
+		std::istringstream fields(line);
+		RenderJob job;
+		std::string projection;
+		if (!(fields >> job.azimuth))
+			continue; // blank line
+		if (!(fields >> job.elevation >> job.radius >> job.width >> job.height >> projection >> job.outputPath) ||
+			job.width <= 0 || job.height <= 0 || job.radius <= 0.0f || (projection != "perspective" && projection != "ortho"))
+		{
+			error = "line " + std::to_string(lineNumber) + ": expected azimuth elevation radius width height perspective|ortho output.png";
+			return false;
+		}
+		job.ortho = projection == "ortho";
+		jobs.push_back(job);
+	}
+	if (jobs.empty())
+	{
+		error = "no jobs";
+		return false;
+	}
+	return true;
+}
+
+// Counter and worker slots visible to every worker process
+inline FarmShared* createFarmShared()
+{
+#ifndef _WIN32
+	void* memory = mmap(nullptr, sizeof(FarmShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	return memory == MAP_FAILED ? nullptr : new (memory) FarmShared();
+#else
+	return new FarmShared();
+#endif
+}
+
+inline void releaseFarmShared(FarmShared* shared)
+{
+#ifndef _WIN32
+	shared->~FarmShared();
+	munmap(shared, sizeof(FarmShared));
+#else
+	delete shared;
+#endif
+}
+
+// Worker: the next job nobody has taken, false when all are taken
+inline bool claimRenderJob(FarmShared& shared, uint32_t jobCount, uint32_t& job)
+{
+	job = shared.nextJob.fetch_add(1, std::memory_order_relaxed);
+	return job < jobCount;
+}
+
+// Run work(worker) in `workers` processes and wait for all of them, returns how many exited cleanly.
+// Workers must not have a GL context or threads from the parent, both are created after the fork
+inline int runFarmWorkers(int workers, const std::function<int(int)>& work)
+{
+#ifndef _WIN32
+	// Output still buffered here would be written once by every worker as well
+	fflush(nullptr);
+	std::vector<pid_t> children;
+	for (int worker = 0; worker < workers && worker < kMaxFarmWorkers; worker++)
+	{
+		pid_t child = fork();
+		if (child == 0)
+		{
+			int status = work(worker);
+			fflush(nullptr);
+			_exit(status); // the parent's atexit handlers and static objects are not the worker's to run
+		}
+		if (child > 0)
+			children.push_back(child);
+	}
+	int clean = 0;
+	for (pid_t child : children)
+	{
+		int status = 0;
+		if (waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+			clean++;
+	}
+	return clean;
+#else
+	return work(0) == 0 ? 1 : 0;
+#endif
+}
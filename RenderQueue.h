@@ -0,0 +1,252 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "GLStateCache.h"
+#include "GpuRingBuffer.h"
+#include "Profiler.h"
+
+// Sort-keyed draw queue that merges identical mesh/material draws into instanced calls
+
+// Per-instance transform attribute slots (a mat4 takes four locations, a mat3 three)
+const GLuint kInstanceModelLocation = 4;
+const GLuint kInstanceNormalLocation = 8;
+
+// World and normal matrix of one instance, as laid out in the instance buffer
+struct InstanceData
+{
+	glm::mat4 model;
+	glm::mat3 normal;
+};
+
+// Index range of a VAO that is drawn as one unit
+struct DrawMesh
+{
+	GLuint vao = 0;
+	GLenum mode = GL_TRIANGLES;
+	GLsizei indexCount = 0;
+	GLenum indexType = GL_UNSIGNED_SHORT;
+	GLsizeiptr indexOffset = 0; // bytes into the element buffer
+	uint16_t id = 0; // unique per mesh range, part of the sort key
+
+	// Quantized positions are decoded by folding scale and offset into each instance's model matrix
+	bool quantized = false;
+	glm::vec3 positionScale = glm::vec3(1.0f), positionOffset = glm::vec3(0.0f);
+
+	// Object space box of the range, for culling
+	glm::vec3 boundsMin = glm::vec3(0.0f), boundsMax = glm::vec3(0.0f);
+};
+
+struct DrawItem
+{
+	uint64_t key;
+	GLuint program, texture;
+	const DrawMesh* mesh;
+	uint32_t instance; // index into RenderQueue::instances
+};
+
+struct RenderQueue
+{
+	std::vector<DrawItem> items;
+	std::vector<InstanceData> instances;
+	std::vector<InstanceData> batchedInstances; // instances in draw order for upload
+	glm::mat4 viewMatrix;
+	float nearPlane = 0.1f, farPlane = 100.0f;
+
+	GLuint instanceVBO = 0;
+	GLsizeiptr instanceCapacity = 0;
+
+	// Per-frame memory for the instances when set, otherwise the instance VBO is orphaned and refilled.
+	// Where this frame's instances ended up
+	GpuRingBuffer* ring = nullptr;
+	GLuint instanceBuffer = 0;
+	GLintptr instanceBase = 0;
+
+	// Stats of the last flush
+	int drawCalls = 0, submittedItems = 0;
+};
+
+// Key layout, most significant first: program 12 | vao 12 | texture 12 | mesh 12 | depth 16
+inline uint64_t makeSortKey(GLuint program, GLuint vao, GLuint texture, uint16_t mesh, uint16_t depth)
+{
+	return ((uint64_t)(program & 0xFFF) << 52) | ((uint64_t)(vao & 0xFFF) << 40) |
+		((uint64_t)(texture & 0xFFF) << 28) | ((uint64_t)(mesh & 0xFFF) << 16) | depth;
+}
+
+// Everything above the depth bits must match for two items to share a draw call
+inline bool sameBatch(const DrawItem& a, const DrawItem& b)
+{
+	return (a.key >> 16) == (b.key >> 16) && a.program == b.program && a.texture == b.texture && a.mesh == b.mesh;
+}
+
+inline void initRenderQueue(RenderQueue& queue)
+{
+	glGenBuffers(1, &queue.instanceVBO);
+}
+
+inline void releaseRenderQueue(RenderQueue& queue)
+{
+	glDeleteBuffers(1, &queue.instanceVBO);
+	queue.instanceVBO = 0;
+	queue.instanceCapacity = 0;
+}
+
+// Enable the instance transform attributes on the bound VAO, call once per VAO at setup
+inline void enableInstanceAttributes(const RenderQueue& queue)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, queue.instanceVBO);
+	for (GLuint column = 0; column < 4; column++)
+	{
+		GLuint location = kInstanceModelLocation + column;
+		glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (GLvoid*)(column * sizeof(glm::vec4)));
+		glEnableVertexAttribArray(location);
+		glVertexAttribDivisor(location, 1);
+	}
+	for (GLuint column = 0; column < 3; column++)
+	{
+		GLuint location = kInstanceNormalLocation + column;
+		glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (GLvoid*)(sizeof(glm::mat4) + column * sizeof(glm::vec3)));
+		glEnableVertexAttribArray(location);
+		glVertexAttribDivisor(location, 1);
+	}
+}
+
+// Point the bound VAO's instance transforms at the first instance of a batch
+inline void bindInstanceAttributes(GLuint instanceVBO, GLsizeiptr offset)
+{
+	stateBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+	for (GLuint column = 0; column < 4; column++)
+		glVertexAttribPointer(kInstanceModelLocation + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+			(GLvoid*)(offset + column * sizeof(glm::vec4)));
+	for (GLuint column = 0; column < 3; column++)
+		glVertexAttribPointer(kInstanceNormalLocation + column, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+			(GLvoid*)(offset + sizeof(glm::mat4) + column * sizeof(glm::vec3)));
+}
+
+inline void beginRenderQueue(RenderQueue& queue, const glm::mat4& viewMatrix, float nearPlane, float farPlane)
+{
+	queue.items.clear();
+	queue.instances.clear();
+	queue.viewMatrix = viewMatrix;
+	queue.nearPlane = nearPlane;
+	queue.farPlane = farPlane;
+}
+
+// Sort key and instance transforms of one object, nearer objects sort first within a batch.
+// The item's instance index is left for the caller to fill
+inline DrawItem prepareDrawItem(const glm::mat4& viewMatrix, float nearPlane, float farPlane, GLuint program, const DrawMesh& mesh,
+	GLuint texture, const glm::mat4& world, const glm::mat3& normal, InstanceData& instance)
+{
+	// model = world * translate(positionOffset) * scale(positionScale), the normal matrix stays the world one
+	glm::mat4 model = world;
+	if (mesh.quantized)
+	{
+		model[3] = world * glm::vec4(mesh.positionOffset, 1.0f);
+		model[0] = world[0] * mesh.positionScale.x;
+		model[1] = world[1] * mesh.positionScale.y;
+		model[2] = world[2] * mesh.positionScale.z;
+	}
+
+	float viewDepth = -(viewMatrix * model[3]).z;
+	float depth01 = glm::clamp((viewDepth - nearPlane) / (farPlane - nearPlane), 0.0f, 1.0f);
+
+	DrawItem item;
+	item.key = makeSortKey(program, mesh.vao, texture, mesh.id, (uint16_t)(depth01 * 65535.0f));
+	item.program = program;
+	item.texture = texture;
+	item.mesh = &mesh;
+	item.instance = 0;
+
+	instance.model = model;
+	instance.normal = normal;
+	return item;
+}
+
+// Queue one object with its precomputed normal matrix
+inline void submitDraw(RenderQueue& queue, GLuint program, const DrawMesh& mesh, GLuint texture, const glm::mat4& world, const glm::mat3& normal)
+{
+	InstanceData instance;
+	DrawItem item = prepareDrawItem(queue.viewMatrix, queue.nearPlane, queue.farPlane, program, mesh, texture, world, normal, instance);
+	item.instance = (uint32_t)queue.instances.size();
+	queue.items.push_back(item);
+	queue.instances.push_back(instance);
+}
+
+// Memory for this frame's instances in draw order: mapped GPU memory from the ring, or the upload array
+inline InstanceData* beginInstanceUpload(RenderQueue& queue, size_t count)
+{
+	if (queue.ring)
+	{
+		GpuAllocation allocation = allocateGpuRing(*queue.ring, count * sizeof(InstanceData), 16);
+		queue.instanceBuffer = allocation.buffer;
+		queue.instanceBase = allocation.offset;
+		return (InstanceData*)allocation.data;
+	}
+	queue.batchedInstances.resize(count);
+	return queue.batchedInstances.data();
+}
+
+// Make the written instances visible to the draws. Without a ring the buffer is orphaned, so last frame's
+// draws never stall the upload
+inline void finishInstanceUpload(RenderQueue& queue)
+{
+	if (queue.ring)
+	{
+		flushGpuRing(*queue.ring);
+		return;
+	}
+	GLsizeiptr bytes = (GLsizeiptr)(queue.batchedInstances.size() * sizeof(InstanceData));
+	stateBindBuffer(GL_ARRAY_BUFFER, queue.instanceVBO);
+	queue.instanceCapacity = std::max(queue.instanceCapacity, bytes);
+	glBufferData(GL_ARRAY_BUFFER, queue.instanceCapacity, nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, queue.batchedInstances.data());
+	queue.instanceBuffer = queue.instanceVBO;
+	queue.instanceBase = 0;
+}
+
+// Sort, upload instance transforms and issue one instanced draw per batch.
+// Bindings are left as they are, the state cache drops them next frame if nothing changed
+inline void flushRenderQueue(RenderQueue& queue)
+{
+	queue.drawCalls = 0;
+	queue.submittedItems = (int)queue.items.size();
+	if (queue.items.empty())
+		return;
+
+	{
+		PROFILE_ZONE("sort and upload instances");
+		std::sort(queue.items.begin(), queue.items.end(),
+			[](const DrawItem& a, const DrawItem& b) { return a.key < b.key; });
+
+		InstanceData* batched = beginInstanceUpload(queue, queue.items.size());
+		for (size_t i = 0; i < queue.items.size(); i++)
+			batched[i] = queue.instances[queue.items[i].instance];
+		finishInstanceUpload(queue);
+	}
+
+	size_t first = 0;
+	while (first < queue.items.size())
+	{
+		size_t last = first + 1;
+		while (last < queue.items.size() && sameBatch(queue.items[first], queue.items[last]))
+			last++;
+
+		// Knives are the textured objects, lamps the untextured ones
+		const DrawItem& item = queue.items[first];
+		const DrawMesh& mesh = *item.mesh;
+		PROFILE_GPU_ZONE(item.texture ? "textured batch" : "untextured batch");
+		stateUseProgram(item.program);
+		stateBindVertexArray(mesh.vao);
+		if (item.texture)
+			stateBindTexture(0, GL_TEXTURE_2D, item.texture);
+
+		bindInstanceAttributes(queue.instanceBuffer, queue.instanceBase + (GLsizeiptr)(first * sizeof(InstanceData)));
+		glDrawElementsInstanced(mesh.mode, mesh.indexCount, mesh.indexType, (GLvoid*)mesh.indexOffset, (GLsizei)(last - first));
+		queue.drawCalls++;
+		first = last;
+	}
+}
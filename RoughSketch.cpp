@@ -1,6 +1,10 @@
 #include <GLEW/glew.h>
 #include <GLFW/glfw3.h>
 #include <iostream>
+#include <cstdlib>
+#include <string>
+#include <cmath>
+#include <chrono>
 
 // GLM Mathematics
 #include <glm/glm.hpp>
@@ -10,6 +14,72 @@
 //SOIL
 #include <SOIL2/SOIL2.h>;
 
+// Headless rendering and frame-time benchmark
+#include "Headless.h"
+#include "FrameBenchmark.h"
+
+// CPU and GPU zones exported as a Chrome trace
+#include "Profiler.h"
+
+// Redundant state filtering
+#include "GLStateCache.h"
+
+// Instanced draw submission
+#include "RenderQueue.h"
+
+// Draw lists recorded on worker threads and replayed on the GL thread
+#include "CommandBuffer.h"
+
+// Reflected shader programs and shared frame uniforms
+#include "ShaderProgram.h"
+
+// Linked program binaries cached on disk
+#include "ProgramCache.h"
+
+// Clustered point lights
+#include "ClusteredLights.h"
+
+// Scene transform hierarchy
+#include "TransformStore.h"
+
+// Memory mapped binary meshes and vertex compression
+#include "MeshFile.h"
+#include "MeshUpload.h"
+#include "VertexQuantize.h"
+
+// Triangulation and vertex cache / overdraw ordering
+#include "MeshOptimize.h"
+
+// Simplified levels of detail picked by screen space error
+#include "MeshLod.h"
+
+// Frustum culling over a bounding volume hierarchy of the scene instances
+#include "Bvh.h"
+
+// Baked block compressed textures
+#include "TextureUpload.h"
+
+// Files decoded on worker threads and streamed into GL under a per-frame budget
+#include "AssetLoader.h"
+
+// Simulation and render threads share frame states through a triple buffer
+#include "FrameState.h"
+
+// Tile based software rasterizer, drawing the scene on hosts without a GPU
+#include "SoftRaster.h"
+
+// Batch renders of camera poses on several offscreen contexts
+#include "RenderFarm.h"
+
+// Frames read back through a ring of pack buffers and encoded on worker threads
+#include "FrameCapture.h"
+
+// Scene files split into chunks, paged in around the camera under a memory budget
+#include "SceneStream.h"
+
+// Objects hidden behind the nearest knives, found on a CPU depth buffer
+#include "OcclusionCull.h"
+
 using namespace std;
 
 int width, height;
@@ -44,6 +114,9 @@ glm::vec3 CameraFront = glm::vec3(0.0f, 0.0f, -1.0f); // 1 unit away from lense
 // Camera Transformation Prototype
 void TransformCamera();
 
+// Orbit Camera Prototype
+void orbitCamera();
+
 // Boolean array for keys and mouse buttons
 bool keys[1024], mouseButtons[3];
 
@@ -67,24 +140,181 @@ glm::vec3 lightPosition1(-1.0f, 1.0f, 1.0f);
 //Light position 2
 glm::vec3 lightPosition2(1.0f, 1.0f, 1.0f);
 
+// Scene transforms
+glm::vec3 planeScale[] =
+{
+glm::vec3(.5f, .5f, .5f)
+};
+
+// Plane Transforms
+glm::vec3 planePositionsBox[] = {
+	glm::vec3(0.0f,  0.0f,  0.5f),
+	glm::vec3(0.5f,  0.0f,  0.0f),
+	glm::vec3(0.0f,  0.0f,  -0.5f),
+	glm::vec3(-0.5f, 0.0f,  0.0f),
+	glm::vec3(0.0f, 0.5f,  0.0f),
+	glm::vec3(0.0f, -0.5f,  0.0f)
+};
+
+glm::float32 planeRotationsBox[] = {
+	0.0f, 90.0f, 180.0f, -90.0f, -90.f, 90.f
+};
+
+// Lamp quad, drawn as the six faces of each lamp box
+GLfloat lampVertices[] =
+{
+	-0.5, -0.5, 0.0, //index 0
 
 
-void drawLamp()
-{
-	GLenum mode = GL_TRIANGLES;
-	GLsizei indices = 6;
-	glDrawElements(mode, indices, GL_UNSIGNED_BYTE, nullptr);
-}
+	-0.5, 0.5, 0.0, //index 1
 
-// Draw Primitive(s)
-void drawKnife()
-{
-	glClear(GL_STENCIL_BUFFER_BIT);
-	GLenum mode = GL_QUADS;
-	GLsizei indices = 104;
-	glDrawElements(mode, indices, GL_UNSIGNED_BYTE, nullptr);
-}
 
+	0.5, -0.5, 0.0,  //index 2	
+
+
+	0.5, 0.5, 0.0  //index 3	
+};
+
+GLubyte indicesBox[] =
+{
+	0, 1, 2,
+	1, 2, 3
+};
+
+
+// Scene GPU resources
+GLuint knifeVBO, knifeEBO, knifeVAO, lightVBO, lightEBO, lightVAO, light2VBO, light2EBO, light2VAO;
+GLuint knifeTextures;
+ShaderProgram shaderProgram, lampShaderProgram, lamp2ShaderProgram;
+GpuRingBuffer frameRing; // frame uniforms and instance transforms, one region per frame in flight
+int framesInFlight = kDefaultGpuRingRegions;
+
+// Index ranges drawn per object, the knife has one LOD chain per submesh
+vector<MeshLods> knifeMeshes;
+DrawMesh lampMesh, lamp2Mesh;
+
+// Mesh file replacing the built-in knife geometry, and how long it took to load
+string knifeMeshPath;
+double knifeMeshLoadMs = 0.0;
+
+// Knife texture, a baked KTX2 file or an image decoded at startup, with its load time and GPU size
+string knifeTexturePath = "metalTex.jpg";
+double knifeTextureLoadMs = 0.0;
+uint64_t knifeTextureBytes = 0;
+
+// Batch runs: the knife mesh file and texture, loaded once before the workers start and read by all of them
+bool sharedKnifeAssets = false;
+MeshFile sharedKnifeFile;
+TextureFile sharedKnifeTexture;
+unsigned char* sharedKnifeImage = nullptr;
+int sharedKnifeImageWidth = 0, sharedKnifeImageHeight = 0;
+
+// Compress the knife vertices at load time, with the resulting layout and error bounds
+bool quantizeVertexData = false;
+QuantizedVertices knifeQuantized;
+
+// Vertex cache efficiency of the knife before and after reordering
+VertexCacheStats knifeCacheBefore, knifeCacheAfter;
+
+// Knife levels of detail (1 = full detail only), the pixel error that selects them,
+// triangles drawn last frame and level changes since setup
+int lodLevels = 1;
+float lodErrorPixels = kLodErrorPixels;
+atomic<int> lodTrianglesDrawn(0), lodSwitches(0); // counted on the threads recording draws
+
+// Mesh and texture files load in the background, the built-in knife and a grey texture are drawn until they are resident.
+// Time from the start of setup to the first frame and until nothing is left loading
+bool asyncLoading = true;
+int uploadBudgetMB = kDefaultUploadBudgetMB;
+AssetLoader assetLoader;
+Asset* knifeMeshAsset = nullptr;
+Asset* knifeTextureAsset = nullptr;
+vector<Asset*> finishedAssets;
+chrono::steady_clock::time_point setupStart;
+double firstFrameMs = 0.0, assetsResidentMs = 0.0;
+bool firstFrameDrawn = false;
+
+// Per-frame draw queue
+RenderQueue renderQueue;
+
+// Worker threads recording the draw lists, the GL thread takes part. Serial submission through the queue alone for comparison
+WorkStealingPool drawPool;
+DrawLists drawLists;
+int workerThreads = 1;
+bool serialDraws = false;
+
+// World and normal matrices of everything in the scene, updated only when something moves
+TransformStore sceneTransforms;
+TransformId lampRoot1, lampRoot2;
+
+// Drawable attached to a transform node
+struct SceneObject
+{
+	TransformId node;
+	GLuint program;
+	const DrawMesh* mesh;
+	GLuint texture;
+	const MeshLods* lods = nullptr; // replaces mesh with the level picked each frame
+	int lod = 0;
+};
+vector<SceneObject> sceneObjects;
+
+// Scene objects by bounds, what passed the frustum test last frame, and the average time spent culling
+SceneBvh sceneBvh;
+vector<uint32_t> visibleObjects;
+bool frustumCulling = true;
+double cullTimeMs = 0.0;
+int cullFrames = 0;
+
+// Point lights binned into view frustum clusters
+LightClusters lightClusters;
+
+// Extra point lights scattered around the scene, for scaling tests
+int extraLights = 0;
+
+// Extra knives laid out on a grid, for scaling tests
+int extraParts = 0;
+
+// Scene file whose chunks near the camera are drawn in place of the built-in and extra knives
+string scenePath;
+int streamBudgetMB = kDefaultStreamBudgetMB;
+float streamRadius = kDefaultStreamRadius;
+SceneStream sceneStream;
+
+// Occlusion culling after the frustum test: the knives covering the most of the screen are drawn into a CPU depth
+// buffer and whatever they hide is not submitted. The knife's full detail triangles are the occluder
+bool occlusionCulling = false;
+int maxOccluders = kDefaultOccluders;
+OcclusionCuller occlusionCuller;
+OccluderMesh knifeOccluder;
+
+// Program binaries from earlier launches, and the time spent creating programs at startup
+string shaderCachePath = "shadercache";
+ProgramCache programCache;
+double shaderMs = 0.0;
+
+// Software renderer: the knife and lamp geometry and the knife texture in memory, the draws of the current frame,
+// and the pool that bins and rasterizes them. A mesh file stays mapped while it is drawn
+WorkStealingPool softPool;
+SoftRasterizer softRaster;
+SoftMesh softKnifeMesh, softLampMesh;
+vector<float> softKnifeVertices;
+vector<uint8_t> softKnifeIndices;
+MeshFile softKnifeFile;
+SoftTexture softKnifeTexture;
+SoftFrame softFrame;
+vector<SoftDraw> softDraws;
+vector<pair<float, uint32_t>> softDrawOrder; // view depth, scene object or sceneObjects.size() + streamed instance
+
+// Windowed runs: states from the simulation thread to the render thread, and the render thread's stop request.
+// The simulation skips ahead rather than catch up on more than a quarter second
+TripleBuffer<FrameState> frameStates;
+atomic<bool> renderStopping(false);
+
+// Windowed runs: late camera latch and input published as it arrives, and the time of the newest input event
+bool lowLatency = false;
+int64_t lastInputNs = 0;
+const double kMaxSimulationLag = 0.25;
 
 
 
@@ -101,86 +331,394 @@ static GLuint CompileShader(const string& source, GLuint shaderType)
 	// Compile Shader
 	glCompileShader(shaderID);
 
+	// Report errors, the program fails to link after this
+	string log;
+	if (!shaderCompiled(shaderID, log))
+		cout << "Error! " << (shaderType == GL_VERTEX_SHADER ? "Vertex" : "Fragment") << " shader: " << log << endl;
+
 	// Return ID of Compiled shader
 	return shaderID;
 
 }
 
-// Create Program Object
-static GLuint CreateShaderProgram(const string& vertexShader, const string& fragmentShader)
+// Create Program Object from a cached binary or from source, and reflect its uniforms
+static ShaderProgram CreateShaderProgram(const string& vertexShader, const string& fragmentShader)
 {
-	// Compile vertex shader
-	GLuint vertexShaderComp = CompileShader(vertexShader, GL_VERTEX_SHADER);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	ShaderProgram shaderProgram;
+
+	// Binary linked by an earlier launch with the same sources and driver
+	uint64_t cacheKey = programCacheKey(programCache, vertexShader, fragmentShader);
+	shaderProgram.id = loadCachedProgram(programCache, cacheKey);
+	if (!shaderProgram.id)
+	{
+		// Compile vertex shader
+		GLuint vertexShaderComp = CompileShader(vertexShader, GL_VERTEX_SHADER);
+
+		// Compile fragment shader
+		GLuint fragmentShaderComp = CompileShader(fragmentShader, GL_FRAGMENT_SHADER);
 
-	// Compile fragment shader
-	GLuint fragmentShaderComp = CompileShader(fragmentShader, GL_FRAGMENT_SHADER);
+		// Create program object
+		shaderProgram.id = glCreateProgram();
 
-	// Create program object
-	GLuint shaderProgram = glCreateProgram();
+		// Attach vertex and fragment shaders to program object
+		glAttachShader(shaderProgram.id, vertexShaderComp);
+		glAttachShader(shaderProgram.id, fragmentShaderComp);
+
+		// Link shaders to create executable, and keep it for the next launch
+		markProgramRetrievable(programCache, shaderProgram.id);
+		glLinkProgram(shaderProgram.id);
+		string log;
+		if (!programLinked(shaderProgram.id, log))
+			cout << "Error! Program link: " << log << endl;
+		else
+			saveCachedProgram(programCache, cacheKey, shaderProgram.id);
 
-	// Attach vertex and fragment shaders to program object
-	glAttachShader(shaderProgram, vertexShaderComp);
-	glAttachShader(shaderProgram, fragmentShaderComp);
+		// Delete compiled vertex and fragment shaders
+		glDetachShader(shaderProgram.id, vertexShaderComp);
+		glDetachShader(shaderProgram.id, fragmentShaderComp);
+		glDeleteShader(vertexShaderComp);
+		glDeleteShader(fragmentShaderComp);
+	}
 
-	// Link shaders to create executable
-	glLinkProgram(shaderProgram);
+	// Look up uniform locations and blocks once
+	reflectShaderProgram(shaderProgram);
 
-	// Delete compiled vertex and fragment shaders
-	glDeleteShader(vertexShaderComp);
-	glDeleteShader(fragmentShaderComp);
+	shaderMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
 
 	// Return Shader Program
 	return shaderProgram;
 
 }
 
-
-int main(void)
+// Command line options
+struct LaunchOptions
 {
-	width = 640; height = 480;
+	bool headless = false;
+	int width = 640, height = 480;
+	int frames = 600; // recorded benchmark frames
+	int warmupFrames = 60; // frames rendered before recording
+	float orbitTurns = 1.0f; // full camera orbits over the run
+	string jsonPath; // benchmark report, stdout when empty
+	int parts = 0; // extra knives on a grid
+	int lights = 0; // extra point lights
+	string meshPath; // mesh file drawn in place of the knife
+	bool quantize = false; // compressed knife vertices
+	bool lod = false; // knife LOD chains
+	float lodError = kLodErrorPixels; // screen space error in pixels
+	bool cull = true; // frustum culling
+	string texturePath = "metalTex.jpg"; // knife texture, .ktx2 files are uploaded as baked
+	bool syncLoad = false; // load files on the GL thread before the first frame
+	int uploadBudget = kDefaultUploadBudgetMB; // MB streamed into GL per frame
+	string shaderCache = "shadercache"; // program binary directory, empty to always compile
+	string profilePath; // Chrome trace of the run, no capture when empty
+	bool software = false; // CPU rasterizer, no GL context
+	int threads = 0; // software renderer and draw recording threads, 0 for every hardware thread
+	bool serialDraws = false; // draws prepared on the GL thread only
+	string screenshotPath; // PNG of the last frame
+	bool lowLatency = false; // late camera latch and one frame in flight, windowed runs
+	int framesInFlight = 0; // 0 for the default, 1 with --low-latency
+	string latencyPath; // input to present latency report of a windowed run, none when empty
+	string batchPath; // job file of poses to render offscreen, see RenderFarm.h
+	int contexts = 0; // batch worker contexts, 0 for one per hardware thread
+	string recordPattern; // every frame to PNG (.png) or raw RGB files, # marks the frame number
+	string recordPipe; // command receiving every frame as raw RGB on its standard input
+	int captureSlots = kDefaultCaptureSlots; // frames between a readback and its mapping
+	int encoders = 0; // capture encoder threads, 0 for the default
+	string scenePath; // chunked scene file drawn in place of the knives, see SceneFile.h
+	int streamBudget = kDefaultStreamBudgetMB; // MB of resident scene chunks
+	float streamRadius = kDefaultStreamRadius; // scene chunks closer to the camera are paged in
+	bool occlusion = false; // occlusion culling on a CPU depth buffer
+	int occluders = kDefaultOccluders; // knives drawn into it per frame
+};
+
+static bool parseLaunchOptions(int argc, char* argv[], LaunchOptions& options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--headless")
+			options.headless = true;
+		else if (arg == "--width" && hasValue)
+			options.width = atoi(argv[++i]);
+		else if (arg == "--height" && hasValue)
+			options.height = atoi(argv[++i]);
+		else if (arg == "--frames" && hasValue)
+			options.frames = atoi(argv[++i]);
+		else if (arg == "--warmup" && hasValue)
+			options.warmupFrames = atoi(argv[++i]);
+		else if (arg == "--orbits" && hasValue)
+			options.orbitTurns = (float)atof(argv[++i]);
+		else if (arg == "--json" && hasValue)
+			options.jsonPath = argv[++i];
+		else if (arg == "--parts" && hasValue)
+			options.parts = atoi(argv[++i]);
+		else if (arg == "--lights" && hasValue)
+			options.lights = atoi(argv[++i]);
+		else if (arg == "--mesh" && hasValue)
+			options.meshPath = argv[++i];
+		else if (arg == "--quantize")
+			options.quantize = true;
+		else if (arg == "--lod")
+			options.lod = true;
+		else if (arg == "--lod-error" && hasValue)
+			options.lodError = (float)atof(argv[++i]);
+		else if (arg == "--no-cull")
+			options.cull = false;
+		else if (arg == "--texture" && hasValue)
+			options.texturePath = argv[++i];
+		else if (arg == "--sync-load")
+			options.syncLoad = true;
+		else if (arg == "--upload-budget" && hasValue)
+			options.uploadBudget = atoi(argv[++i]);
+		else if (arg == "--shader-cache" && hasValue)
+			options.shaderCache = argv[++i];
+		else if (arg == "--no-shader-cache")
+			options.shaderCache.clear();
+		else if (arg == "--profile" && hasValue && RS_PROFILER)
+			options.profilePath = argv[++i];
+		else if (arg == "--software")
+			options.software = true;
+		else if (arg == "--threads" && hasValue)
+			options.threads = atoi(argv[++i]);
+		else if (arg == "--serial-draws")
+			options.serialDraws = true;
+		else if (arg == "--screenshot" && hasValue)
+			options.screenshotPath = argv[++i];
+		else if (arg == "--low-latency")
+			options.lowLatency = true;
+		else if (arg == "--frames-in-flight" && hasValue)
+			options.framesInFlight = atoi(argv[++i]);
+		else if (arg == "--latency" && hasValue)
+			options.latencyPath = argv[++i];
+		else if (arg == "--batch" && hasValue)
+			options.batchPath = argv[++i];
+		else if (arg == "--contexts" && hasValue)
+			options.contexts = atoi(argv[++i]);
+		else if (arg == "--record" && hasValue)
+			options.recordPattern = argv[++i];
+		else if (arg == "--record-pipe" && hasValue)
+			options.recordPipe = argv[++i];
+		else if (arg == "--capture-slots" && hasValue)
+			options.captureSlots = atoi(argv[++i]);
+		else if (arg == "--encoders" && hasValue)
+			options.encoders = atoi(argv[++i]);
+		else if (arg == "--scene" && hasValue)
+			options.scenePath = argv[++i];
+		else if (arg == "--stream-budget" && hasValue)
+			options.streamBudget = atoi(argv[++i]);
+		else if (arg == "--stream-radius" && hasValue)
+			options.streamRadius = (float)atof(argv[++i]);
+		else if (arg == "--occlusion")
+			options.occlusion = true;
+		else if (arg == "--occluders" && hasValue)
+			options.occluders = atoi(argv[++i]);
+		else
+		{
+			cout << "Unknown option: " << arg << endl;
+			cout << "Usage: RoughSketch [--headless] [--width W] [--height H] [--frames N] [--warmup N] [--orbits N] [--json file] [--parts N] [--lights N] [--mesh file] [--quantize] [--lod] [--lod-error px] [--no-cull] [--texture file] [--sync-load] [--upload-budget MB] [--shader-cache dir] [--no-shader-cache] [--profile trace.json] [--software] [--threads N] [--serial-draws] [--screenshot file.png] [--low-latency] [--frames-in-flight N] [--latency file.json] [--batch jobs.txt] [--contexts N] [--record frame_#####.png] [--record-pipe command] [--capture-slots N] [--encoders N] [--scene file.rssc] [--stream-budget MB] [--stream-radius R] [--occlusion] [--occluders N]" << endl;
+			return false;
+		}
+	}
+	return options.width > 0 && options.height > 0 && options.frames > 0 && options.warmupFrames >= 0 && options.parts >= 0 && options.lights >= 0 && options.lodError > 0.0f && options.uploadBudget > 0 && options.threads >= 0 &&
+		options.framesInFlight >= 0 && options.framesInFlight <= kMaxGpuRingRegions && options.contexts >= 0 &&
+		options.captureSlots > 0 && options.captureSlots <= kMaxCaptureSlots && options.encoders >= 0 && (options.recordPattern.empty() || options.recordPipe.empty()) &&
+		options.streamBudget > 0 && options.streamRadius > 0.0f && options.occluders > 0;
+}
 
-	GLFWwindow* window;
+// Scene settings shared by every way of running
+static void applyLaunchOptions(const LaunchOptions& options)
+{
+	extraParts = options.parts;
+	extraLights = options.lights;
+	knifeMeshPath = options.meshPath;
+	quantizeVertexData = options.quantize;
+	lodLevels = options.lod ? kMaxLodLevels : 1;
+	lodErrorPixels = options.lodError;
+	frustumCulling = options.cull;
+	knifeTexturePath = options.texturePath;
+	asyncLoading = !options.syncLoad;
+	uploadBudgetMB = options.uploadBudget;
+	shaderCachePath = options.shaderCache;
+	lowLatency = options.lowLatency;
+	workerThreads = options.threads > 0 ? options.threads : max((int)thread::hardware_concurrency(), 1);
+	serialDraws = options.serialDraws;
+	framesInFlight = options.framesInFlight > 0 ? options.framesInFlight : options.lowLatency ? 1 : kDefaultGpuRingRegions;
+	scenePath = options.scenePath;
+	streamBudgetMB = options.streamBudget;
+	streamRadius = options.streamRadius;
+	occlusionCulling = options.occlusion;
+	maxOccluders = options.occluders;
+}
 
-	/* Initialize the library */
-	if (!glfwInit())
-		return -1;
+// Map the scene file, the built-in knives are drawn when it cannot be used
+static void openSceneFileStream()
+{
+	if (scenePath.empty())
+		return;
+	if (!openSceneStream(sceneStream, scenePath.c_str(), (size_t)streamBudgetMB << 20, streamRadius))
+		cout << "Error! " << scenePath << ": " << sceneStream.file.error << endl;
+}
 
-	/* Create a windowed mode window and its OpenGL context */
-	window = glfwCreateWindow(width, height, "Main Window", NULL, NULL);
-	if (!window)
+// Sphere around every submesh of the knife, streamed instances are culled with it
+static StreamMesh knifeStreamMesh()
+{
+	Aabb bounds = { glm::vec3(INFINITY), glm::vec3(-INFINITY) };
+	for (const MeshLods& lods : knifeMeshes)
 	{
-		glfwTerminate();
-		return -1;
+		bounds.min = glm::min(bounds.min, lods.levels[0].boundsMin);
+		bounds.max = glm::max(bounds.max, lods.levels[0].boundsMax);
 	}
+	StreamMesh mesh;
+	mesh.center = (bounds.min + bounds.max) * 0.5f;
+	mesh.radius = glm::length(bounds.max - bounds.min) * 0.5f;
+	return mesh;
+}
 
-	// Set input callback functions
-	glfwSetKeyCallback(window, key_callback);
-	glfwSetCursorPosCallback(window, mouse_callback);
-	glfwSetMouseButtonCallback(window, mouse_button_callback);
-	glfwSetScrollCallback(window, scroll_callback);
-
-	/* Make the window's context current */
-	glfwMakeContextCurrent(window);
-
-	// Initialize GLEW
-	if (glewInit() != GLEW_OK)
-		cout << "Error!" << endl;
+// Occluder triangles of the built-in knife, its finest level
+static void setKnifeOccluder(const vector<float>& vertices, size_t vertexCount, const vector<uint32_t>& chain, const LodLevel& level)
+{
+	knifeOccluder.positions.resize(vertexCount);
+	for (size_t i = 0; i < vertexCount; i++)
+		knifeOccluder.positions[i] = glm::vec3(vertices[i * 11], vertices[i * 11 + 1], vertices[i * 11 + 2]);
+	knifeOccluder.indices.assign(chain.begin() + level.firstIndex, chain.begin() + level.firstIndex + level.indexCount);
+}
 
-	GLfloat lampVertices[] =
+// Occluder triangles of a mesh file, every submesh. Without float positions the knife occludes nothing
+static void setKnifeOccluderFromFile(const MeshFile& file)
+{
+	knifeOccluder = OccluderMesh();
+	const MeshFileHeader& header = *file.header;
+	const MeshAttribute* position = nullptr;
+	for (uint32_t i = 0; i < header.attributeCount; i++)
+		if (file.attributes[i].location == 0 && file.attributes[i].type == kMeshFloat32 && file.attributes[i].components >= 3 &&
+			file.attributes[i].offset + 3 * sizeof(float) <= header.vertexStride)
+			position = &file.attributes[i];
+	if (!position)
+		return;
+
+	knifeOccluder.positions.resize(header.vertexCount);
+	for (uint32_t i = 0; i < header.vertexCount; i++)
 	{
-		-0.5, -0.5, 0.0, //index 0
-
+		const float* p = (const float*)((const uint8_t*)file.vertices + (size_t)i * header.vertexStride + position->offset);
+		knifeOccluder.positions[i] = glm::vec3(p[0], p[1], p[2]);
+	}
+	vector<uint32_t> indices(header.indexCount);
+	for (uint32_t i = 0; i < header.indexCount; i++)
+		indices[i] = readMeshIndex(file.indices, header.indexSize, i);
+	if (header.primitive == kMeshQuads)
+	{
+		vector<uint32_t> faceSizes(indices.size() / 4, 4);
+		triangulateFaces(indices.data(), faceSizes.data(), faceSizes.size(), knifeOccluder.indices);
+	}
+	else
+		knifeOccluder.indices.swap(indices);
+}
 
-		-0.5, 0.5, 0.0, //index 1
+// Draw the knives covering the most of the screen into the occlusion buffer, then drop the visible objects and
+// streamed instances they hide. One submesh stands for each knife, its occluder has all of them
+static void cullOccludedObjects(const glm::mat4& projectionMatrix)
+{
+	PROFILE_ZONE("occlusion");
+	beginOcclusionFrame(occlusionCuller, projectionMatrix * viewMatrix);
+	StreamMesh knifeSphere = knifeStreamMesh();
+	for (uint32_t index : visibleObjects)
+	{
+		const SceneObject& object = sceneObjects[index];
+		if (knifeMeshes.empty() || object.lods != &knifeMeshes[0])
+			continue;
+		const glm::mat4& world = sceneTransforms.world[object.node];
+		float scale = glm::max(glm::length(glm::vec3(world[0])), glm::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+		addOccluderCandidate(occlusionCuller, knifeOccluder, world, glm::vec3(world * glm::vec4(knifeSphere.center, 1.0f)), knifeSphere.radius * scale);
+	}
+	for (const StreamedInstance& streamed : sceneStream.visible)
+	{
+		const ResidentChunk& chunk = sceneStream.slots[streamed.slot];
+		const glm::vec4& sphere = chunk.spheres[streamed.instance];
+		addOccluderCandidate(occlusionCuller, knifeOccluder, chunk.world[streamed.instance], glm::vec3(sphere), sphere.w);
+	}
+	renderOccluders(occlusionCuller);
 
+	testOcclusion(occlusionCuller, (uint32_t)visibleObjects.size(), [](uint32_t i)
+	{
+		const SceneObject& object = sceneObjects[visibleObjects[i]];
+		Aabb local = { object.mesh->boundsMin, object.mesh->boundsMax };
+		return transformAabb(local, sceneTransforms.world[object.node]);
+	});
+	removeOccluded(occlusionCuller, visibleObjects);
+	testOcclusion(occlusionCuller, (uint32_t)sceneStream.visible.size(), [](uint32_t i)
+	{
+		const StreamedInstance& streamed = sceneStream.visible[i];
+		const glm::vec4& sphere = sceneStream.slots[streamed.slot].spheres[streamed.instance];
+		Aabb box = { glm::vec3(sphere) - sphere.w, glm::vec3(sphere) + sphere.w };
+		return box;
+	});
+	removeOccluded(occlusionCuller, sceneStream.visible);
+}
 
-		0.5, -0.5, 0.0,  //index 2	
+// Knives, then each lamp as a root with its six faces as children, with the bounds hierarchy over all of them.
+// With a scene file the knives are its instances, streamed in separately.
+// Built again when a mesh file replaces the built-in knife
+static void buildSceneObjects()
+{
+	clearTransforms(sceneTransforms);
+	sceneObjects.clear();
+	lodSwitches = 0;
+	bool streamed = sceneStream.file.header != nullptr;
+	glm::mat4 knifeScale = glm::scale(glm::mat4(), planeScale[0]);
+	for (GLuint i = 0; i <= 104 && !streamed; i++)
+	{
+		TransformId node = createTransform(sceneTransforms, knifeScale);
+		for (const MeshLods& lods : knifeMeshes)
+			sceneObjects.push_back({ node, shaderProgram.id, &lods.levels[0], knifeTextures, &lods });
+	}
 
+	//Extra knives on a grid below the scene
+	int partsPerRow = (int)ceil(sqrt((double)extraParts));
+	for (int i = 0; i < extraParts && !streamed; i++)
+	{
+		glm::mat4 modelMatrix;
+		modelMatrix = glm::translate(modelMatrix, glm::vec3((i % partsPerRow) * 2.5f - partsPerRow * 1.25f, -1.0f, (i / partsPerRow) * -0.5f));
+		modelMatrix = glm::scale(modelMatrix, planeScale[0]);
+		TransformId node = createTransform(sceneTransforms, modelMatrix);
+		for (const MeshLods& lods : knifeMeshes)
+			sceneObjects.push_back({ node, shaderProgram.id, &lods.levels[0], knifeTextures, &lods });
+	}
 
-		0.5, 0.5, 0.0  //index 3	
-	};
+	lampRoot1 = createTransform(sceneTransforms, glm::translate(glm::mat4(), lightPosition1));
+	lampRoot2 = createTransform(sceneTransforms, glm::translate(glm::mat4(), lightPosition2));
+	for (GLuint i = 0; i < 6; i++)
+	{
+		glm::mat4 faceRotation;
+		faceRotation = glm::rotate(faceRotation, planeRotationsBox[i] * toRadians, glm::vec3(0.0f, 1.0f, 0.0f));
+		faceRotation = glm::scale(faceRotation, glm::vec3(.125f, .125f, .125f));
+		if (i >= 4)
+			faceRotation = glm::rotate(faceRotation, planeRotationsBox[i] * toRadians, glm::vec3(1.0f, 0.0f, 0.0f));
+
+		glm::mat4 face1 = glm::translate(glm::mat4(), planePositionsBox[i] / glm::vec3(8.0, 8.0, 8.0)) * faceRotation;
+		glm::mat4 face2 = glm::translate(glm::mat4(), planePositionsBox[i] / glm::vec3(8.0, 8.0, -8.0)) * faceRotation;
+		sceneObjects.push_back({ createTransform(sceneTransforms, face1, lampRoot1), lampShaderProgram.id, &lampMesh, 0 });
+		sceneObjects.push_back({ createTransform(sceneTransforms, face2, lampRoot2), lamp2ShaderProgram.id, &lamp2Mesh, 0 });
+	}
 
+	//Bounds hierarchy over every object at its starting place
+	updateTransforms(sceneTransforms);
+	clearBvh(sceneBvh);
+	for (const SceneObject& object : sceneObjects)
+		addBvhItem(sceneBvh, object.node, { object.mesh->boundsMin, object.mesh->boundsMax });
+	buildBvh(sceneBvh, sceneTransforms);
+	cullTimeMs = 0.0;
+	cullFrames = 0;
+
+	//Resident chunks hold LODs of the knife they were loaded for
+	if (streamed)
+		resetSceneStream(sceneStream, vector<StreamMesh>(1, knifeStreamMesh()), (int)knifeMeshes.size());
+}
 
+// Built-in knife geometry as quads, triangulated and optimized, with its LOD chain (levels share the index list)
+static void buildKnifeGeometry(vector<float>& knifeVertices, size_t& knifeVertexCount, vector<uint32_t>& knifeChain, vector<LodLevel>& knifeLevels)
+{
 	GLfloat vertices[] = {
 		//Handle
 		0.0f, -0.2f, 0.1f,//0
@@ -372,9 +910,58 @@ int main(void)
 		0,1,5,4
 	};
 
+	//Triangulate the quads, then order triangles for the vertex cache and overdraw and vertices for fetch
+	vector<uint32_t> knifeQuads(indicesKnife, indicesKnife + sizeof(indicesKnife));
+	vector<uint32_t> knifeFaceSizes(knifeQuads.size() / 4, 4);
+	vector<uint32_t> knifeIndices;
+	triangulateFaces(knifeQuads.data(), knifeFaceSizes.data(), knifeFaceSizes.size(), knifeIndices);
+	knifeVertices.assign(vertices, vertices + sizeof(vertices) / sizeof(GLfloat));
+	knifeVertexCount = knifeVertices.size() / 11;
+	knifeCacheBefore = analyzeVertexCache(knifeIndices.data(), knifeIndices.size(), knifeVertexCount);
+	optimizeVertexCache(knifeIndices.data(), knifeIndices.size(), knifeVertexCount);
+	optimizeOverdraw(knifeIndices.data(), knifeIndices.size(), knifeVertices.data(), 11);
+	knifeVertexCount = optimizeVertexFetch(knifeIndices, knifeVertices, 11);
+	knifeCacheAfter = analyzeVertexCache(knifeIndices.data(), knifeIndices.size(), knifeVertexCount);
+
+	//Coarser levels follow the full knife in the same index buffer
+	buildLodChain(knifeIndices, knifeVertices.data(), knifeVertexCount, 11, lodLevels, knifeChain, knifeLevels);
+}
 
+// Index ranges of the lamp quads
+static void setupLampMeshes()
+{
+	lampMesh = { lightVAO, GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, 0, 1 };
+	lamp2Mesh = { light2VAO, GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, 0, 2 };
+	Aabb lampBounds = pointBounds(lampVertices, sizeof(lampVertices) / (3 * sizeof(GLfloat)), 3);
+	lampMesh.boundsMin = lamp2Mesh.boundsMin = lampBounds.min;
+	lampMesh.boundsMax = lamp2Mesh.boundsMax = lampBounds.max;
+}
 
+// The two lamps, then any extra lights
+static void setupSceneLights()
+{
+	lightClusters.lights.clear();
+	lightClusters.lights.push_back({ lightPosition1, 100.0f, glm::vec3(0.1f, 0.0f, 0.0f) });
+	lightClusters.lights.push_back({ lightPosition2, 100.0f, glm::vec3(1.0f, 1.0f, 1.0f) });
+	unsigned int seed = 12345u;
+	for (int i = 0; i < extraLights; i++)
+	{
+		// Small deterministic generator so benchmark runs are repeatable
+		float random[7];
+		for (int j = 0; j < 7; j++)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			random[j] = (seed >> 8) / 16777216.0f;
+		}
+		glm::vec3 position(random[0] * 8.0f - 4.0f, random[1] * 3.0f - 1.5f, random[2] * 8.0f - 4.0f);
+		glm::vec3 color = glm::vec3(random[3], random[4], random[5]) * 0.5f;
+		lightClusters.lights.push_back({ position, 0.5f + random[6], color });
+	}
+}
 
+// Create scene geometry, textures and shaders
+static void setupScene()
+{
 	GLfloat verticesSquare[] = {
 		// Triangle 1
 		-0.5, 0.0, 0.0,//0
@@ -423,37 +1010,35 @@ int main(void)
 		-45.0f, -45.0f, 45.0f, 45.0f
 	};
 
-	glm::vec3 planeScale[] =
-	{
-	glm::vec3(.5f, .5f, .5f)
-	};
 
-	// Define element indices
-	GLubyte indicesBox[] =
-	{
-		0, 1, 2,
-		1, 2, 3
-	};
-
-	// Plane Transforms
-	glm::vec3 planePositionsBox[] = {
-		glm::vec3(0.0f,  0.0f,  0.5f),
-		glm::vec3(0.5f,  0.0f,  0.0f),
-		glm::vec3(0.0f,  0.0f,  -0.5f),
-		glm::vec3(-0.5f, 0.0f,  0.0f),
-		glm::vec3(0.0f, 0.5f,  0.0f),
-		glm::vec3(0.0f, -0.5f,  0.0f)
-	};
-
-	glm::float32 planeRotationsBox[] = {
-		0.0f, 90.0f, 180.0f, -90.0f, -90.f, 90.f
-	};
 
 	glEnable(GL_DEPTH_TEST);
 	//glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
+	//Start the file loads first, the workers decode while the rest of the scene is set up
+	setupStart = chrono::steady_clock::now();
+	firstFrameDrawn = false;
+	knifeMeshAsset = knifeTextureAsset = nullptr;
+	if (asyncLoading)
+	{
+		initAssetLoader(assetLoader, uploadBudgetMB);
+		knifeTextureAsset = requestTexture(assetLoader, knifeTexturePath);
+		if (!knifeMeshPath.empty())
+		{
+			MeshUploadOptions upload;
+			upload.quantize = quantizeVertexData;
+			upload.lodLevels = lodLevels;
+			knifeMeshAsset = requestMesh(assetLoader, knifeMeshPath, upload, 3);
+		}
+	}
+
 
-	GLuint knifeVBO, knifeEBO, knifeVAO, lightVBO, lightEBO, lightVAO, light2VBO, light2EBO, light2VAO;
+
+	// Instance transforms shared by every VAO, and the threads recording draws into them
+	initRenderQueue(renderQueue);
+	startWorkStealingPool(drawPool, workerThreads);
+	if (occlusionCulling)
+		initOcclusionCuller(occlusionCuller, drawPool, maxOccluders);
 
 	glGenBuffers(1, &knifeVBO); // Create VBO
 	glGenBuffers(1, &knifeEBO); // Create EBO
@@ -468,21 +1053,76 @@ int main(void)
 	glGenVertexArrays(1, &lightVAO); // Create VAO
 	glGenVertexArrays(1, &light2VAO); // Create VAO
 
-	glBindVertexArray(knifeVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, knifeVBO); // Select VBO
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, knifeEBO); // Select EB
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW); // Load vertex attributes
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indicesKnife), indicesKnife, GL_STATIC_DRAW); // Load indices 
-	 // Specify attribute location and layout to GPU
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(6 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(8 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(3);
-	glBindVertexArray(0); // Unbind VOA or close off (Must call VOA explicitly in loop)
+	//Knife from a mesh file, straight from the mapping into the buffers
+	knifeMeshes.clear();
+	if (!knifeMeshPath.empty() && !asyncLoading)
+	{
+		chrono::steady_clock::time_point loadStart = chrono::steady_clock::now();
+		MeshFile knifeFile;
+		if (!sharedKnifeAssets && !openMeshFile(knifeMeshPath.c_str(), knifeFile))
+			cout << "Error! " << knifeMeshPath << ": " << knifeFile.error << endl;
+		else
+		{
+			MeshUploadOptions upload;
+			upload.quantize = quantizeVertexData;
+			upload.lodLevels = lodLevels;
+			string meshError;
+			if (!uploadMeshFile(sharedKnifeAssets ? sharedKnifeFile : knifeFile, knifeVAO, knifeVBO, knifeEBO, renderQueue, 3, knifeMeshes, upload, meshError, &knifeQuantized))
+				cout << "Error! " << knifeMeshPath << ": " << meshError << endl;
+			else if (occlusionCulling)
+				setKnifeOccluderFromFile(sharedKnifeAssets ? sharedKnifeFile : knifeFile);
+		}
+		closeMeshFile(knifeFile);
+		knifeMeshLoadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - loadStart).count();
+	}
+
+	//Built-in knife, also drawn while a mesh file loads
+	if (knifeMeshes.empty())
+	{
+		vector<float> knifeVertices;
+		size_t knifeVertexCount = 0;
+		vector<uint32_t> knifeChain;
+		vector<LodLevel> knifeLevels;
+		buildKnifeGeometry(knifeVertices, knifeVertexCount, knifeChain, knifeLevels);
+		if (occlusionCulling)
+			setKnifeOccluder(knifeVertices, knifeVertexCount, knifeChain, knifeLevels[0]);
+
+		uint32_t knifeIndexSize = promotedIndexSize(knifeVertexCount);
+		vector<uint8_t> knifeIndexData;
+		packIndices(knifeChain, knifeIndexSize, knifeIndexData);
+
+		glBindVertexArray(knifeVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, knifeVBO); // Select VBO
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, knifeEBO); // Select EB
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, knifeIndexData.size(), knifeIndexData.data(), GL_STATIC_DRAW); // Load indices 
+		if (quantizeVertexData)
+		{
+			// Compressed vertices, positions decode through the instance matrix
+			quantizeVertices(knifeVertices.data(), knifeVertexCount, 11, knifeQuantized);
+			glBufferData(GL_ARRAY_BUFFER, knifeQuantized.data.size(), knifeQuantized.data.data(), GL_STATIC_DRAW);
+			setQuantizedAttributes(knifeQuantized);
+		}
+		else
+		{
+			glBufferData(GL_ARRAY_BUFFER, knifeVertices.size() * sizeof(GLfloat), knifeVertices.data(), GL_STATIC_DRAW); // Load vertex attributes
+			 // Specify attribute location and layout to GPU
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)0);
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(6 * sizeof(GLfloat)));
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(8 * sizeof(GLfloat)));
+			glEnableVertexAttribArray(3);
+		}
+		enableInstanceAttributes(renderQueue);
+		glBindVertexArray(0); // Unbind VOA or close off (Must call VOA explicitly in loop)
+
+		uint16_t knifeMeshId = 3;
+		Aabb knifeBounds = pointBounds(knifeVertices.data(), knifeVertexCount, 11);
+		knifeMeshes.push_back(makeMeshLods(knifeVAO, knifeIndexSize, 0, knifeLevels, knifeBounds.min, knifeBounds.max,
+			quantizeVertexData ? &knifeQuantized : nullptr, knifeMeshId));
+	}
 
 
 	//Bind and release light object
@@ -493,6 +1133,7 @@ int main(void)
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indicesBox), indicesBox, GL_STATIC_DRAW); // Load indices 
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
 	glEnableVertexAttribArray(0);
+	enableInstanceAttributes(renderQueue);
 	glBindVertexArray(0);
 
 	//Bind and release light2 object
@@ -503,50 +1144,100 @@ int main(void)
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indicesBox), indicesBox, GL_STATIC_DRAW); // Load indices 
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
 	glEnableVertexAttribArray(0);
+	enableInstanceAttributes(renderQueue);
 	glBindVertexArray(0);
 
-	//Load textures
-	int knifeTexWidth, knifeTexHeight;
-	unsigned char* knifeImage = SOIL_load_image("metalTex.png", &knifeTexWidth, &knifeTexHeight, 0, SOIL_LOAD_RGB);
+	// Index ranges drawn per object
+	setupLampMeshes();
 
-	//Generate textures 
-	GLuint knifeTextures;
+	//Load textures, baked ones with all their mips as they are in the file
+	chrono::steady_clock::time_point textureStart = chrono::steady_clock::now();
 	glGenTextures(1, &knifeTextures);
-	glBindTexture(GL_TEXTURE_2D, knifeTextures);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, knifeTexWidth, knifeTexHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, knifeImage);
+	bool knifeTextureKtx = knifeTexturePath.size() > 5 && knifeTexturePath.compare(knifeTexturePath.size() - 5, 5, ".ktx2") == 0;
+	bool knifeTextureBaked = false;
+	if (asyncLoading)
+	{
+		//Flat grey until the requested texture is resident
+		const unsigned char grey[3] = { 128, 128, 128 };
+		glBindTexture(GL_TEXTURE_2D, knifeTextures);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, grey);
+		knifeTextureBytes = 0;
+	}
+	else if (knifeTextureKtx)
+	{
+		TextureFile knifeTextureFile;
+		string textureError;
+		if (!sharedKnifeAssets && !openTextureFile(knifeTexturePath.c_str(), knifeTextureFile))
+			cout << "Error! " << knifeTexturePath << ": " << knifeTextureFile.error << endl;
+		else if (!uploadTextureFile(sharedKnifeAssets ? sharedKnifeTexture : knifeTextureFile, knifeTextures, knifeTextureBytes, textureError))
+			cout << "Error! " << knifeTexturePath << ": " << textureError << endl;
+		else
+			knifeTextureBaked = true;
+	}
+	if (!knifeTextureBaked && !asyncLoading)
+	{
+		//Decode, upload and build the mips here, the shipped JPEG when a baked file failed
+		string imagePath = knifeTextureKtx ? "metalTex.jpg" : knifeTexturePath;
+		int knifeTexWidth = sharedKnifeImageWidth, knifeTexHeight = sharedKnifeImageHeight;
+		unsigned char* knifeImage = sharedKnifeImage;
+		if (!knifeImage)
+			knifeImage = SOIL_load_image(imagePath.c_str(), &knifeTexWidth, &knifeTexHeight, 0, SOIL_LOAD_RGB);
+		if (!knifeImage)
+			cout << "Error! Could not load " << imagePath << endl;
+
+		//Generate textures 
+		glBindTexture(GL_TEXTURE_2D, knifeTextures);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, knifeTexWidth, knifeTexHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, knifeImage);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		knifeTextureBytes = knifeImage ? (uint64_t)knifeTexWidth * knifeTexHeight * 4 * 4 / 3 : 0; // drivers pad RGB to RGBA
+		if (knifeImage != sharedKnifeImage)
+			SOIL_free_image_data(knifeImage);
+	}
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	SOIL_free_image_data(knifeImage);
 	glBindTexture(GL_TEXTURE_2D, 0);
+	knifeTextureLoadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - textureStart).count();
 
 
-	// Vertex shader source code
+	// Vertex shader source code, quantized knives carry octahedral normals
 	string vertexShaderSource =
 		"#version 330 core\n"
+		+ string(quantizeVertexData ? "#define OCT_NORMALS\n" : "")
+		+ string(kFrameDataBlockSource) +
 		"layout(location = 0) in vec3 vPosition;"
 		"layout(location = 1) in vec3 aColor;"
 		"layout(location = 2) in vec2 texCoord;"
+		"\n#ifdef OCT_NORMALS\n"
+		"layout(location = 3) in vec2 octNormal;"
+		"vec3 decodeNormal()"
+		"{"
+		"vec3 n = vec3(octNormal, 1.0 - abs(octNormal.x) - abs(octNormal.y));"
+		"if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * mix(vec2(-1.0), vec2(1.0), greaterThanEqual(n.xy, vec2(0.0)));"
+		"return normalize(n);"
+		"}"
+		"\n#else\n"
 		"layout(location = 3) in vec3 normal;"
+		"vec3 decodeNormal() { return normal; }"
+		"\n#endif\n"
 		"out vec3 oColor;"
 		"out vec2 oTexCoord;"
 		"out vec3 oNormal;"
 		"out vec3 FragPos;"
-		"uniform mat4 model;"
-		"uniform mat4 view;"
-		"uniform mat4 projection;"
+		"layout(location = 4) in mat4 model;"
+		"layout(location = 8) in mat3 normalMatrix;"
 
 		"void main()\n"
 		"{\n"
 		"gl_Position = projection * view * model * vec4(vPosition.x, vPosition.y, vPosition.z, 1.0);"
 		"oColor = aColor;"
 		"oTexCoord = vec2(1.0f - texCoord.x, 1.0f - texCoord.y);"
-		"oNormal = mat3(transpose(inverse(model))) * normal;"
+		"oNormal = normalMatrix * decodeNormal();"
 		"FragPos = vec3(model * vec4(vPosition, 1.0f));"
 		"}\n";
 
 	// Fragment shader source code
 	string fragmentShaderSource =
 		"#version 330 core\n"
+		+ string(kFrameDataBlockSource) +
 		"in vec3 oColor;"
 		"in vec2 oTexCoord;"
 		"in vec3 oNormal;"
@@ -556,40 +1247,51 @@ int main(void)
 
 		"uniform sampler2D myTexture;"
 		"uniform vec3 objectColor;"
-		"uniform vec3 viewPos;"
-		"uniform vec3 lightColor;"
-		"uniform vec3 lightPos;"
-		"uniform vec3 lightColor1;"
-		"uniform vec3 lightPos1;"
 		"uniform vec3 result;"
 
+		"//Clustered lights: (position, radius) and (color) texels, per cluster (offset, count), light indices\n"
+		"uniform samplerBuffer lightData;"
+		"uniform usamplerBuffer clusterGrid;"
+		"uniform usamplerBuffer lightIndices;"
+
 		"void main()\n"
 		"{\n"
 		"//Ambient\n"
-		"float ambientStrength = 0.3f;"
-		"vec3 ambient = ambientStrength * lightColor;"
-		"vec3 ambient1 = ambientStrength * lightColor1;"
+		"vec3 lighting = ambient.rgb;"
+
+		"//Find the cluster of this fragment\n"
+		"float viewDepth = -(view * vec4(FragPos, 1.0f)).z;"
+		"ivec2 tile = clamp(ivec2(gl_FragCoord.xy / clusterScale.xy), ivec2(0), clusterDims.xy - 1);"
+		"int slice = int(clamp(floor(log(max(viewDepth, 1e-4)) * clusterScale.z + clusterScale.w), 0.0, float(clusterDims.z - 1)));"
+		"uvec2 range = texelFetch(clusterGrid, (slice * clusterDims.y + tile.y) * clusterDims.x + tile.x).xy;"
 
-		"//Diffuse\n"
 		"vec3 norm = normalize(oNormal);"
-		"vec3 lightDir = normalize(lightPos - FragPos);"
-		"vec3 lightDir1 = normalize(lightPos1 - FragPos);"
+		"float specularStrength = 10.25f;"
+		"vec3 viewDir = normalize(viewPos.xyz - FragPos);"
+		"for (uint i = 0u; i < range.y; i++)"
+		"{"
+		"int light = int(texelFetch(lightIndices, int(range.x + i)).r);"
+		"vec4 lightPosRadius = texelFetch(lightData, light * 2);"
+		"vec3 lightColor = texelFetch(lightData, light * 2 + 1).rgb;"
+		"vec3 toLight = lightPosRadius.xyz - FragPos;"
+		"float lightDistance = length(toLight);"
+
+		"//Smooth falloff to zero at the light radius\n"
+		"float falloff = clamp(1.0 - pow(lightDistance / lightPosRadius.w, 4.0), 0.0, 1.0);"
+		"falloff *= falloff;"
+
+		"//Diffuse\n"
+		"vec3 lightDir = toLight / lightDistance;"
 		"float diff = max(dot(norm, lightDir), 0.0);"
-		"float diff1 = max(dot(norm, lightDir1), 0.0);"
-		"vec3 diffuse = diff * lightColor;"
-		"vec3 diffuse1 = diff1 * lightColor1;"
 
 		"//Specularity\n"
-		"float specularStrength = 10.25f;"
-		"vec3 viewDir = normalize(viewPos - FragPos);"
 		"vec3 reflectDir = reflect(-lightDir, norm);"
-		"vec3 reflectDir1 = reflect(-lightDir1, norm);"
 		"float spec = pow(max(dot(viewDir, reflectDir), 0.0), 128);"
-		"float spec1 = pow(max(dot(viewDir, reflectDir1), 0.0), 128);"
-		"vec3 specular = specularStrength * spec * lightColor;"
-		"vec3 specular1 = specularStrength * spec1 * lightColor1;"
 
-		"vec3 result = (ambient + diffuse + specular + ambient1 + diffuse1 + specular1) * objectColor;"
+		"lighting += (diff + specularStrength * spec) * lightColor * falloff;"
+		"}"
+
+		"vec3 result = lighting * objectColor;"
 		"fragColor = texture(myTexture, oTexCoord) * vec4(result, 1.0f);"
 
 		"}\n";
@@ -598,10 +1300,9 @@ int main(void)
 	// Lamp Vertex shader source code
 	string lampVertexShaderSource =
 		"#version 330 core\n"
+		+ string(kFrameDataBlockSource) +
 		"layout(location = 0) in vec3 vPosition;"
-		"uniform mat4 model;"
-		"uniform mat4 view;"
-		"uniform mat4 projection;"
+		"layout(location = 4) in mat4 model;"
 		"void main()\n"
 		"{\n"
 		"gl_Position = projection * view * model * vec4(vPosition.x, vPosition.y, vPosition.z, 1.0);"
@@ -619,10 +1320,9 @@ int main(void)
 	// Lamp Vertex shader source code
 	string lamp2VertexShaderSource =
 		"#version 330 core\n"
+		+ string(kFrameDataBlockSource) +
 		"layout(location = 0) in vec3 vPosition;"
-		"uniform mat4 model;"
-		"uniform mat4 view;"
-		"uniform mat4 projection;"
+		"layout(location = 4) in mat4 model;"
 		"void main()\n"
 		"{\n"
 		"gl_Position = projection * view * model * vec4(vPosition.x, vPosition.y, vPosition.z, 1.0);"
@@ -639,157 +1339,345 @@ int main(void)
 
 
 	// Creating Shader Program
-	GLuint shaderProgram = CreateShaderProgram(vertexShaderSource, fragmentShaderSource);
+	initProgramCache(programCache, shaderCachePath);
+	shaderMs = 0.0;
+	shaderProgram = CreateShaderProgram(vertexShaderSource, fragmentShaderSource);
 
 	//Creating Lamp Shader Program
-	GLuint lampShaderProgram = CreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource);
-	GLuint lamp2ShaderProgram = CreateShaderProgram(lamp2VertexShaderSource, lamp2FragmentShaderSource);
-	/* Loop until the user closes the window */
-	while (!glfwWindowShouldClose(window))
+	lampShaderProgram = CreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource);
+	lamp2ShaderProgram = CreateShaderProgram(lamp2VertexShaderSource, lamp2FragmentShaderSource);
+
+	// Per-frame camera, light and instance data, one region per frame in flight
+	initGpuRingBuffer(frameRing, framesInFlight);
+	renderQueue.ring = &frameRing;
+
+	//Assign object color, it never changes
+	glUseProgram(shaderProgram.id);
+	glUniform3f(uniformLocation(shaderProgram, "objectColor"), 1.0f, 1.0f, 1.0f);
+
+	//Assign light buffer texture units
+	glUniform1i(uniformLocation(shaderProgram, "lightData"), kLightDataUnit);
+	glUniform1i(uniformLocation(shaderProgram, "clusterGrid"), kClusterGridUnit);
+	glUniform1i(uniformLocation(shaderProgram, "lightIndices"), kLightIndexUnit);
+	glUseProgram(0);
+
+	openSceneFileStream();
+	buildSceneObjects();
+
+	//Scene lights: the two lamps, then any extra lights
+	initLightClusters(lightClusters);
+	setupSceneLights();
+
+	// Setup bound objects directly, start the frame path from a clean cache
+	resetGLStateCache();
+	if (!asyncLoading)
+		assetsResidentMs = chrono::duration<double, milli>(chrono::steady_clock::now() - setupStart).count();
+}
+
+// Stream loaded files into GL and swap them in for their placeholders
+static void updateSceneAssets()
+{
+	if (!asyncLoading || assetLoader.pending == 0)
+		return;
+
+	pumpAssetLoader(assetLoader, renderQueue, finishedAssets);
+	for (Asset* asset : finishedAssets)
 	{
-		// Set frame time
-		GLfloat currentFrame = glfwGetTime();
-		deltaTime = currentFrame - lastFrame;
-		lastFrame = currentFrame;
+		if (asset->state == kAssetFailed)
+		{
+			cout << "Error! " << asset->path << ": " << asset->error << endl;
 
-		// Resize window and graphics simultaneously
-		glfwGetFramebufferSize(window, &width, &height);
-		glViewport(0, 0, width, height);
+			//A baked texture that cannot be used falls back to the shipped JPEG
+			if (asset == knifeTextureAsset && asset->path != "metalTex.jpg")
+				knifeTextureAsset = requestTexture(assetLoader, "metalTex.jpg");
+		}
+		else if (asset == knifeTextureAsset)
+		{
+			stateBindTexture(0, GL_TEXTURE_2D, asset->texture);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			for (SceneObject& object : sceneObjects)
+				if (object.texture == knifeTextures)
+					object.texture = asset->texture;
+			glDeleteTextures(1, &knifeTextures);
+			knifeTextures = asset->texture;
+			knifeTextureBytes = asset->gpuBytes;
+			knifeTextureLoadMs = asset->residentMs;
+		}
+		else if (asset == knifeMeshAsset)
+		{
+			//The file's buffers replace the built-in knife's
+			glDeleteVertexArrays(1, &knifeVAO);
+			glDeleteBuffers(1, &knifeVBO);
+			glDeleteBuffers(1, &knifeEBO);
+			knifeVAO = asset->vao;
+			knifeVBO = asset->vbo;
+			knifeEBO = asset->ebo;
+			knifeMeshes.swap(asset->meshes);
+			if (quantizeVertexData)
+				knifeQuantized = move(asset->prepared.quantized);
+			knifeMeshLoadMs = asset->residentMs;
+
+			//The loader has let go of the file, its triangles are read again for the occluder
+			MeshFile occluderFile;
+			if (occlusionCulling && openMeshFile(asset->path.c_str(), occluderFile))
+				setKnifeOccluderFromFile(occluderFile);
+			closeMeshFile(occluderFile);
+			buildSceneObjects();
+		}
+	}
+	finishedAssets.clear();
+	if (assetLoader.pending == 0)
+		assetsResidentMs = chrono::duration<double, milli>(chrono::steady_clock::now() - setupStart).count();
+}
 
-		/* Render here */
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+// Copy of the camera, window and light globals, the only state rendering reads from the simulation
+static FrameState captureFrameState()
+{
+	FrameState state;
+	state.cameraPosition = cameraPosition;
+	state.target = target;
+	state.worldUp = worldUp;
+	state.fov = fov;
+	state.ortho = viewType;
+	state.width = width;
+	state.height = height;
+	state.lightPosition1 = lightPosition1;
+	state.lightPosition2 = lightPosition2;
+	state.inputNs = lastInputNs;
+	return state;
+}
 
-		// Use Shader Program exe and select VAO before drawing 
-		glUseProgram(shaderProgram); // Call Shader per-frame when updating attributes
+// View matrix from the camera, and the projection of the frame
+static glm::mat4 updateCameraMatrices(const FrameState& state)
+{
+	glm::mat4 projectionMatrix;
 
+	//Define LookAt Matrix
+	viewMatrix = glm::lookAt(state.cameraPosition, state.target, state.worldUp);
 
-		//Declare transformations (can be initialized outside loop)		
-		glm::mat4 projectionMatrix;
+	// Define projection matrix
+	if (state.ortho) {
+		//Switches to orthographic projection
+		projectionMatrix = glm::ortho(-5.0f, (GLfloat)state.width/100, (GLfloat)state.height/125, -1.0f, 0.1f, 100.0f);
+	}
+	else
+	{
+		//Standard set for perspective projection
+		projectionMatrix = glm::perspective(state.fov, (GLfloat)state.width / (GLfloat)state.height, 0.1f, 100.0f);
+	}
+	return projectionMatrix;
+}
 
-		//Define LookAt Matrix
-		viewMatrix = glm::lookAt(cameraPosition, target, worldUp);
+// Move the lamps and fill visibleObjects and the streamed instances for this camera
+static void updateSceneVisibility(const FrameState& state, const glm::mat4& projectionMatrix)
+{
+	glm::vec4 frustumPlanes[6];
 
-		// Define projection matrix
-		if (viewType == true) {
-			//Switches to orthographic projection
-			projectionMatrix = glm::ortho(-5.0f, (GLfloat)width/100, (GLfloat)height/125, -1.0f, 0.1f, 100.0f);
-		}
+	//Lamps follow their light positions, only moved nodes are recomputed
+	{
+		PROFILE_ZONE("transforms");
+		setLocalTransform(sceneTransforms, lampRoot1, glm::translate(glm::mat4(), state.lightPosition1));
+		setLocalTransform(sceneTransforms, lampRoot2, glm::translate(glm::mat4(), state.lightPosition2));
+		updateTransforms(sceneTransforms);
+	}
+
+	//Refit the moved objects' bounds and keep those inside the view frustum
+	{
+		PROFILE_ZONE("cull");
+		chrono::steady_clock::time_point cullStart = chrono::steady_clock::now();
+		refitBvh(sceneBvh, sceneTransforms);
+		extractFrustumPlanes(projectionMatrix * viewMatrix, frustumPlanes);
+		if (frustumCulling)
+			cullBvh(sceneBvh, frustumPlanes, visibleObjects);
 		else
 		{
-			//Standard set for perspective projection
-			projectionMatrix = glm::perspective(fov, (GLfloat)width / (GLfloat)height, 0.1f, 100.0f);
+			visibleObjects.resize(sceneObjects.size());
+			for (size_t i = 0; i < sceneObjects.size(); i++)
+				visibleObjects[i] = (uint32_t)i;
 		}
+		cullTimeMs += chrono::duration<double, milli>(chrono::steady_clock::now() - cullStart).count();
+		cullFrames++;
+	}
 
-		// Get matrix's uniform location and set matrix
-		GLint modelLoc = glGetUniformLocation(shaderProgram, "model");
-		GLint viewLoc = glGetUniformLocation(shaderProgram, "view");
-		GLint projLoc = glGetUniformLocation(shaderProgram, "projection");
+	//Scene file chunks around the camera, and their instances in view
+	{
+		PROFILE_ZONE("scene stream");
+		updateSceneStream(sceneStream, state.cameraPosition, frustumCulling ? frustumPlanes : nullptr);
+	}
 
-		//Get light and object color location and lightPos
-		GLint objectColorLoc = glGetUniformLocation(shaderProgram, "objectColor");
-		GLint objectLightCol = glGetUniformLocation(shaderProgram, "lightColor");
-		GLint lightPosLoc = glGetUniformLocation(shaderProgram, "lightPos");
-		GLint viewPosLoc = glGetUniformLocation(shaderProgram, "viewPos");
-		GLint objectLightCol1 = glGetUniformLocation(shaderProgram, "lightColor1");
-		GLint lightPosLoc1 = glGetUniformLocation(shaderProgram, "lightPos1");
+	//Then what the nearest knives hide
+	if (occlusionCulling)
+		cullOccludedObjects(projectionMatrix);
+}
 
+// Level of a LOD chain the size on screen needs, `lod` is the level drawn last time
+static const DrawMesh* selectLodMesh(const MeshLods& lods, int& lod, const glm::mat4& world, const FrameState& state, const glm::mat4& projectionMatrix, float lodScale)
+{
+	int selected = selectLod(lods, lod, world, state.cameraPosition, projectionMatrix, lodScale, lodErrorPixels);
+	lodSwitches += selected != lod;
+	lod = selected;
+	const DrawMesh* mesh = &lods.levels[lod];
+	lodTrianglesDrawn += mesh->indexCount / 3;
+	return mesh;
+}
 
-		//Assign Light and object Colors
-		glUniform3f(objectColorLoc, 1.0f, 1.0f, 1.0f);
-		glUniform3f(objectLightCol, 0.1f, 0.0f, 0.0f);
+// Draw range of an object at the level of detail its size on screen needs
+static const DrawMesh* selectObjectMesh(SceneObject& object, const FrameState& state, const glm::mat4& projectionMatrix, float lodScale)
+{
+	if (!object.lods)
+		return object.mesh;
+	return selectLodMesh(*object.lods, object.lod, sceneTransforms.world[object.node], state, projectionMatrix, lodScale);
+}
 
-		//Assign second light color 
-		glUniform3f(objectLightCol1, 1.0f, 1.0f, 1.0f);
+// Draw range of one knife submesh of a streamed instance
+static const DrawMesh* selectStreamedMesh(const StreamedInstance& streamed, size_t submesh, const FrameState& state, const glm::mat4& projectionMatrix, float lodScale)
+{
+	ResidentChunk& chunk = sceneStream.slots[streamed.slot];
+	uint8_t& slot = chunk.lods[(size_t)streamed.instance * sceneStream.lodSlots + submesh];
+	int lod = slot;
+	const DrawMesh* mesh = selectLodMesh(knifeMeshes[submesh], lod, chunk.world[streamed.instance], state, projectionMatrix, lodScale);
+	slot = (uint8_t)lod;
+	return mesh;
+}
 
-		//Assign light positions
-		glUniform3f(lightPosLoc, lightPosition1.x, lightPosition1.y, lightPosition1.z);
-		glUniform3f(lightPosLoc1, lightPosition2.x, lightPosition2.y, lightPosition2.z);
+// Draw one frame of the scene into the bound framebuffer. With `latest` the camera is latched again from the newest
+// published state just before the draws are issued, and `state` is left holding the camera that was drawn.
+// Objects are still culled and sorted for the camera the frame started with
+static void renderScene(FrameState& state, TripleBuffer<FrameState>* latest = nullptr)
+{
+	profileFrame();
 
-		//Specify View position
-		glUniform3f(viewPosLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(viewMatrix));
-		glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projectionMatrix));
+	// Never more than framesInFlight frames ahead of the GPU
+	{
+		PROFILE_ZONE("frame fence");
+		beginGpuRingFrame(frameRing);
+	}
+	{
+		PROFILE_GPU_ZONE("asset uploads");
+		updateSceneAssets();
+	}
 
-		//Bind texture
-		glBindTexture(GL_TEXTURE_2D, knifeTextures);
-		glBindVertexArray(knifeVAO); // User-defined VAO must be called before draw. 
+	beginGLStateFrame();
+	stateViewport(0, 0, state.width, state.height);
+	stateEnable(GL_DEPTH_TEST, true);
 
-		//Draw Knife
-		for (GLuint i = 0; i <= 104; i++)
-		{
-			glm::mat4 modelMatrix;
-			modelMatrix = glm::scale(modelMatrix, planeScale[0]);
-			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-			// Draw primitive(s)
-			drawKnife();
-		}
+	/* Render here */
+	stateClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	// View and projection of this frame
+	glm::mat4 projectionMatrix = updateCameraMatrices(state);
 
-		// Unbind Shader exe and VOA after drawing per frame
-		glBindVertexArray(0); //Incase different VAO wii be used after
-		glUseProgram(0);
+	beginRenderQueue(renderQueue, viewMatrix, 0.1f, 100.0f);
 
+	//Lamps follow their light positions and everything is culled against the view frustum
+	updateSceneVisibility(state, projectionMatrix);
 
-		glUseProgram(lampShaderProgram);
-		GLint lampModelLoc = glGetUniformLocation(lampShaderProgram, "model");
-		GLint lampViewLoc = glGetUniformLocation(lampShaderProgram, "view");
-		GLint lampProjLoc = glGetUniformLocation(lampShaderProgram, "projection");
-		glUniformMatrix4fv(lampViewLoc, 1, GL_FALSE, glm::value_ptr(viewMatrix));
-		glUniformMatrix4fv(lampProjLoc, 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-		glBindVertexArray(lightVAO); // User-defined VAO must be called before draw. 
-		//Loop to make first light
-		for (GLuint i = 0; i < 6; i++)
+	//Record every visible object with its cached world and normal matrix, at the level of detail its size on screen needs.
+	//Partitions of the visible list are recorded on the draw pool
+	{
+		PROFILE_ZONE("submit");
+		float lodScale = lodPixelScale(projectionMatrix, state.height);
+		lodTrianglesDrawn = 0;
+		if (serialDraws)
 		{
-			glm::mat4 modelMatrix;
-			modelMatrix = glm::translate(modelMatrix, planePositionsBox[i] / glm::vec3(8.0, 8.0, 8.0) + lightPosition1);
-			modelMatrix = glm::rotate(modelMatrix, planeRotationsBox[i] * toRadians, glm::vec3(0.0f, 1.0f, 0.0f));
-			modelMatrix = glm::scale(modelMatrix, glm::vec3(.125f, .125f, .125f));
-			if (i >= 4)
-				modelMatrix = glm::rotate(modelMatrix, planeRotationsBox[i] * toRadians, glm::vec3(1.0f, 0.0f, 0.0f));
-			glUniformMatrix4fv(lampModelLoc, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-			// Draw primitive(s)
-			drawLamp();
+			for (uint32_t index : visibleObjects)
+			{
+				SceneObject& object = sceneObjects[index];
+				const glm::mat4& world = sceneTransforms.world[object.node];
+				const DrawMesh* mesh = selectObjectMesh(object, state, projectionMatrix, lodScale);
+				submitDraw(renderQueue, object.program, *mesh, object.texture, world, sceneTransforms.normal[object.node]);
+			}
+			for (const StreamedInstance& streamed : sceneStream.visible)
+			{
+				const ResidentChunk& chunk = sceneStream.slots[streamed.slot];
+				for (size_t submesh = 0; submesh < knifeMeshes.size(); submesh++)
+				{
+					const DrawMesh* mesh = selectStreamedMesh(streamed, submesh, state, projectionMatrix, lodScale);
+					submitDraw(renderQueue, shaderProgram.id, *mesh, knifeTextures, chunk.world[streamed.instance], chunk.normal[streamed.instance]);
+				}
+			}
 		}
-		glBindVertexArray(0); //Incase different VAO wii be used after
-		glUseProgram(0);
-
-		glUseProgram(lamp2ShaderProgram);
-
-		//Specify View position
-		GLint lamp2ModelLoc = glGetUniformLocation(lamp2ShaderProgram, "model");
-		GLint lamp2ViewLoc = glGetUniformLocation(lamp2ShaderProgram, "view");
-		GLint lamp2ProjLoc = glGetUniformLocation(lamp2ShaderProgram, "projection");
-		glUniformMatrix4fv(lamp2ViewLoc, 1, GL_FALSE, glm::value_ptr(viewMatrix));
-		glUniformMatrix4fv(lamp2ProjLoc, 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-
-		glBindVertexArray(light2VAO); // User-defined VAO must be called before draw. 
-
-		//Loop to make second light
-		for (GLuint i = 0; i < 6; i++)
+		else
 		{
-			glm::mat4 modelMatrix;
-			modelMatrix = glm::translate(modelMatrix, planePositionsBox[i] / glm::vec3(8.0, 8.0, -8.0) + lightPosition2);
-			modelMatrix = glm::rotate(modelMatrix, planeRotationsBox[i] * toRadians, glm::vec3(0.0f, 1.0f, 0.0f));
-			modelMatrix = glm::scale(modelMatrix, glm::vec3(0.125f, 0.125f, 0.125f));
-			if (i >= 4)
-				modelMatrix = glm::rotate(modelMatrix, planeRotationsBox[i] * toRadians, glm::vec3(1.0f, 0.0f, 0.0f));
-			glUniformMatrix4fv(lamp2ModelLoc, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-			// Draw primitive(s)
-			drawLamp();
+			//Scene objects, then streamed instances with all their submeshes
+			uint32_t objectCount = (uint32_t)visibleObjects.size();
+			uint32_t count = objectCount + (uint32_t)sceneStream.visible.size();
+			recordDrawLists(drawLists, drawPool, count, [&state, &projectionMatrix, lodScale, objectCount](uint32_t begin, uint32_t end, DrawPartition& partition)
+			{
+				for (uint32_t i = begin; i < end; i++)
+				{
+					if (i >= objectCount)
+					{
+						const StreamedInstance& streamed = sceneStream.visible[i - objectCount];
+						const ResidentChunk& chunk = sceneStream.slots[streamed.slot];
+						for (size_t submesh = 0; submesh < knifeMeshes.size(); submesh++)
+						{
+							const DrawMesh* mesh = selectStreamedMesh(streamed, submesh, state, projectionMatrix, lodScale);
+							recordDraw(renderQueue, partition, shaderProgram.id, *mesh, knifeTextures, chunk.world[streamed.instance], chunk.normal[streamed.instance]);
+						}
+						continue;
+					}
+					SceneObject& object = sceneObjects[visibleObjects[i]];
+					const glm::mat4& world = sceneTransforms.world[object.node];
+					const DrawMesh* mesh = selectObjectMesh(object, state, projectionMatrix, lodScale);
+					recordDraw(renderQueue, partition, object.program, *mesh, object.texture, world, sceneTransforms.normal[object.node]);
+				}
+			});
 		}
-		glBindVertexArray(0);
-		glUseProgram(0); // Incase different shader will be used after
-		/* Swap front and back buffers */
-		glfwSwapBuffers(window);
+	}
 
-		/* Poll for and process events */
-		glfwPollEvents();
+	// Late latch: whatever the simulation published while this frame was being prepared
+	if (latest && acquireTripleBuffer(*latest))
+	{
+		latchFrameCamera(state, tripleBufferFront(*latest));
+		projectionMatrix = updateCameraMatrices(state);
+	}
 
-		// Poll Camera Transformations
-		TransformCamera();
+	//Bin lights into clusters for this camera
+	{
+		PROFILE_GPU_ZONE("light clusters");
+		updateLightClusters(lightClusters, viewMatrix, projectionMatrix, state.width, state.height, 0.1f, 100.0f);
+		bindLightClusters(lightClusters);
+	}
 
+	// Camera and lighting go to every program through this frame's slot of the uniform ring
+	{
+		PROFILE_ZONE("frame uniforms");
+		FrameUniforms frame;
+		frame.view = viewMatrix;
+		frame.projection = projectionMatrix;
+		frame.viewPos = glm::vec4(state.cameraPosition, 1.0f);
+
+		//Ambient of the two lamps
+		float ambientStrength = 0.3f;
+		frame.ambient = glm::vec4((lightClusters.lights[0].color + lightClusters.lights[1].color) * ambientStrength, 1.0f);
+
+		frame.clusterScale = clusterScaleBias(lightClusters, state.width, state.height);
+		frame.clusterDims[0] = kClusterTilesX;
+		frame.clusterDims[1] = kClusterTilesY;
+		frame.clusterDims[2] = kClusterSlices;
+		frame.clusterDims[3] = (int)lightClusters.lights.size();
+		writeFrameUniforms(frameRing, frame);
 	}
 
-	//Clear GPU resources
+	// Sort, batch and draw
+	{
+		PROFILE_GPU_ZONE("draw");
+		if (serialDraws)
+			flushRenderQueue(renderQueue);
+		else
+			flushDrawLists(drawLists, renderQueue, drawPool);
+	}
+	endGpuRingFrame(frameRing);
+
+	if (!firstFrameDrawn)
+		firstFrameMs = chrono::duration<double, milli>(chrono::steady_clock::now() - setupStart).count();
+	firstFrameDrawn = true;
+}
+
+//Clear GPU resources
+static void releaseScene()
+{
 	glDeleteVertexArrays(1, &knifeVAO);
 	glDeleteBuffers(1, &knifeVBO);
 	glDeleteBuffers(1, &knifeEBO);
@@ -799,6 +1687,965 @@ int main(void)
 	glDeleteVertexArrays(1, &light2VAO);
 	glDeleteBuffers(1, &light2VBO);
 	glDeleteBuffers(1, &light2EBO);
+	glDeleteTextures(1, &knifeTextures);
+	glDeleteProgram(shaderProgram.id);
+	glDeleteProgram(lampShaderProgram.id);
+	glDeleteProgram(lamp2ShaderProgram.id);
+	renderQueue.ring = nullptr;
+	releaseGpuRingBuffer(frameRing);
+	releaseLightClusters(lightClusters);
+	releaseRenderQueue(renderQueue);
+	stopWorkStealingPool(drawPool);
+	if (asyncLoading)
+		releaseAssetLoader(assetLoader);
+	closeSceneStream(sceneStream);
+}
+
+// Knife texture for the software renderer: the levels of a baked file, or an image with mips built here
+static void loadSoftwareTexture()
+{
+	chrono::steady_clock::time_point textureStart = chrono::steady_clock::now();
+	bool knifeTextureKtx = knifeTexturePath.size() > 5 && knifeTexturePath.compare(knifeTexturePath.size() - 5, 5, ".ktx2") == 0;
+	bool loaded = false;
+	if (knifeTextureKtx)
+	{
+		TextureFile knifeTextureFile;
+		string textureError;
+		if (!openTextureFile(knifeTexturePath.c_str(), knifeTextureFile))
+			cout << "Error! " << knifeTexturePath << ": " << knifeTextureFile.error << endl;
+		else if (!softTextureFromFile(knifeTextureFile, softKnifeTexture, textureError))
+			cout << "Error! " << knifeTexturePath << ": " << textureError << endl;
+		else
+			loaded = true;
+	}
+	if (!loaded)
+	{
+		//Same fallback as the GL path, then a grey texel when the image is missing too
+		string imagePath = knifeTextureKtx ? "metalTex.jpg" : knifeTexturePath;
+		int knifeTexWidth = 1, knifeTexHeight = 1;
+		unsigned char* knifeImage = SOIL_load_image(imagePath.c_str(), &knifeTexWidth, &knifeTexHeight, 0, SOIL_LOAD_RGBA);
+		const unsigned char grey[4] = { 128, 128, 128, 255 };
+		if (!knifeImage)
+		{
+			cout << "Error! Could not load " << imagePath << endl;
+			knifeTexWidth = knifeTexHeight = 1;
+		}
+		initSoftTexture(softKnifeTexture, knifeImage ? knifeImage : grey, knifeTexWidth, knifeTexHeight);
+		SOIL_free_image_data(knifeImage);
+	}
+	knifeTextureBytes = 0;
+	for (const vector<uint8_t>& level : softKnifeTexture.levels)
+		knifeTextureBytes += level.size();
+	knifeTextureLoadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - textureStart).count();
+}
+
+// Scene for the software renderer, everything loads before the first frame. The rasterizer reads the
+// float vertices as they are, so --quantize does not apply
+static void setupSoftwareScene()
+{
+	setupStart = chrono::steady_clock::now();
+	quantizeVertexData = false;
+
+	//Mesh file replacing the knife, kept mapped for its vertices
+	knifeMeshes.clear();
+	if (!knifeMeshPath.empty())
+	{
+		chrono::steady_clock::time_point loadStart = chrono::steady_clock::now();
+		MeshUploadOptions upload;
+		upload.lodLevels = lodLevels;
+		PreparedMesh prepared;
+		string meshError;
+		if (!openMeshFile(knifeMeshPath.c_str(), softKnifeFile))
+			cout << "Error! " << knifeMeshPath << ": " << softKnifeFile.error << endl;
+		else if (!hasStandardLayout(softKnifeFile))
+			cout << "Error! " << knifeMeshPath << ": the software renderer needs the standard vertex layout" << endl;
+		else if (!prepareMeshUpload(softKnifeFile, upload, prepared, meshError))
+			cout << "Error! " << knifeMeshPath << ": " << meshError << endl;
+		else
+		{
+			size_t indexBytes;
+			const uint8_t* indexData = (const uint8_t*)preparedIndexData(prepared, indexBytes);
+			softKnifeIndices.assign(indexData, indexData + indexBytes);
+			softKnifeMesh.vertices = (const float*)softKnifeFile.vertices;
+			softKnifeMesh.vertexCount = softKnifeFile.header->vertexCount;
+			softKnifeMesh.indexSize = prepared.indexSize;
+			makePreparedMeshLods(prepared, 0, 3, knifeMeshes);
+			if (occlusionCulling)
+				setKnifeOccluderFromFile(softKnifeFile);
+		}
+		knifeMeshLoadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - loadStart).count();
+	}
+
+	//Built-in knife
+	if (knifeMeshes.empty())
+	{
+		size_t knifeVertexCount = 0;
+		vector<uint32_t> knifeChain;
+		vector<LodLevel> knifeLevels;
+		buildKnifeGeometry(softKnifeVertices, knifeVertexCount, knifeChain, knifeLevels);
+		if (occlusionCulling)
+			setKnifeOccluder(softKnifeVertices, knifeVertexCount, knifeChain, knifeLevels[0]);
+		uint32_t knifeIndexSize = promotedIndexSize(knifeVertexCount);
+		packIndices(knifeChain, knifeIndexSize, softKnifeIndices);
+		softKnifeMesh.vertices = softKnifeVertices.data();
+		softKnifeMesh.vertexCount = (uint32_t)knifeVertexCount;
+		softKnifeMesh.indexSize = knifeIndexSize;
+
+		uint16_t knifeMeshId = 3;
+		Aabb knifeBounds = pointBounds(softKnifeVertices.data(), knifeVertexCount, 11);
+		knifeMeshes.push_back(makeMeshLods(0, knifeIndexSize, 0, knifeLevels, knifeBounds.min, knifeBounds.max, nullptr, knifeMeshId));
+	}
+	softKnifeMesh.stride = 11;
+	softKnifeMesh.indices = softKnifeIndices.data();
+	if (occlusionCulling)
+		initOcclusionCuller(occlusionCuller, softPool, maxOccluders);
+
+	//Lamp quads, positions only
+	softLampMesh.vertices = lampVertices;
+	softLampMesh.stride = 3;
+	softLampMesh.vertexCount = sizeof(lampVertices) / (3 * sizeof(GLfloat));
+	softLampMesh.indices = indicesBox;
+	softLampMesh.indexSize = 1;
+	setupLampMeshes();
+
+	loadSoftwareTexture();
+	openSceneFileStream();
+	buildSceneObjects();
+	setupSceneLights();
+	assetsResidentMs = chrono::duration<double, milli>(chrono::steady_clock::now() - setupStart).count();
+}
+
+// Draw one frame of the scene with the software rasterizer
+static void renderSoftwareScene(const FrameState& state)
+{
+	glm::mat4 projectionMatrix = updateCameraMatrices(state);
+	updateSceneVisibility(state, projectionMatrix);
+
+	//Visible objects front to back, so the depth test rejects hidden pixels before they are shaded,
+	//at their level of detail. Lamps are flat in their shader's colour
+	{
+		PROFILE_ZONE("submit");
+		softDrawOrder.clear();
+		for (uint32_t index : visibleObjects)
+			softDrawOrder.push_back(make_pair(-(viewMatrix * sceneTransforms.world[sceneObjects[index].node][3]).z, index));
+		uint32_t objectCount = (uint32_t)sceneObjects.size();
+		for (uint32_t i = 0; i < sceneStream.visible.size(); i++)
+		{
+			const StreamedInstance& streamed = sceneStream.visible[i];
+			softDrawOrder.push_back(make_pair(-(viewMatrix * sceneStream.slots[streamed.slot].world[streamed.instance][3]).z, objectCount + i));
+		}
+		sort(softDrawOrder.begin(), softDrawOrder.end());
+
+		float lodScale = lodPixelScale(projectionMatrix, state.height);
+		lodTrianglesDrawn = 0;
+		softDraws.clear();
+		for (const pair<float, uint32_t>& entry : softDrawOrder)
+		{
+			if (entry.second >= objectCount)
+			{
+				const StreamedInstance& streamed = sceneStream.visible[entry.second - objectCount];
+				const ResidentChunk& chunk = sceneStream.slots[streamed.slot];
+				for (size_t submesh = 0; submesh < knifeMeshes.size(); submesh++)
+				{
+					const DrawMesh* mesh = selectStreamedMesh(streamed, submesh, state, projectionMatrix, lodScale);
+					SoftDraw draw;
+					draw.mesh = &softKnifeMesh;
+					draw.firstIndex = (uint32_t)(mesh->indexOffset / draw.mesh->indexSize);
+					draw.indexCount = (uint32_t)mesh->indexCount;
+					draw.model = chunk.world[streamed.instance];
+					draw.normalMatrix = chunk.normal[streamed.instance];
+					draw.texture = &softKnifeTexture;
+					softDraws.push_back(draw);
+				}
+				continue;
+			}
+			SceneObject& object = sceneObjects[entry.second];
+			const DrawMesh* mesh = selectObjectMesh(object, state, projectionMatrix, lodScale);
+			bool lamp = object.mesh == &lampMesh || object.mesh == &lamp2Mesh;
+			SoftDraw draw;
+			draw.mesh = lamp ? &softLampMesh : &softKnifeMesh;
+			draw.firstIndex = (uint32_t)(mesh->indexOffset / draw.mesh->indexSize);
+			draw.indexCount = (uint32_t)mesh->indexCount;
+			draw.model = sceneTransforms.world[object.node];
+			draw.normalMatrix = sceneTransforms.normal[object.node];
+			if (!lamp)
+				draw.texture = &softKnifeTexture;
+			else
+				draw.color = object.mesh == &lampMesh ? glm::vec4(0.1f, 0.0f, 0.0f, 0.0f) : glm::vec4(1.0f);
+			softDraws.push_back(draw);
+		}
+	}
+
+	//Camera and every light, with the ambient of the two lamps
+	softFrame.view = viewMatrix;
+	softFrame.projection = projectionMatrix;
+	softFrame.viewPos = state.cameraPosition;
+	softFrame.ambient = (lightClusters.lights[0].color + lightClusters.lights[1].color) * 0.3f;
+	softFrame.lights.resize(lightClusters.lights.size());
+	for (size_t i = 0; i < lightClusters.lights.size(); i++)
+	{
+		const PointLight& light = lightClusters.lights[i];
+		softFrame.lights[i] = { light.position, light.radius, light.color };
+	}
+
+	{
+		PROFILE_ZONE("draw");
+		renderSoftFrame(softRaster, softFrame, softDraws);
+	}
+
+	if (!firstFrameDrawn)
+		firstFrameMs = chrono::duration<double, milli>(chrono::steady_clock::now() - setupStart).count();
+	firstFrameDrawn = true;
+}
+
+// Rows arrive bottom up as GL and the rasterizer store them, PNG wants them top down
+static bool saveScreenshot(const string& path, int imageWidth, int imageHeight, vector<uint8_t>& rgb)
+{
+	size_t rowBytes = (size_t)imageWidth * 3;
+	for (int y = 0; y < imageHeight / 2; y++)
+		swap_ranges(rgb.begin() + y * rowBytes, rgb.begin() + (y + 1) * rowBytes, rgb.begin() + (imageHeight - 1 - y) * rowBytes);
+	return SOIL_save_image(path.c_str(), SOIL_SAVE_TYPE_PNG, imageWidth, imageHeight, 3, rgb.data()) != 0;
+}
+
+// Knife mesh counters of a benchmark run: load time, vertex cache order, compression and LODs
+static void setMeshCounters(FrameBenchmark& bench)
+{
+	if (!knifeMeshPath.empty())
+		setBenchmarkCounter(bench, "mesh_load_ms", knifeMeshLoadMs);
+	if (knifeMeshPath.empty())
+	{
+		setBenchmarkCounter(bench, "acmr_before", knifeCacheBefore.acmr);
+		setBenchmarkCounter(bench, "acmr_after", knifeCacheAfter.acmr);
+		setBenchmarkCounter(bench, "atvr_before", knifeCacheBefore.atvr);
+		setBenchmarkCounter(bench, "atvr_after", knifeCacheAfter.atvr);
+	}
+	if (quantizeVertexData)
+	{
+		setBenchmarkCounter(bench, "vertex_stride", knifeQuantized.stride);
+		setBenchmarkCounter(bench, "vertex_bytes", (double)knifeQuantized.data.size());
+		setBenchmarkCounter(bench, "vertex_bytes_float", (double)knifeQuantized.vertexCount * 11 * sizeof(GLfloat));
+		setBenchmarkCounter(bench, "max_position_error", knifeQuantized.maxPositionError);
+		setBenchmarkCounter(bench, "max_normal_error_deg", knifeQuantized.maxNormalErrorDegrees);
+		setBenchmarkCounter(bench, "max_uv_error", knifeQuantized.maxUvError);
+		setBenchmarkCounter(bench, "max_color_error", knifeQuantized.maxColorError);
+	}
+	if (lodLevels > 1)
+	{
+		size_t levels = 0, fullTriangles = 0;
+		for (const MeshLods& lods : knifeMeshes)
+		{
+			levels = max(levels, lods.levels.size());
+			fullTriangles += lods.levels[0].indexCount / 3;
+		}
+		setBenchmarkCounter(bench, "lod_levels", (double)levels);
+		setBenchmarkCounter(bench, "lod_triangles", lodTrianglesDrawn);
+		double knives = sceneStream.file.header ? (double)sceneStream.file.header->instanceCount : 105.0 + extraParts;
+		setBenchmarkCounter(bench, "lod_triangles_full", (double)fullTriangles * knives);
+		setBenchmarkCounter(bench, "lod_switches", lodSwitches);
+	}
+}
+
+// Scene counters of a benchmark run: texture, culling, transforms and lights
+static void setSceneCounters(FrameBenchmark& bench)
+{
+	setBenchmarkCounter(bench, "texture_load_ms", knifeTextureLoadMs);
+	setBenchmarkCounter(bench, "texture_bytes", (double)knifeTextureBytes);
+	setBenchmarkCounter(bench, "visible_objects", (double)visibleObjects.size());
+	setBenchmarkCounter(bench, "bvh_nodes", (double)sceneBvh.nodes.size());
+	setBenchmarkCounter(bench, "bvh_nodes_tested", sceneBvh.testedNodes);
+	setBenchmarkCounter(bench, "cull_ms", cullFrames ? cullTimeMs / cullFrames : 0.0);
+	setBenchmarkCounter(bench, "transform_nodes", (double)sceneTransforms.parent.size());
+	setBenchmarkCounter(bench, "transforms_updated", sceneTransforms.updatedNodes);
+	setBenchmarkCounter(bench, "lights", (double)lightClusters.lights.size());
+
+	//Scene file streaming: chunks paged in and out over the run, and what was resident and drawn at the end
+	if (sceneStream.file.header)
+	{
+		setBenchmarkCounter(bench, "stream_chunks", sceneStream.file.header->chunkCount);
+		setBenchmarkCounter(bench, "stream_instances", (double)sceneStream.file.header->instanceCount);
+		setBenchmarkCounter(bench, "stream_loads", (double)sceneStream.loads);
+		setBenchmarkCounter(bench, "stream_evictions", (double)sceneStream.evictions);
+		setBenchmarkCounter(bench, "stream_prefetches", (double)sceneStream.prefetches);
+		setBenchmarkCounter(bench, "stream_budget_skips", (double)sceneStream.budgetSkips);
+		setBenchmarkCounter(bench, "stream_load_ms", sceneStream.loadMs);
+		setBenchmarkCounter(bench, "stream_max_frame_load_ms", sceneStream.maxFrameLoadMs);
+		setBenchmarkCounter(bench, "stream_resident_chunks", sceneStream.residentChunks);
+		setBenchmarkCounter(bench, "stream_resident_mb", sceneStream.residentBytes / 1048576.0);
+		setBenchmarkCounter(bench, "stream_peak_resident_mb", sceneStream.peakResidentBytes / 1048576.0);
+		setBenchmarkCounter(bench, "stream_visible_chunks", sceneStream.visibleChunks);
+		setBenchmarkCounter(bench, "stream_visible_instances", (double)sceneStream.visible.size());
+	}
+
+	//Occlusion culling: last frame's occluders and tests, the share culled and the time per frame over the run
+	if (occlusionCulling)
+	{
+		OcclusionCuller& culler = occlusionCuller;
+		setBenchmarkCounter(bench, "occlusion_occluders", culler.occluderCount);
+		setBenchmarkCounter(bench, "occlusion_triangles", culler.occluderTriangles);
+		setBenchmarkCounter(bench, "occlusion_tested", culler.tested);
+		setBenchmarkCounter(bench, "occlusion_culled", culler.culled);
+		setBenchmarkCounter(bench, "occlusion_cull_rate", culler.totalTested ? (double)culler.totalCulled / culler.totalTested : 0.0);
+		setBenchmarkCounter(bench, "occlusion_raster_ms", culler.frames ? culler.rasterMs / culler.frames : 0.0);
+		setBenchmarkCounter(bench, "occlusion_test_ms", culler.frames ? culler.testMs / culler.frames : 0.0);
+	}
+}
+
+// Readback ring and encoders of a recorded run, false when the pipe command could not be started
+static bool startRecording(FrameCapture& capture, const LaunchOptions& options)
+{
+	CaptureOutput output = options.recordPipe.empty() ? captureOutputForPath(options.recordPattern) : kCaptureStream;
+	int encoders = options.encoders > 0 ? options.encoders : defaultWorkerCount();
+	if (!initFrameCapture(capture, output, options.captureSlots, encoders, kDefaultCaptureQueue, options.recordPipe))
+	{
+		cout << "Error! Could not start " << options.recordPipe << endl;
+		return false;
+	}
+	return true;
+}
+
+// Queue a copy of the frame just drawn, named after its number in the recording
+static void recordFrame(FrameCapture& capture, const LaunchOptions& options, int frameWidth, int frameHeight, uint64_t frame)
+{
+	PROFILE_ZONE("capture");
+	captureFrame(capture, frameWidth, frameHeight, options.recordPipe.empty() ? captureFramePath(options.recordPattern, frame) : string());
+}
+
+// Recording counters: readback latency, GL thread waits, and encoder throughput
+static void setCaptureCounters(FrameBenchmark& bench, const FrameCapture& capture)
+{
+	BenchmarkStats readback = summarizeSamples(capture.readbackMs);
+	setBenchmarkCounter(bench, "capture_frames", (double)capture.frames);
+	setBenchmarkCounter(bench, "capture_encoded", capture.encoded);
+	setBenchmarkCounter(bench, "capture_failures", capture.failures);
+	setBenchmarkCounter(bench, "capture_slots", capture.slotCount);
+	setBenchmarkCounter(bench, "capture_encoders", capture.encoderCount);
+	setBenchmarkCounter(bench, "capture_readback_ms", readback.mean);
+	setBenchmarkCounter(bench, "capture_readback_p95_ms", readback.p95);
+	setBenchmarkCounter(bench, "capture_readback_stalls", capture.readbackStalls);
+	setBenchmarkCounter(bench, "capture_backpressure_waits", capture.backpressureWaits);
+	setBenchmarkCounter(bench, "capture_backpressure_ms", capture.backpressureMs);
+	setBenchmarkCounter(bench, "capture_encode_ms", capture.encoded + capture.failures > 0 ? capture.encodeMs / (capture.encoded + capture.failures) : 0.0);
+	setBenchmarkCounter(bench, "capture_encode_fps", captureEncodeFps(capture));
+	double seconds = chrono::duration<double>(capture.end - capture.start).count();
+	setBenchmarkCounter(bench, "capture_mb_per_sec", seconds > 0.0 ? capture.encodedBytes / seconds / 1e6 : 0.0);
+}
+
+// Render a scripted orbit offscreen and report frame timings
+static int runHeadless(const LaunchOptions& options)
+{
+	HeadlessContext headless;
+	if (!createHeadlessContext(headless))
+	{
+		cout << "Error! Could not create a headless GL context" << endl;
+		return -1;
+	}
+
+	// GLEW built for GLX reports a missing display here but still loads GL entry points
+	glewExperimental = GL_TRUE;
+	GLenum glewStatus = glewInit();
+	if (glewStatus != GLEW_OK && glewStatus != GLEW_ERROR_NO_GLX_DISPLAY)
+		cout << "Error!" << endl;
+
+	width = options.width; height = options.height;
+	applyLaunchOptions(options);
+	if (!createOffscreenTarget(headless, width, height))
+	{
+		cout << "Error! Offscreen framebuffer incomplete" << endl;
+		destroyHeadlessContext(headless);
+		return -1;
+	}
+
+	setupScene();
+
+	// Recorded frames only, the warmup is not written
+	FrameCapture capture;
+	bool recordFrames = (!options.recordPattern.empty() || !options.recordPipe.empty()) && startRecording(capture, options);
+
+	// Draw placeholder frames from the first camera position until everything is loaded,
+	// so the recorded frames are the same as after a synchronous load
+	int totalFrames = options.warmupFrames + options.frames;
+	int loadingFrames = 0;
+	scriptedOrbitAngles(0, totalFrames, options.orbitTurns, rawYaw, rawPitch);
+	orbitCamera();
+	do
+	{
+		FrameState state = captureFrameState();
+		renderScene(state);
+		loadingFrames++;
+	} while (asyncLoading && assetLoader.pending > 0);
+	lodSwitches = 0;
+	cullTimeMs = 0.0;
+	cullFrames = 0;
+
+	// Zones of the recorded frames only
+	if (!options.profilePath.empty())
+	{
+		nameProfileThread("GL");
+		initGpuProfiler();
+		startProfileCapture();
+	}
+
+	FrameBenchmark bench;
+	initBenchmark(bench, options.frames);
+	for (int frame = 0; frame < totalFrames; frame++)
+	{
+		// Scripted camera path replaces mouse input
+		scriptedOrbitAngles(frame, totalFrames, options.orbitTurns, rawYaw, rawPitch);
+		orbitCamera();
+
+		beginBenchmarkFrame(bench);
+		{
+			PROFILE_ZONE("frame");
+			FrameState state = captureFrameState();
+			renderScene(state);
+			if (recordFrames && frame >= options.warmupFrames)
+				recordFrame(capture, options, width, height, frame - options.warmupFrames);
+		}
+		endBenchmarkFrame(bench, frame >= options.warmupFrames);
+	}
+	if (recordFrames)
+		finishFrameCapture(capture);
+
+	// Last frame as an image
+	if (!options.screenshotPath.empty())
+	{
+		vector<uint8_t> pixels((size_t)width * height * 3);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+		if (!saveScreenshot(options.screenshotPath, width, height, pixels))
+			cout << "Error! Could not write " << options.screenshotPath << endl;
+	}
+	if (!options.profilePath.empty())
+	{
+		stopProfileCapture();
+		if (!writeProfileTrace(options.profilePath))
+			cout << "Error! Could not write " << options.profilePath << endl;
+		setBenchmarkCounter(bench, "profile_events", (double)profileEventCount());
+		setBenchmarkCounter(bench, "profile_gpu_frames_dropped", profileGpuFramesDropped());
+		releaseGpuProfiler();
+	}
+	setBenchmarkCounter(bench, "draw_calls", renderQueue.drawCalls);
+	setBenchmarkCounter(bench, "objects", renderQueue.submittedItems);
+	setBenchmarkCounter(bench, "draw_threads", serialDraws ? 1 : workerThreads);
+	if (!serialDraws)
+	{
+		setBenchmarkCounter(bench, "draw_partitions", drawLists.partitionCount);
+		setBenchmarkCounter(bench, "draw_commands", drawLists.commands);
+		setBenchmarkCounter(bench, "draw_command_bytes", (double)drawLists.commandBytes);
+	}
+	setBenchmarkCounter(bench, "gl_calls_issued", glState().frameIssued);
+	setBenchmarkCounter(bench, "gl_calls_elided", glState().frameElided);
+	setMeshCounters(bench);
+	setBenchmarkCounter(bench, "first_frame_ms", firstFrameMs);
+	setBenchmarkCounter(bench, "assets_resident_ms", assetsResidentMs);
+	setBenchmarkCounter(bench, "loading_frames", loadingFrames);
+	if (asyncLoading)
+	{
+		setBenchmarkCounter(bench, "upload_bytes", (double)assetLoader.uploadedBytes);
+		setBenchmarkCounter(bench, "upload_frames", assetLoader.uploadFrames);
+		setBenchmarkCounter(bench, "upload_max_frame_bytes", (double)assetLoader.maxFrameBytes);
+		setBenchmarkCounter(bench, "upload_fence_waits", assetLoader.fenceWaits);
+	}
+	setBenchmarkCounter(bench, "frames_in_flight", frameRing.regions);
+	setBenchmarkCounter(bench, "frame_fence_waits", frameRing.fenceWaits);
+	setBenchmarkCounter(bench, "frame_fence_wait_ms", frameRing.fenceWaitMs);
+	setBenchmarkCounter(bench, "ring_persistent", frameRing.persistent);
+	setBenchmarkCounter(bench, "ring_region_bytes", (double)frameRing.regionBytes);
+	setBenchmarkCounter(bench, "ring_bytes_per_frame", frameRing.frames > 0 ? (double)frameRing.totalBytes / frameRing.frames : 0.0);
+	setBenchmarkCounter(bench, "ring_max_frame_bytes", (double)frameRing.maxFrameBytes);
+	setBenchmarkCounter(bench, "ring_grows", frameRing.grows);
+	setBenchmarkCounter(bench, "shader_ms", shaderMs);
+	setBenchmarkCounter(bench, "program_cache_hits", programCache.hits);
+	setBenchmarkCounter(bench, "program_cache_misses", programCache.misses);
+	setBenchmarkCounter(bench, "program_cache_rejected", programCache.rejected);
+	setSceneCounters(bench);
+	setBenchmarkCounter(bench, "light_cluster_pairs", lightClusters.lightClusterPairs);
+	setBenchmarkCounter(bench, "max_lights_per_cluster", lightClusters.maxLightsPerCluster);
+	if (recordFrames)
+		setCaptureCounters(bench, capture);
+	finishBenchmark(bench);
+
+	if (!writeBenchmarkJson(bench, options.jsonPath, width, height, options.warmupFrames))
+		cout << "Error! Could not write " << options.jsonPath << endl;
+
+	releaseScene();
+	destroyHeadlessContext(headless);
+	return 0;
+}
+
+// Render the scripted orbit on the CPU and report frame timings, no GL context is created
+static int runSoftware(const LaunchOptions& options)
+{
+	width = options.width; height = options.height;
+	applyLaunchOptions(options);
+
+	int threads = workerThreads;
+	startWorkStealingPool(softPool, threads);
+	if (!initSoftRasterizer(softRaster, width, height, softPool))
+	{
+		cout << "Error! The software renderer draws at most " << kSoftMaxSize << "x" << kSoftMaxSize << endl;
+		stopWorkStealingPool(softPool);
+		return -1;
+	}
+
+	setupSoftwareScene();
+	lodSwitches = 0;
+
+	if (!options.profilePath.empty())
+	{
+		nameProfileThread("Main");
+		startProfileCapture();
+	}
+
+	FrameBenchmark bench;
+	bench.gpuTimers = false;
+	bench.renderer = "Software rasterizer (" + to_string(threads) + " threads)";
+	initBenchmark(bench, options.frames);
+	uint64_t stealsBefore = softPool.steals.load();
+	int totalFrames = options.warmupFrames + options.frames;
+	for (int frame = 0; frame < totalFrames; frame++)
+	{
+		scriptedOrbitAngles(frame, totalFrames, options.orbitTurns, rawYaw, rawPitch);
+		orbitCamera();
+
+		beginBenchmarkFrame(bench);
+		{
+			PROFILE_ZONE("frame");
+			renderSoftwareScene(captureFrameState());
+		}
+		endBenchmarkFrame(bench, frame >= options.warmupFrames);
+	}
+	finishBenchmark(bench);
+
+	if (!options.screenshotPath.empty())
+	{
+		vector<uint8_t> pixels;
+		readSoftPixels(softRaster, pixels);
+		if (!saveScreenshot(options.screenshotPath, width, height, pixels))
+			cout << "Error! Could not write " << options.screenshotPath << endl;
+	}
+	if (!options.profilePath.empty())
+	{
+		stopProfileCapture();
+		if (!writeProfileTrace(options.profilePath))
+			cout << "Error! Could not write " << options.profilePath << endl;
+		setBenchmarkCounter(bench, "profile_events", (double)profileEventCount());
+	}
+	setBenchmarkCounter(bench, "objects", (double)softDraws.size());
+	setMeshCounters(bench);
+	setBenchmarkCounter(bench, "first_frame_ms", firstFrameMs);
+	setBenchmarkCounter(bench, "assets_resident_ms", assetsResidentMs);
+	setSceneCounters(bench);
+
+	//Last frame's rasterizer work, and how often a thread ran out of its own tiles over the run
+	setBenchmarkCounter(bench, "soft_threads", threads);
+	setBenchmarkCounter(bench, "soft_triangles", (double)softRaster.stats.triangles);
+	setBenchmarkCounter(bench, "soft_binned_triangles", (double)softRaster.stats.binnedTriangles);
+	setBenchmarkCounter(bench, "soft_blocks_tested", (double)softRaster.stats.blocksTested);
+	setBenchmarkCounter(bench, "soft_blocks_depth_rejected", (double)softRaster.stats.blocksRejected);
+	setBenchmarkCounter(bench, "soft_pixels_shaded", (double)softRaster.stats.pixelsShaded);
+	setBenchmarkCounter(bench, "soft_steals", (double)(softPool.steals.load() - stealsBefore));
+
+	if (!writeBenchmarkJson(bench, options.jsonPath, width, height, options.warmupFrames))
+		cout << "Error! Could not write " << options.jsonPath << endl;
+
+	stopWorkStealingPool(softPool);
+	closeMeshFile(softKnifeFile);
+	closeSceneStream(sceneStream);
+	return 0;
+}
+
+// Batch runs: map the knife mesh file and read or decode its texture before the workers are forked, so every
+// worker uploads from the same pages. Files that cannot be used fall back here, as setupScene would
+static void loadSharedKnifeAssets()
+{
+	if (!knifeMeshPath.empty() && !openMeshFile(knifeMeshPath.c_str(), sharedKnifeFile))
+	{
+		cout << "Error! " << knifeMeshPath << ": " << sharedKnifeFile.error << endl;
+		knifeMeshPath.clear();
+	}
+
+	bool knifeTextureKtx = knifeTexturePath.size() > 5 && knifeTexturePath.compare(knifeTexturePath.size() - 5, 5, ".ktx2") == 0;
+	if (knifeTextureKtx && !openTextureFile(knifeTexturePath.c_str(), sharedKnifeTexture))
+	{
+		cout << "Error! " << knifeTexturePath << ": " << sharedKnifeTexture.error << endl;
+		knifeTexturePath = "metalTex.jpg";
+		knifeTextureKtx = false;
+	}
+	if (!knifeTextureKtx)
+		sharedKnifeImage = SOIL_load_image(knifeTexturePath.c_str(), &sharedKnifeImageWidth, &sharedKnifeImageHeight, 0, SOIL_LOAD_RGB);
+	sharedKnifeAssets = true;
+}
+
+static void releaseSharedKnifeAssets()
+{
+	closeMeshFile(sharedKnifeFile);
+	sharedKnifeTexture = TextureFile();
+	SOIL_free_image_data(sharedKnifeImage);
+	sharedKnifeImage = nullptr;
+	sharedKnifeAssets = false;
+}
+
+// Batch worker: own context and scene, then render jobs until none are left. Returns the process exit status
+static int renderBatchJobs(const vector<RenderJob>& jobs, FarmShared& shared, int worker, int rasterThreads)
+{
+	FarmWorkerStats& stats = shared.workers[worker];
+	chrono::steady_clock::time_point setupBegin = chrono::steady_clock::now();
+
+	// llvmpipe starts a rasterizer thread per core in every context unless told otherwise
+#ifndef _WIN32
+	if (!getenv("LP_NUM_THREADS"))
+		setenv("LP_NUM_THREADS", to_string(rasterThreads).c_str(), 1);
+#endif
+
+	HeadlessContext headless;
+	if (!createHeadlessContext(headless))
+	{
+		cout << "Error! Could not create a headless GL context" << endl;
+		return 1;
+	}
+	glewExperimental = GL_TRUE;
+	GLenum glewStatus = glewInit();
+	if (glewStatus != GLEW_OK && glewStatus != GLEW_ERROR_NO_GLX_DISPLAY)
+		cout << "Error!" << endl;
+
+	setupScene();
+
+	// Images are read back and written while the next ones are drawn
+	FrameCapture capture;
+	initFrameCapture(capture, kCapturePng, kDefaultCaptureSlots, rasterThreads);
+	stats.setupMs = chrono::duration<double, milli>(chrono::steady_clock::now() - setupBegin).count();
+	stats.started = true;
+
+	uint32_t index;
+	while (claimRenderJob(shared, (uint32_t)jobs.size(), index))
+	{
+		const RenderJob& job = jobs[index];
+		if (job.width != headless.width || job.height != headless.height)
+		{
+			destroyOffscreenTarget(headless);
+			if (!createOffscreenTarget(headless, job.width, job.height))
+			{
+				cout << "Error! Offscreen framebuffer incomplete at " << job.width << "x" << job.height << endl;
+				destroyOffscreenTarget(headless);
+				stats.failures++;
+				continue;
+			}
+		}
+
+		// Pose on the orbit around the target. Levels of detail start over, so the image does not depend on the jobs drawn before it
+		rawYaw = job.azimuth;
+		rawPitch = job.elevation;
+		radius = job.radius;
+		orbitCamera();
+		viewType = job.ortho;
+		width = job.width; height = job.height;
+		for (SceneObject& object : sceneObjects)
+			object.lod = 0;
+
+		chrono::steady_clock::time_point renderBegin = chrono::steady_clock::now();
+		{
+			PROFILE_ZONE("frame");
+			FrameState state = captureFrameState();
+			renderScene(state);
+			captureFrame(capture, width, height, job.outputPath);
+		}
+		stats.renderMs += chrono::duration<double, milli>(chrono::steady_clock::now() - renderBegin).count();
+	}
+	finishFrameCapture(capture);
+	stats.images = capture.encoded;
+	stats.failures += capture.failures;
+	for (double readbackMs : capture.readbackMs)
+		stats.readbackMs += readbackMs;
+	stats.encodeMs = capture.encodeMs;
+
+	releaseScene();
+	destroyHeadlessContext(headless);
+	return 0;
+}
+
+// Throughput of a batch run and where the workers spent their time, per image
+static bool writeBatchJson(const string& path, int jobs, int contexts, int threadsPerContext, int cleanWorkers, const FarmShared& shared, double seconds)
+{
+	FILE* out = path.empty() ? stdout : fopen(path.c_str(), "w");
+	if (!out)
+		return false;
+	int images = 0, failures = 0, started = 0;
+	double setupMs = 0.0, renderMs = 0.0, readbackMs = 0.0, encodeMs = 0.0;
+	for (int worker = 0; worker < contexts; worker++)
+	{
+		const FarmWorkerStats& stats = shared.workers[worker];
+		started += stats.started;
+		images += stats.images;
+		failures += stats.failures;
+		setupMs += stats.setupMs;
+		renderMs += stats.renderMs;
+		readbackMs += stats.readbackMs;
+		encodeMs += stats.encodeMs;
+	}
+	double perImage = images > 0 ? 1.0 / images : 0.0;
+	fprintf(out, "{\n");
+	fprintf(out, "  \"jobs\": %d,\n", jobs);
+	fprintf(out, "  \"images\": %d,\n", images);
+	fprintf(out, "  \"failed\": %d,\n", jobs - images);
+	fprintf(out, "  \"contexts\": %d,\n", contexts);
+	fprintf(out, "  \"contexts_started\": %d,\n", started);
+	fprintf(out, "  \"contexts_exited_cleanly\": %d,\n", cleanWorkers);
+	fprintf(out, "  \"threads_per_context\": %d,\n", threadsPerContext);
+	fprintf(out, "  \"seconds\": %.4f,\n", seconds);
+	fprintf(out, "  \"images_per_sec\": %.3f,\n", seconds > 0.0 ? images / seconds : 0.0);
+	fprintf(out, "  \"setup_ms\": %.4f,\n", started > 0 ? setupMs / started : 0.0);
+	fprintf(out, "  \"render_ms\": %.4f,\n", renderMs * perImage);
+	fprintf(out, "  \"readback_ms\": %.4f,\n", readbackMs * perImage);
+	fprintf(out, "  \"encode_ms\": %.4f\n", encodeMs * perImage);
+	fprintf(out, "}\n");
+	return out == stdout || fclose(out) == 0;
+}
+
+// Render every pose of a job file offscreen, spread over worker contexts, and report images per second
+static int runBatch(const LaunchOptions& options)
+{
+	vector<RenderJob> jobs;
+	string jobError;
+	if (!loadRenderJobs(options.batchPath, jobs, jobError))
+	{
+		cout << "Error! " << options.batchPath << ": " << jobError << endl;
+		return -1;
+	}
+
+	applyLaunchOptions(options);
+	asyncLoading = false; // every image is of the finished scene
+
+	// One context per hardware thread by default. The threads recording draws and llvmpipe's rasterizer threads
+	// split the cores between the contexts
+	int hardwareThreads = max((int)thread::hardware_concurrency(), 1);
+	int contexts = options.contexts > 0 ? options.contexts : hardwareThreads;
+	contexts = min(min(contexts, (int)jobs.size()), kMaxFarmWorkers);
+	int threadsPerContext = max(workerThreads / contexts, 1);
+	workerThreads = threadsPerContext;
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	loadSharedKnifeAssets();
+	FarmShared* shared = createFarmShared();
+	if (!shared)
+	{
+		cout << "Error! Could not share memory with the batch workers" << endl;
+		releaseSharedKnifeAssets();
+		return -1;
+	}
+	int cleanWorkers = runFarmWorkers(contexts, [&jobs, shared, threadsPerContext](int worker)
+	{
+		return renderBatchJobs(jobs, *shared, worker, threadsPerContext);
+	});
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	if (!writeBatchJson(options.jsonPath, (int)jobs.size(), contexts, threadsPerContext, cleanWorkers, *shared, seconds))
+		cout << "Error! Could not write " << options.jsonPath << endl;
+	bool complete = cleanWorkers == contexts;
+	for (int worker = 0; worker < contexts; worker++)
+		complete = complete && shared->workers[worker].failures == 0;
+	releaseFarmShared(shared);
+	releaseSharedKnifeAssets();
+	return complete ? 0 : -1;
+}
+
+// Input to present latency of a windowed run, with the frame pacing settings it was measured under
+static bool writeLatencyJson(const string& path, const vector<double>& inputLatencyMs, int frames)
+{
+	FILE* out = fopen(path.c_str(), "w");
+	if (!out)
+		return false;
+	fprintf(out, "{\n");
+	fprintf(out, "  \"low_latency\": %s,\n", lowLatency ? "true" : "false");
+	fprintf(out, "  \"frames_in_flight\": %d,\n", frameRing.regions);
+	fprintf(out, "  \"frames\": %d,\n", frames);
+	fprintf(out, "  \"frame_fence_waits\": %d,\n", frameRing.fenceWaits);
+	fprintf(out, "  \"frame_fence_wait_ms\": %.4f,\n", frameRing.fenceWaitMs);
+	fprintf(out, "  \"input_samples\": %d,\n", (int)inputLatencyMs.size());
+	writeStatsJson(out, "input_to_present_ms", summarizeSamples(inputLatencyMs), true);
+	fprintf(out, "}\n");
+	return fclose(out) == 0;
+}
+
+// Render thread of a windowed run: owns the GL context and draws the newest published frame state
+// until the simulation thread asks it to stop
+static void renderWindow(GLFWwindow* window, const LaunchOptions& options)
+{
+	/* Make the window's context current */
+	glfwMakeContextCurrent(window);
+
+	// Initialize GLEW
+	if (glewInit() != GLEW_OK)
+		cout << "Error!" << endl;
+
+	setupScene();
+
+	// The trace keeps the last frames of the session
+	if (!options.profilePath.empty())
+	{
+		nameProfileThread("GL");
+		initGpuProfiler();
+		startProfileCapture();
+	}
+
+	FrameCapture capture;
+	bool recordFrames = (!options.recordPattern.empty() || !options.recordPipe.empty()) && startRecording(capture, options);
+
+	// Input reaching the screen: from the newest input event a frame reflects to the swap that shows it
+	vector<double> inputLatencyMs;
+	int64_t presentedInputNs = 0;
+	int frames = 0;
+
+	FrameState state;
+	while (!renderStopping.load(memory_order_acquire))
+	{
+		PROFILE_ZONE("frame");
+
+		// Nothing new is published while the simulation waits for its next step, the same state is drawn again.
+		// Drawn from a copy, the slot goes back to the simulation when the camera is latched again
+		if (acquireTripleBuffer(frameStates))
+			state = tripleBufferFront(frameStates);
+		renderScene(state, lowLatency ? &frameStates : nullptr);
+		if (recordFrames)
+			recordFrame(capture, options, state.width, state.height, frames);
+
+		/* Swap front and back buffers */
+		{
+			PROFILE_ZONE("swap buffers");
+			glfwSwapBuffers(window);
+		}
+
+		frames++;
+		if (state.inputNs > presentedInputNs)
+		{
+			inputLatencyMs.push_back((inputClockNs() - state.inputNs) / 1e6);
+			presentedInputNs = state.inputNs;
+		}
+	}
+
+	if (!options.latencyPath.empty() && !writeLatencyJson(options.latencyPath, inputLatencyMs, frames))
+		cout << "Error! Could not write " << options.latencyPath << endl;
+
+	if (recordFrames)
+	{
+		finishFrameCapture(capture);
+		BenchmarkStats readback = summarizeSamples(capture.readbackMs);
+		cout << "Recorded " << capture.encoded << " of " << capture.frames << " frames, readback " << readback.mean << " ms (p95 " << readback.p95 << "), "
+			<< captureEncodeFps(capture) << " frames/s encoded, " << capture.backpressureWaits << " encoder waits" << endl;
+	}
+
+	if (!options.profilePath.empty())
+	{
+		stopProfileCapture();
+		if (!writeProfileTrace(options.profilePath))
+			cout << "Error! Could not write " << options.profilePath << endl;
+		releaseGpuProfiler();
+	}
+
+	releaseScene();
+	glfwMakeContextCurrent(NULL);
+}
+
+int main(int argc, char* argv[])
+{
+	width = 640; height = 480;
+
+	LaunchOptions options;
+	if (!parseLaunchOptions(argc, argv, options))
+		return -1;
+
+	if (!options.batchPath.empty())
+		return runBatch(options);
+	if (options.software)
+		return runSoftware(options);
+	if (options.headless)
+		return runHeadless(options);
+
+	GLFWwindow* window;
+
+	/* Initialize the library */
+	if (!glfwInit())
+		return -1;
+
+	/* Create a windowed mode window and its OpenGL context */
+	window = glfwCreateWindow(width, height, "Main Window", NULL, NULL);
+	if (!window)
+	{
+		glfwTerminate();
+		return -1;
+	}
+
+	// Set input callback functions
+	glfwSetKeyCallback(window, key_callback);
+	glfwSetCursorPosCallback(window, mouse_callback);
+	glfwSetMouseButtonCallback(window, mouse_button_callback);
+	glfwSetScrollCallback(window, scroll_callback);
+
+	applyLaunchOptions(options);
+	if (!options.profilePath.empty())
+		nameProfileThread("Simulation");
+
+	// This thread keeps the window, input and the simulation, the render thread takes the GL context
+	// and draws whichever state was published last
+	glfwGetFramebufferSize(window, &width, &height);
+	tripleBufferBack(frameStates) = captureFrameState();
+	publishTripleBuffer(frameStates);
+	thread renderer(renderWindow, window, cref(options));
+
+	/* Loop until the user closes the window */
+	const double step = 1.0 / kSimulationHz;
+	double simulatedTime = glfwGetTime();
+	uint64_t steps = 0;
+	int64_t publishedInputNs = 0;
+	while (!glfwWindowShouldClose(window))
+	{
+		/* Poll for and process events */
+		{
+			PROFILE_ZONE("poll events");
+			glfwPollEvents();
+		}
+
+		// Run the steps that are due, after a long stall the lost time is skipped rather than caught up
+		double now = glfwGetTime();
+		simulatedTime = max(simulatedTime, now - kMaxSimulationLag);
+		bool stepped = false;
+		while (simulatedTime + step <= now)
+		{
+			PROFILE_ZONE("simulate");
+			deltaTime = (GLfloat)step;
+			lastFrame = (GLfloat)simulatedTime;
+			simulatedTime += step;
+			steps++;
+			stepped = true;
+
+			// Poll Camera Transformations
+			TransformCamera();
+		}
+
+		// Publish a complete copy, the renderer never sees a state halfway through an update.
+		// In low latency mode input is published as soon as it arrives instead of at the next step
+		if (stepped || (lowLatency && lastInputNs != publishedInputNs))
+		{
+			// Resize window and graphics simultaneously
+			glfwGetFramebufferSize(window, &width, &height);
+			FrameState& state = tripleBufferBack(frameStates);
+			state = captureFrameState();
+			state.step = steps;
+			state.time = steps * step;
+			publishTripleBuffer(frameStates);
+			publishedInputNs = state.inputNs;
+		}
+
+		// Wait for the next step, or in low latency mode for the next input event if it comes first
+		double wait = simulatedTime + step - glfwGetTime();
+		if (wait > 0.0 && lowLatency)
+			glfwWaitEventsTimeout(wait);
+		else if (wait > 0.0)
+			this_thread::sleep_for(chrono::duration<double>(wait));
+	}
+
+	renderStopping.store(true, memory_order_release);
+	renderer.join();
 	glfwTerminate();
 	return 0;
 }
@@ -806,6 +2653,8 @@ int main(void)
 // Define input functions
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode)
 {
+	lastInputNs = inputClockNs();
+
 	// Display ASCII Key code
 	//std::cout <<"ASCII: "<< key << std::endl;	
 
@@ -822,6 +2671,7 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 }
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
+	lastInputNs = inputClockNs();
 
 	// Clamp FOV
 	if (fov >= 1.0f && fov <= 55.0f)
@@ -836,6 +2686,7 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 }
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 {
+	lastInputNs = inputClockNs();
 
 	if (firstMouseMove)
 	{
@@ -858,18 +2709,26 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 		rawYaw += xChange;
 		rawPitch += yChange;
 
-		// Conver yaw and pitch to degrees, and clamp pitch
-		degYaw = glm::radians(rawYaw);
-		degPitch = glm::clamp(glm::radians(rawPitch), -glm::pi<float>() / 2.f + .1f, glm::pi<float>() / 2.f - .1f);
-
-		// Azimuth Altitude formula
-		cameraPosition.x = target.x + radius * cosf(degPitch) * sinf(degYaw);
-		cameraPosition.y = target.y + radius * sinf(degPitch);
-		cameraPosition.z = target.z + radius * cosf(degPitch) * cosf(degYaw);
+		orbitCamera();
 	}
 }
+
+// Place camera on its orbit around the target from raw yaw and pitch
+void orbitCamera()
+{
+	// Conver yaw and pitch to degrees, and clamp pitch
+	degYaw = glm::radians(rawYaw);
+	degPitch = glm::clamp(glm::radians(rawPitch), -glm::pi<float>() / 2.f + .1f, glm::pi<float>() / 2.f - .1f);
+
+	// Azimuth Altitude formula
+	cameraPosition.x = target.x + radius * cosf(degPitch) * sinf(degYaw);
+	cameraPosition.y = target.y + radius * sinf(degPitch);
+	cameraPosition.z = target.z + radius * cosf(degPitch) * cosf(degYaw);
+}
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mode)
 {
+	lastInputNs = inputClockNs();
+
 	// Assign boolean state to element Button code
 	if (action == GLFW_PRESS)
 		mouseButtons[button] = true;
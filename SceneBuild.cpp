@@ -0,0 +1,133 @@
+// Offline builder of the chunked scene files read by RoughSketch --scene
+//
+//     SceneBuild output.rssc [--parts N] [--chunk-size S] [--no-builtin]
+//
+// Writes the viewer's knives as instances: the 105 built-in knives at the origin as one chunk, then N extra
+// knives on the grid --parts lays out, cut into chunks of about S x S world units. A chunk is generated and
+// written before the next one, so the scene never has to fit in memory.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "SceneFile.h"
+
+using namespace std;
+
+const float kKnifeScale = 0.5f; // planeScale in the viewer
+const float kPartSpacingX = 2.5f, kPartSpacingZ = 0.5f;
+const float kDefaultChunkSize = 16.0f;
+
+// Knife at a position, scaled like the viewer's
+static void addKnife(SceneChunkData& chunk, float x, float y, float z)
+{
+	float transform[12] = { kKnifeScale, 0.0f, 0.0f, 0.0f, kKnifeScale, 0.0f, 0.0f, 0.0f, kKnifeScale, x, y, z };
+	chunk.meshes.push_back(kSceneMeshKnife);
+	chunk.materials.push_back(kSceneMaterialKnife);
+	for (int component = 0; component < 12; component++)
+		chunk.transforms[component].push_back(transform[component]);
+}
+
+static void clearChunk(SceneChunkData& chunk)
+{
+	chunk.meshes.clear();
+	chunk.materials.clear();
+	for (vector<float>& component : chunk.transforms)
+		component.clear();
+}
+
+// Knives of the grid with columns [column, column + columns) and rows [row, row + rows), placed as --parts places them
+static int partsInBlock(int parts, int partsPerRow, int column, int columns, int row, int rows)
+{
+	int count = 0;
+	for (int r = row; r < row + rows; r++)
+		count += max(0, min(column + columns, parts - r * partsPerRow) - column);
+	return count;
+}
+
+int main(int argc, char* argv[])
+{
+	string outputPath;
+	int parts = 0;
+	float chunkSize = kDefaultChunkSize;
+	bool builtin = true;
+	bool valid = true;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--parts" && i + 1 < argc)
+			parts = atoi(argv[++i]);
+		else if (arg == "--chunk-size" && i + 1 < argc)
+			chunkSize = (float)atof(argv[++i]);
+		else if (arg == "--no-builtin")
+			builtin = false;
+		else if (outputPath.empty() && arg[0] != '-')
+			outputPath = arg;
+		else
+			valid = false;
+	}
+	if (!valid || outputPath.empty() || parts < 0 || chunkSize <= 0.0f)
+	{
+		cout << "Usage: SceneBuild output.rssc [--parts N] [--chunk-size S] [--no-builtin]" << endl;
+		return -1;
+	}
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	//Grid blocks of whole columns and rows, about chunkSize on each side
+	int partsPerRow = (int)ceil(sqrt((double)parts));
+	int rowCount = partsPerRow ? (parts + partsPerRow - 1) / partsPerRow : 0;
+	int blockColumns = max(1, (int)(chunkSize / kPartSpacingX)), blockRows = max(1, (int)(chunkSize / kPartSpacingZ));
+	uint32_t chunkCount = builtin ? 1 : 0;
+	for (int row = 0; row < rowCount; row += blockRows)
+		for (int column = 0; column < partsPerRow; column += blockColumns)
+			chunkCount += partsInBlock(parts, partsPerRow, column, blockColumns, row, blockRows) > 0;
+
+	SceneFileWriter writer;
+	if (!beginSceneFile(writer, outputPath.c_str(), chunkCount))
+	{
+		cout << "Error! Could not write " << outputPath << endl;
+		return -1;
+	}
+	bool ok = true;
+	SceneChunkData chunk;
+	if (builtin)
+	{
+		for (int i = 0; i <= 104; i++)
+			addKnife(chunk, 0.0f, 0.0f, 0.0f);
+		ok = writeSceneChunk(writer, chunk);
+	}
+	for (int row = 0; row < rowCount && ok; row += blockRows)
+	{
+		for (int column = 0; column < partsPerRow && ok; column += blockColumns)
+		{
+			clearChunk(chunk);
+			for (int r = row; r < row + blockRows; r++)
+			{
+				for (int c = column; c < column + blockColumns && c < partsPerRow; c++)
+				{
+					int i = r * partsPerRow + c;
+					if (i < parts)
+						addKnife(chunk, (i % partsPerRow) * 2.5f - partsPerRow * 1.25f, -1.0f, (i / partsPerRow) * -0.5f);
+				}
+			}
+			if (!chunk.meshes.empty())
+				ok = writeSceneChunk(writer, chunk);
+		}
+	}
+	SceneFileHeader header = writer.header;
+	uint64_t bytes = writer.written;
+	if (!finishSceneFile(writer) || !ok)
+	{
+		cout << "Error! Could not write " << outputPath << endl;
+		return -1;
+	}
+
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	cout << outputPath << ": " << header.instanceCount << " instances in " << header.chunkCount << " chunks, "
+		<< bytes << " bytes, " << ms << " ms" << endl;
+	return 0;
+}
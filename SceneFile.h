@@ -0,0 +1,341 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Binary scene container: mesh instances grouped into spatial chunks, memory mapped and read one chunk at a time.
+// Layout: header, chunk table, then one instance block per chunk. Values are little endian.
+// A chunk's block holds its instances as separate arrays (structure of arrays): mesh ids, material ids, then the
+// 12 floats of each instance's 3x4 transform, one array per float, column by column. Blocks start on a page
+// boundary so a chunk's pages can be read ahead and released on their own.
+
+const uint32_t kSceneFileMagic = 0x43535352u; // "RSSC"
+const uint32_t kSceneFileVersion = 1;
+const uint64_t kSceneBlockAlignment = 4096;
+
+// Mesh and material ids known to the viewer
+const uint16_t kSceneMeshKnife = 0;
+const uint16_t kSceneMaterialKnife = 0;
+
+struct SceneFileHeader
+{
+	uint32_t magic, version;
+	uint32_t chunkCount, flags; // flags reserved, 0
+	uint64_t instanceCount;
+	float boundsMin[3], boundsMax[3]; // instance positions, over every chunk
+	uint64_t chunkOffset; // bytes from the start of the file
+};
+static_assert(sizeof(SceneFileHeader) == 56, "SceneFileHeader is written to disk as is");
+
+// Bounds are of the instance positions (transform translations). The meshes reach out from there by at most
+// their radius times maxScale, the largest axis scale of any instance in the chunk
+struct SceneChunk
+{
+	float boundsMin[3], boundsMax[3];
+	float maxScale;
+	uint32_t instanceCount;
+	uint64_t offset; // instance block, bytes from the start of the file
+};
+static_assert(sizeof(SceneChunk) == 40, "SceneChunk is written to disk as is");
+
+// Read-only view of a mapped scene file, the pointers are valid until closeSceneFile
+struct SceneFile
+{
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE, mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+
+	const SceneFileHeader* header = nullptr;
+	const SceneChunk* chunks = nullptr;
+
+	std::string error;
+};
+
+// One chunk's instances in memory, e.g. while a scene is being built
+struct SceneChunkData
+{
+	std::vector<uint16_t> meshes, materials;
+	std::vector<float> transforms[12]; // column major 3x4, transforms[column * 3 + row][instance]
+};
+
+inline uint64_t alignSceneOffset(uint64_t offset)
+{
+	return (offset + kSceneBlockAlignment - 1) & ~(kSceneBlockAlignment - 1);
+}
+
+// Block of `bytes` at `offset` inside a file of `size` bytes, without overflowing on crafted offsets
+inline bool sceneBlockInFile(uint64_t offset, uint64_t bytes, uint64_t size)
+{
+	return offset <= size && bytes <= size - offset;
+}
+
+// Offsets inside a block of `count` instances, each array starts 4-byte aligned
+inline uint64_t sceneMaterialsOffset(uint32_t count)
+{
+	return ((uint64_t)count * 2 + 3) & ~(uint64_t)3;
+}
+
+inline uint64_t sceneTransformOffset(uint32_t count, int component)
+{
+	return sceneMaterialsOffset(count) * 2 + (uint64_t)component * count * 4;
+}
+
+inline uint64_t sceneChunkBytes(uint32_t count)
+{
+	return sceneTransformOffset(count, 12);
+}
+
+inline const uint16_t* sceneChunkMeshes(const SceneFile& scene, const SceneChunk& chunk)
+{
+	return (const uint16_t*)(scene.data + chunk.offset);
+}
+
+inline const uint16_t* sceneChunkMaterials(const SceneFile& scene, const SceneChunk& chunk)
+{
+	return (const uint16_t*)(scene.data + chunk.offset + sceneMaterialsOffset(chunk.instanceCount));
+}
+
+inline const float* sceneChunkTransform(const SceneFile& scene, const SceneChunk& chunk, int component)
+{
+	return (const float*)(scene.data + chunk.offset + sceneTransformOffset(chunk.instanceCount, component));
+}
+
+inline void closeSceneFile(SceneFile& scene)
+{
+#ifdef _WIN32
+	if (scene.data)
+		UnmapViewOfFile(scene.data);
+	if (scene.mapping)
+		CloseHandle(scene.mapping);
+	if (scene.file != INVALID_HANDLE_VALUE)
+		CloseHandle(scene.file);
+	scene.file = INVALID_HANDLE_VALUE;
+	scene.mapping = nullptr;
+#else
+	if (scene.data)
+		munmap((void*)scene.data, scene.size);
+	if (scene.fd >= 0)
+		close(scene.fd);
+	scene.fd = -1;
+#endif
+	scene.data = nullptr;
+	scene.size = 0;
+	scene.header = nullptr;
+	scene.chunks = nullptr;
+}
+
+inline bool mapSceneFile(const char* path, SceneFile& scene)
+{
+#ifdef _WIN32
+	scene.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (scene.file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(scene.file, &fileSize) || fileSize.QuadPart == 0)
+		return false;
+	scene.size = (size_t)fileSize.QuadPart;
+	scene.mapping = CreateFileMappingA(scene.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!scene.mapping)
+		return false;
+	scene.data = (const uint8_t*)MapViewOfFile(scene.mapping, FILE_MAP_READ, 0, 0, 0);
+	return scene.data != nullptr;
+#else
+	scene.fd = open(path, O_RDONLY);
+	if (scene.fd < 0)
+		return false;
+	struct stat info;
+	if (fstat(scene.fd, &info) != 0 || info.st_size == 0)
+		return false;
+	scene.size = (size_t)info.st_size;
+	void* data = mmap(nullptr, scene.size, PROT_READ, MAP_PRIVATE, scene.fd, 0);
+	if (data == MAP_FAILED)
+		return false;
+	// Chunks are read where the camera is, not front to back
+	madvise(data, scene.size, MADV_RANDOM);
+	scene.data = (const uint8_t*)data;
+	return true;
+#endif
+}
+
+// Read ahead the pages of a chunk that is likely to be needed soon
+inline void prefetchSceneChunk(const SceneFile& scene, const SceneChunk& chunk)
+{
+#ifndef _WIN32
+	madvise((void*)(scene.data + chunk.offset), (size_t)sceneChunkBytes(chunk.instanceCount), MADV_WILLNEED);
+#endif
+}
+
+// Give back the pages of a chunk whose instances have been copied out, they are read again from the file if needed
+inline void releaseSceneChunkPages(const SceneFile& scene, const SceneChunk& chunk)
+{
+#ifndef _WIN32
+	madvise((void*)(scene.data + chunk.offset), (size_t)sceneChunkBytes(chunk.instanceCount), MADV_DONTNEED);
+#endif
+}
+
+// Map a scene file and check that the chunk table and every block lie inside it
+inline bool openSceneFile(const char* path, SceneFile& scene)
+{
+	if (!mapSceneFile(path, scene))
+	{
+		closeSceneFile(scene);
+		scene.error = std::string("cannot map ") + path;
+		return false;
+	}
+
+	const SceneFileHeader* header = (const SceneFileHeader*)scene.data;
+	if (scene.size < sizeof(SceneFileHeader) || header->magic != kSceneFileMagic)
+		scene.error = "not a scene file";
+	else if (header->version != kSceneFileVersion)
+		scene.error = "unsupported scene file version";
+	else if (header->chunkOffset % 8 != 0 || !sceneBlockInFile(header->chunkOffset, (uint64_t)header->chunkCount * sizeof(SceneChunk), scene.size))
+		scene.error = "truncated scene file";
+	if (!scene.error.empty())
+	{
+		closeSceneFile(scene);
+		return false;
+	}
+
+	scene.header = header;
+	scene.chunks = (const SceneChunk*)(scene.data + header->chunkOffset);
+	for (uint32_t i = 0; i < header->chunkCount; i++)
+	{
+		const SceneChunk& chunk = scene.chunks[i];
+		if (chunk.offset % kSceneBlockAlignment != 0 || !sceneBlockInFile(chunk.offset, sceneChunkBytes(chunk.instanceCount), scene.size))
+		{
+			closeSceneFile(scene);
+			scene.error = "chunk outside the file";
+			return false;
+		}
+	}
+	return true;
+}
+
+// Writes chunks as they are built, so a scene never has to fit in memory. The chunk table goes in once every
+// chunk has been written
+struct SceneFileWriter
+{
+	FILE* out = nullptr;
+	SceneFileHeader header = {};
+	std::vector<SceneChunk> chunks;
+	uint64_t written = 0;
+};
+
+// Zeros up to `offset`, the space left for the chunk table can be more than a page
+inline bool writeScenePadding(SceneFileWriter& writer, uint64_t offset)
+{
+	static const uint8_t padding[kSceneBlockAlignment] = {};
+	while (writer.written < offset)
+	{
+		size_t bytes = (size_t)std::min<uint64_t>(offset - writer.written, kSceneBlockAlignment);
+		if (fwrite(padding, 1, bytes, writer.out) != bytes)
+			return false;
+		writer.written += bytes;
+	}
+	return true;
+}
+
+// Room for the header and a table of `chunkCount` chunks
+inline bool beginSceneFile(SceneFileWriter& writer, const char* path, uint32_t chunkCount)
+{
+	writer = SceneFileWriter();
+	writer.out = fopen(path, "wb");
+	if (!writer.out)
+		return false;
+	writer.header.magic = kSceneFileMagic;
+	writer.header.version = kSceneFileVersion;
+	writer.header.chunkCount = chunkCount;
+	writer.header.chunkOffset = sizeof(SceneFileHeader);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		writer.header.boundsMin[axis] = INFINITY;
+		writer.header.boundsMax[axis] = -INFINITY;
+	}
+	writer.chunks.reserve(chunkCount);
+	return writeScenePadding(writer, alignSceneOffset(writer.header.chunkOffset + (uint64_t)chunkCount * sizeof(SceneChunk)));
+}
+
+// Append one chunk, its bounds are computed here
+inline bool writeSceneChunk(SceneFileWriter& writer, const SceneChunkData& data)
+{
+	if (writer.chunks.size() == writer.header.chunkCount)
+		return false;
+	uint32_t count = (uint32_t)data.meshes.size();
+	SceneChunk chunk = {};
+	chunk.instanceCount = count;
+	chunk.offset = writer.written;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		chunk.boundsMin[axis] = count ? INFINITY : 0.0f;
+		chunk.boundsMax[axis] = count ? -INFINITY : 0.0f;
+	}
+	for (uint32_t i = 0; i < count; i++)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float position = data.transforms[9 + axis][i];
+			chunk.boundsMin[axis] = position < chunk.boundsMin[axis] ? position : chunk.boundsMin[axis];
+			chunk.boundsMax[axis] = position > chunk.boundsMax[axis] ? position : chunk.boundsMax[axis];
+		}
+		for (int column = 0; column < 3; column++)
+		{
+			float x = data.transforms[column * 3][i], y = data.transforms[column * 3 + 1][i], z = data.transforms[column * 3 + 2][i];
+			float scale = sqrtf(x * x + y * y + z * z);
+			chunk.maxScale = scale > chunk.maxScale ? scale : chunk.maxScale;
+		}
+	}
+	for (int axis = 0; axis < 3 && count; axis++)
+	{
+		writer.header.boundsMin[axis] = chunk.boundsMin[axis] < writer.header.boundsMin[axis] ? chunk.boundsMin[axis] : writer.header.boundsMin[axis];
+		writer.header.boundsMax[axis] = chunk.boundsMax[axis] > writer.header.boundsMax[axis] ? chunk.boundsMax[axis] : writer.header.boundsMax[axis];
+	}
+
+	bool ok = fwrite(data.meshes.data(), 2, count, writer.out) == count;
+	writer.written += (uint64_t)count * 2;
+	ok = ok && writeScenePadding(writer, chunk.offset + sceneMaterialsOffset(count));
+	ok = ok && fwrite(data.materials.data(), 2, count, writer.out) == count;
+	writer.written += (uint64_t)count * 2;
+	ok = ok && writeScenePadding(writer, chunk.offset + sceneTransformOffset(count, 0));
+	for (int component = 0; component < 12; component++)
+		ok = ok && fwrite(data.transforms[component].data(), 4, count, writer.out) == count;
+	writer.written += (uint64_t)count * 48;
+	ok = ok && writeScenePadding(writer, alignSceneOffset(writer.written));
+
+	writer.chunks.push_back(chunk);
+	writer.header.instanceCount += count;
+	return ok;
+}
+
+// Header and chunk table, false if fewer chunks were written than announced
+inline bool finishSceneFile(SceneFileWriter& writer)
+{
+	bool ok = writer.chunks.size() == writer.header.chunkCount;
+	if (writer.header.instanceCount == 0)
+	{
+		for (int axis = 0; axis < 3; axis++)
+			writer.header.boundsMin[axis] = writer.header.boundsMax[axis] = 0.0f;
+	}
+	ok = ok && fseek(writer.out, 0, SEEK_SET) == 0;
+	ok = ok && fwrite(&writer.header, sizeof(writer.header), 1, writer.out) == 1;
+	ok = ok && (writer.chunks.empty() || fwrite(writer.chunks.data(), sizeof(SceneChunk), writer.chunks.size(), writer.out) == writer.chunks.size());
+	ok = fclose(writer.out) == 0 && ok;
+	writer.out = nullptr;
+	return ok;
+}
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Bvh.h"
+#include "SceneFile.h"
+#include "SimdMat4.h"
+
+// Chunks of a scene file paged in around the camera. Every frame the chunks within `radius` of the camera are
+// wanted: missing ones are copied out of the mapping into resident arrays (world and normal matrices, bounding
+// spheres, ids), nearest first, and the file pages they came from are given back. When the resident chunks would
+// go over the memory budget the least recently wanted ones are evicted; a chunk still wanted this frame never is,
+// so one that does not fit is skipped until the camera moves. Chunks in a shell past the radius get a read-ahead
+// hint, so the pages are usually in memory before the chunk is wanted.
+// Instances of the wanted chunks are frustum culled chunk by chunk and then one by one into `visible`.
+
+const int kDefaultStreamBudgetMB = 64;
+const float kDefaultStreamRadius = 20.0f;
+const float kStreamPrefetchScale = 1.5f; // prefetch shell, times the radius
+
+// Object space bounding sphere of a mesh id, from the app
+struct StreamMesh
+{
+	glm::vec3 center = glm::vec3(0.0f);
+	float radius = 0.0f;
+};
+
+// Instances of one chunk in memory. Slots are reused, so their arrays keep their capacity
+struct ResidentChunk
+{
+	uint32_t chunk = UINT32_MAX; // UINT32_MAX when the slot is free
+	uint64_t lastWanted = 0; // frame
+	size_t bytes = 0;
+	std::vector<glm::mat4> world;
+	std::vector<glm::mat3> normal;
+	std::vector<glm::vec4> spheres; // world center and radius
+	std::vector<uint16_t> meshes, materials;
+	std::vector<uint8_t> lods; // lodSlots per instance, the level each submesh was drawn at
+};
+
+struct StreamedInstance
+{
+	uint32_t slot, instance;
+};
+
+struct SceneStream
+{
+	SceneFile file;
+	std::vector<StreamMesh> meshes;
+	int lodSlots = 1;
+	size_t budgetBytes = (size_t)kDefaultStreamBudgetMB << 20;
+	float radius = kDefaultStreamRadius;
+
+	// Per chunk: bounds grown by the largest mesh sphere at the chunk's largest scale, its slot, and whether
+	// its pages were asked to be read ahead since it was last resident
+	std::vector<Aabb> chunkBounds;
+	std::vector<int32_t> residentSlot;
+	std::vector<uint8_t> prefetched;
+
+	std::vector<ResidentChunk> slots;
+	std::vector<uint32_t> freeSlots;
+	std::vector<std::pair<float, uint32_t>> wanted; // scratch, distance and chunk
+	std::vector<StreamedInstance> visible;
+	uint64_t frame = 0;
+
+	// Stats over the run, and of the last frame
+	uint64_t loads = 0, evictions = 0, prefetches = 0, budgetSkips = 0;
+	double loadMs = 0.0, maxFrameLoadMs = 0.0;
+	size_t residentBytes = 0, peakResidentBytes = 0;
+	int residentChunks = 0, wantedChunks = 0, visibleChunks = 0;
+};
+
+inline size_t streamInstanceBytes(int lodSlots)
+{
+	return sizeof(glm::mat4) + sizeof(glm::mat3) + sizeof(glm::vec4) + 2 * sizeof(uint16_t) + (size_t)lodSlots;
+}
+
+inline bool openSceneStream(SceneStream& stream, const char* path, size_t budgetBytes, float radius)
+{
+	closeSceneFile(stream.file);
+	stream.budgetBytes = budgetBytes;
+	stream.radius = radius;
+	return openSceneFile(path, stream.file);
+}
+
+inline void evictStreamChunk(SceneStream& stream, uint32_t slot)
+{
+	ResidentChunk& resident = stream.slots[slot];
+	stream.residentSlot[resident.chunk] = -1;
+	stream.prefetched[resident.chunk] = 0;
+	stream.residentBytes -= resident.bytes;
+	stream.residentChunks--;
+	resident.chunk = UINT32_MAX;
+	resident.bytes = 0;
+	stream.freeSlots.push_back(slot);
+}
+
+// Drop every resident chunk and take the meshes the instances are drawn with, e.g. when the app's meshes change
+inline void resetSceneStream(SceneStream& stream, const std::vector<StreamMesh>& meshes, int lodSlots)
+{
+	stream.meshes = meshes;
+	stream.lodSlots = std::max(lodSlots, 1);
+	for (uint32_t slot = 0; slot < stream.slots.size(); slot++)
+		if (stream.slots[slot].chunk != UINT32_MAX)
+			evictStreamChunk(stream, slot);
+	stream.visible.clear();
+	if (!stream.file.header)
+		return;
+
+	float meshReach = 0.0f;
+	for (const StreamMesh& mesh : meshes)
+		meshReach = std::max(meshReach, glm::length(mesh.center) + mesh.radius);
+	uint32_t count = stream.file.header->chunkCount;
+	stream.chunkBounds.resize(count);
+	stream.residentSlot.assign(count, -1);
+	stream.prefetched.assign(count, 0);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const SceneChunk& chunk = stream.file.chunks[i];
+		glm::vec3 reach(meshReach * chunk.maxScale);
+		stream.chunkBounds[i] = { glm::vec3(chunk.boundsMin[0], chunk.boundsMin[1], chunk.boundsMin[2]) - reach,
+			glm::vec3(chunk.boundsMax[0], chunk.boundsMax[1], chunk.boundsMax[2]) + reach };
+	}
+}
+
+inline void closeSceneStream(SceneStream& stream)
+{
+	closeSceneFile(stream.file);
+	stream = SceneStream();
+}
+
+inline float distanceToAabb(const Aabb& box, const glm::vec3& point)
+{
+	return glm::length(glm::max(glm::max(box.min - point, point - box.max), glm::vec3(0.0f)));
+}
+
+// Box against the frustum planes: -1 outside one of them, 1 inside all of them, 0 across
+inline int testStreamChunk(const Aabb& box, const glm::vec4* planes)
+{
+	int result = 1;
+	for (int p = 0; p < 6; p++)
+	{
+		float x0 = planes[p].x * box.min.x, x1 = planes[p].x * box.max.x;
+		float y0 = planes[p].y * box.min.y, y1 = planes[p].y * box.max.y;
+		float z0 = planes[p].z * box.min.z, z1 = planes[p].z * box.max.z;
+		if (std::max(x0, x1) + std::max(y0, y1) + std::max(z0, z1) + planes[p].w < 0.0f)
+			return -1;
+		if (std::min(x0, x1) + std::min(y0, y1) + std::min(z0, z1) + planes[p].w < 0.0f)
+			result = 0;
+	}
+	return result;
+}
+
+// Copy a chunk's instances out of the mapping, then release the pages they were read from
+inline void loadStreamChunk(SceneStream& stream, uint32_t chunkIndex, size_t bytes)
+{
+	const SceneFile& file = stream.file;
+	const SceneChunk& chunk = file.chunks[chunkIndex];
+	uint32_t slot;
+	if (!stream.freeSlots.empty())
+	{
+		slot = stream.freeSlots.back();
+		stream.freeSlots.pop_back();
+	}
+	else
+	{
+		slot = (uint32_t)stream.slots.size();
+		stream.slots.emplace_back();
+	}
+
+	ResidentChunk& resident = stream.slots[slot];
+	uint32_t count = chunk.instanceCount;
+	resident.chunk = chunkIndex;
+	resident.lastWanted = stream.frame;
+	resident.bytes = bytes;
+	resident.world.resize(count);
+	resident.normal.resize(count);
+	resident.spheres.resize(count);
+	resident.meshes.assign(sceneChunkMeshes(file, chunk), sceneChunkMeshes(file, chunk) + count);
+	resident.materials.assign(sceneChunkMaterials(file, chunk), sceneChunkMaterials(file, chunk) + count);
+	resident.lods.assign((size_t)count * stream.lodSlots, 0);
+
+	const float* transform[12];
+	for (int component = 0; component < 12; component++)
+		transform[component] = sceneChunkTransform(file, chunk, component);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		glm::mat4& world = resident.world[i];
+		for (int column = 0; column < 4; column++)
+			world[column] = glm::vec4(transform[column * 3][i], transform[column * 3 + 1][i], transform[column * 3 + 2][i], column == 3 ? 1.0f : 0.0f);
+	}
+	normalMatrices(resident.world.data(), count, resident.normal.data());
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const glm::mat4& world = resident.world[i];
+
+		// Ids the app has no mesh for are culled below
+		StreamMesh mesh = resident.meshes[i] < stream.meshes.size() ? stream.meshes[resident.meshes[i]] : StreamMesh();
+		float scale = glm::max(glm::length(glm::vec3(world[0])), glm::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+		resident.spheres[i] = glm::vec4(glm::vec3(world * glm::vec4(mesh.center, 1.0f)), mesh.radius * scale);
+	}
+	releaseSceneChunkPages(file, chunk);
+
+	stream.residentSlot[chunkIndex] = (int32_t)slot;
+	stream.prefetched[chunkIndex] = 0;
+	stream.residentBytes += bytes;
+	stream.peakResidentBytes = std::max(stream.peakResidentBytes, stream.residentBytes);
+	stream.residentChunks++;
+	stream.loads++;
+}
+
+// Least recently wanted chunk that is not wanted this frame, false when every resident chunk is
+inline bool evictLeastRecentChunk(SceneStream& stream)
+{
+	uint32_t oldest = UINT32_MAX;
+	for (uint32_t slot = 0; slot < stream.slots.size(); slot++)
+	{
+		const ResidentChunk& resident = stream.slots[slot];
+		if (resident.chunk != UINT32_MAX && resident.lastWanted < stream.frame &&
+			(oldest == UINT32_MAX || resident.lastWanted < stream.slots[oldest].lastWanted))
+			oldest = slot;
+	}
+	if (oldest == UINT32_MAX)
+		return false;
+	evictStreamChunk(stream, oldest);
+	stream.evictions++;
+	return true;
+}
+
+// Page chunks in and out for this camera, then fill `visible` with the instances of wanted chunks inside the
+// frustum (all of them without planes). The chunk table is small next to the instances, so it is scanned as a whole
+inline void updateSceneStream(SceneStream& stream, const glm::vec3& cameraPosition, const glm::vec4* frustumPlanes)
+{
+	stream.visible.clear();
+	stream.visibleChunks = 0;
+	if (!stream.file.header)
+		return;
+	stream.frame++;
+
+	// Wanted chunks nearest first, and read-ahead for the shell around them
+	uint32_t count = stream.file.header->chunkCount;
+	float prefetchRadius = stream.radius * kStreamPrefetchScale;
+	stream.wanted.clear();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		float distance = distanceToAabb(stream.chunkBounds[i], cameraPosition);
+		if (distance <= stream.radius)
+			stream.wanted.push_back(std::make_pair(distance, i));
+		else if (distance <= prefetchRadius && stream.residentSlot[i] < 0 && !stream.prefetched[i])
+		{
+			prefetchSceneChunk(stream.file, stream.file.chunks[i]);
+			stream.prefetched[i] = 1;
+			stream.prefetches++;
+		}
+		else if (distance > prefetchRadius)
+			stream.prefetched[i] = 0;
+	}
+	std::sort(stream.wanted.begin(), stream.wanted.end());
+	stream.wantedChunks = (int)stream.wanted.size();
+
+	// Everything wanted and already resident is kept, whatever gets loaded after it
+	for (const std::pair<float, uint32_t>& entry : stream.wanted)
+		if (stream.residentSlot[entry.second] >= 0)
+			stream.slots[stream.residentSlot[entry.second]].lastWanted = stream.frame;
+
+	std::chrono::steady_clock::time_point loadStart = std::chrono::steady_clock::now();
+	bool loaded = false;
+	for (const std::pair<float, uint32_t>& entry : stream.wanted)
+	{
+		if (stream.residentSlot[entry.second] >= 0)
+			continue;
+		size_t bytes = stream.file.chunks[entry.second].instanceCount * streamInstanceBytes(stream.lodSlots);
+		while (stream.residentBytes + bytes > stream.budgetBytes && evictLeastRecentChunk(stream))
+			;
+		if (stream.residentBytes + bytes > stream.budgetBytes)
+		{
+			stream.budgetSkips++;
+			continue;
+		}
+		loadStreamChunk(stream, entry.second, bytes);
+		loaded = true;
+	}
+	if (loaded)
+	{
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
+		stream.loadMs += ms;
+		stream.maxFrameLoadMs = std::max(stream.maxFrameLoadMs, ms);
+	}
+
+	// Only wanted chunks are drawn, the others are kept in case the camera comes back
+	for (uint32_t slot = 0; slot < stream.slots.size(); slot++)
+	{
+		const ResidentChunk& resident = stream.slots[slot];
+		if (resident.chunk == UINT32_MAX || resident.lastWanted != stream.frame)
+			continue;
+		int chunkTest = frustumPlanes ? testStreamChunk(stream.chunkBounds[resident.chunk], frustumPlanes) : 1;
+		if (chunkTest < 0)
+			continue;
+		stream.visibleChunks++;
+
+		uint32_t instances = (uint32_t)resident.world.size();
+		for (uint32_t i = 0; i < instances; i++)
+		{
+			if (resident.meshes[i] >= stream.meshes.size())
+				continue;
+			const glm::vec4& sphere = resident.spheres[i];
+			bool culled = false;
+			for (int p = 0; chunkTest == 0 && p < 6 && !culled; p++)
+				culled = glm::dot(glm::vec3(frustumPlanes[p]), glm::vec3(sphere)) + frustumPlanes[p].w < -sphere.w;
+			if (!culled)
+				stream.visible.push_back({ slot, i });
+		}
+	}
+}
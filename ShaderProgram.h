@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+#include <glm/glm.hpp>
+
+#include "GLStateCache.h"
+#include "GpuRingBuffer.h"
+
+// Linked program with its active uniforms and uniform blocks reflected once at link time
+struct ShaderProgram
+{
+	GLuint id = 0;
+	std::unordered_map<std::string, GLint> uniforms; // default block uniform locations
+	std::unordered_map<std::string, GLuint> blocks; // uniform block indices
+};
+
+// Per-frame camera and lighting data shared by every program (std140 layout)
+struct FrameUniforms
+{
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::vec4 viewPos;
+	glm::vec4 ambient;
+	glm::vec4 clusterScale; // tile size in pixels, slice log scale and bias
+	int clusterDims[4]; // tiles x, tiles y, slices, light count
+};
+static_assert(sizeof(FrameUniforms) == 192, "FrameUniforms must match the std140 FrameData block");
+
+const GLuint kFrameUniformBinding = 0;
+
+// GLSL declaration of FrameUniforms, prepended to shaders that read it
+const char* const kFrameDataBlockSource =
+	"layout(std140) uniform FrameData"
+	"{"
+	"mat4 view;"
+	"mat4 projection;"
+	"vec4 viewPos;"
+	"vec4 ambient;"
+	"vec4 clusterScale;"
+	"ivec4 clusterDims;"
+	"};";
+
+// Compile or link result, with the driver's log when it failed
+inline bool shaderCompiled(GLuint shader, std::string& log)
+{
+	GLint status = GL_FALSE, length = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (status)
+		return true;
+	glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+	log.assign(length > 0 ? length : 1, '\0');
+	glGetShaderInfoLog(shader, (GLsizei)log.size(), nullptr, &log[0]);
+	log.resize(strlen(log.c_str()));
+	return false;
+}
+
+inline bool programLinked(GLuint program, std::string& log)
+{
+	GLint status = GL_FALSE, length = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (status)
+		return true;
+	glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+	log.assign(length > 0 ? length : 1, '\0');
+	glGetProgramInfoLog(program, (GLsizei)log.size(), nullptr, &log[0]);
+	log.resize(strlen(log.c_str()));
+	return false;
+}
+
+// Fill the uniform and block tables from the linked program
+inline void reflectShaderProgram(ShaderProgram& program)
+{
+	GLint count = 0, maxLength = 0;
+	glGetProgramiv(program.id, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(program.id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	std::string name(maxLength > 0 ? maxLength : 1, '\0');
+	for (GLint i = 0; i < count; i++)
+	{
+		GLsizei length = 0;
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveUniform(program.id, (GLuint)i, maxLength, &length, &size, &type, &name[0]);
+		std::string uniformName(name.c_str(), length);
+
+		// Block members have no location
+		GLint location = glGetUniformLocation(program.id, uniformName.c_str());
+		if (location < 0)
+			continue;
+
+		// Arrays are reported as "name[0]", store them under both names
+		size_t bracket = uniformName.find("[0]");
+		if (bracket != std::string::npos)
+			program.uniforms[uniformName.substr(0, bracket)] = location;
+		program.uniforms[uniformName] = location;
+	}
+
+	glGetProgramiv(program.id, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+	glGetProgramiv(program.id, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+	name.assign(maxLength > 0 ? maxLength : 1, '\0');
+	for (GLint i = 0; i < count; i++)
+	{
+		GLsizei length = 0;
+		glGetActiveUniformBlockName(program.id, (GLuint)i, maxLength, &length, &name[0]);
+		program.blocks[std::string(name.c_str(), length)] = (GLuint)i;
+	}
+
+	// Every program reads the shared frame data from the same binding point
+	std::unordered_map<std::string, GLuint>::const_iterator frameBlock = program.blocks.find("FrameData");
+	if (frameBlock != program.blocks.end())
+		glUniformBlockBinding(program.id, frameBlock->second, kFrameUniformBinding);
+}
+
+// Location from the reflected table, -1 when the program has no such uniform
+inline GLint uniformLocation(const ShaderProgram& program, const char* name)
+{
+	std::unordered_map<std::string, GLint>::const_iterator it = program.uniforms.find(name);
+	return it != program.uniforms.end() ? it->second : -1;
+}
+
+// Write this frame's camera and lighting into the frame's dynamic buffer and point the shared binding at it
+inline void writeFrameUniforms(GpuRingBuffer& ring, const FrameUniforms& frame)
+{
+	GpuAllocation allocation = allocateGpuRing(ring, sizeof(FrameUniforms), ring.uniformAlignment);
+	memcpy(allocation.data, &frame, sizeof(FrameUniforms));
+
+	// Binding a range also binds the generic target
+	glBindBufferRange(GL_UNIFORM_BUFFER, kFrameUniformBinding, allocation.buffer, allocation.offset, sizeof(FrameUniforms));
+	glState().buffers[kUniformBufferSlot] = allocation.buffer;
+}
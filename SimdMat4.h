@@ -0,0 +1,433 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define MATRIX_SSE 1
+#if defined(__GNUC__) || defined(__clang__)
+#define MATRIX_AVX2 1
+#define MATRIX_AVX2_TARGET __attribute__((target("avx2,fma")))
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define MATRIX_AVX2 1
+#define MATRIX_AVX2_TARGET
+#endif
+#endif
+
+#include "Bvh.h"
+
+// Matrix kernels over arrays of transforms: compose from translation/rotation/scale, multiply by one matrix
+// (the view-projection), normal matrices of affine transforms, and world boxes of local boxes.
+// Each has a glm path, an SSE path that works on one matrix per register and an AVX2/FMA path that works on two,
+// picked once from the CPU's features. The AVX2 code is compiled for that target only, so the build needs no flags.
+
+enum MatrixPath { kMatrixScalar, kMatrixSse, kMatrixAvx2 };
+
+// Translations, rotation quaternions (x, y, z, w) and scales as separate arrays, like the scene file's transforms
+struct TrsArrays
+{
+	const float* translation[3];
+	const float* rotation[4];
+	const float* scale[3];
+};
+
+inline const char* matrixPathName(MatrixPath path)
+{
+	return path == kMatrixAvx2 ? "avx2" : path == kMatrixSse ? "sse" : "scalar";
+}
+
+// Widest path this CPU and OS can run
+inline MatrixPath detectMatrixPath()
+{
+#if defined(MATRIX_AVX2) && (defined(__GNUC__) || defined(__clang__))
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return kMatrixAvx2;
+	return kMatrixSse;
+#elif defined(MATRIX_AVX2)
+	int info[4];
+	__cpuid(info, 0);
+	bool avx2 = false;
+	if (info[0] >= 7)
+	{
+		__cpuid(info, 1);
+		bool fma = (info[2] & (1 << 12)) != 0, osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+		__cpuidex(info, 7, 0);
+		avx2 = fma && osxsave && avx && (info[1] & (1 << 5)) != 0 && (_xgetbv(0) & 6) == 6;
+	}
+	return avx2 ? kMatrixAvx2 : kMatrixSse;
+#elif defined(MATRIX_SSE)
+	return kMatrixSse;
+#else
+	return kMatrixScalar;
+#endif
+}
+
+inline MatrixPath& matrixPathSetting()
+{
+	static MatrixPath path = detectMatrixPath();
+	return path;
+}
+
+inline MatrixPath matrixPath()
+{
+	return matrixPathSetting();
+}
+
+// Force a narrower path, for benchmarks. Paths the CPU cannot run fall back to the detected one.
+inline MatrixPath setMatrixPath(MatrixPath path)
+{
+	MatrixPath widest = detectMatrixPath();
+	matrixPathSetting() = path > widest ? widest : path;
+	return matrixPathSetting();
+}
+
+// Scalar kernels, also used for the tail of the SIMD loops
+
+inline glm::mat4 composeTrs(const TrsArrays& trs, size_t i)
+{
+	float x = trs.rotation[0][i], y = trs.rotation[1][i], z = trs.rotation[2][i], w = trs.rotation[3][i];
+	float sx = trs.scale[0][i], sy = trs.scale[1][i], sz = trs.scale[2][i];
+	glm::mat4 m;
+	m[0] = glm::vec4((1.0f - 2.0f * (y * y + z * z)) * sx, 2.0f * (x * y + w * z) * sx, 2.0f * (x * z - w * y) * sx, 0.0f);
+	m[1] = glm::vec4(2.0f * (x * y - w * z) * sy, (1.0f - 2.0f * (x * x + z * z)) * sy, 2.0f * (y * z + w * x) * sy, 0.0f);
+	m[2] = glm::vec4(2.0f * (x * z + w * y) * sz, 2.0f * (y * z - w * x) * sz, (1.0f - 2.0f * (x * x + y * y)) * sz, 0.0f);
+	m[3] = glm::vec4(trs.translation[0][i], trs.translation[1][i], trs.translation[2][i], 1.0f);
+	return m;
+}
+
+// Inverse transpose of the upper 3x3 from cofactors: the columns are the cross products of the other two columns
+inline glm::mat3 affineNormalMatrix(const glm::mat4& m)
+{
+	glm::vec3 a(m[0]), b(m[1]), c(m[2]);
+	glm::vec3 bc = glm::cross(b, c), ca = glm::cross(c, a), ab = glm::cross(a, b);
+	float invDet = 1.0f / glm::dot(a, bc);
+	return glm::mat3(bc * invDet, ca * invDet, ab * invDet);
+}
+
+#ifdef MATRIX_SSE
+
+// vec3 loads and stores that never touch the float after z
+inline __m128 loadVec3(const float* p)
+{
+	return _mm_movelh_ps(_mm_castpd_ps(_mm_load_sd((const double*)p)), _mm_load_ss(p + 2));
+}
+
+inline void storeVec3(float* p, __m128 v)
+{
+	_mm_storel_pi((__m64*)p, v);
+	_mm_store_ss(p + 2, _mm_movehl_ps(v, v));
+}
+
+#define MATRIX_SPLAT(v, lane) _mm_shuffle_ps(v, v, _MM_SHUFFLE(lane, lane, lane, lane))
+#define MATRIX_YZX(v) _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1))
+
+inline __m128 crossSse(__m128 a, __m128 b)
+{
+	__m128 c = _mm_sub_ps(_mm_mul_ps(a, MATRIX_YZX(b)), _mm_mul_ps(MATRIX_YZX(a), b));
+	return MATRIX_YZX(c);
+}
+
+// Four instances per pass, one per lane, transposed into their columns on the way out
+inline void composeTransformsSse(const TrsArrays& trs, size_t count, glm::mat4* out)
+{
+	const __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f), zero = _mm_setzero_ps();
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(trs.rotation[0] + i), y = _mm_loadu_ps(trs.rotation[1] + i);
+		__m128 z = _mm_loadu_ps(trs.rotation[2] + i), w = _mm_loadu_ps(trs.rotation[3] + i);
+		__m128 sx = _mm_loadu_ps(trs.scale[0] + i), sy = _mm_loadu_ps(trs.scale[1] + i), sz = _mm_loadu_ps(trs.scale[2] + i);
+		__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+		__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+		__m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+		__m128 columns[4][4];
+		columns[0][0] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx);
+		columns[0][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx);
+		columns[0][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx);
+		columns[1][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy);
+		columns[1][1] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy);
+		columns[1][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy);
+		columns[2][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz);
+		columns[2][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz);
+		columns[2][2] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz);
+		columns[3][0] = _mm_loadu_ps(trs.translation[0] + i);
+		columns[3][1] = _mm_loadu_ps(trs.translation[1] + i);
+		columns[3][2] = _mm_loadu_ps(trs.translation[2] + i);
+		for (int c = 0; c < 4; c++)
+		{
+			__m128 r0 = columns[c][0], r1 = columns[c][1], r2 = columns[c][2], r3 = c == 3 ? one : zero;
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			_mm_storeu_ps(&out[i][c][0], r0);
+			_mm_storeu_ps(&out[i + 1][c][0], r1);
+			_mm_storeu_ps(&out[i + 2][c][0], r2);
+			_mm_storeu_ps(&out[i + 3][c][0], r3);
+		}
+	}
+	for (; i < count; i++)
+		out[i] = composeTrs(trs, i);
+}
+
+inline void multiplyTransformsSse(const glm::mat4& left, const glm::mat4* right, size_t count, glm::mat4* out)
+{
+	__m128 l0 = _mm_loadu_ps(&left[0][0]), l1 = _mm_loadu_ps(&left[1][0]), l2 = _mm_loadu_ps(&left[2][0]), l3 = _mm_loadu_ps(&left[3][0]);
+	for (size_t i = 0; i < count; i++)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			__m128 r = _mm_loadu_ps(&right[i][c][0]);
+			__m128 sum = _mm_add_ps(_mm_mul_ps(l0, MATRIX_SPLAT(r, 0)), _mm_mul_ps(l1, MATRIX_SPLAT(r, 1)));
+			sum = _mm_add_ps(sum, _mm_add_ps(_mm_mul_ps(l2, MATRIX_SPLAT(r, 2)), _mm_mul_ps(l3, MATRIX_SPLAT(r, 3))));
+			_mm_storeu_ps(&out[i][c][0], sum);
+		}
+	}
+}
+
+inline void normalMatricesSse(const glm::mat4* world, size_t count, glm::mat3* out)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		__m128 a = _mm_loadu_ps(&world[i][0][0]), b = _mm_loadu_ps(&world[i][1][0]), c = _mm_loadu_ps(&world[i][2][0]);
+		__m128 bc = crossSse(b, c), ca = crossSse(c, a), ab = crossSse(a, b);
+		__m128 dot = _mm_mul_ps(a, bc);
+		__m128 det = _mm_add_ps(_mm_add_ps(MATRIX_SPLAT(dot, 0), MATRIX_SPLAT(dot, 1)), MATRIX_SPLAT(dot, 2));
+		__m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+		// Each column store spills into the next one, which is stored after it; the last one is stored exactly
+		float* m = &out[i][0][0];
+		_mm_storeu_ps(m, _mm_mul_ps(bc, invDet));
+		_mm_storeu_ps(m + 3, _mm_mul_ps(ca, invDet));
+		storeVec3(m + 6, _mm_mul_ps(ab, invDet));
+	}
+}
+
+inline void transformAabbsSse(const Aabb* local, const glm::mat4* world, size_t count, Aabb* out)
+{
+	const __m128 half = _mm_set1_ps(0.5f), absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	for (size_t i = 0; i < count; i++)
+	{
+		__m128 boxMin = loadVec3(&local[i].min.x), boxMax = loadVec3(&local[i].max.x);
+		__m128 center = _mm_mul_ps(_mm_add_ps(boxMin, boxMax), half), extent = _mm_mul_ps(_mm_sub_ps(boxMax, boxMin), half);
+		__m128 m0 = _mm_loadu_ps(&world[i][0][0]), m1 = _mm_loadu_ps(&world[i][1][0]), m2 = _mm_loadu_ps(&world[i][2][0]);
+		__m128 worldCenter = _mm_add_ps(_mm_loadu_ps(&world[i][3][0]), _mm_mul_ps(m0, MATRIX_SPLAT(center, 0)));
+		worldCenter = _mm_add_ps(worldCenter, _mm_add_ps(_mm_mul_ps(m1, MATRIX_SPLAT(center, 1)), _mm_mul_ps(m2, MATRIX_SPLAT(center, 2))));
+		__m128 worldExtent = _mm_mul_ps(_mm_and_ps(m0, absMask), MATRIX_SPLAT(extent, 0));
+		worldExtent = _mm_add_ps(worldExtent, _mm_add_ps(_mm_mul_ps(_mm_and_ps(m1, absMask), MATRIX_SPLAT(extent, 1)), _mm_mul_ps(_mm_and_ps(m2, absMask), MATRIX_SPLAT(extent, 2))));
+		storeVec3(&out[i].min.x, _mm_sub_ps(worldCenter, worldExtent));
+		storeVec3(&out[i].max.x, _mm_add_ps(worldCenter, worldExtent));
+	}
+}
+
+#endif
+
+#ifdef MATRIX_AVX2
+
+// Two matrices side by side, one per 128-bit lane, so the in-lane shuffles of the SSE code carry over
+
+#define MATRIX_SPLAT8(v, lane) _mm256_permute_ps(v, _MM_SHUFFLE(lane, lane, lane, lane))
+#define MATRIX_YZX8(v) _mm256_permute_ps(v, _MM_SHUFFLE(3, 0, 2, 1))
+
+MATRIX_AVX2_TARGET inline __m256 loadPair(const float* first, const float* second)
+{
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(first)), _mm_loadu_ps(second), 1);
+}
+
+MATRIX_AVX2_TARGET inline __m256 crossAvx2(__m256 a, __m256 b)
+{
+	return MATRIX_YZX8(_mm256_fmsub_ps(a, MATRIX_YZX8(b), _mm256_mul_ps(MATRIX_YZX8(a), b)));
+}
+
+// Eight instances per pass, each 4x4 block of lanes transposed with SSE on the way out
+MATRIX_AVX2_TARGET inline void composeTransformsAvx2(const TrsArrays& trs, size_t count, glm::mat4* out)
+{
+	const __m256 one = _mm256_set1_ps(1.0f), two = _mm256_set1_ps(2.0f);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(trs.rotation[0] + i), y = _mm256_loadu_ps(trs.rotation[1] + i);
+		__m256 z = _mm256_loadu_ps(trs.rotation[2] + i), w = _mm256_loadu_ps(trs.rotation[3] + i);
+		__m256 sx = _mm256_loadu_ps(trs.scale[0] + i), sy = _mm256_loadu_ps(trs.scale[1] + i), sz = _mm256_loadu_ps(trs.scale[2] + i);
+		__m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y), zz = _mm256_mul_ps(z, z);
+		__m256 xy = _mm256_mul_ps(x, y), xz = _mm256_mul_ps(x, z), yz = _mm256_mul_ps(y, z);
+		__m256 wx = _mm256_mul_ps(w, x), wy = _mm256_mul_ps(w, y), wz = _mm256_mul_ps(w, z);
+
+		__m256 columns[4][3];
+		columns[0][0] = _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(yy, zz), one), sx);
+		columns[0][1] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xy, wz)), sx);
+		columns[0][2] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xz, wy)), sx);
+		columns[1][0] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xy, wz)), sy);
+		columns[1][1] = _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(xx, zz), one), sy);
+		columns[1][2] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(yz, wx)), sy);
+		columns[2][0] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xz, wy)), sz);
+		columns[2][1] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(yz, wx)), sz);
+		columns[2][2] = _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(xx, yy), one), sz);
+		columns[3][0] = _mm256_loadu_ps(trs.translation[0] + i);
+		columns[3][1] = _mm256_loadu_ps(trs.translation[1] + i);
+		columns[3][2] = _mm256_loadu_ps(trs.translation[2] + i);
+		for (int c = 0; c < 4; c++)
+		{
+			for (int half = 0; half < 2; half++)
+			{
+				__m128 r0 = half ? _mm256_extractf128_ps(columns[c][0], 1) : _mm256_castps256_ps128(columns[c][0]);
+				__m128 r1 = half ? _mm256_extractf128_ps(columns[c][1], 1) : _mm256_castps256_ps128(columns[c][1]);
+				__m128 r2 = half ? _mm256_extractf128_ps(columns[c][2], 1) : _mm256_castps256_ps128(columns[c][2]);
+				__m128 r3 = c == 3 ? _mm_set1_ps(1.0f) : _mm_setzero_ps();
+				_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+				size_t first = i + half * 4;
+				_mm_storeu_ps(&out[first][c][0], r0);
+				_mm_storeu_ps(&out[first + 1][c][0], r1);
+				_mm_storeu_ps(&out[first + 2][c][0], r2);
+				_mm_storeu_ps(&out[first + 3][c][0], r3);
+			}
+		}
+	}
+	for (; i < count; i++)
+		out[i] = composeTrs(trs, i);
+}
+
+// Two columns of one matrix per register
+MATRIX_AVX2_TARGET inline void multiplyTransformsAvx2(const glm::mat4& left, const glm::mat4* right, size_t count, glm::mat4* out)
+{
+	__m256 l0 = _mm256_broadcast_ps((const __m128*)&left[0][0]), l1 = _mm256_broadcast_ps((const __m128*)&left[1][0]);
+	__m256 l2 = _mm256_broadcast_ps((const __m128*)&left[2][0]), l3 = _mm256_broadcast_ps((const __m128*)&left[3][0]);
+	for (size_t i = 0; i < count; i++)
+	{
+		for (int c = 0; c < 4; c += 2)
+		{
+			__m256 r = _mm256_loadu_ps(&right[i][c][0]);
+			__m256 sum = _mm256_mul_ps(l0, MATRIX_SPLAT8(r, 0));
+			sum = _mm256_fmadd_ps(l1, MATRIX_SPLAT8(r, 1), sum);
+			sum = _mm256_fmadd_ps(l2, MATRIX_SPLAT8(r, 2), sum);
+			sum = _mm256_fmadd_ps(l3, MATRIX_SPLAT8(r, 3), sum);
+			_mm256_storeu_ps(&out[i][c][0], sum);
+		}
+	}
+}
+
+MATRIX_AVX2_TARGET inline void normalMatricesAvx2(const glm::mat4* world, size_t count, glm::mat3* out)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	size_t i = 0;
+	for (; i + 2 <= count; i += 2)
+	{
+		__m256 a = loadPair(&world[i][0][0], &world[i + 1][0][0]);
+		__m256 b = loadPair(&world[i][1][0], &world[i + 1][1][0]);
+		__m256 c = loadPair(&world[i][2][0], &world[i + 1][2][0]);
+		__m256 bc = crossAvx2(b, c), ca = crossAvx2(c, a), ab = crossAvx2(a, b);
+		__m256 dot = _mm256_mul_ps(a, bc);
+		__m256 det = _mm256_add_ps(_mm256_add_ps(MATRIX_SPLAT8(dot, 0), MATRIX_SPLAT8(dot, 1)), MATRIX_SPLAT8(dot, 2));
+		__m256 invDet = _mm256_div_ps(one, det);
+		bc = _mm256_mul_ps(bc, invDet);
+		ca = _mm256_mul_ps(ca, invDet);
+		ab = _mm256_mul_ps(ab, invDet);
+		for (int half = 0; half < 2; half++)
+		{
+			float* m = &out[i + half][0][0];
+			_mm_storeu_ps(m, half ? _mm256_extractf128_ps(bc, 1) : _mm256_castps256_ps128(bc));
+			_mm_storeu_ps(m + 3, half ? _mm256_extractf128_ps(ca, 1) : _mm256_castps256_ps128(ca));
+			storeVec3(m + 6, half ? _mm256_extractf128_ps(ab, 1) : _mm256_castps256_ps128(ab));
+		}
+	}
+	if (i < count)
+		normalMatricesSse(world + i, count - i, out + i);
+}
+
+MATRIX_AVX2_TARGET inline void transformAabbsAvx2(const Aabb* local, const glm::mat4* world, size_t count, Aabb* out)
+{
+	const __m256 half = _mm256_set1_ps(0.5f), absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+	size_t i = 0;
+	for (; i + 2 <= count; i += 2)
+	{
+		__m256 boxMin = _mm256_insertf128_ps(_mm256_castps128_ps256(loadVec3(&local[i].min.x)), loadVec3(&local[i + 1].min.x), 1);
+		__m256 boxMax = _mm256_insertf128_ps(_mm256_castps128_ps256(loadVec3(&local[i].max.x)), loadVec3(&local[i + 1].max.x), 1);
+		__m256 center = _mm256_mul_ps(_mm256_add_ps(boxMin, boxMax), half), extent = _mm256_mul_ps(_mm256_sub_ps(boxMax, boxMin), half);
+		__m256 m0 = loadPair(&world[i][0][0], &world[i + 1][0][0]);
+		__m256 m1 = loadPair(&world[i][1][0], &world[i + 1][1][0]);
+		__m256 m2 = loadPair(&world[i][2][0], &world[i + 1][2][0]);
+		__m256 worldCenter = loadPair(&world[i][3][0], &world[i + 1][3][0]);
+		worldCenter = _mm256_fmadd_ps(m0, MATRIX_SPLAT8(center, 0), worldCenter);
+		worldCenter = _mm256_fmadd_ps(m1, MATRIX_SPLAT8(center, 1), worldCenter);
+		worldCenter = _mm256_fmadd_ps(m2, MATRIX_SPLAT8(center, 2), worldCenter);
+		__m256 worldExtent = _mm256_mul_ps(_mm256_and_ps(m0, absMask), MATRIX_SPLAT8(extent, 0));
+		worldExtent = _mm256_fmadd_ps(_mm256_and_ps(m1, absMask), MATRIX_SPLAT8(extent, 1), worldExtent);
+		worldExtent = _mm256_fmadd_ps(_mm256_and_ps(m2, absMask), MATRIX_SPLAT8(extent, 2), worldExtent);
+		__m256 boundsMin = _mm256_sub_ps(worldCenter, worldExtent), boundsMax = _mm256_add_ps(worldCenter, worldExtent);
+		storeVec3(&out[i].min.x, _mm256_castps256_ps128(boundsMin));
+		storeVec3(&out[i].max.x, _mm256_castps256_ps128(boundsMax));
+		storeVec3(&out[i + 1].min.x, _mm256_extractf128_ps(boundsMin, 1));
+		storeVec3(&out[i + 1].max.x, _mm256_extractf128_ps(boundsMax, 1));
+	}
+	if (i < count)
+		transformAabbsSse(local + i, world + i, count - i, out + i);
+}
+
+#endif
+
+// Public kernels, on the path matrixPath() picked
+
+inline void composeTransforms(const TrsArrays& trs, size_t count, glm::mat4* out)
+{
+	MatrixPath path = matrixPath();
+#ifdef MATRIX_AVX2
+	if (path == kMatrixAvx2)
+		return composeTransformsAvx2(trs, count, out);
+#endif
+#ifdef MATRIX_SSE
+	if (path == kMatrixSse)
+		return composeTransformsSse(trs, count, out);
+#endif
+	for (size_t i = 0; i < count; i++)
+		out[i] = composeTrs(trs, i);
+}
+
+// out[i] = left * right[i], e.g. the view-projection times each world matrix. out may alias right.
+inline void multiplyTransforms(const glm::mat4& left, const glm::mat4* right, size_t count, glm::mat4* out)
+{
+	MatrixPath path = matrixPath();
+#ifdef MATRIX_AVX2
+	if (path == kMatrixAvx2)
+		return multiplyTransformsAvx2(left, right, count, out);
+#endif
+#ifdef MATRIX_SSE
+	if (path == kMatrixSse)
+		return multiplyTransformsSse(left, right, count, out);
+#endif
+	for (size_t i = 0; i < count; i++)
+		out[i] = left * right[i];
+}
+
+// Inverse transpose of each world matrix' upper 3x3
+inline void normalMatrices(const glm::mat4* world, size_t count, glm::mat3* out)
+{
+	MatrixPath path = matrixPath();
+#ifdef MATRIX_AVX2
+	if (path == kMatrixAvx2)
+		return normalMatricesAvx2(world, count, out);
+#endif
+#ifdef MATRIX_SSE
+	if (path == kMatrixSse)
+		return normalMatricesSse(world, count, out);
+#endif
+	for (size_t i = 0; i < count; i++)
+		out[i] = affineNormalMatrix(world[i]);
+}
+
+// World box around each local box under its world matrix, as transformAabb
+inline void transformAabbs(const Aabb* local, const glm::mat4* world, size_t count, Aabb* out)
+{
+	MatrixPath path = matrixPath();
+#ifdef MATRIX_AVX2
+	if (path == kMatrixAvx2)
+		return transformAabbsAvx2(local, world, count, out);
+#endif
+#ifdef MATRIX_SSE
+	if (path == kMatrixSse)
+		return transformAabbsSse(local, world, count, out);
+#endif
+	for (size_t i = 0; i < count; i++)
+		out[i] = transformAabb(local[i], world[i]);
+}
@@ -0,0 +1,878 @@
+#pragma once
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SOFT_AVX 1
+#elif defined(__SSE__) || defined(_M_X64) || defined(_M_IX86)
+#include <xmmintrin.h>
+#define SOFT_SSE 1
+#endif
+
+#include "Profiler.h"
+#include "TextureCompress.h"
+#include "TextureFile.h"
+#include "ThreadPool.h"
+
+// CPU rasterizer for hosts without a GPU, drawing the same scene as the GL path: textured Phong with point lights
+// for the knives, flat colour for the lamps. Follows GL's conventions (bottom-up rows, pixel centres at +0.5,
+// top-left fill rule, depth test GL_LESS) so its images line up with the GL ones.
+//
+// A frame runs in two parallel passes on a work-stealing pool:
+//   geometry  per chunk of draws: transform, clip, set up edge equations and attribute planes, bin into tiles
+//   raster    per screen tile: walk the chunks' bins in draw order, test 8x8 blocks against the block's
+//             farthest depth, then test edges, depth and shade one 8 pixel row of a block at a time
+// Tiles own their pixels, so the raster pass needs no locks and the image does not depend on the thread count.
+//
+// Vertices are snapped to 1/8 pixel and edge functions are evaluated exactly (integers per row, floats per lane
+// within their exact range), so triangles sharing an edge never leave a crack or touch a pixel twice.
+
+const int kSoftTileSize = 64;
+const int kSoftBlockSize = 8; // hierarchical depth block, and the lane count of a span
+const int kSoftSubpixelBits = 3;
+const int kSoftSubpixels = 1 << kSoftSubpixelBits;
+const int kSoftGuardPixels = 2048; // triangles are clipped this far outside the screen, not at its border
+const int kSoftMaxSize = 4096; // edge equations stay exact up to this width and height
+const uint32_t kSoftDrawsPerChunk = 8;
+
+// Eight float lanes: one AVX register, a pair of SSE registers, or plain floats
+#if SOFT_AVX
+
+struct SoftLanes
+{
+	__m256 v;
+};
+
+inline SoftLanes softLanes(float value) { return { _mm256_set1_ps(value) }; }
+inline SoftLanes softLaneIndices() { return { _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f) }; }
+inline SoftLanes loadLanes(const float* values) { return { _mm256_loadu_ps(values) }; }
+inline void storeLanes(float* values, SoftLanes a) { _mm256_storeu_ps(values, a.v); }
+inline SoftLanes operator+(SoftLanes a, SoftLanes b) { return { _mm256_add_ps(a.v, b.v) }; }
+inline SoftLanes operator-(SoftLanes a, SoftLanes b) { return { _mm256_sub_ps(a.v, b.v) }; }
+inline SoftLanes operator*(SoftLanes a, SoftLanes b) { return { _mm256_mul_ps(a.v, b.v) }; }
+inline SoftLanes operator/(SoftLanes a, SoftLanes b) { return { _mm256_div_ps(a.v, b.v) }; }
+inline SoftLanes operator&(SoftLanes a, SoftLanes b) { return { _mm256_and_ps(a.v, b.v) }; }
+inline SoftLanes minLanes(SoftLanes a, SoftLanes b) { return { _mm256_min_ps(a.v, b.v) }; }
+inline SoftLanes maxLanes(SoftLanes a, SoftLanes b) { return { _mm256_max_ps(a.v, b.v) }; }
+inline SoftLanes sqrtLanes(SoftLanes a) { return { _mm256_sqrt_ps(a.v) }; }
+inline SoftLanes lanesGreater(SoftLanes a, SoftLanes b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+inline SoftLanes lanesGreaterEqual(SoftLanes a, SoftLanes b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+inline SoftLanes lanesLess(SoftLanes a, SoftLanes b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+inline SoftLanes selectLanes(SoftLanes mask, SoftLanes a, SoftLanes b) { return { _mm256_blendv_ps(b.v, a.v, mask.v) }; }
+inline int laneMask(SoftLanes mask) { return _mm256_movemask_ps(mask.v); }
+
+#elif SOFT_SSE
+
+struct SoftLanes
+{
+	__m128 lo, hi;
+};
+
+inline SoftLanes softLanes(float value) { return { _mm_set1_ps(value), _mm_set1_ps(value) }; }
+inline SoftLanes softLaneIndices() { return { _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f), _mm_setr_ps(4.0f, 5.0f, 6.0f, 7.0f) }; }
+inline SoftLanes loadLanes(const float* values) { return { _mm_loadu_ps(values), _mm_loadu_ps(values + 4) }; }
+inline void storeLanes(float* values, SoftLanes a) { _mm_storeu_ps(values, a.lo); _mm_storeu_ps(values + 4, a.hi); }
+inline SoftLanes operator+(SoftLanes a, SoftLanes b) { return { _mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi) }; }
+inline SoftLanes operator-(SoftLanes a, SoftLanes b) { return { _mm_sub_ps(a.lo, b.lo), _mm_sub_ps(a.hi, b.hi) }; }
+inline SoftLanes operator*(SoftLanes a, SoftLanes b) { return { _mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi) }; }
+inline SoftLanes operator/(SoftLanes a, SoftLanes b) { return { _mm_div_ps(a.lo, b.lo), _mm_div_ps(a.hi, b.hi) }; }
+inline SoftLanes operator&(SoftLanes a, SoftLanes b) { return { _mm_and_ps(a.lo, b.lo), _mm_and_ps(a.hi, b.hi) }; }
+inline SoftLanes minLanes(SoftLanes a, SoftLanes b) { return { _mm_min_ps(a.lo, b.lo), _mm_min_ps(a.hi, b.hi) }; }
+inline SoftLanes maxLanes(SoftLanes a, SoftLanes b) { return { _mm_max_ps(a.lo, b.lo), _mm_max_ps(a.hi, b.hi) }; }
+inline SoftLanes sqrtLanes(SoftLanes a) { return { _mm_sqrt_ps(a.lo), _mm_sqrt_ps(a.hi) }; }
+inline SoftLanes lanesGreater(SoftLanes a, SoftLanes b) { return { _mm_cmpgt_ps(a.lo, b.lo), _mm_cmpgt_ps(a.hi, b.hi) }; }
+inline SoftLanes lanesGreaterEqual(SoftLanes a, SoftLanes b) { return { _mm_cmpge_ps(a.lo, b.lo), _mm_cmpge_ps(a.hi, b.hi) }; }
+inline SoftLanes lanesLess(SoftLanes a, SoftLanes b) { return { _mm_cmplt_ps(a.lo, b.lo), _mm_cmplt_ps(a.hi, b.hi) }; }
+inline SoftLanes selectLanes(SoftLanes mask, SoftLanes a, SoftLanes b)
+{
+	return { _mm_or_ps(_mm_and_ps(mask.lo, a.lo), _mm_andnot_ps(mask.lo, b.lo)), _mm_or_ps(_mm_and_ps(mask.hi, a.hi), _mm_andnot_ps(mask.hi, b.hi)) };
+}
+inline int laneMask(SoftLanes mask) { return _mm_movemask_ps(mask.lo) | _mm_movemask_ps(mask.hi) << 4; }
+
+#else
+
+// Masks hold all bits set or clear, like the SIMD compares
+struct SoftLanes
+{
+	float v[8];
+};
+
+inline float softMaskBits(bool set)
+{
+	uint32_t bits = set ? 0xFFFFFFFFu : 0u;
+	float mask;
+	memcpy(&mask, &bits, sizeof(mask));
+	return mask;
+}
+
+inline bool softMaskSet(float mask)
+{
+	uint32_t bits;
+	memcpy(&bits, &mask, sizeof(bits));
+	return bits != 0;
+}
+
+#define SOFT_LANEWISE(expression) SoftLanes r; for (int i = 0; i < 8; i++) r.v[i] = (expression); return r
+
+inline SoftLanes softLanes(float value) { SOFT_LANEWISE(value); }
+inline SoftLanes softLaneIndices() { SOFT_LANEWISE((float)i); }
+inline SoftLanes loadLanes(const float* values) { SOFT_LANEWISE(values[i]); }
+inline void storeLanes(float* values, SoftLanes a) { memcpy(values, a.v, sizeof(a.v)); }
+inline SoftLanes operator+(SoftLanes a, SoftLanes b) { SOFT_LANEWISE(a.v[i] + b.v[i]); }
+inline SoftLanes operator-(SoftLanes a, SoftLanes b) { SOFT_LANEWISE(a.v[i] - b.v[i]); }
+inline SoftLanes operator*(SoftLanes a, SoftLanes b) { SOFT_LANEWISE(a.v[i] * b.v[i]); }
+inline SoftLanes operator/(SoftLanes a, SoftLanes b) { SOFT_LANEWISE(a.v[i] / b.v[i]); }
+inline SoftLanes operator&(SoftLanes a, SoftLanes b) { SOFT_LANEWISE(softMaskBits(softMaskSet(a.v[i]) && softMaskSet(b.v[i]))); }
+inline SoftLanes minLanes(SoftLanes a, SoftLanes b) { SOFT_LANEWISE(b.v[i] < a.v[i] ? b.v[i] : a.v[i]); }
+inline SoftLanes maxLanes(SoftLanes a, SoftLanes b) { SOFT_LANEWISE(b.v[i] > a.v[i] ? b.v[i] : a.v[i]); }
+inline SoftLanes sqrtLanes(SoftLanes a) { SOFT_LANEWISE(sqrtf(a.v[i])); }
+inline SoftLanes lanesGreater(SoftLanes a, SoftLanes b) { SOFT_LANEWISE(softMaskBits(a.v[i] > b.v[i])); }
+inline SoftLanes lanesGreaterEqual(SoftLanes a, SoftLanes b) { SOFT_LANEWISE(softMaskBits(a.v[i] >= b.v[i])); }
+inline SoftLanes lanesLess(SoftLanes a, SoftLanes b) { SOFT_LANEWISE(softMaskBits(a.v[i] < b.v[i])); }
+inline SoftLanes selectLanes(SoftLanes mask, SoftLanes a, SoftLanes b) { SOFT_LANEWISE(softMaskSet(mask.v[i]) ? a.v[i] : b.v[i]); }
+inline int laneMask(SoftLanes mask)
+{
+	int bits = 0;
+	for (int i = 0; i < 8; i++)
+		bits |= softMaskSet(mask.v[i]) << i;
+	return bits;
+}
+
+#undef SOFT_LANEWISE
+
+#endif
+
+// RGBA8 mip chain, sampled like a GL texture with REPEAT wrapping, GL_LINEAR magnification
+// and GL_NEAREST_MIPMAP_LINEAR minification (the defaults the GL path leaves in place)
+struct SoftTexture
+{
+	std::vector<std::vector<uint8_t>> levels;
+	std::vector<int> widths, heights;
+};
+
+// Vertex and index arrays in the layout uploaded to GL: position first, then for textured meshes
+// colour, uv and normal (11 floats)
+struct SoftMesh
+{
+	const float* vertices = nullptr;
+	uint32_t stride = 11; // floats per vertex
+	uint32_t vertexCount = 0;
+	const void* indices = nullptr;
+	uint32_t indexSize = 4;
+};
+
+struct SoftDraw
+{
+	const SoftMesh* mesh = nullptr;
+	uint32_t firstIndex = 0, indexCount = 0;
+	glm::mat4 model;
+	glm::mat3 normalMatrix;
+	const SoftTexture* texture = nullptr; // lit and textured, otherwise flat `color`
+	glm::vec4 color = glm::vec4(1.0f);
+};
+
+struct SoftLight
+{
+	glm::vec3 position;
+	float radius;
+	glm::vec3 color;
+};
+
+struct SoftFrame
+{
+	glm::mat4 view, projection;
+	glm::vec3 viewPos;
+	glm::vec3 ambient;
+	std::vector<SoftLight> lights;
+};
+
+// Attribute planes of a triangle, interpolated linearly in screen space: depth and 1/w,
+// then the perspective-correct attributes divided by w
+enum SoftPlane
+{
+	kSoftDepth, kSoftInvW,
+	kSoftWorldX, kSoftWorldY, kSoftWorldZ,
+	kSoftNormalX, kSoftNormalY, kSoftNormalZ,
+	kSoftU, kSoftV,
+	kSoftPlaneCount
+};
+
+// Post-transform vertex, clip space position followed by the interpolated attributes
+struct SoftVertex
+{
+	glm::vec4 clip;
+	float attributes[kSoftPlaneCount - kSoftWorldX];
+};
+
+struct SoftTriangle
+{
+	// Edge functions A x + B y + C in subpixel units, >= 0 inside (> 0 unless the edge is top or left)
+	int32_t edgeA[3], edgeB[3];
+	int64_t edgeC[3];
+	bool edgeInclusive[3];
+
+	// Plane value at (originX, originY) in pixels, and its x and y gradients
+	float originX, originY;
+	float planes[kSoftPlaneCount][3];
+
+	float minDepth;
+	int minX, minY, maxX, maxY; // pixel bounds, inclusive and on screen
+	uint32_t draw;
+};
+
+// Triangles set up from a run of draws, with their indices binned per tile (tileStart has a sentinel)
+struct SoftChunk
+{
+	std::vector<SoftTriangle> triangles;
+	std::vector<uint32_t> tileStart, tileTriangles;
+
+	// Lights that can reach each draw of the chunk
+	std::vector<uint32_t> lightStart, lights;
+};
+
+struct SoftStats
+{
+	uint64_t triangles = 0, binnedTriangles = 0, blocksTested = 0, blocksRejected = 0, pixelsShaded = 0;
+};
+
+struct SoftRasterizer
+{
+	int width = 0, height = 0;
+	int tilesX = 0, tilesY = 0, pitch = 0; // pitch: padded row length, whole tiles
+	std::vector<uint32_t> color; // RGBA8, bottom row first like GL
+	std::vector<float> depth;
+	std::vector<float> blockMaxDepth; // farthest depth in each 8x8 block
+
+	WorkStealingPool* pool = nullptr;
+	std::vector<SoftChunk> chunks;
+	std::vector<std::vector<SoftVertex>> vertexScratch; // per thread
+	std::vector<SoftStats> threadStats;
+
+	// Totals of the last frame
+	SoftStats stats;
+};
+
+inline bool initSoftRasterizer(SoftRasterizer& raster, int width, int height, WorkStealingPool& pool)
+{
+	if (width <= 0 || height <= 0 || width > kSoftMaxSize || height > kSoftMaxSize)
+		return false;
+	raster.width = width;
+	raster.height = height;
+	raster.tilesX = (width + kSoftTileSize - 1) / kSoftTileSize;
+	raster.tilesY = (height + kSoftTileSize - 1) / kSoftTileSize;
+	raster.pitch = raster.tilesX * kSoftTileSize;
+	size_t pixels = (size_t)raster.pitch * raster.tilesY * kSoftTileSize;
+	raster.color.assign(pixels, 0);
+	raster.depth.assign(pixels, 1.0f);
+	raster.blockMaxDepth.assign(pixels / (kSoftBlockSize * kSoftBlockSize), 1.0f);
+	raster.pool = &pool;
+	raster.vertexScratch.assign(workStealingThreads(pool), std::vector<SoftVertex>());
+	raster.threadStats.assign(workStealingThreads(pool), SoftStats());
+	return true;
+}
+
+// Mip chain of an RGBA8 image, filtered down like the baked textures
+inline void initSoftTexture(SoftTexture& texture, const uint8_t* rgba, int width, int height)
+{
+	buildMipChain(rgba, (uint32_t)width, (uint32_t)height, texture.levels);
+	texture.widths.clear();
+	texture.heights.clear();
+	for (size_t level = 0; level < texture.levels.size(); level++)
+	{
+		texture.widths.push_back(std::max(width >> level, 1));
+		texture.heights.push_back(std::max(height >> level, 1));
+	}
+}
+
+// Levels of a baked file, BC1 is decoded. BC7 has no decoder here
+inline bool softTextureFromFile(const TextureFile& file, SoftTexture& texture, std::string& error)
+{
+	const Ktx2Header& header = file.header;
+	if (header.vkFormat == kVkFormatBc7Unorm)
+	{
+		error = "BC7 textures cannot be decoded by the software renderer";
+		return false;
+	}
+	texture = SoftTexture();
+	for (uint32_t level = 0; level < file.levels.size(); level++)
+	{
+		uint32_t width = std::max(header.pixelWidth >> level, 1u), height = std::max(header.pixelHeight >> level, 1u);
+		const uint8_t* data = textureLevelData(file, level);
+		std::vector<uint8_t> rgba;
+		if (header.vkFormat == kVkFormatBc1RgbUnorm)
+			decodeBc1Image(data, width, height, rgba);
+		else
+			rgba.assign(data, data + (size_t)width * height * 4);
+		texture.levels.push_back(rgba);
+		texture.widths.push_back((int)width);
+		texture.heights.push_back((int)height);
+	}
+	return !texture.levels.empty();
+}
+
+inline glm::vec4 softTexel(const SoftTexture& texture, int level, int x, int y)
+{
+	int width = texture.widths[level], height = texture.heights[level];
+	x %= width;
+	y %= height;
+	x += x < 0 ? width : 0;
+	y += y < 0 ? height : 0;
+	const uint8_t* texel = &texture.levels[level][((size_t)y * width + x) * 4];
+	return glm::vec4(texel[0], texel[1], texel[2], texel[3]) * (1.0f / 255.0f);
+}
+
+inline glm::vec4 softNearest(const SoftTexture& texture, int level, float u, float v)
+{
+	return softTexel(texture, level, (int)floorf(u * texture.widths[level]), (int)floorf(v * texture.heights[level]));
+}
+
+inline glm::vec4 softBilinear(const SoftTexture& texture, int level, float u, float v)
+{
+	float x = u * texture.widths[level] - 0.5f, y = v * texture.heights[level] - 0.5f;
+	float x0 = floorf(x), y0 = floorf(y);
+	float fx = x - x0, fy = y - y0;
+	int ix = (int)x0, iy = (int)y0;
+	glm::vec4 bottom = softTexel(texture, level, ix, iy) * (1.0f - fx) + softTexel(texture, level, ix + 1, iy) * fx;
+	glm::vec4 top = softTexel(texture, level, ix, iy + 1) * (1.0f - fx) + softTexel(texture, level, ix + 1, iy + 1) * fx;
+	return bottom * (1.0f - fy) + top * fy;
+}
+
+// Level of detail from the uv derivatives along x and y, as GL computes it
+inline glm::vec4 sampleSoftTexture(const SoftTexture& texture, float u, float v, float dudx, float dvdx, float dudy, float dvdy)
+{
+	float width = (float)texture.widths[0], height = (float)texture.heights[0];
+	float rhoX = (dudx * width) * (dudx * width) + (dvdx * height) * (dvdx * height);
+	float rhoY = (dudy * width) * (dudy * width) + (dvdy * height) * (dvdy * height);
+	float lod = 0.5f * log2f(std::max(rhoX, rhoY));
+	if (!(lod > 0.0f))
+		return softBilinear(texture, 0, u, v);
+
+	int maxLevel = (int)texture.levels.size() - 1;
+	lod = std::min(lod, (float)maxLevel);
+	int level = (int)lod;
+	float blend = lod - level;
+	glm::vec4 texel = softNearest(texture, level, u, v);
+	if (blend > 0.0f && level < maxLevel)
+		texel = texel * (1.0f - blend) + softNearest(texture, level + 1, u, v) * blend;
+	return texel;
+}
+
+// Sutherland-Hodgman against plane . clip >= 0, attributes interpolated with the position
+inline int clipSoftPolygon(const SoftVertex* in, int count, const glm::vec4& plane, SoftVertex* out)
+{
+	int written = 0;
+	for (int i = 0; i < count; i++)
+	{
+		const SoftVertex& a = in[i];
+		const SoftVertex& b = in[(i + 1) % count];
+		float da = glm::dot(plane, a.clip), db = glm::dot(plane, b.clip);
+		if (da >= 0.0f)
+			out[written++] = a;
+		if ((da >= 0.0f) != (db >= 0.0f))
+		{
+			float t = da / (da - db);
+			SoftVertex& v = out[written++];
+			v.clip = a.clip + (b.clip - a.clip) * t;
+			for (int k = 0; k < kSoftPlaneCount - kSoftWorldX; k++)
+				v.attributes[k] = a.attributes[k] + (b.attributes[k] - a.attributes[k]) * t;
+		}
+	}
+	return written;
+}
+
+// Plane through three values at the triangle's window positions
+inline void setSoftPlane(float plane[3], float f0, float f1, float f2, float dx1, float dy1, float dx2, float dy2, float invDet)
+{
+	plane[0] = f0;
+	plane[1] = ((f1 - f0) * dy2 - (f2 - f0) * dy1) * invDet;
+	plane[2] = ((f2 - f0) * dx1 - (f1 - f0) * dx2) * invDet;
+}
+
+// Window space triangle from three clipped vertices, false when it covers no pixel centre area or lies off screen
+inline bool setupSoftTriangle(const SoftRasterizer& raster, const SoftVertex* v0, const SoftVertex* v1, const SoftVertex* v2,
+	uint32_t draw, SoftTriangle& tri)
+{
+	const SoftVertex* v[3] = { v0, v1, v2 };
+	int64_t x[3], y[3];
+	float depth[3], invW[3];
+	for (int i = 0; i < 3; i++)
+	{
+		invW[i] = 1.0f / v[i]->clip.w;
+		float wx = (v[i]->clip.x * invW[i] * 0.5f + 0.5f) * raster.width;
+		float wy = (v[i]->clip.y * invW[i] * 0.5f + 0.5f) * raster.height;
+		x[i] = (int64_t)lrintf(wx * kSoftSubpixels);
+		y[i] = (int64_t)lrintf(wy * kSoftSubpixels);
+		depth[i] = v[i]->clip.z * invW[i] * 0.5f + 0.5f;
+	}
+
+	// Counter-clockwise from here on, both windings are drawn
+	int64_t area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (area == 0)
+		return false;
+	if (area < 0)
+	{
+		std::swap(v[1], v[2]);
+		std::swap(x[1], x[2]);
+		std::swap(y[1], y[2]);
+		std::swap(depth[1], depth[2]);
+		std::swap(invW[1], invW[2]);
+	}
+
+	int64_t minX = std::min(x[0], std::min(x[1], x[2])), maxX = std::max(x[0], std::max(x[1], x[2]));
+	int64_t minY = std::min(y[0], std::min(y[1], y[2])), maxY = std::max(y[0], std::max(y[1], y[2]));
+	tri.minX = (int)std::max<int64_t>(minX >> kSoftSubpixelBits, 0);
+	tri.minY = (int)std::max<int64_t>(minY >> kSoftSubpixelBits, 0);
+	tri.maxX = (int)std::min<int64_t>(maxX >> kSoftSubpixelBits, raster.width - 1);
+	tri.maxY = (int)std::min<int64_t>(maxY >> kSoftSubpixelBits, raster.height - 1);
+	if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+		return false;
+
+	// Edge i runs from vertex i to the next; top edges are horizontal going left, left edges go down
+	for (int i = 0; i < 3; i++)
+	{
+		int j = (i + 1) % 3;
+		tri.edgeA[i] = (int32_t)(y[i] - y[j]);
+		tri.edgeB[i] = (int32_t)(x[j] - x[i]);
+		tri.edgeC[i] = x[i] * y[j] - y[i] * x[j];
+		tri.edgeInclusive[i] = tri.edgeA[i] > 0 || (tri.edgeA[i] == 0 && tri.edgeB[i] < 0);
+	}
+
+	// Attribute planes from the snapped positions, relative to the first vertex
+	float px[3], py[3];
+	for (int i = 0; i < 3; i++)
+	{
+		px[i] = (float)x[i] / kSoftSubpixels;
+		py[i] = (float)y[i] / kSoftSubpixels;
+	}
+	float dx1 = px[1] - px[0], dy1 = py[1] - py[0], dx2 = px[2] - px[0], dy2 = py[2] - py[0];
+	float invDet = 1.0f / (dx1 * dy2 - dx2 * dy1);
+	tri.originX = px[0];
+	tri.originY = py[0];
+	setSoftPlane(tri.planes[kSoftDepth], depth[0], depth[1], depth[2], dx1, dy1, dx2, dy2, invDet);
+	setSoftPlane(tri.planes[kSoftInvW], invW[0], invW[1], invW[2], dx1, dy1, dx2, dy2, invDet);
+	for (int k = kSoftWorldX; k < kSoftPlaneCount; k++)
+	{
+		int a = k - kSoftWorldX;
+		setSoftPlane(tri.planes[k], v[0]->attributes[a] * invW[0], v[1]->attributes[a] * invW[1], v[2]->attributes[a] * invW[2],
+			dx1, dy1, dx2, dy2, invDet);
+	}
+	tri.minDepth = std::max(std::min(depth[0], std::min(depth[1], depth[2])), 0.0f);
+	tri.draw = draw;
+	return true;
+}
+
+// Geometry pass of one chunk: vertices of each draw, triangles clipped and set up, then binned per tile
+inline void setupSoftChunk(SoftRasterizer& raster, const SoftFrame& frame, const std::vector<SoftDraw>& draws,
+	uint32_t chunkIndex, int thread)
+{
+	PROFILE_ZONE("soft geometry");
+	SoftChunk& chunk = raster.chunks[chunkIndex];
+	chunk.triangles.clear();
+	chunk.lightStart.assign(1, 0);
+	chunk.lights.clear();
+	std::vector<SoftVertex>& vertices = raster.vertexScratch[thread];
+	glm::mat4 viewProjection = frame.projection * frame.view;
+
+	// Trivial rejects use the frustum, clipping uses the guard band
+	float guardX = 1.0f + 2.0f * kSoftGuardPixels / raster.width, guardY = 1.0f + 2.0f * kSoftGuardPixels / raster.height;
+	const glm::vec4 clipPlanes[5] =
+	{
+		glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
+		glm::vec4(-1.0f, 0.0f, 0.0f, guardX), glm::vec4(1.0f, 0.0f, 0.0f, guardX),
+		glm::vec4(0.0f, -1.0f, 0.0f, guardY), glm::vec4(0.0f, 1.0f, 0.0f, guardY)
+	};
+
+	uint32_t first = chunkIndex * kSoftDrawsPerChunk, last = std::min(first + kSoftDrawsPerChunk, (uint32_t)draws.size());
+	for (uint32_t d = first; d < last; d++)
+	{
+		const SoftDraw& draw = draws[d];
+		const SoftMesh& mesh = *draw.mesh;
+		vertices.resize(mesh.vertexCount);
+		glm::vec3 boundsMin(1e30f), boundsMax(-1e30f);
+		for (uint32_t i = 0; i < mesh.vertexCount; i++)
+		{
+			const float* source = mesh.vertices + (size_t)i * mesh.stride;
+			SoftVertex& vertex = vertices[i];
+			glm::vec4 world = draw.model * glm::vec4(source[0], source[1], source[2], 1.0f);
+			vertex.clip = viewProjection * world;
+			vertex.attributes[0] = world.x;
+			vertex.attributes[1] = world.y;
+			vertex.attributes[2] = world.z;
+			boundsMin = glm::min(boundsMin, glm::vec3(world));
+			boundsMax = glm::max(boundsMax, glm::vec3(world));
+			if (draw.texture)
+			{
+				glm::vec3 normal = draw.normalMatrix * glm::vec3(source[8], source[9], source[10]);
+				vertex.attributes[3] = normal.x;
+				vertex.attributes[4] = normal.y;
+				vertex.attributes[5] = normal.z;
+				vertex.attributes[6] = 1.0f - source[6];
+				vertex.attributes[7] = 1.0f - source[7];
+			}
+			else
+				std::fill(vertex.attributes + 3, vertex.attributes + 8, 0.0f);
+		}
+
+		// Lights whose sphere touches the draw's bounds, all others have faded to zero
+		if (draw.texture)
+		{
+			for (uint32_t l = 0; l < frame.lights.size(); l++)
+			{
+				const SoftLight& light = frame.lights[l];
+				glm::vec3 offset = light.position - glm::clamp(light.position, boundsMin, boundsMax);
+				if (glm::dot(offset, offset) < light.radius * light.radius)
+					chunk.lights.push_back(l);
+			}
+		}
+		chunk.lightStart.push_back((uint32_t)chunk.lights.size());
+
+		for (uint32_t i = 0; i + 2 < draw.indexCount; i += 3)
+		{
+			const SoftVertex* corners[3];
+			for (int k = 0; k < 3; k++)
+			{
+				uint32_t index = draw.firstIndex + i + k;
+				uint32_t vertex = mesh.indexSize == 1 ? ((const uint8_t*)mesh.indices)[index] :
+					mesh.indexSize == 2 ? ((const uint16_t*)mesh.indices)[index] : ((const uint32_t*)mesh.indices)[index];
+				corners[k] = &vertices[vertex];
+			}
+
+			// Entirely outside one frustum plane
+			int outside[6] = {};
+			for (int k = 0; k < 3; k++)
+			{
+				const glm::vec4& c = corners[k]->clip;
+				outside[0] += c.x < -c.w; outside[1] += c.x > c.w;
+				outside[2] += c.y < -c.w; outside[3] += c.y > c.w;
+				outside[4] += c.z < -c.w; outside[5] += c.z > c.w;
+			}
+			if (*std::max_element(outside, outside + 6) == 3)
+				continue;
+
+			// Clip only what crosses the near plane or leaves the guard band
+			bool inside = true;
+			for (int k = 0; k < 3 && inside; k++)
+				for (const glm::vec4& plane : clipPlanes)
+					inside = inside && glm::dot(plane, corners[k]->clip) >= 0.0f;
+			uint32_t drawInChunk = d - first;
+			if (inside)
+			{
+				SoftTriangle tri;
+				if (setupSoftTriangle(raster, corners[0], corners[1], corners[2], drawInChunk, tri))
+					chunk.triangles.push_back(tri);
+				continue;
+			}
+			SoftVertex polygon[2][9];
+			int count = 3;
+			for (int k = 0; k < 3; k++)
+				polygon[0][k] = *corners[k];
+			int current = 0;
+			for (const glm::vec4& plane : clipPlanes)
+			{
+				count = clipSoftPolygon(polygon[current], count, plane, polygon[1 - current]);
+				current = 1 - current;
+			}
+			for (int k = 1; k + 1 < count; k++)
+			{
+				SoftTriangle tri;
+				if (setupSoftTriangle(raster, &polygon[current][0], &polygon[current][k], &polygon[current][k + 1], drawInChunk, tri))
+					chunk.triangles.push_back(tri);
+			}
+		}
+	}
+
+	// Bin by the tiles each bounding box overlaps, counted first so the lists are contiguous
+	int tiles = raster.tilesX * raster.tilesY;
+	chunk.tileStart.assign(tiles + 1, 0);
+	for (const SoftTriangle& tri : chunk.triangles)
+		for (int ty = tri.minY / kSoftTileSize; ty <= tri.maxY / kSoftTileSize; ty++)
+			for (int tx = tri.minX / kSoftTileSize; tx <= tri.maxX / kSoftTileSize; tx++)
+				chunk.tileStart[ty * raster.tilesX + tx + 1]++;
+	for (int t = 0; t < tiles; t++)
+		chunk.tileStart[t + 1] += chunk.tileStart[t];
+	chunk.tileTriangles.resize(chunk.tileStart[tiles]);
+	std::vector<uint32_t> cursor(chunk.tileStart.begin(), chunk.tileStart.end() - 1);
+	for (uint32_t i = 0; i < chunk.triangles.size(); i++)
+	{
+		const SoftTriangle& tri = chunk.triangles[i];
+		for (int ty = tri.minY / kSoftTileSize; ty <= tri.maxY / kSoftTileSize; ty++)
+			for (int tx = tri.minX / kSoftTileSize; tx <= tri.maxX / kSoftTileSize; tx++)
+				chunk.tileTriangles[cursor[ty * raster.tilesX + tx]++] = i;
+	}
+
+	SoftStats& stats = raster.threadStats[thread];
+	stats.triangles += chunk.triangles.size();
+	stats.binnedTriangles += chunk.tileTriangles.size();
+}
+
+inline SoftLanes softPlaneLanes(const float plane[3], SoftLanes x, float y)
+{
+	return softLanes(plane[0] + plane[2] * y) + softLanes(plane[1]) * x;
+}
+
+inline uint8_t softUnorm8(float value)
+{
+	return (uint8_t)(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+// Colour of the covered lanes of one span, the fragment shader of the GL path
+inline void shadeSoftSpan(const SoftTriangle& tri, const SoftDraw& draw, const SoftFrame& frame, const uint32_t* lights,
+	uint32_t lightCount, SoftLanes x, float y, int covered, uint32_t* out)
+{
+	if (!draw.texture)
+	{
+		uint32_t flat = softUnorm8(draw.color.x) | softUnorm8(draw.color.y) << 8 | softUnorm8(draw.color.z) << 16 |
+			(uint32_t)softUnorm8(draw.color.w) << 24;
+		for (int i = 0; i < kSoftBlockSize; i++)
+			if (covered & (1 << i))
+				out[i] = flat;
+		return;
+	}
+
+	SoftLanes one = softLanes(1.0f), zero = softLanes(0.0f);
+	SoftLanes invW = softPlaneLanes(tri.planes[kSoftInvW], x, y);
+	SoftLanes w = one / invW;
+	SoftLanes posX = softPlaneLanes(tri.planes[kSoftWorldX], x, y) * w;
+	SoftLanes posY = softPlaneLanes(tri.planes[kSoftWorldY], x, y) * w;
+	SoftLanes posZ = softPlaneLanes(tri.planes[kSoftWorldZ], x, y) * w;
+	SoftLanes normX = softPlaneLanes(tri.planes[kSoftNormalX], x, y);
+	SoftLanes normY = softPlaneLanes(tri.planes[kSoftNormalY], x, y);
+	SoftLanes normZ = softPlaneLanes(tri.planes[kSoftNormalZ], x, y);
+	SoftLanes normScale = one / sqrtLanes(normX * normX + normY * normY + normZ * normZ);
+	normX = normX * normScale;
+	normY = normY * normScale;
+	normZ = normZ * normScale;
+	SoftLanes viewX = softLanes(frame.viewPos.x) - posX, viewY = softLanes(frame.viewPos.y) - posY, viewZ = softLanes(frame.viewPos.z) - posZ;
+	SoftLanes viewScale = one / sqrtLanes(viewX * viewX + viewY * viewY + viewZ * viewZ);
+	viewX = viewX * viewScale;
+	viewY = viewY * viewScale;
+	viewZ = viewZ * viewScale;
+
+	SoftLanes red = softLanes(frame.ambient.x), green = softLanes(frame.ambient.y), blue = softLanes(frame.ambient.z);
+	for (uint32_t l = 0; l < lightCount; l++)
+	{
+		const SoftLight& light = frame.lights[lights[l]];
+		SoftLanes toX = softLanes(light.position.x) - posX, toY = softLanes(light.position.y) - posY, toZ = softLanes(light.position.z) - posZ;
+		SoftLanes distance = sqrtLanes(toX * toX + toY * toY + toZ * toZ);
+
+		// Smooth falloff to zero at the light radius
+		SoftLanes ratio = distance / softLanes(light.radius);
+		ratio = ratio * ratio;
+		SoftLanes falloff = maxLanes(one - ratio * ratio, zero);
+		falloff = falloff * falloff;
+		if (!laneMask(lanesGreater(falloff, zero)))
+			continue;
+
+		// Diffuse
+		SoftLanes inverse = one / distance;
+		toX = toX * inverse;
+		toY = toY * inverse;
+		toZ = toZ * inverse;
+		SoftLanes facing = normX * toX + normY * toY + normZ * toZ;
+		SoftLanes diffuse = maxLanes(facing, zero);
+
+		// Specular, reflect(-lightDir, norm) and pow 128 by squaring
+		SoftLanes twice = facing + facing;
+		SoftLanes reflectX = normX * twice - toX, reflectY = normY * twice - toY, reflectZ = normZ * twice - toZ;
+		SoftLanes specular = maxLanes(viewX * reflectX + viewY * reflectY + viewZ * reflectZ, zero);
+		for (int i = 0; i < 7; i++)
+			specular = specular * specular;
+
+		SoftLanes amount = (diffuse + softLanes(10.25f) * specular) * falloff;
+		red = red + amount * softLanes(light.color.x);
+		green = green + amount * softLanes(light.color.y);
+		blue = blue + amount * softLanes(light.color.z);
+	}
+
+	// Texture coordinates and their screen derivatives per lane, (d(a/w) - a d(1/w)) w
+	SoftLanes u = softPlaneLanes(tri.planes[kSoftU], x, y) * w;
+	SoftLanes v = softPlaneLanes(tri.planes[kSoftV], x, y) * w;
+	SoftLanes dudx = (softLanes(tri.planes[kSoftU][1]) - u * softLanes(tri.planes[kSoftInvW][1])) * w;
+	SoftLanes dudy = (softLanes(tri.planes[kSoftU][2]) - u * softLanes(tri.planes[kSoftInvW][2])) * w;
+	SoftLanes dvdx = (softLanes(tri.planes[kSoftV][1]) - v * softLanes(tri.planes[kSoftInvW][1])) * w;
+	SoftLanes dvdy = (softLanes(tri.planes[kSoftV][2]) - v * softLanes(tri.planes[kSoftInvW][2])) * w;
+
+	float lanes[9][kSoftBlockSize];
+	storeLanes(lanes[0], red);
+	storeLanes(lanes[1], green);
+	storeLanes(lanes[2], blue);
+	storeLanes(lanes[3], u);
+	storeLanes(lanes[4], v);
+	storeLanes(lanes[5], dudx);
+	storeLanes(lanes[6], dvdx);
+	storeLanes(lanes[7], dudy);
+	storeLanes(lanes[8], dvdy);
+	for (int i = 0; i < kSoftBlockSize; i++)
+	{
+		if (!(covered & (1 << i)))
+			continue;
+		glm::vec4 texel = sampleSoftTexture(*draw.texture, lanes[3][i], lanes[4][i], lanes[5][i], lanes[6][i], lanes[7][i], lanes[8][i]);
+		out[i] = softUnorm8(texel.x * lanes[0][i]) | softUnorm8(texel.y * lanes[1][i]) << 8 | softUnorm8(texel.z * lanes[2][i]) << 16 |
+			(uint32_t)softUnorm8(texel.w) << 24;
+	}
+}
+
+// Every triangle of one chunk binned to the tile, in submission order
+inline void rasterSoftChunk(SoftRasterizer& raster, const SoftFrame& frame, const std::vector<SoftDraw>& draws, uint32_t chunkIndex,
+	int tile, SoftStats& stats)
+{
+	const SoftChunk& chunk = raster.chunks[chunkIndex];
+	int tileX = (tile % raster.tilesX) * kSoftTileSize, tileY = (tile / raster.tilesX) * kSoftTileSize;
+	int blocksPerRow = raster.pitch / kSoftBlockSize;
+	SoftLanes laneX = softLaneIndices() + softLanes(0.5f);
+
+	for (uint32_t entry = chunk.tileStart[tile]; entry < chunk.tileStart[tile + 1]; entry++)
+	{
+		const SoftTriangle& tri = chunk.triangles[chunk.tileTriangles[entry]];
+		uint32_t drawInChunk = tri.draw;
+		const SoftDraw& draw = draws[chunkIndex * kSoftDrawsPerChunk + drawInChunk];
+		const uint32_t* lights = chunk.lights.data() + chunk.lightStart[drawInChunk];
+		uint32_t lightCount = chunk.lightStart[drawInChunk + 1] - chunk.lightStart[drawInChunk];
+
+		// Lane offsets of the edge functions, exact in float (below 2^24 for any screen up to kSoftMaxSize)
+		SoftLanes edgeSteps[3];
+		for (int e = 0; e < 3; e++)
+			edgeSteps[e] = softLaneIndices() * softLanes((float)tri.edgeA[e] * kSoftSubpixels);
+
+		int x0 = std::max(tri.minX, tileX) & ~(kSoftBlockSize - 1), x1 = std::min(tri.maxX, tileX + kSoftTileSize - 1);
+		int y0 = std::max(tri.minY, tileY) & ~(kSoftBlockSize - 1), y1 = std::min(tri.maxY, tileY + kSoftTileSize - 1);
+		for (int by = y0; by <= y1; by += kSoftBlockSize)
+		{
+			for (int bx = x0; bx <= x1; bx += kSoftBlockSize)
+			{
+				stats.blocksTested++;
+				float& blockMax = raster.blockMaxDepth[(by / kSoftBlockSize) * blocksPerRow + bx / kSoftBlockSize];
+				if (tri.minDepth >= blockMax)
+				{
+					stats.blocksRejected++;
+					continue;
+				}
+
+				// Edge functions at the block's first pixel centre, and a reject when one edge excludes all four corners
+				int64_t centerX = (int64_t)bx * kSoftSubpixels + kSoftSubpixels / 2, centerY = (int64_t)by * kSoftSubpixels + kSoftSubpixels / 2;
+				int64_t blockEdge[3];
+				bool outside = false;
+				for (int e = 0; e < 3; e++)
+				{
+					blockEdge[e] = tri.edgeA[e] * centerX + tri.edgeB[e] * centerY + tri.edgeC[e];
+					int64_t span = (int64_t)(kSoftBlockSize - 1) * kSoftSubpixels;
+					int64_t best = blockEdge[e] + std::max<int64_t>(tri.edgeA[e] * span, 0) + std::max<int64_t>(tri.edgeB[e] * span, 0);
+					outside = outside || best < 0 || (best == 0 && !tri.edgeInclusive[e]);
+				}
+				if (outside)
+					continue;
+
+				bool written = false;
+				for (int row = 0; row < kSoftBlockSize; row++)
+				{
+					int y = by + row;
+					if (y < tri.minY || y > tri.maxY)
+						continue;
+					SoftLanes inside;
+					for (int e = 0; e < 3; e++)
+					{
+						int64_t rowEdge = blockEdge[e] + (int64_t)tri.edgeB[e] * row * kSoftSubpixels;
+						SoftLanes edge = softLanes((float)rowEdge) + edgeSteps[e];
+						SoftLanes edgeInside = tri.edgeInclusive[e] ? lanesGreaterEqual(edge, softLanes(0.0f)) : lanesGreater(edge, softLanes(0.0f));
+						inside = e ? inside & edgeInside : edgeInside;
+					}
+					if (!laneMask(inside))
+						continue;
+
+					// Depth test GL_LESS against the stored row, and nothing beyond the far plane
+					float py = y + 0.5f - tri.originY;
+					SoftLanes px = laneX + softLanes(bx - tri.originX);
+					SoftLanes z = softPlaneLanes(tri.planes[kSoftDepth], px, py);
+					size_t pixel = (size_t)y * raster.pitch + bx;
+					SoftLanes stored = loadLanes(&raster.depth[pixel]);
+					SoftLanes pass = inside & lanesLess(z, stored) & lanesGreaterEqual(softLanes(1.0f), z);
+					int covered = laneMask(pass);
+					if (!covered)
+						continue;
+					storeLanes(&raster.depth[pixel], selectLanes(pass, z, stored));
+					shadeSoftSpan(tri, draw, frame, lights, lightCount, px, py, covered, &raster.color[pixel]);
+					stats.pixelsShaded += std::bitset<kSoftBlockSize>((unsigned)covered).count();
+					written = true;
+				}
+
+				if (written)
+				{
+					SoftLanes farthest = loadLanes(&raster.depth[(size_t)by * raster.pitch + bx]);
+					for (int row = 1; row < kSoftBlockSize; row++)
+						farthest = maxLanes(farthest, loadLanes(&raster.depth[(size_t)(by + row) * raster.pitch + bx]));
+					float values[kSoftBlockSize];
+					storeLanes(values, farthest);
+					blockMax = *std::max_element(values, values + kSoftBlockSize);
+				}
+			}
+		}
+	}
+}
+
+// Clear a tile and draw everything binned to it
+inline void rasterSoftTile(SoftRasterizer& raster, const SoftFrame& frame, const std::vector<SoftDraw>& draws, int tile, int thread)
+{
+	PROFILE_ZONE("soft tile");
+	int tileX = (tile % raster.tilesX) * kSoftTileSize, tileY = (tile / raster.tilesX) * kSoftTileSize;
+	for (int y = tileY; y < tileY + kSoftTileSize; y++)
+	{
+		std::fill_n(&raster.color[(size_t)y * raster.pitch + tileX], kSoftTileSize, 0u);
+		std::fill_n(&raster.depth[(size_t)y * raster.pitch + tileX], kSoftTileSize, 1.0f);
+	}
+	int blocksPerRow = raster.pitch / kSoftBlockSize;
+	for (int by = tileY / kSoftBlockSize; by < (tileY + kSoftTileSize) / kSoftBlockSize; by++)
+		std::fill_n(&raster.blockMaxDepth[by * blocksPerRow + tileX / kSoftBlockSize], kSoftTileSize / kSoftBlockSize, 1.0f);
+
+	for (uint32_t chunk = 0; chunk < raster.chunks.size(); chunk++)
+		rasterSoftChunk(raster, frame, draws, chunk, tile, raster.threadStats[thread]);
+}
+
+// Draw a frame into the rasterizer's buffers, cleared to transparent black and depth 1
+inline void renderSoftFrame(SoftRasterizer& raster, const SoftFrame& frame, const std::vector<SoftDraw>& draws)
+{
+	for (SoftStats& stats : raster.threadStats)
+		stats = SoftStats();
+	raster.chunks.resize((draws.size() + kSoftDrawsPerChunk - 1) / kSoftDrawsPerChunk);
+	parallelFor(*raster.pool, (uint32_t)raster.chunks.size(), [&](uint32_t chunk, int thread) {
+		setupSoftChunk(raster, frame, draws, chunk, thread);
+	});
+	parallelFor(*raster.pool, (uint32_t)(raster.tilesX * raster.tilesY), [&](uint32_t tile, int thread) {
+		rasterSoftTile(raster, frame, draws, (int)tile, thread);
+	});
+
+	raster.stats = SoftStats();
+	for (const SoftStats& stats : raster.threadStats)
+	{
+		raster.stats.triangles += stats.triangles;
+		raster.stats.binnedTriangles += stats.binnedTriangles;
+		raster.stats.blocksTested += stats.blocksTested;
+		raster.stats.blocksRejected += stats.blocksRejected;
+		raster.stats.pixelsShaded += stats.pixelsShaded;
+	}
+}
+
+// RGB rows bottom up, as glReadPixels returns them
+inline void readSoftPixels(const SoftRasterizer& raster, std::vector<uint8_t>& rgb)
+{
+	rgb.resize((size_t)raster.width * raster.height * 3);
+	for (int y = 0; y < raster.height; y++)
+	{
+		for (int x = 0; x < raster.width; x++)
+		{
+			uint32_t color = raster.color[(size_t)y * raster.pitch + x];
+			uint8_t* out = &rgb[((size_t)y * raster.width + x) * 3];
+			out[0] = (uint8_t)color;
+			out[1] = (uint8_t)(color >> 8);
+			out[2] = (uint8_t)(color >> 16);
+		}
+	}
+}
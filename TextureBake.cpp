@@ -0,0 +1,89 @@
+// Offline texture baker: any image SOIL2 reads to a KTX2 file with a full, precomputed mip chain
+//
+//     TextureBake input.jpg output.ktx2 [--bc7 | --bc1 | --rgba]
+//
+// Mips are filtered in linear light, then every level is block compressed on the CPU:
+// BC7 (default, 8 bits per texel), BC1 (4 bits per texel, opaque) or left as RGBA8.
+// RoughSketch --texture uploads the levels as they are, with no decode or mip generation at startup.
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <SOIL2/SOIL2.h>
+
+#include "TextureCompress.h"
+#include "TextureFile.h"
+
+using namespace std;
+
+int main(int argc, char* argv[])
+{
+	uint32_t vkFormat = kVkFormatBc7Unorm;
+	if (argc == 4 && strcmp(argv[3], "--bc1") == 0)
+		vkFormat = kVkFormatBc1RgbUnorm;
+	else if (argc == 4 && strcmp(argv[3], "--rgba") == 0)
+		vkFormat = kVkFormatR8G8B8A8Unorm;
+	else if (argc != 3 && !(argc == 4 && strcmp(argv[3], "--bc7") == 0))
+	{
+		cout << "Usage: TextureBake input.jpg output.ktx2 [--bc7 | --bc1 | --rgba]" << endl;
+		return -1;
+	}
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	int width, height;
+	unsigned char* image = SOIL_load_image(argv[1], &width, &height, 0, SOIL_LOAD_RGBA);
+	if (!image)
+	{
+		cout << "Error! Could not read " << argv[1] << endl;
+		return -1;
+	}
+
+	vector<vector<uint8_t>> mips, levels;
+	buildMipChain(image, (uint32_t)width, (uint32_t)height, mips);
+	SOIL_free_image_data(image);
+
+	// Error of the full size level only, the smaller ones are dominated by the filter anyway
+	uint64_t squaredError = 0;
+	size_t rgbaBytes = 0;
+	levels.resize(mips.size());
+	for (size_t level = 0; level < mips.size(); level++)
+	{
+		uint32_t levelWidth = max((uint32_t)width >> level, 1u), levelHeight = max((uint32_t)height >> level, 1u);
+		rgbaBytes += mips[level].size();
+		if (vkFormat == kVkFormatR8G8B8A8Unorm)
+			levels[level].swap(mips[level]);
+		else
+		{
+			uint64_t error = encodeTextureImage(mips[level].data(), levelWidth, levelHeight, vkFormat == kVkFormatBc7Unorm, levels[level]);
+			if (level == 0)
+				squaredError = error;
+		}
+	}
+
+	if (!writeTextureFile(argv[2], vkFormat, (uint32_t)width, (uint32_t)height, levels, "RoughSketch TextureBake"))
+	{
+		cout << "Error! Could not write " << argv[2] << endl;
+		return -1;
+	}
+
+	size_t bakedBytes = 0;
+	for (const vector<uint8_t>& level : levels)
+		bakedBytes += level.size();
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	const char* formatName = vkFormat == kVkFormatBc7Unorm ? "BC7" : vkFormat == kVkFormatBc1RgbUnorm ? "BC1" : "RGBA8";
+	cout << argv[2] << ": " << width << "x" << height << " " << formatName << ", " << levels.size() << " levels, "
+		<< bakedBytes << " bytes (RGBA8 " << rgbaBytes << ", " << (double)rgbaBytes / bakedBytes << "x smaller)"
+		<< " (" << seconds * 1000.0 << " ms)" << endl;
+	if (vkFormat != kVkFormatR8G8B8A8Unorm)
+	{
+		// Over the channels the format stores, BC1 has no alpha
+		double samples = (double)width * height * (vkFormat == kVkFormatBc1RgbUnorm ? 3 : 4);
+		double mse = squaredError / samples;
+		cout << "Level 0 PSNR " << (mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY) << " dB" << endl;
+	}
+	return 0;
+}
@@ -0,0 +1,465 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// CPU side of the texture baker: mip chains filtered in linear light and 4x4 block encoders.
+// BC1 stores 4 bits per texel (two RGB565 endpoints, 2-bit indices), BC7 8 bits; the BC7 encoder only uses
+// mode 6 (one RGBA 7.7.7.7 endpoint pair with p-bits, 4-bit indices), which suits smooth opaque textures well.
+// All images are RGBA8 with rows starting at the top left.
+
+// 8-bit sRGB to linear, and back with rounding
+inline float srgbToLinear(float value)
+{
+	return value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+}
+
+inline uint8_t linearToSrgb8(float value)
+{
+	value = std::min(std::max(value, 0.0f), 1.0f);
+	float srgb = value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+	return (uint8_t)lroundf(srgb * 255.0f);
+}
+
+// Halve an image with a tent filter two source texels wide ([1 3 3 1] / 8 for even sizes), wrapping at the edges
+// like the GL_REPEAT sampler. Color is filtered in linear light, alpha as is
+inline void downsampleImage(const std::vector<float>& linear, uint32_t width, uint32_t height,
+	std::vector<float>& result, uint32_t& resultWidth, uint32_t& resultHeight)
+{
+	resultWidth = std::max(width / 2, 1u);
+	resultHeight = std::max(height / 2, 1u);
+
+	// Separable weights per output column or row
+	struct Tap { int source; float weight; };
+	auto makeTaps = [](uint32_t size, uint32_t resultSize, std::vector<std::vector<Tap>>& taps)
+	{
+		taps.assign(resultSize, std::vector<Tap>());
+		float scale = (float)size / resultSize;
+		for (uint32_t i = 0; i < resultSize; i++)
+		{
+			float center = (i + 0.5f) * scale - 0.5f;
+			float radius = scale > 1.0f ? scale : 1.0f;
+			float total = 0.0f;
+			for (int s = (int)floorf(center - radius); s <= (int)ceilf(center + radius); s++)
+			{
+				float weight = 1.0f - fabsf(s - center) / radius;
+				if (weight <= 0.0f)
+					continue;
+				taps[i].push_back({ (int)(((s % (int)size) + (int)size) % (int)size), weight });
+				total += weight;
+			}
+			for (Tap& tap : taps[i])
+				tap.weight /= total;
+		}
+	};
+	std::vector<std::vector<Tap>> columns, rows;
+	makeTaps(width, resultWidth, columns);
+	makeTaps(height, resultHeight, rows);
+
+	std::vector<float> horizontal((size_t)resultWidth * height * 4, 0.0f);
+	for (uint32_t y = 0; y < height; y++)
+		for (uint32_t x = 0; x < resultWidth; x++)
+			for (const Tap& tap : columns[x])
+				for (int c = 0; c < 4; c++)
+					horizontal[((size_t)y * resultWidth + x) * 4 + c] += linear[((size_t)y * width + tap.source) * 4 + c] * tap.weight;
+
+	result.assign((size_t)resultWidth * resultHeight * 4, 0.0f);
+	for (uint32_t y = 0; y < resultHeight; y++)
+		for (const Tap& tap : rows[y])
+			for (uint32_t x = 0; x < resultWidth; x++)
+				for (int c = 0; c < 4; c++)
+					result[((size_t)y * resultWidth + x) * 4 + c] += horizontal[((size_t)tap.source * resultWidth + x) * 4 + c] * tap.weight;
+}
+
+// Full mip chain down to 1x1 as RGBA8, levels[0] is a copy of the image
+inline void buildMipChain(const uint8_t* rgba, uint32_t width, uint32_t height, std::vector<std::vector<uint8_t>>& levels)
+{
+	levels.assign(1, std::vector<uint8_t>(rgba, rgba + (size_t)width * height * 4));
+	float toLinear[256];
+	for (int i = 0; i < 256; i++)
+		toLinear[i] = srgbToLinear(i / 255.0f);
+
+	std::vector<float> linear((size_t)width * height * 4), next;
+	for (size_t i = 0; i < linear.size(); i++)
+		linear[i] = (i & 3) == 3 ? rgba[i] / 255.0f : toLinear[rgba[i]];
+	while (width > 1 || height > 1)
+	{
+		downsampleImage(linear, width, height, next, width, height);
+		linear.swap(next);
+		std::vector<uint8_t> level(linear.size());
+		for (size_t i = 0; i < linear.size(); i++)
+			level[i] = (i & 3) == 3 ? (uint8_t)lroundf(std::min(std::max(linear[i], 0.0f), 1.0f) * 255.0f) : linearToSrgb8(linear[i]);
+		levels.push_back(level);
+	}
+}
+
+// 4x4 block at (bx, by) with edge texels repeated for images that are not a multiple of 4
+inline void readTextureBlock(const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t bx, uint32_t by, uint8_t block[64])
+{
+	for (uint32_t y = 0; y < 4; y++)
+		for (uint32_t x = 0; x < 4; x++)
+			memcpy(block + (y * 4 + x) * 4, rgba + ((size_t)std::min(by * 4 + y, height - 1) * width + std::min(bx * 4 + x, width - 1)) * 4, 4);
+}
+
+// Principal axis of the block's colors (first `channels` channels), from a few power iterations on the covariance
+inline void blockPrincipalAxis(const uint8_t block[64], int channels, float mean[4], float axis[4])
+{
+	float covariance[4][4] = {};
+	for (int c = 0; c < 4; c++)
+	{
+		mean[c] = 0.0f;
+		for (int i = 0; i < 16; i++)
+			mean[c] += block[i * 4 + c] / 16.0f;
+	}
+	for (int i = 0; i < 16; i++)
+		for (int a = 0; a < channels; a++)
+			for (int b = 0; b < channels; b++)
+				covariance[a][b] += (block[i * 4 + a] - mean[a]) * (block[i * 4 + b] - mean[b]);
+
+	for (int c = 0; c < 4; c++)
+		axis[c] = c < channels ? 1.0f : 0.0f;
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float next[4] = {}, length = 0.0f;
+		for (int a = 0; a < channels; a++)
+		{
+			for (int b = 0; b < channels; b++)
+				next[a] += covariance[a][b] * axis[b];
+			length = std::max(length, fabsf(next[a]));
+		}
+		if (length <= 0.0f)
+			break;
+		for (int c = 0; c < channels; c++)
+			axis[c] = next[c] / length;
+	}
+	float length = 0.0f;
+	for (int c = 0; c < channels; c++)
+		length += axis[c] * axis[c];
+	length = sqrtf(length);
+	for (int c = 0; c < channels; c++)
+		axis[c] = length > 0.0f ? axis[c] / length : 0.0f;
+}
+
+// Endpoints at the extremes of the block's projection on the axis
+inline void blockAxisEndpoints(const uint8_t block[64], int channels, float endpoints[2][4])
+{
+	float mean[4], axis[4];
+	blockPrincipalAxis(block, channels, mean, axis);
+	float low = 0.0f, high = 0.0f;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = 0.0f;
+		for (int c = 0; c < channels; c++)
+			t += (block[i * 4 + c] - mean[c]) * axis[c];
+		low = std::min(low, t);
+		high = std::max(high, t);
+	}
+	for (int c = 0; c < 4; c++)
+	{
+		endpoints[0][c] = mean[c] + axis[c] * high;
+		endpoints[1][c] = mean[c] + axis[c] * low;
+	}
+}
+
+// Least squares endpoints for fixed indices, w[i] is texel i's weight of endpoint 1. False when the fit is singular
+inline bool fitBlockEndpoints(const uint8_t block[64], int channels, const float w[16], float endpoints[2][4])
+{
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[4] = {}, bx[4] = {};
+	for (int i = 0; i < 16; i++)
+	{
+		float a = 1.0f - w[i], b = w[i];
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int c = 0; c < channels; c++)
+		{
+			ax[c] += a * block[i * 4 + c];
+			bx[c] += b * block[i * 4 + c];
+		}
+	}
+	float determinant = aa * bb - ab * ab;
+	if (fabsf(determinant) < 1e-6f)
+		return false;
+	for (int c = 0; c < channels; c++)
+	{
+		endpoints[0][c] = std::min(std::max((ax[c] * bb - bx[c] * ab) / determinant, 0.0f), 255.0f);
+		endpoints[1][c] = std::min(std::max((bx[c] * aa - ax[c] * ab) / determinant, 0.0f), 255.0f);
+	}
+	return true;
+}
+
+inline uint16_t packRgb565(const float color[4])
+{
+	int r = (int)lroundf(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f);
+	int g = (int)lroundf(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f);
+	int b = (int)lroundf(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f);
+	return (uint16_t)(r << 11 | g << 5 | b);
+}
+
+// BC1 four color palette, two thirds interpolation as the common decoders do it
+inline void bc1Palette(uint16_t color0, uint16_t color1, int palette[4][3])
+{
+	for (int e = 0; e < 2; e++)
+	{
+		uint16_t v = e ? color1 : color0;
+		int r = v >> 11, g = (v >> 5) & 63, b = v & 31;
+		palette[e][0] = r << 3 | r >> 2;
+		palette[e][1] = g << 2 | g >> 4;
+		palette[e][2] = b << 3 | b >> 2;
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		if (color0 > color1)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		else
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+}
+
+// Nearest palette entry per texel, returns the squared error
+inline uint32_t bc1Indices(const uint8_t block[64], uint16_t color0, uint16_t color1, uint32_t& indices)
+{
+	int palette[4][3];
+	bc1Palette(color0, color1, palette);
+	uint32_t error = 0;
+	indices = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int best = 0, bestError = 1 << 30;
+		for (int p = 0; p < 4; p++)
+		{
+			int dr = block[i * 4] - palette[p][0], dg = block[i * 4 + 1] - palette[p][1], db = block[i * 4 + 2] - palette[p][2];
+			int e = dr * dr + dg * dg + db * db;
+			if (e < bestError)
+			{
+				bestError = e;
+				best = p;
+			}
+		}
+		indices |= (uint32_t)best << (i * 2);
+		error += (uint32_t)bestError;
+	}
+	return error;
+}
+
+// Encode one opaque block in four color mode, returns the squared error
+inline uint32_t encodeBc1Block(const uint8_t block[64], uint8_t out[8])
+{
+	float endpoints[2][4];
+	blockAxisEndpoints(block, 3, endpoints);
+	uint16_t color0 = packRgb565(endpoints[0]), color1 = packRgb565(endpoints[1]);
+	if (color0 < color1)
+		std::swap(color0, color1);
+	uint32_t indices = 0, error = bc1Indices(block, color0, color1, indices);
+
+	// Refit the endpoints to the chosen indices while that helps
+	const float weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+	for (int iteration = 0; iteration < 2 && color0 != color1; iteration++)
+	{
+		float w[16];
+		for (int i = 0; i < 16; i++)
+			w[i] = weights[(indices >> (i * 2)) & 3];
+		if (!fitBlockEndpoints(block, 3, w, endpoints))
+			break;
+		uint16_t fit0 = packRgb565(endpoints[0]), fit1 = packRgb565(endpoints[1]);
+		if (fit0 < fit1)
+			std::swap(fit0, fit1);
+		uint32_t fitIndices = 0, fitError = fit0 == fit1 ? ~0u : bc1Indices(block, fit0, fit1, fitIndices);
+		if (fitError >= error)
+			break;
+		color0 = fit0;
+		color1 = fit1;
+		indices = fitIndices;
+		error = fitError;
+	}
+
+	// A flat block ends up with equal endpoints, i.e. three color mode, where the fourth entry is opaque black for RGB
+	memcpy(out, &color0, 2);
+	memcpy(out + 2, &color1, 2);
+	memcpy(out + 4, &indices, 4);
+	return error;
+}
+
+inline void decodeBc1Block(const uint8_t in[8], uint8_t block[64])
+{
+	uint16_t color0, color1;
+	uint32_t indices;
+	memcpy(&color0, in, 2);
+	memcpy(&color1, in + 2, 2);
+	memcpy(&indices, in + 4, 4);
+	int palette[4][3];
+	bc1Palette(color0, color1, palette);
+	for (int i = 0; i < 16; i++)
+	{
+		int p = (indices >> (i * 2)) & 3;
+		for (int c = 0; c < 3; c++)
+			block[i * 4 + c] = (uint8_t)palette[p][c];
+		block[i * 4 + 3] = color0 <= color1 && p == 3 ? 0 : 255;
+	}
+}
+
+// Whole BC1 image to RGBA8
+inline void decodeBc1Image(const uint8_t* data, uint32_t width, uint32_t height, std::vector<uint8_t>& rgba)
+{
+	rgba.resize((size_t)width * height * 4);
+	uint32_t blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+	uint8_t block[64];
+	for (uint32_t by = 0; by < blocksY; by++)
+	{
+		for (uint32_t bx = 0; bx < blocksX; bx++)
+		{
+			decodeBc1Block(data + ((size_t)by * blocksX + bx) * 8, block);
+			for (uint32_t y = by * 4; y < std::min(by * 4 + 4, height); y++)
+				for (uint32_t x = bx * 4; x < std::min(bx * 4 + 4, width); x++)
+					memcpy(&rgba[((size_t)y * width + x) * 4], block + ((y & 3) * 4 + (x & 3)) * 4, 4);
+		}
+	}
+}
+
+const int kBc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Mode 6 endpoints: 7 bits per channel plus a shared lowest bit (p-bit) per endpoint
+struct Bc7Mode6
+{
+	uint8_t endpoint[2][4]; // 7-bit values
+	uint8_t pbit[2];
+	uint8_t index[16];
+};
+
+inline uint32_t bc7Mode6Indices(const uint8_t block[64], Bc7Mode6& mode)
+{
+	int palette[16][4];
+	for (int c = 0; c < 4; c++)
+	{
+		int e0 = mode.endpoint[0][c] << 1 | mode.pbit[0], e1 = mode.endpoint[1][c] << 1 | mode.pbit[1];
+		for (int w = 0; w < 16; w++)
+			palette[w][c] = ((64 - kBc7Weights4[w]) * e0 + kBc7Weights4[w] * e1 + 32) >> 6;
+	}
+	uint32_t error = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int best = 0, bestError = 1 << 30;
+		for (int w = 0; w < 16; w++)
+		{
+			int e = 0;
+			for (int c = 0; c < 4; c++)
+			{
+				int d = block[i * 4 + c] - palette[w][c];
+				e += d * d;
+			}
+			if (e < bestError)
+			{
+				bestError = e;
+				best = w;
+			}
+		}
+		mode.index[i] = (uint8_t)best;
+		error += (uint32_t)bestError;
+	}
+	return error;
+}
+
+// Best p-bits and 7-bit endpoints for float endpoints, with indices and error
+inline uint32_t bc7Mode6Quantize(const uint8_t block[64], const float endpoints[2][4], Bc7Mode6& best)
+{
+	uint32_t bestError = ~0u;
+	for (int p = 0; p < 4; p++)
+	{
+		Bc7Mode6 mode;
+		for (int e = 0; e < 2; e++)
+		{
+			mode.pbit[e] = (uint8_t)((p >> e) & 1);
+			for (int c = 0; c < 4; c++)
+				mode.endpoint[e][c] = (uint8_t)std::min(std::max((int)lroundf((endpoints[e][c] - mode.pbit[e]) / 2.0f), 0), 127);
+		}
+		uint32_t error = bc7Mode6Indices(block, mode);
+		if (error < bestError)
+		{
+			bestError = error;
+			best = mode;
+		}
+	}
+	return bestError;
+}
+
+// Encode one block in mode 6, returns the squared error
+inline uint32_t encodeBc7Block(const uint8_t block[64], uint8_t out[16])
+{
+	float endpoints[2][4];
+	blockAxisEndpoints(block, 4, endpoints);
+	Bc7Mode6 mode;
+	uint32_t error = bc7Mode6Quantize(block, endpoints, mode);
+	for (int iteration = 0; iteration < 2 && error > 0; iteration++)
+	{
+		float w[16];
+		for (int i = 0; i < 16; i++)
+			w[i] = kBc7Weights4[mode.index[i]] / 64.0f;
+		if (!fitBlockEndpoints(block, 4, w, endpoints))
+			break;
+		Bc7Mode6 fit;
+		uint32_t fitError = bc7Mode6Quantize(block, endpoints, fit);
+		if (fitError >= error)
+			break;
+		mode = fit;
+		error = fitError;
+	}
+
+	// The first index is stored without its top bit, swap the endpoints when it is set
+	if (mode.index[0] & 8)
+	{
+		for (int c = 0; c < 4; c++)
+			std::swap(mode.endpoint[0][c], mode.endpoint[1][c]);
+		std::swap(mode.pbit[0], mode.pbit[1]);
+		for (int i = 0; i < 16; i++)
+			mode.index[i] = (uint8_t)(15 - mode.index[i]);
+	}
+
+	// Fields from the lowest bit up: mode 6 marker, R0 R1 G0 G1 B0 B1 A0 A1, P0 P1, indices
+	uint64_t bits[2] = { 0, 0 };
+	int position = 0;
+	auto put = [&](uint32_t value, int count)
+	{
+		for (int b = 0; b < count; b++, position++)
+			bits[position >> 6] |= (uint64_t)((value >> b) & 1) << (position & 63);
+	};
+	put(1u << 6, 7);
+	for (int c = 0; c < 4; c++)
+	{
+		put(mode.endpoint[0][c], 7);
+		put(mode.endpoint[1][c], 7);
+	}
+	put(mode.pbit[0], 1);
+	put(mode.pbit[1], 1);
+	for (int i = 0; i < 16; i++)
+		put(mode.index[i], i == 0 ? 3 : 4);
+	memcpy(out, bits, 16);
+	return error;
+}
+
+// Encode a whole RGBA8 image, returns the summed squared error over its RGB(A) channels
+inline uint64_t encodeTextureImage(const uint8_t* rgba, uint32_t width, uint32_t height, bool bc7, std::vector<uint8_t>& out)
+{
+	uint32_t blocksX = (width + 3) / 4, blocksY = (height + 3) / 4, blockBytes = bc7 ? 16 : 8;
+	out.resize((size_t)blocksX * blocksY * blockBytes);
+	uint64_t error = 0;
+	uint8_t block[64];
+	for (uint32_t by = 0; by < blocksY; by++)
+	{
+		for (uint32_t bx = 0; bx < blocksX; bx++)
+		{
+			readTextureBlock(rgba, width, height, bx, by, block);
+			uint8_t* encoded = out.data() + ((size_t)by * blocksX + bx) * blockBytes;
+			error += bc7 ? encodeBc7Block(block, encoded) : encodeBc1Block(block, encoded);
+		}
+	}
+	return error;
+}
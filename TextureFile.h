@@ -0,0 +1,218 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// KTX2 texture container, limited to what the texture baker writes:
+// one 2D image with a full or partial mip chain, no supercompression, block compressed or RGBA8 levels.
+//
+// File layout: identifier, header, level index, data format descriptor, key/value data,
+// then the level images from the smallest mip to the largest, each aligned to its block size
+
+const uint8_t kKtx2Identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+// Vulkan format numbers used by KTX2
+const uint32_t kVkFormatR8G8B8A8Unorm = 37;
+const uint32_t kVkFormatBc1RgbUnorm = 131;
+const uint32_t kVkFormatBc7Unorm = 145;
+
+const uint32_t kKtxMaxLevels = 16;
+
+struct Ktx2Header
+{
+	uint8_t identifier[12];
+	uint32_t vkFormat;
+	uint32_t typeSize; // 1 for block compressed formats
+	uint32_t pixelWidth, pixelHeight, pixelDepth;
+	uint32_t layerCount, faceCount, levelCount;
+	uint32_t supercompressionScheme;
+
+	// Index, byte offsets from the start of the file
+	uint32_t dfdByteOffset, dfdByteLength;
+	uint32_t kvdByteOffset, kvdByteLength;
+	uint64_t sgdByteOffset, sgdByteLength;
+};
+static_assert(sizeof(Ktx2Header) == 80, "Ktx2Header is written to disk as is");
+
+struct Ktx2Level
+{
+	uint64_t byteOffset, byteLength, uncompressedByteLength;
+};
+
+// Block footprint of a format, 0 bytes when the format is not one of ours
+inline uint32_t textureBlockBytes(uint32_t vkFormat, uint32_t& blockSize)
+{
+	switch (vkFormat)
+	{
+	case kVkFormatR8G8B8A8Unorm: blockSize = 1; return 4;
+	case kVkFormatBc1RgbUnorm: blockSize = 4; return 8;
+	case kVkFormatBc7Unorm: blockSize = 4; return 16;
+	default: blockSize = 1; return 0;
+	}
+}
+
+inline uint64_t textureLevelBytes(uint32_t vkFormat, uint32_t width, uint32_t height)
+{
+	uint32_t blockSize;
+	uint32_t blockBytes = textureBlockBytes(vkFormat, blockSize);
+	return (uint64_t)((width + blockSize - 1) / blockSize) * ((height + blockSize - 1) / blockSize) * blockBytes;
+}
+
+// Texture read into memory, level 0 is the full size image
+struct TextureFile
+{
+	std::vector<uint8_t> data;
+	Ktx2Header header = {};
+	std::vector<Ktx2Level> levels;
+
+	std::string error;
+};
+
+inline const uint8_t* textureLevelData(const TextureFile& texture, uint32_t level)
+{
+	return texture.data.data() + texture.levels[level].byteOffset;
+}
+
+// Read a KTX2 file and check that it is a plain 2D texture whose levels lie inside it
+inline bool openTextureFile(const char* path, TextureFile& texture)
+{
+	texture.error.clear();
+	FILE* in = fopen(path, "rb");
+	if (!in)
+	{
+		texture.error = std::string("cannot open ") + path;
+		return false;
+	}
+	fseek(in, 0, SEEK_END);
+	long size = ftell(in);
+	fseek(in, 0, SEEK_SET);
+	texture.data.resize(size > 0 ? (size_t)size : 0);
+	bool read = size > 0 && fread(texture.data.data(), 1, texture.data.size(), in) == texture.data.size();
+	fclose(in);
+
+	const Ktx2Header& header = texture.header;
+	if (read && texture.data.size() >= sizeof(Ktx2Header))
+		memcpy(&texture.header, texture.data.data(), sizeof(Ktx2Header));
+	uint32_t blockSize;
+	if (!read || texture.data.size() < sizeof(Ktx2Header) || memcmp(header.identifier, kKtx2Identifier, sizeof(kKtx2Identifier)) != 0)
+		texture.error = "not a KTX2 file";
+	else if (textureBlockBytes(header.vkFormat, blockSize) == 0)
+		texture.error = "unsupported texture format";
+	else if (header.supercompressionScheme != 0 || header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount != 1)
+		texture.error = "only plain 2D textures are supported";
+	else if (header.pixelWidth == 0 || header.pixelHeight == 0 || header.levelCount > kKtxMaxLevels ||
+		sizeof(Ktx2Header) + (uint64_t)(header.levelCount ? header.levelCount : 1) * sizeof(Ktx2Level) > texture.data.size())
+		texture.error = "bad texture size or level count";
+	if (!texture.error.empty())
+		return false;
+
+	texture.levels.resize(header.levelCount ? header.levelCount : 1);
+	memcpy(texture.levels.data(), texture.data.data() + sizeof(Ktx2Header), texture.levels.size() * sizeof(Ktx2Level));
+	for (uint32_t level = 0; level < texture.levels.size(); level++)
+	{
+		uint32_t width = header.pixelWidth >> level ? header.pixelWidth >> level : 1;
+		uint32_t height = header.pixelHeight >> level ? header.pixelHeight >> level : 1;
+		const Ktx2Level& range = texture.levels[level];
+		if (range.byteLength != textureLevelBytes(header.vkFormat, width, height) ||
+			range.byteOffset + range.byteLength > texture.data.size())
+		{
+			texture.error = "truncated texture file";
+			return false;
+		}
+	}
+	return true;
+}
+
+// Basic data format descriptor of the formats above, required by KTX2 readers other than ours
+inline void appendTextureDfd(uint32_t vkFormat, std::vector<uint32_t>& dfd)
+{
+	uint32_t blockSize;
+	uint32_t blockBytes = textureBlockBytes(vkFormat, blockSize);
+	int samples = vkFormat == kVkFormatR8G8B8A8Unorm ? 4 : 1;
+	uint32_t colorModel = vkFormat == kVkFormatBc1RgbUnorm ? 128 : vkFormat == kVkFormatBc7Unorm ? 134 : 1; // BC1A, BC7, RGBSDA
+	uint32_t blockWords = 6 + 4 * samples;
+
+	dfd.push_back(4 + blockWords * 4); // total size
+	dfd.push_back(0); // Khronos vendor, basic descriptor
+	dfd.push_back(2 | (blockWords * 4) << 16); // version 2, block size
+	dfd.push_back(colorModel | 1 << 8 | 1 << 16); // BT.709 primaries, linear transfer, straight alpha
+	dfd.push_back((blockSize - 1) | (blockSize - 1) << 8); // texel block dimensions minus one
+	dfd.push_back(blockBytes); // bytes in plane 0
+	dfd.push_back(0);
+	for (int sample = 0; sample < samples; sample++)
+	{
+		uint32_t bits = samples == 1 ? blockBytes * 8 : 8;
+		uint32_t channel = samples == 1 ? 0 : sample == 3 ? 15 : sample; // R, G, B, alpha
+		dfd.push_back((samples == 1 ? 0 : sample * 8) | (bits - 1) << 16 | channel << 24);
+		dfd.push_back(0); // sample position
+		dfd.push_back(0); // lower
+		dfd.push_back(samples == 1 ? 0xFFFFFFFFu : 255); // upper
+	}
+}
+
+// Write a texture, levels[0] is the full size image and each one after it half the size
+inline bool writeTextureFile(const char* path, uint32_t vkFormat, uint32_t width, uint32_t height,
+	const std::vector<std::vector<uint8_t>>& levels, const char* writer)
+{
+	uint32_t blockSize;
+	uint32_t blockBytes = textureBlockBytes(vkFormat, blockSize);
+	if (blockBytes == 0 || levels.empty() || levels.size() > kKtxMaxLevels)
+		return false;
+
+	Ktx2Header header = {};
+	memcpy(header.identifier, kKtx2Identifier, sizeof(kKtx2Identifier));
+	header.vkFormat = vkFormat;
+	header.typeSize = 1; // bytes, for block compressed formats too
+	header.pixelWidth = width;
+	header.pixelHeight = height;
+	header.faceCount = 1;
+	header.levelCount = (uint32_t)levels.size();
+
+	std::vector<uint32_t> dfd;
+	appendTextureDfd(vkFormat, dfd);
+
+	// Rows start at the top left, as decoded images and the existing uploads have them
+	std::vector<uint8_t> kvd;
+	const char* entries[2][2] = { { "KTXorientation", "rd" }, { "KTXwriter", writer } };
+	for (int i = 0; i < 2; i++)
+	{
+		uint32_t length = (uint32_t)(strlen(entries[i][0]) + strlen(entries[i][1]) + 2);
+		kvd.insert(kvd.end(), (const uint8_t*)&length, (const uint8_t*)&length + 4);
+		kvd.insert(kvd.end(), entries[i][0], entries[i][0] + strlen(entries[i][0]) + 1);
+		kvd.insert(kvd.end(), entries[i][1], entries[i][1] + strlen(entries[i][1]) + 1);
+		kvd.resize((kvd.size() + 3) & ~(size_t)3, 0);
+	}
+
+	std::vector<Ktx2Level> index(levels.size());
+	header.dfdByteOffset = (uint32_t)(sizeof(Ktx2Header) + index.size() * sizeof(Ktx2Level));
+	header.dfdByteLength = (uint32_t)(dfd.size() * sizeof(uint32_t));
+	header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+	header.kvdByteLength = (uint32_t)kvd.size();
+
+	// Smallest level first, each at a multiple of the block size
+	uint64_t offset = header.kvdByteOffset + header.kvdByteLength;
+	for (size_t level = levels.size(); level-- > 0;)
+	{
+		offset = (offset + blockBytes - 1) / blockBytes * blockBytes;
+		index[level].byteOffset = offset;
+		index[level].byteLength = index[level].uncompressedByteLength = levels[level].size();
+		offset += levels[level].size();
+	}
+
+	std::vector<uint8_t> file(offset, 0);
+	memcpy(file.data(), &header, sizeof(header));
+	memcpy(file.data() + sizeof(header), index.data(), index.size() * sizeof(Ktx2Level));
+	memcpy(file.data() + header.dfdByteOffset, dfd.data(), header.dfdByteLength);
+	memcpy(file.data() + header.kvdByteOffset, kvd.data(), kvd.size());
+	for (size_t level = 0; level < levels.size(); level++)
+		memcpy(file.data() + index[level].byteOffset, levels[level].data(), levels[level].size());
+
+	FILE* out = fopen(path, "wb");
+	if (!out)
+		return false;
+	bool ok = fwrite(file.data(), 1, file.size(), out) == file.size();
+	return fclose(out) == 0 && ok;
+}
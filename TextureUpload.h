@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "TextureCompress.h"
+#include "TextureFile.h"
+
+// GL upload of baked textures, compressed levels go to glCompressedTexImage2D as they are in the file
+
+// Compressed internal format of a file format, 0 when the driver cannot sample it
+inline GLenum textureGLFormat(uint32_t vkFormat)
+{
+	switch (vkFormat)
+	{
+	case kVkFormatBc1RgbUnorm: return GLEW_EXT_texture_compression_s3tc ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : 0;
+	case kVkFormatBc7Unorm: return GLEW_ARB_texture_compression_bptc ? GL_COMPRESSED_RGBA_BPTC_UNORM : 0;
+	default: return 0;
+	}
+}
+
+// Upload every level of the file into `texture` (2D, bound to the current unit on return).
+// BC1 is decoded to RGBA8 on drivers without S3TC, `gpuBytes` receives the size of what was uploaded
+inline bool uploadTextureFile(const TextureFile& file, GLuint texture, uint64_t& gpuBytes, std::string& error)
+{
+	const Ktx2Header& header = file.header;
+	GLenum compressed = textureGLFormat(header.vkFormat);
+	if (!compressed && header.vkFormat == kVkFormatBc7Unorm)
+	{
+		error = "BC7 textures need ARB_texture_compression_bptc";
+		return false;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)file.levels.size() - 1);
+	gpuBytes = 0;
+	std::vector<uint8_t> decoded;
+	for (uint32_t level = 0; level < file.levels.size(); level++)
+	{
+		GLsizei width = (GLsizei)std::max(header.pixelWidth >> level, 1u);
+		GLsizei height = (GLsizei)std::max(header.pixelHeight >> level, 1u);
+		const uint8_t* data = textureLevelData(file, level);
+		GLsizei bytes = (GLsizei)file.levels[level].byteLength;
+		if (compressed)
+			glCompressedTexImage2D(GL_TEXTURE_2D, level, compressed, width, height, 0, bytes, data);
+		else if (header.vkFormat == kVkFormatBc1RgbUnorm)
+		{
+			decodeBc1Image(data, (uint32_t)width, (uint32_t)height, decoded);
+			glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, decoded.data());
+			bytes = (GLsizei)decoded.size();
+		}
+		else
+			glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+		gpuBytes += (uint64_t)bytes;
+	}
+	return true;
+}
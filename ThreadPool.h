@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads taking tasks from one queue in submission order
+
+struct ThreadPool
+{
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<std::function<void()>> tasks;
+	bool stopping = false;
+};
+
+// One less than the hardware threads, the GL thread keeps a core
+inline int defaultWorkerCount()
+{
+	int threads = (int)std::thread::hardware_concurrency();
+	return threads > 1 ? threads - 1 : 1;
+}
+
+inline void threadPoolWorker(ThreadPool& pool)
+{
+	for (;;)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(pool.mutex);
+			pool.wake.wait(lock, [&pool] { return pool.stopping || !pool.tasks.empty(); });
+			if (pool.stopping)
+				return;
+			task = std::move(pool.tasks.front());
+			pool.tasks.pop_front();
+		}
+		task();
+	}
+}
+
+inline void startThreadPool(ThreadPool& pool, int threads)
+{
+	pool.stopping = false;
+	for (int i = 0; i < threads; i++)
+		pool.workers.push_back(std::thread(threadPoolWorker, std::ref(pool)));
+}
+
+inline void submitTask(ThreadPool& pool, std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.tasks.push_back(std::move(task));
+	}
+	pool.wake.notify_one();
+}
+
+// Let running tasks finish, drop the queued ones and join the workers
+inline void stopThreadPool(ThreadPool& pool)
+{
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.stopping = true;
+		pool.tasks.clear();
+	}
+	pool.wake.notify_all();
+	for (std::thread& worker : pool.workers)
+		worker.join();
+	pool.workers.clear();
+}
+
+// Fork-join pool for data parallel loops. Every thread owns a deque of indices, takes work from its front
+// and, once empty, steals from the back of the others', so uneven items (screen tiles, scene partitions)
+// even out without a shared queue. The calling thread takes part as thread 0.
+
+struct StealingQueue
+{
+	std::mutex mutex;
+	std::deque<uint32_t> items;
+};
+
+struct WorkStealingPool
+{
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<StealingQueue>> queues; // one per thread, the caller's first
+	std::mutex mutex;
+	std::condition_variable wake, done;
+	std::function<void(uint32_t, int)> job; // (index, thread)
+	uint64_t generation = 0;
+	std::atomic<uint32_t> remaining;
+	bool stopping = false;
+
+	// Items taken from another thread's queue, over the pool's life
+	std::atomic<uint64_t> steals;
+
+	WorkStealingPool() : remaining(0), steals(0) {}
+};
+
+inline int workStealingThreads(const WorkStealingPool& pool)
+{
+	return (int)pool.queues.size();
+}
+
+// Own queue first, then the others' from the back, false when nothing is left anywhere
+inline bool takeStealingItem(WorkStealingPool& pool, int thread, uint32_t& item)
+{
+	{
+		StealingQueue& own = *pool.queues[thread];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.items.empty())
+		{
+			item = own.items.front();
+			own.items.pop_front();
+			return true;
+		}
+	}
+	int threads = workStealingThreads(pool);
+	for (int offset = 1; offset < threads; offset++)
+	{
+		StealingQueue& victim = *pool.queues[(thread + offset) % threads];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.items.empty())
+		{
+			item = victim.items.back();
+			victim.items.pop_back();
+			pool.steals.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+inline void runStealingItems(WorkStealingPool& pool, int thread)
+{
+	uint32_t item;
+	while (takeStealingItem(pool, thread, item))
+	{
+		pool.job(item, thread);
+		if (pool.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			std::lock_guard<std::mutex> lock(pool.mutex);
+			pool.done.notify_all();
+		}
+	}
+}
+
+inline void workStealingWorker(WorkStealingPool& pool, int thread)
+{
+	uint64_t seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(pool.mutex);
+			pool.wake.wait(lock, [&pool, seen] { return pool.stopping || pool.generation != seen; });
+			if (pool.stopping)
+				return;
+			seen = pool.generation;
+		}
+		runStealingItems(pool, thread);
+	}
+}
+
+// `threads` counts the caller, 1 runs every loop on the calling thread
+inline void startWorkStealingPool(WorkStealingPool& pool, int threads)
+{
+	pool.stopping = false;
+	pool.queues.clear();
+	for (int i = 0; i < std::max(threads, 1); i++)
+		pool.queues.push_back(std::unique_ptr<StealingQueue>(new StealingQueue()));
+	for (int i = 1; i < threads; i++)
+		pool.workers.push_back(std::thread(workStealingWorker, std::ref(pool), i));
+}
+
+// Run job(index, thread) for every index below `count` and wait for all of them.
+// Indices are dealt out in contiguous runs, so neighbours start on the same thread
+inline void parallelFor(WorkStealingPool& pool, uint32_t count, std::function<void(uint32_t, int)> job)
+{
+	if (count == 0)
+		return;
+	int threads = workStealingThreads(pool);
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.job = std::move(job);
+		pool.remaining.store(count, std::memory_order_relaxed);
+		for (int thread = 0; thread < threads; thread++)
+		{
+			StealingQueue& queue = *pool.queues[thread];
+			std::lock_guard<std::mutex> queueLock(queue.mutex);
+			for (uint32_t i = (uint32_t)((uint64_t)count * thread / threads); i < (uint32_t)((uint64_t)count * (thread + 1) / threads); i++)
+				queue.items.push_back(i);
+		}
+		pool.generation++;
+	}
+	pool.wake.notify_all();
+
+	runStealingItems(pool, 0);
+	std::unique_lock<std::mutex> lock(pool.mutex);
+	pool.done.wait(lock, [&pool] { return pool.remaining.load(std::memory_order_acquire) == 0; });
+}
+
+inline void stopWorkStealingPool(WorkStealingPool& pool)
+{
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.stopping = true;
+	}
+	pool.wake.notify_all();
+	for (std::thread& worker : pool.workers)
+		worker.join();
+	pool.workers.clear();
+	pool.queues.clear();
+}
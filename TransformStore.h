@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Scene transform hierarchy in structure-of-arrays layout.
+// Nodes are created parent first, so one forward pass sees every parent before its children.
+// Only nodes whose local matrix changed (and their descendants) are recomputed, one hierarchy level per batch.
+
+typedef uint32_t TransformId;
+const TransformId kNoParent = 0xFFFFFFFFu;
+
+struct TransformStore
+{
+	std::vector<TransformId> parent;
+	std::vector<uint16_t> level; // depth in the hierarchy, roots are 0
+	std::vector<glm::mat4> local;
+	std::vector<glm::mat4> world;
+	std::vector<glm::mat3> normal; // inverse transpose of the world matrix' upper 3x3
+	std::vector<uint8_t> dirty;
+
+	TransformId firstDirty = kNoParent;
+	std::vector<std::vector<TransformId>> levelBatches; // scratch, dirty nodes per level
+
+	// Stats of the last update
+	int updatedNodes = 0;
+};
+
+inline TransformId createTransform(TransformStore& store, const glm::mat4& local, TransformId parent = kNoParent)
+{
+	TransformId id = (TransformId)store.parent.size();
+	store.parent.push_back(parent);
+	store.level.push_back(parent == kNoParent ? 0 : store.level[parent] + 1);
+	store.local.push_back(local);
+	store.world.push_back(local);
+	store.normal.push_back(glm::mat3());
+	store.dirty.push_back(1);
+	if (store.firstDirty == kNoParent || id < store.firstDirty)
+		store.firstDirty = id;
+	return id;
+}
+
+// Change a node's local matrix, a no-op when nothing changed
+inline void setLocalTransform(TransformStore& store, TransformId id, const glm::mat4& local)
+{
+	if (store.local[id] == local)
+		return;
+	store.local[id] = local;
+	store.dirty[id] = 1;
+	if (store.firstDirty == kNoParent || id < store.firstDirty)
+		store.firstDirty = id;
+}
+
+inline void clearTransforms(TransformStore& store)
+{
+	store.parent.clear();
+	store.level.clear();
+	store.local.clear();
+	store.world.clear();
+	store.normal.clear();
+	store.dirty.clear();
+	store.firstDirty = kNoParent;
+}
+
+// World matrices of one batch of nodes whose parents are already up to date
+inline void updateWorldBatch(TransformStore& store, const std::vector<TransformId>& batch)
+{
+	for (TransformId id : batch)
+	{
+		TransformId parent = store.parent[id];
+		store.world[id] = parent == kNoParent ? store.local[id] : store.world[parent] * store.local[id];
+	}
+}
+
+// Normal matrices of one batch, replaces the per-vertex inverse in the shader
+inline void updateNormalBatch(TransformStore& store, const std::vector<TransformId>& batch)
+{
+	for (TransformId id : batch)
+		store.normal[id] = glm::transpose(glm::inverse(glm::mat3(store.world[id])));
+}
+
+// Recompute world and normal matrices of dirty nodes and their descendants
+inline void updateTransforms(TransformStore& store)
+{
+	store.updatedNodes = 0;
+	if (store.firstDirty == kNoParent)
+		return;
+
+	// Propagate dirty flags down and bucket the nodes by level
+	for (std::vector<TransformId>& batch : store.levelBatches)
+		batch.clear();
+	TransformId count = (TransformId)store.parent.size();
+	for (TransformId id = store.firstDirty; id < count; id++)
+	{
+		TransformId parent = store.parent[id];
+		if (parent != kNoParent && store.dirty[parent])
+			store.dirty[id] = 1;
+		if (!store.dirty[id])
+			continue;
+
+		if (store.levelBatches.size() <= store.level[id])
+			store.levelBatches.resize(store.level[id] + 1);
+		store.levelBatches[store.level[id]].push_back(id);
+	}
+
+	for (std::vector<TransformId>& batch : store.levelBatches)
+	{
+		updateWorldBatch(store, batch);
+		updateNormalBatch(store, batch);
+		for (TransformId id : batch)
+			store.dirty[id] = 0;
+		store.updatedNodes += (int)batch.size();
+	}
+	store.firstDirty = kNoParent;
+}
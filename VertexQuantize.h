@@ -0,0 +1,251 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Load-time compression of the 11-float position/color/uv/normal vertex:
+// positions as 16-bit snorm inside the mesh bounds, octahedral normals in 2x16 bits,
+// half float UVs and RGBA8 color, or no color at all when it is the same on every vertex.
+// 44 bytes per vertex become 20 (16 without color).
+
+const uint32_t kQuantizedPositionOffset = 0; // 3 x int16 snorm + 2 bytes padding
+const uint32_t kQuantizedNormalOffset = 8; // 2 x int16 snorm octahedral
+const uint32_t kQuantizedUvOffset = 12; // 2 x half float
+const uint32_t kQuantizedColorOffset = 16; // RGBA8 unorm, only when colors vary
+
+struct QuantizedVertices
+{
+	std::vector<uint8_t> data;
+	uint32_t stride = 0;
+	size_t vertexCount = 0;
+	bool hasColor = false;
+	glm::vec3 constantColor = glm::vec3(1.0f);
+
+	// Decoded position = snorm * positionScale + positionOffset
+	glm::vec3 positionScale = glm::vec3(1.0f), positionOffset = glm::vec3(0.0f);
+
+	// Largest round trip error over all vertices
+	float maxPositionError = 0.0f; // object space units
+	float maxNormalErrorDegrees = 0.0f;
+	float maxUvError = 0.0f;
+	float maxColorError = 0.0f;
+};
+
+inline uint16_t floatToHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000u;
+	int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFFu;
+
+	if (((bits >> 23) & 0xFF) == 0xFF)
+		return (uint16_t)(sign | 0x7C00u | (mantissa ? 0x200u : 0u)); // inf / nan
+	if (exponent >= 31)
+		return (uint16_t)(sign | 0x7C00u); // overflow to inf
+	if (exponent <= 0)
+	{
+		// Subnormal or zero, round to nearest even
+		if (exponent < -10)
+			return (uint16_t)sign;
+		mantissa |= 0x800000u;
+		uint32_t shift = (uint32_t)(14 - exponent);
+		uint32_t half = mantissa >> shift;
+		uint32_t rest = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half & 1)))
+			half++;
+		return (uint16_t)(sign | half);
+	}
+
+	uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+	uint32_t rest = mantissa & 0x1FFFu;
+	if (rest > 0x1000u || (rest == 0x1000u && (half & 1)))
+		half++; // may carry into the exponent, which is still correct rounding
+	return (uint16_t)half;
+}
+
+inline float halfToFloat(uint16_t half)
+{
+	uint32_t sign = (uint32_t)(half & 0x8000u) << 16;
+	uint32_t exponent = (half >> 10) & 0x1F;
+	uint32_t mantissa = half & 0x3FFu;
+	uint32_t bits;
+	if (exponent == 0)
+	{
+		if (mantissa == 0)
+			bits = sign;
+		else
+		{
+			// Renormalize the subnormal
+			exponent = 127 - 15 + 1;
+			while (!(mantissa & 0x400u))
+			{
+				mantissa <<= 1;
+				exponent--;
+			}
+			bits = sign | (exponent << 23) | ((mantissa & 0x3FFu) << 13);
+		}
+	}
+	else if (exponent == 31)
+		bits = sign | 0x7F800000u | (mantissa << 13);
+	else
+		bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+inline int16_t floatToSnorm16(float value)
+{
+	value = glm::clamp(value, -1.0f, 1.0f);
+	return (int16_t)lroundf(value * 32767.0f);
+}
+
+// GL's snorm conversion
+inline float snorm16ToFloat(int16_t value)
+{
+	return glm::max(value / 32767.0f, -1.0f);
+}
+
+inline glm::vec3 decodeOctahedral(float x, float y)
+{
+	glm::vec3 n(x, y, 1.0f - fabsf(x) - fabsf(y));
+	if (n.z < 0.0f)
+	{
+		float nx = (1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+		float ny = (1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+		n.x = nx;
+		n.y = ny;
+	}
+	return glm::normalize(n);
+}
+
+// Octahedral encoding, trying the neighbouring grid points to keep the most accurate one
+inline void encodeOctahedral(glm::vec3 n, int16_t encoded[2])
+{
+	float length = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	if (length == 0.0f)
+	{
+		encoded[0] = encoded[1] = 0;
+		return;
+	}
+	n /= length;
+	float x = n.x, y = n.y;
+	if (n.z < 0.0f)
+	{
+		x = (1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+		y = (1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+
+	glm::vec3 target = glm::normalize(n);
+	float bestDot = -2.0f;
+	float baseX = floorf(glm::clamp(x, -1.0f, 1.0f) * 32767.0f);
+	float baseY = floorf(glm::clamp(y, -1.0f, 1.0f) * 32767.0f);
+	for (int i = 0; i < 4; i++)
+	{
+		float qx = glm::clamp(baseX + (i & 1), -32767.0f, 32767.0f);
+		float qy = glm::clamp(baseY + (i >> 1), -32767.0f, 32767.0f);
+		float dot = glm::dot(decodeOctahedral(qx / 32767.0f, qy / 32767.0f), target);
+		if (dot > bestDot)
+		{
+			bestDot = dot;
+			encoded[0] = (int16_t)qx;
+			encoded[1] = (int16_t)qy;
+		}
+	}
+}
+
+// Quantize vertices in the 11-float layout (position, color, uv, normal), `floatStride` floats apart
+inline void quantizeVertices(const float* vertices, size_t vertexCount, size_t floatStride, QuantizedVertices& out)
+{
+	out.vertexCount = vertexCount;
+
+	// Bounds and whether the color varies
+	glm::vec3 boundsMin(INFINITY), boundsMax(-INFINITY);
+	out.hasColor = false;
+	out.constantColor = vertexCount ? glm::vec3(vertices[3], vertices[4], vertices[5]) : glm::vec3(1.0f);
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		const float* v = vertices + i * floatStride;
+		boundsMin = glm::min(boundsMin, glm::vec3(v[0], v[1], v[2]));
+		boundsMax = glm::max(boundsMax, glm::vec3(v[0], v[1], v[2]));
+		if (v[3] != out.constantColor.x || v[4] != out.constantColor.y || v[5] != out.constantColor.z)
+			out.hasColor = true;
+	}
+	out.positionOffset = vertexCount ? (boundsMin + boundsMax) * 0.5f : glm::vec3(0.0f);
+	out.positionScale = vertexCount ? (boundsMax - boundsMin) * 0.5f : glm::vec3(1.0f);
+	for (int axis = 0; axis < 3; axis++)
+		if (out.positionScale[axis] <= 0.0f)
+			out.positionScale[axis] = 1.0f;
+
+	out.stride = out.hasColor ? kQuantizedColorOffset + 4 : kQuantizedColorOffset;
+	out.data.assign(vertexCount * out.stride, 0);
+	out.maxPositionError = out.maxNormalErrorDegrees = out.maxUvError = out.maxColorError = 0.0f;
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		const float* v = vertices + i * floatStride;
+		uint8_t* q = out.data.data() + i * out.stride;
+
+		int16_t position[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			position[axis] = floatToSnorm16((v[axis] - out.positionOffset[axis]) / out.positionScale[axis]);
+			float decoded = snorm16ToFloat(position[axis]) * out.positionScale[axis] + out.positionOffset[axis];
+			out.maxPositionError = glm::max(out.maxPositionError, fabsf(decoded - v[axis]));
+		}
+		memcpy(q + kQuantizedPositionOffset, position, sizeof(position));
+
+		glm::vec3 normal(v[8], v[9], v[10]);
+		int16_t octahedral[2];
+		encodeOctahedral(normal, octahedral);
+		memcpy(q + kQuantizedNormalOffset, octahedral, sizeof(octahedral));
+		if (glm::dot(normal, normal) > 0.0f)
+		{
+			glm::vec3 decoded = decodeOctahedral(snorm16ToFloat(octahedral[0]), snorm16ToFloat(octahedral[1]));
+			float cosine = glm::clamp(glm::dot(decoded, glm::normalize(normal)), -1.0f, 1.0f);
+			out.maxNormalErrorDegrees = glm::max(out.maxNormalErrorDegrees, glm::degrees(acosf(cosine)));
+		}
+
+		uint16_t uv[2] = { floatToHalf(v[6]), floatToHalf(v[7]) };
+		memcpy(q + kQuantizedUvOffset, uv, sizeof(uv));
+		out.maxUvError = glm::max(out.maxUvError, glm::max(fabsf(halfToFloat(uv[0]) - v[6]), fabsf(halfToFloat(uv[1]) - v[7])));
+
+		if (out.hasColor)
+		{
+			for (int channel = 0; channel < 3; channel++)
+			{
+				float c = glm::clamp(v[3 + channel], 0.0f, 1.0f);
+				q[kQuantizedColorOffset + channel] = (uint8_t)lroundf(c * 255.0f);
+				out.maxColorError = glm::max(out.maxColorError, fabsf(q[kQuantizedColorOffset + channel] / 255.0f - v[3 + channel]));
+			}
+			q[kQuantizedColorOffset + 3] = 255;
+		}
+	}
+}
+
+// Point attributes 0-3 of the bound VAO at quantized data in the bound GL_ARRAY_BUFFER.
+// A constant color goes to the generic attribute value, which only the knife program reads
+inline void setQuantizedAttributes(const QuantizedVertices& quantized)
+{
+	glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, quantized.stride, (GLvoid*)(size_t)kQuantizedPositionOffset);
+	glEnableVertexAttribArray(0);
+	if (quantized.hasColor)
+	{
+		glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, quantized.stride, (GLvoid*)(size_t)kQuantizedColorOffset);
+		glEnableVertexAttribArray(1);
+	}
+	else
+	{
+		glDisableVertexAttribArray(1);
+		glVertexAttrib3f(1, quantized.constantColor.x, quantized.constantColor.y, quantized.constantColor.z);
+	}
+	glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, quantized.stride, (GLvoid*)(size_t)kQuantizedUvOffset);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, quantized.stride, (GLvoid*)(size_t)kQuantizedNormalOffset);
+	glEnableVertexAttribArray(3);
+}